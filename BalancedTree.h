@@ -0,0 +1,46 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: BalancedTree.h
+//
+//	$Header: $
+//
+//
+//	Compile-time choice of balanced tree engine.  Code that only needs
+//	FreeAll(), LookUp(), Insert(), Delete() and Range() can use
+//	BalancedTree_t, and be rebuilt against any of three engines:
+//
+//	  - LeftLeaningRedBlack arranged as a 2-3 tree, which is the default.
+//
+//	  - LeftLeaningRedBlack arranged as a 2-3-4 tree.  Define USE_234_TREE
+//	    when compiling LeftLeaningRedBlack.cpp.
+//
+//	  - WideNodeTree, a B-tree that packs up to 15 keys into each node and
+//	    searches them with vector compares.  Define USE_WIDE_NODE_TREE
+//	    here, or on the command line.
+//
+//	The two LLRB arrangements differ only in where 4-nodes are split, and
+//	have identical interfaces.  WideNodeTree only has the core operations
+//	listed above, plus Count() and Traverse().
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+//#define USE_WIDE_NODE_TREE
+
+
+#if defined(USE_WIDE_NODE_TREE)
+
+#include "WideNodeTree.h"
+
+typedef WideNodeTree BalancedTree_t;
+
+#else
+
+#include "LeftLeaningRedBlack.h"
+
+typedef LeftLeaningRedBlack BalancedTree_t;
+
+#endif
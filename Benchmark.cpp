@@ -0,0 +1,1066 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: Benchmark.cpp
+//
+//	$Header: $
+//
+//
+//	Benchmark driver for the balanced trees (llrb_bench).
+//
+//	For every combination of engine, key distribution and tree size, the
+//	driver runs four timed phases against one tree:
+//
+//	  insert	build the tree from empty, one Insert() per key
+//	  lookup	LookUp() keys drawn from the distribution
+//	  range		visit BENCH_RANGE_KEYS consecutive keys from a drawn start
+//	  delete	Delete() every key, emptying the tree
+//
+//	Each phase reports its throughput, and the median and 99th percentile
+//	latency of a single operation.  Timing every operation would cost more
+//	than the cheaper operations themselves, so once a phase has more than
+//	BENCH_ALL_SAMPLES operations only every BENCH_SAMPLE_EVERY-th one is
+//	timed individually.  The cost of reading the clock is measured once and
+//	subtracted from every sample.  Keys are generated ahead of time, so
+//	neither figure includes the cost of the distribution.
+//
+//	The engines are:
+//
+//	  llrb / llrb234	LeftLeaningRedBlack, in whichever arrangement it was
+//	 			compiled with (see USE_234_TREE)
+//	  wide			WideNodeTree
+//	  map			std::map, which is a classic (not left-leaning)
+//	 			red-black tree in libstdc++ and libc++
+//
+//	Since the two LLRB arrangements are one class compiled two ways, the
+//	makefile builds the driver twice: llrb_bench and llrb_bench_234.
+//
+//	The tree holds the even keys 0, 2, ... 2(n - 1), so an odd key is
+//	always a miss.  The distributions decide which of those keys each
+//	operation uses:
+//
+//	  sequential	ascending order
+//	  uniform	a pseudo-random permutation for insert and delete, and
+//	 		independent uniform draws for lookup and range
+//	  zipf		Zipf draws (theta = 0.99) over the keys, with the hot keys
+//	 		scattered across the key space.  Inserts and deletes
+//	 		repeat hot keys, so the insert phase is followed by an
+//	 		untimed fill to make sure every key is present.
+//	  adversarial	inserts and deletes converge from both ends of the key
+//	 		space (0, n - 1, 1, n - 2, ...), keeping the rebalancing
+//	 		busy at the edges of the tree, and every lookup is a miss
+//	 		that has to search all the way down to a leaf
+//
+//	Results go to stdout, or to --out, as a table, CSV, or JSON.  Run with
+//	--help for the options.  Combinations that are unlikely to fit in the
+//	available memory are skipped with a note on stderr.
+//
+//	--check times nothing.  Instead it runs random inserts and deletes
+//	against every LLRB engine built with the same USE_234_TREE setting,
+//	and compares each against a std::set after every round, with the
+//	engine's own Validate() as well.  `make check` runs it in both
+//	llrb_bench and llrb_bench_234.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "LeftLeaningRedBlack.h"
+#include "CompactLeftLeaningRedBlack.h"
+#include "ConcurrentLeftLeaningRedBlack.h"
+#include "WideNodeTree.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+
+// Operations in the lookup phase, unless changed with --ops.  The range
+// phase runs a tenth as many scans.
+#define BENCH_DEFAULT_OPS	1000000
+
+// Number of consecutive keys visited by each range scan.
+#define BENCH_RANGE_KEYS	100
+
+// Phases with at most this many operations time every one of them.
+// Longer phases only time every BENCH_SAMPLE_EVERY-th operation.
+#define BENCH_ALL_SAMPLES	65536
+#define BENCH_SAMPLE_EVERY	8
+
+// Keys are generated this many at a time, between timed stretches.
+#define BENCH_KEY_CHUNK		65536
+
+#define BENCH_ZIPF_THETA	0.99
+
+// --check runs this many rounds of this many random operations per
+// engine, on keys below BENCH_CHECK_KEYS so that they often collide.
+#define BENCH_CHECK_ROUNDS	50
+#define BENCH_CHECK_OPS		4000
+#define BENCH_CHECK_KEYS	2000
+
+// Rough bytes per key for each engine, including allocator overhead,
+// used to skip sizes that will not fit in memory.
+#define BENCH_BYTES_LLRB		(sizeof(LLTB_t) + 2)
+#define BENCH_BYTES_WIDE		24
+#define BENCH_BYTES_MAP			56
+
+
+#if defined(USE_234_TREE)
+#define BENCH_LLRB_NAME		"llrb234"
+#else
+#define BENCH_LLRB_NAME		"llrb"
+#endif
+
+
+enum Distribution_t
+{
+	DIST_SEQUENTIAL,
+	DIST_UNIFORM,
+	DIST_ZIPF,
+	DIST_ADVERSARIAL,
+	DIST_COUNT
+};
+
+
+static const char* g_DistributionNames[DIST_COUNT] = { "sequential", "uniform", "zipf", "adversarial" };
+
+
+enum Format_t
+{
+	FORMAT_TABLE,
+	FORMAT_CSV,
+	FORMAT_JSON
+};
+
+
+struct Result_t
+{
+	const char* Engine;
+	const char* Distribution;
+	const char* Operation;
+	uint64_t    Size;
+	uint64_t    Ops;
+	double      Seconds;
+	double      P50;		// nanoseconds
+	double      P99;
+};
+
+
+typedef std::chrono::steady_clock Clock_t;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Permutation_t
+//
+//	Pseudo-random bijection on [0, n), so a shuffled insert order does not
+//	need an n-entry array.  A four-round Feistel network permutes the
+//	smallest power-of-four domain that covers n, and values that land
+//	outside [0, n) are fed through again until they do (cycle walking).
+//	Each walk needs fewer than four passes on average.
+//
+class Permutation_t
+{
+private:
+	uint64_t m_Count;
+	uint32_t m_HalfBits;
+	uint32_t m_HalfMask;
+	uint32_t m_Keys[4];
+
+	uint64_t Round(uint64_t value) const
+	{
+		uint32_t left  = uint32_t(value >> m_HalfBits);
+		uint32_t right = uint32_t(value) & m_HalfMask;
+
+		for (int i = 0; i < 4; ++i) {
+			uint32_t mix = (right ^ m_Keys[i]) * 0x9E3779B1u;
+			mix ^= mix >> 15;
+
+			uint32_t next = (left ^ mix) & m_HalfMask;
+			left  = right;
+			right = next;
+		}
+
+		return (uint64_t(left) << m_HalfBits) | right;
+	}
+
+public:
+	Permutation_t(uint64_t count, uint64_t seed)
+		: m_Count(count)
+		, m_HalfBits(1)
+	{
+		while ((uint64_t(1) << (2 * m_HalfBits)) < count) {
+			++m_HalfBits;
+		}
+
+		m_HalfMask = uint32_t((uint64_t(1) << m_HalfBits) - 1);
+
+		std::mt19937_64 random(seed);
+		for (int i = 0; i < 4; ++i) {
+			m_Keys[i] = uint32_t(random());
+		}
+	}
+
+	uint64_t operator()(uint64_t index) const
+	{
+		uint64_t value = Round(index);
+
+		while (value >= m_Count) {
+			value = Round(value);
+		}
+
+		return value;
+	}
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Zipf_t
+//
+//	Zipf-distributed ranks in [0, n), with rank 0 the most popular, using
+//	the constant-time method of Gray et al., "Quickly Generating
+//	Billion-Record Synthetic Databases" (SIGMOD 1994), which is also what
+//	YCSB uses.  Only the setup is O(n).
+//
+class Zipf_t
+{
+private:
+	uint64_t m_Count;
+	double   m_Alpha;
+	double   m_Zeta;
+	double   m_Eta;
+	double   m_Half;
+
+	std::mt19937_64                        m_Random;
+	std::uniform_real_distribution<double> m_Uniform;
+
+public:
+	Zipf_t(uint64_t count, double theta, uint64_t seed)
+		: m_Count(count)
+		, m_Random(seed)
+		, m_Uniform(0.0, 1.0)
+	{
+		double zeta2 = 1.0 + pow(0.5, theta);
+
+		m_Zeta  = Zeta(count, theta);
+		m_Alpha = 1.0 / (1.0 - theta);
+		m_Eta   = (1.0 - pow(2.0 / double(count), 1.0 - theta)) / (1.0 - zeta2 / m_Zeta);
+		m_Half  = zeta2;
+	}
+
+	// Every phase of a run needs the same sum, and it takes a while for
+	// large n, so the last one is kept.
+	static double Zeta(uint64_t count, double theta)
+	{
+		static uint64_t s_Count = 0;
+		static double   s_Theta = 0.0;
+		static double   s_Zeta  = 0.0;
+
+		if ((count != s_Count) || (theta != s_Theta)) {
+			s_Zeta = 0.0;
+
+			for (uint64_t i = 1; i <= count; ++i) {
+				s_Zeta += 1.0 / pow(double(i), theta);
+			}
+
+			s_Count = count;
+			s_Theta = theta;
+		}
+
+		return s_Zeta;
+	}
+
+	uint64_t operator()(void)
+	{
+		double u  = m_Uniform(m_Random);
+		double uz = u * m_Zeta;
+
+		if (uz < 1.0) {
+			return 0;
+		}
+
+		if (uz < m_Half) {
+			return (m_Count > 1) ? 1 : 0;
+		}
+
+		uint64_t rank = uint64_t(double(m_Count) * pow(m_Eta * u - m_Eta + 1.0, m_Alpha));
+
+		return (rank < m_Count) ? rank : (m_Count - 1);
+	}
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	KeyStream_t
+//
+//	Produces the keys used by one phase.  Order() gives the i-th key of an
+//	insert or delete pass, and Draw() gives the key for the next lookup or
+//	range scan.
+//
+class KeyStream_t
+{
+private:
+	Distribution_t  m_Distribution;
+	uint64_t        m_Count;
+	uint64_t        m_Drawn;
+	Permutation_t   m_Permutation;
+	Zipf_t*         m_pZipf;
+	std::mt19937_64 m_Random;
+
+	KeyStream_t(const KeyStream_t&);
+	KeyStream_t& operator=(const KeyStream_t&);
+
+	uint64_t ZigZag(uint64_t i) const
+	{
+		i %= m_Count;
+
+		return (0 == (i & 1)) ? (i / 2) : (m_Count - 1 - (i / 2));
+	}
+
+	static uint32_t Present(uint64_t index) { return uint32_t(2 * index); }
+
+public:
+	KeyStream_t(Distribution_t distribution, uint64_t count, uint64_t seed)
+		: m_Distribution(distribution)
+		, m_Count(count)
+		, m_Drawn(0)
+		, m_Permutation(count, seed)
+		, m_pZipf((DIST_ZIPF == distribution) ? new Zipf_t(count, BENCH_ZIPF_THETA, seed + 1) : nullptr)
+		, m_Random(seed + 2)
+	{
+	}
+
+	~KeyStream_t(void)
+	{
+		delete m_pZipf;
+	}
+
+	uint32_t Order(uint64_t i)
+	{
+		switch (m_Distribution) {
+			case DIST_SEQUENTIAL:	return Present(i);
+			case DIST_UNIFORM:		return Present(m_Permutation(i));
+			case DIST_ZIPF:			return Present(m_Permutation((*m_pZipf)()));
+			default:				return Present(ZigZag(i));
+		}
+	}
+
+	uint32_t Draw(void)
+	{
+		uint64_t i = m_Drawn++;
+
+		switch (m_Distribution) {
+			case DIST_SEQUENTIAL:	return Present(i % m_Count);
+			case DIST_UNIFORM:		return Present(m_Random() % m_Count);
+			case DIST_ZIPF:			return Present(m_Permutation((*m_pZipf)()));
+			default:				return Present(ZigZag(i)) + 1;
+		}
+	}
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Engine adapters
+//
+//	The LLRB and the wide-node tree share an interface, so one template
+//	covers both.  std::map gets overloads.
+//
+template <typename Tree_t>
+inline void BenchInsert(Tree_t& tree, uint32_t key)
+{
+	VoidRef_t ref;
+	ref.Key = key;
+	tree.Insert(ref);
+}
+
+template <typename Tree_t>
+inline bool BenchLookUp(Tree_t& tree, uint32_t key)
+{
+	return nullptr != tree.LookUp(key);
+}
+
+template <typename Tree_t>
+inline void BenchDelete(Tree_t& tree, uint32_t key)
+{
+	tree.Delete(key);
+}
+
+template <typename Tree_t>
+inline uint64_t BenchRange(Tree_t& tree, uint32_t lo, uint32_t hi)
+{
+	uint64_t sum = 0;
+
+	tree.Range(lo, hi, [&sum](const VoidRef_t& ref) { sum += ref.Key; });
+
+	return sum;
+}
+
+
+typedef std::map<uint32_t, VoidRef_t> StdMap_t;
+
+inline void BenchInsert(StdMap_t& tree, uint32_t key)
+{
+	VoidRef_t ref;
+	ref.Key = key;
+	tree[key] = ref;
+}
+
+inline bool BenchLookUp(StdMap_t& tree, uint32_t key)
+{
+	return tree.end() != tree.find(key);
+}
+
+inline void BenchDelete(StdMap_t& tree, uint32_t key)
+{
+	tree.erase(key);
+}
+
+inline uint64_t BenchRange(StdMap_t& tree, uint32_t lo, uint32_t hi)
+{
+	uint64_t sum = 0;
+
+	for (StdMap_t::const_iterator it = tree.lower_bound(lo); (tree.end() != it) && (it->first <= hi); ++it) {
+		sum += it->second.Key;
+	}
+
+	return sum;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Check adapters
+//
+//	The engines differ in how they report a lookup, so CheckEngine() goes
+//	through one small wrapper per engine.  The iterative wrapper covers the
+//	second insert and delete path of LeftLeaningRedBlack.
+//
+struct CheckLLRB_t
+{
+	LeftLeaningRedBlack Tree;
+
+	void Insert(VoidRef_t ref)          { Tree.Insert(ref); }
+	void Delete(uint32_t key)           { Tree.Delete(key); }
+	bool Contains(uint32_t key)         { return nullptr != Tree.LookUp(key); }
+	bool Validate(LLRBCheck_t& check)   { return Tree.Validate(check); }
+};
+
+struct CheckIterative_t
+{
+	LeftLeaningRedBlack Tree;
+
+	void Insert(VoidRef_t ref)          { Tree.InsertIterative(ref); }
+	void Delete(uint32_t key)           { Tree.DeleteIterative(key); }
+	bool Contains(uint32_t key)         { return nullptr != Tree.LookUp(key); }
+	bool Validate(LLRBCheck_t& check)   { return Tree.Validate(check); }
+};
+
+struct CheckCompact_t
+{
+	CompactLeftLeaningRedBlack Tree;
+
+	void Insert(VoidRef_t ref)          { Tree.Insert(ref); }
+	void Delete(uint32_t key)           { Tree.Delete(key); }
+	bool Contains(uint32_t key)         { return nullptr != Tree.LookUp(key); }
+	bool Validate(LLRBCheck_t& check)   { return Tree.Validate(check); }
+};
+
+struct CheckConcurrent_t
+{
+	ConcurrentLeftLeaningRedBlack Tree;
+
+	void Insert(VoidRef_t ref)          { Tree.Insert(ref); }
+	void Delete(uint32_t key)           { Tree.Delete(key); }
+	bool Contains(uint32_t key)         { return Tree.LookUp(key); }
+	bool Validate(LLRBCheck_t& check)   { return Tree.Validate(check); }
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	CheckEngine()
+//
+//	Each round mixes inserts and deletes in proportions that drift from
+//	round to round, so the tree repeatedly grows, shrinks and empties.
+//	After the round the engine must pass Validate(), hold exactly as many
+//	keys as the std::set, and agree with it on every key in the range.
+//
+template <typename Check_t>
+static bool CheckEngine(const char* engine, uint64_t seed)
+{
+	Check_t            tree;
+	std::set<uint32_t> model;
+	std::mt19937_64    random(seed);
+
+	for (int round = 0; round < BENCH_CHECK_ROUNDS; ++round) {
+		uint32_t insertShare = uint32_t(20 + (round * 37) % 61);
+
+		for (int op = 0; op < BENCH_CHECK_OPS; ++op) {
+			uint32_t key = uint32_t(random() % BENCH_CHECK_KEYS);
+
+			if (uint32_t(random() % 100) < insertShare) {
+				VoidRef_t ref;
+				ref.Key = key;
+				tree.Insert(ref);
+				model.insert(key);
+			}
+			else {
+				tree.Delete(key);
+				model.erase(key);
+			}
+		}
+
+		LLRBCheck_t check;
+
+		if (false == tree.Validate(check)) {
+			fprintf(stderr, "check: %s round %d: %s at key %u\n",
+				engine, round, LeftLeaningRedBlack::ErrorText(check.Error), check.Key);
+			return false;
+		}
+
+		if (check.Count != model.size()) {
+			fprintf(stderr, "check: %s round %d: %zu keys counted, %zu expected\n",
+				engine, round, check.Count, model.size());
+			return false;
+		}
+
+		for (uint32_t key = 0; key < BENCH_CHECK_KEYS; ++key) {
+			if (tree.Contains(key) != (0 != model.count(key))) {
+				fprintf(stderr, "check: %s round %d: lookup of key %u disagrees with std::set\n",
+					engine, round, key);
+				return false;
+			}
+		}
+	}
+
+	printf("check    %-16s %6d rounds ok\n", engine, BENCH_CHECK_ROUNDS);
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Check()
+//
+//	Runs every engine even after one fails, so a single run shows all of
+//	the broken ones.
+//
+static bool Check(uint64_t seed)
+{
+	bool ok = true;
+
+	ok = CheckEngine<CheckLLRB_t>(BENCH_LLRB_NAME, seed) && ok;
+	ok = CheckEngine<CheckIterative_t>(BENCH_LLRB_NAME "-iter", seed) && ok;
+	ok = CheckEngine<CheckCompact_t>(BENCH_LLRB_NAME "-compact", seed) && ok;
+	ok = CheckEngine<CheckConcurrent_t>(BENCH_LLRB_NAME "-cow", seed) && ok;
+
+	return ok;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Benchmark_t
+//
+//	Holds the options and the results collected so far.
+//
+class Benchmark_t
+{
+private:
+	std::vector<uint64_t> m_Sizes;
+	bool                  m_Distributions[DIST_COUNT];
+	std::vector<Result_t> m_Results;
+	uint64_t              m_Ops;
+	uint64_t              m_Seed;
+	double                m_ClockCost;	// nanoseconds per pair of clock reads
+
+	// Stops the optimizer from discarding the lookups.
+	volatile uint64_t     m_Sink;
+
+	template <typename Key_t, typename Op_t>
+	void Phase(const char* engine, Distribution_t distribution, const char* operation, uint64_t size, uint64_t ops, Key_t key, Op_t op);
+
+public:
+	bool        m_Engines[3];
+	bool        m_Check;
+	Format_t    m_Format;
+	std::string m_OutPath;
+
+	Benchmark_t(void);
+
+	bool ParseArgs(int argc, char** argv);
+	void MeasureClock(void);
+
+	uint64_t Seed(void) const { return m_Seed; }
+
+	template <typename Tree_t>
+	void Run(const char* engine, size_t bytesPerKey);
+
+	bool Write(void) const;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	constructor
+//
+Benchmark_t::Benchmark_t(void)
+	: m_Ops(BENCH_DEFAULT_OPS)
+	, m_Seed(1)
+	, m_ClockCost(0.0)
+	, m_Sink(0)
+	, m_Check(false)
+	, m_Format(FORMAT_TABLE)
+{
+	const uint64_t sizes[] = { 1000, 10000, 100000, 1000000, 10000000 };
+
+	m_Sizes.assign(sizes, sizes + (sizeof(sizes) / sizeof(sizes[0])));
+
+	for (int i = 0; i < DIST_COUNT; ++i) {
+		m_Distributions[i] = true;
+	}
+
+	for (int i = 0; i < 3; ++i) {
+		m_Engines[i] = true;
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	ParseCount()
+//
+//	Accepts a K, M or G suffix, so "100M" is 100,000,000.
+//
+static bool ParseCount(const char* pText, uint64_t& value)
+{
+	char*  pEnd  = nullptr;
+	double count = strtod(pText, &pEnd);
+
+	if ((pEnd == pText) || (count < 1.0)) {
+		return false;
+	}
+
+	switch (*pEnd) {
+		case 'k': case 'K':	count *= 1e3; ++pEnd; break;
+		case 'm': case 'M':	count *= 1e6; ++pEnd; break;
+		case 'g': case 'G':	count *= 1e9; ++pEnd; break;
+		default:			break;
+	}
+
+	value = uint64_t(count);
+
+	return '\0' == *pEnd;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	ParseArgs()
+//
+bool Benchmark_t::ParseArgs(int argc, char** argv)
+{
+	for (int i = 1; i < argc; ++i) {
+		const char* pArg   = argv[i];
+		const char* pValue = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+		if ((0 == strcmp(pArg, "--sizes")) && (nullptr != pValue)) {
+			m_Sizes.clear();
+
+			std::string list(pValue);
+			size_t      start = 0;
+
+			while (start <= list.size()) {
+				size_t   end  = list.find(',', start);
+				uint64_t size = 0;
+
+				if (std::string::npos == end) {
+					end = list.size();
+				}
+
+				// Keys are stored doubled, so they must stay below 2^31.
+				if ((false == ParseCount(list.substr(start, end - start).c_str(), size)) || (size >= (uint64_t(1) << 31))) {
+					fprintf(stderr, "bad size in --sizes: %s\n", pValue);
+					return false;
+				}
+
+				m_Sizes.push_back(size);
+				start = end + 1;
+			}
+
+			++i;
+		}
+		else if ((0 == strcmp(pArg, "--dists")) && (nullptr != pValue)) {
+			for (int d = 0; d < DIST_COUNT; ++d) {
+				m_Distributions[d] = (nullptr != strstr(pValue, g_DistributionNames[d]));
+			}
+
+			++i;
+		}
+		else if ((0 == strcmp(pArg, "--engines")) && (nullptr != pValue)) {
+			m_Engines[0] = (nullptr != strstr(pValue, "llrb"));
+			m_Engines[1] = (nullptr != strstr(pValue, "wide"));
+			m_Engines[2] = (nullptr != strstr(pValue, "map"));
+
+			++i;
+		}
+		else if ((0 == strcmp(pArg, "--ops")) && (nullptr != pValue)) {
+			if (false == ParseCount(pValue, m_Ops)) {
+				fprintf(stderr, "bad count for --ops: %s\n", pValue);
+				return false;
+			}
+
+			++i;
+		}
+		else if ((0 == strcmp(pArg, "--seed")) && (nullptr != pValue)) {
+			m_Seed = strtoull(pValue, nullptr, 10);
+			++i;
+		}
+		else if ((0 == strcmp(pArg, "--format")) && (nullptr != pValue)) {
+			if (0 == strcmp(pValue, "csv")) {
+				m_Format = FORMAT_CSV;
+			}
+			else if (0 == strcmp(pValue, "json")) {
+				m_Format = FORMAT_JSON;
+			}
+			else if (0 == strcmp(pValue, "table")) {
+				m_Format = FORMAT_TABLE;
+			}
+			else {
+				fprintf(stderr, "unknown format: %s\n", pValue);
+				return false;
+			}
+
+			++i;
+		}
+		else if ((0 == strcmp(pArg, "--out")) && (nullptr != pValue)) {
+			m_OutPath = pValue;
+			++i;
+		}
+		else if (0 == strcmp(pArg, "--check")) {
+			m_Check = true;
+		}
+		else {
+			fprintf(stderr,
+				"usage: %s [options]\n"
+				"  --sizes 1K,10K,...   tree sizes (default 1K,10K,100K,1M,10M; at most 2G)\n"
+				"  --dists LIST         any of sequential,uniform,zipf,adversarial\n"
+				"  --engines LIST       any of llrb,wide,map\n"
+				"  --ops N              lookups per run (default %d; range scans are N / 10)\n"
+				"  --seed N             seed for the random distributions\n"
+				"  --format FMT         table, csv or json (default table)\n"
+				"  --out PATH           write the results to PATH instead of stdout\n"
+				"  --check              check the LLRB engines against std::set instead of timing\n",
+				argv[0], BENCH_DEFAULT_OPS);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	MeasureClock()
+//
+//	Finds the median cost of timing an empty operation, which is then
+//	subtracted from every latency sample.
+//
+void Benchmark_t::MeasureClock(void)
+{
+	std::vector<double> samples(100000);
+
+	for (size_t i = 0; i < samples.size(); ++i) {
+		Clock_t::time_point start = Clock_t::now();
+		Clock_t::time_point stop  = Clock_t::now();
+
+		samples[i] = std::chrono::duration<double, std::nano>(stop - start).count();
+	}
+
+	std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+
+	m_ClockCost = samples[samples.size() / 2];
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Percentile()
+//
+static double Percentile(std::vector<double>& samples, double fraction)
+{
+	if (samples.empty()) {
+		return 0.0;
+	}
+
+	size_t index = size_t(fraction * double(samples.size() - 1));
+
+	std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+
+	return samples[index];
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Phase()
+//
+//	Runs op(key(i)) for i in [0, ops), timing the operations as a whole and
+//	a sample of them one at a time, and records the result.
+//
+//	Generating a key can cost as much as a lookup, and now and then far
+//	more (a Mersenne Twister refills its state every 312 draws), so the
+//	keys are generated in chunks outside of the timed loop.
+//
+template <typename Key_t, typename Op_t>
+void Benchmark_t::Phase(const char* engine, Distribution_t distribution, const char* operation, uint64_t size, uint64_t ops, Key_t key, Op_t op)
+{
+	const uint64_t every = (ops <= BENCH_ALL_SAMPLES) ? 1 : BENCH_SAMPLE_EVERY;
+
+	std::vector<double>   samples;
+	std::vector<uint32_t> chunk(BENCH_KEY_CHUNK);
+
+	samples.reserve(size_t(ops / every + 1));
+
+	Clock_t::duration elapsed(0);
+
+	for (uint64_t base = 0; base < ops; base += BENCH_KEY_CHUNK) {
+		const uint64_t count = std::min<uint64_t>(BENCH_KEY_CHUNK, ops - base);
+
+		for (uint64_t i = 0; i < count; ++i) {
+			chunk[i] = key(base + i);
+		}
+
+		Clock_t::time_point begin = Clock_t::now();
+
+		for (uint64_t i = 0; i < count; ++i) {
+			if (0 == ((base + i) % every)) {
+				Clock_t::time_point start = Clock_t::now();
+				op(chunk[i]);
+				Clock_t::time_point stop = Clock_t::now();
+
+				double ns = std::chrono::duration<double, std::nano>(stop - start).count() - m_ClockCost;
+				samples.push_back((ns > 0.0) ? ns : 0.0);
+			}
+			else {
+				op(chunk[i]);
+			}
+		}
+
+		elapsed += Clock_t::now() - begin;
+	}
+
+	Result_t result;
+	result.Engine       = engine;
+	result.Distribution = g_DistributionNames[distribution];
+	result.Operation    = operation;
+	result.Size         = size;
+	result.Ops          = ops;
+	result.Seconds      = std::chrono::duration<double>(elapsed).count();
+	result.P50          = Percentile(samples, 0.50);
+	result.P99          = Percentile(samples, 0.99);
+
+	m_Results.push_back(result);
+
+	fprintf(stderr, "%-8s %-11s %10llu %-6s %8.2f Mops/s  p50 %7.0f ns  p99 %7.0f ns\n",
+		engine, result.Distribution, (unsigned long long)size, operation,
+		(result.Seconds > 0.0) ? (double(ops) / result.Seconds / 1e6) : 0.0, result.P50, result.P99);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	AvailableBytes()
+//
+static uint64_t AvailableBytes(void)
+{
+	long pages = sysconf(_SC_AVPHYS_PAGES);
+	long size  = sysconf(_SC_PAGESIZE);
+
+	return ((pages > 0) && (size > 0)) ? (uint64_t(pages) * uint64_t(size)) : ~uint64_t(0);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Run()
+//
+//	Runs all four phases for every selected size and distribution on a
+//	fresh tree of type Tree_t.
+//
+template <typename Tree_t>
+void Benchmark_t::Run(const char* engine, size_t bytesPerKey)
+{
+	for (size_t s = 0; s < m_Sizes.size(); ++s) {
+		const uint64_t size = m_Sizes[s];
+
+		// Leave a quarter of the free memory for everything else.
+		if (size * bytesPerKey > AvailableBytes() / 4 * 3) {
+			fprintf(stderr, "%-8s skipping %llu keys: needs about %llu MB\n",
+				engine, (unsigned long long)size, (unsigned long long)(size * bytesPerKey >> 20));
+			continue;
+		}
+
+		for (int d = 0; d < DIST_COUNT; ++d) {
+			if (false == m_Distributions[d]) {
+				continue;
+			}
+
+			Distribution_t distribution = Distribution_t(d);
+			Tree_t*        pTree        = new Tree_t;
+			Tree_t&        tree         = *pTree;
+
+			{
+				KeyStream_t keys(distribution, size, m_Seed);
+				Phase(engine, distribution, "insert", size, size,
+					[&](uint64_t i) { return keys.Order(i); },
+					[&](uint32_t key) { BenchInsert(tree, key); });
+			}
+
+			if (DIST_ZIPF == distribution) {
+				KeyStream_t fill(DIST_SEQUENTIAL, size, m_Seed);
+
+				for (uint64_t i = 0; i < size; ++i) {
+					BenchInsert(tree, fill.Order(i));
+				}
+			}
+
+			{
+				KeyStream_t keys(distribution, size, m_Seed + 10);
+				uint64_t    hits = 0;
+
+				Phase(engine, distribution, "lookup", size, m_Ops,
+					[&](uint64_t) { return keys.Draw(); },
+					[&](uint32_t key) { hits += BenchLookUp(tree, key); });
+
+				m_Sink = m_Sink + hits;
+			}
+
+			{
+				KeyStream_t keys(distribution, size, m_Seed + 20);
+				uint64_t    sum = 0;
+
+				Phase(engine, distribution, "range", size, (m_Ops + 9) / 10,
+					[&](uint64_t) { return keys.Draw(); },
+					[&](uint32_t lo) { sum += BenchRange(tree, lo, lo + 2 * (BENCH_RANGE_KEYS - 1)); });
+
+				m_Sink = m_Sink + sum;
+			}
+
+			{
+				KeyStream_t keys(distribution, size, m_Seed);
+				Phase(engine, distribution, "delete", size, size,
+					[&](uint64_t i) { return keys.Order(i); },
+					[&](uint32_t key) { BenchDelete(tree, key); });
+			}
+
+			delete pTree;
+		}
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Write()
+//
+bool Benchmark_t::Write(void) const
+{
+	FILE* pFile = stdout;
+
+	if (false == m_OutPath.empty()) {
+		pFile = fopen(m_OutPath.c_str(), "w");
+
+		if (nullptr == pFile) {
+			perror(m_OutPath.c_str());
+			return false;
+		}
+	}
+
+	if (FORMAT_CSV == m_Format) {
+		fprintf(pFile, "engine,distribution,size,operation,ops,seconds,mops_per_sec,p50_ns,p99_ns\n");
+	}
+	else if (FORMAT_JSON == m_Format) {
+		fprintf(pFile, "{\n  \"range_keys\": %d,\n  \"seed\": %llu,\n  \"results\": [\n", BENCH_RANGE_KEYS, (unsigned long long)m_Seed);
+	}
+	else {
+		fprintf(pFile, "%-8s %-11s %10s %-6s %10s %10s %10s\n", "engine", "dist", "size", "op", "Mops/s", "p50 ns", "p99 ns");
+	}
+
+	for (size_t i = 0; i < m_Results.size(); ++i) {
+		const Result_t& r    = m_Results[i];
+		double          mops = (r.Seconds > 0.0) ? (double(r.Ops) / r.Seconds / 1e6) : 0.0;
+
+		if (FORMAT_CSV == m_Format) {
+			fprintf(pFile, "%s,%s,%llu,%s,%llu,%.6f,%.4f,%.1f,%.1f\n",
+				r.Engine, r.Distribution, (unsigned long long)r.Size, r.Operation,
+				(unsigned long long)r.Ops, r.Seconds, mops, r.P50, r.P99);
+		}
+		else if (FORMAT_JSON == m_Format) {
+			fprintf(pFile, "    {\"engine\": \"%s\", \"distribution\": \"%s\", \"size\": %llu, \"operation\": \"%s\", "
+				"\"ops\": %llu, \"seconds\": %.6f, \"mops_per_sec\": %.4f, \"p50_ns\": %.1f, \"p99_ns\": %.1f}%s\n",
+				r.Engine, r.Distribution, (unsigned long long)r.Size, r.Operation,
+				(unsigned long long)r.Ops, r.Seconds, mops, r.P50, r.P99,
+				(i + 1 < m_Results.size()) ? "," : "");
+		}
+		else {
+			fprintf(pFile, "%-8s %-11s %10llu %-6s %10.2f %10.0f %10.0f\n",
+				r.Engine, r.Distribution, (unsigned long long)r.Size, r.Operation, mops, r.P50, r.P99);
+		}
+	}
+
+	if (FORMAT_JSON == m_Format) {
+		fprintf(pFile, "  ]\n}\n");
+	}
+
+	if (stdout != pFile) {
+		fclose(pFile);
+	}
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	main()
+//
+int main(int argc, char** argv)
+{
+	Benchmark_t bench;
+
+	if (false == bench.ParseArgs(argc, argv)) {
+		return 1;
+	}
+
+	if (bench.m_Check) {
+		return Check(bench.Seed()) ? 0 : 2;
+	}
+
+	bench.MeasureClock();
+
+	if (bench.m_Engines[0]) {
+		bench.Run<LeftLeaningRedBlack>(BENCH_LLRB_NAME, BENCH_BYTES_LLRB);
+	}
+
+	if (bench.m_Engines[1]) {
+		bench.Run<WideNodeTree>("wide", BENCH_BYTES_WIDE);
+	}
+
+	if (bench.m_Engines[2]) {
+		bench.Run<StdMap_t>("map", BENCH_BYTES_MAP);
+	}
+
+	return bench.Write() ? 0 : 2;
+}
@@ -0,0 +1,694 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: CompactLeftLeaningRedBlack.cpp
+//
+//	$Header: $
+//
+//
+//	Index-based LLRB with 12-byte nodes.  The algorithms here are a direct
+//	translation of the ones in LeftLeaningRedBlack.cpp; refer to that file
+//	for the full explanation of each rebalancing step.
+//
+//	Note that NewNode() may grow (and therefore move) the arena.  Code in
+//	this file never holds a reference to a node across a call that may
+//	allocate; it only holds indices.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "CompactLeftLeaningRedBlack.h"
+#include "LeftLeaningRedBlack.h"
+#include "LeftLeaningRedBlackSnapshot.h"
+#include <string.h>
+#include <new>
+#include <vector>
+
+
+static_assert(sizeof(LLTBCompact_t) == 12, "compact LLRB node should be 12 bytes");
+
+
+// Initial number of arena slots, including the sentinel.
+#define FIRST_CAPACITY	64
+
+// Largest arena allowed, since the high bit of an index holds the color.
+#define MAX_CAPACITY	0x80000000u
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	constructor
+//
+CompactLeftLeaningRedBlack::CompactLeftLeaningRedBlack(void)
+	: m_pNodes(nullptr)
+	, m_Capacity(0)
+	, m_Used(0)
+	, m_FreeList(0)
+	, m_Root(0)
+{
+	Grow();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	destructor
+//
+CompactLeftLeaningRedBlack::~CompactLeftLeaningRedBlack(void)
+{
+	::operator delete(m_pNodes);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FreeAll()
+//
+//	Keeps the arena so that refilling the tree does not reallocate, but
+//	forgets every node in it.
+//
+void CompactLeftLeaningRedBlack::FreeAll(void)
+{
+	m_Used     = 1;
+	m_FreeList = 0;
+	m_Root     = 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Grow()
+//
+//	Doubles the size of the arena.  On the first call this also sets up the
+//	black sentinel in slot 0.
+//
+void CompactLeftLeaningRedBlack::Grow(void)
+{
+	uint32_t capacity = (0 == m_Capacity) ? FIRST_CAPACITY : (m_Capacity * 2);
+
+	if ((capacity > MAX_CAPACITY) || (capacity <= m_Capacity)) {
+		throw std::bad_alloc();
+	}
+
+	LLTBCompact_t* pNodes = static_cast<LLTBCompact_t*>(::operator new(capacity * sizeof(LLTBCompact_t)));
+
+	if (nullptr != m_pNodes) {
+		memcpy(pNodes, m_pNodes, m_Used * sizeof(LLTBCompact_t));
+		::operator delete(m_pNodes);
+	}
+	else {
+		pNodes[0].Ref.Key      = 0;
+		pNodes[0].LeftAndColor = 0;
+		pNodes[0].Right        = 0;
+		m_Used = 1;
+	}
+
+	m_pNodes   = pNodes;
+	m_Capacity = capacity;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	NewNode()
+//
+//	Note that a new node defaults to being red.
+//
+uint32_t CompactLeftLeaningRedBlack::NewNode(void)
+{
+	uint32_t node = m_FreeList;
+
+	if (0 != node) {
+		m_FreeList = m_pNodes[node].Right;
+	}
+	else {
+		if (m_Used == m_Capacity) {
+			Grow();
+		}
+
+		node = m_Used++;
+	}
+
+	m_pNodes[node].Ref.Key      = 0;
+	m_pNodes[node].LeftAndColor = LLTB_COMPACT_RED;
+	m_pNodes[node].Right        = 0;
+
+	return node;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Free()
+//
+void CompactLeftLeaningRedBlack::Free(uint32_t node)
+{
+	m_pNodes[node].Right = m_FreeList;
+	m_FreeList = node;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUp()
+//
+//	If the key is not in the tree, this will return nullptr.
+//
+void* CompactLeftLeaningRedBlack::LookUp(const uint32_t key)
+{
+	uint32_t node = m_Root;
+
+	while (0 != node) {
+		if (key == m_pNodes[node].Ref.Key) {
+			return &(m_pNodes[node].Ref);
+		}
+
+		node = (key < m_pNodes[node].Ref.Key) ? Left(node) : Right(node);
+	}
+
+	return nullptr;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	RotateLeft()
+//
+uint32_t CompactLeftLeaningRedBlack::RotateLeft(uint32_t node)
+{
+	uint32_t temp = Right(node);
+	SetRight(node, Left(temp));
+	SetLeft(temp, node);
+	SetRed(temp, IsRed(node));
+	SetRed(node, true);
+
+	return temp;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	RotateRight()
+//
+uint32_t CompactLeftLeaningRedBlack::RotateRight(uint32_t node)
+{
+	uint32_t temp = Left(node);
+	SetLeft(node, Right(temp));
+	SetRight(temp, node);
+	SetRed(temp, IsRed(node));
+	SetRed(node, true);
+
+	return temp;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	ColorFlip()
+//
+//	The sentinel must stay black, so missing children are skipped.
+//
+void CompactLeftLeaningRedBlack::ColorFlip(uint32_t node)
+{
+	m_pNodes[node].LeftAndColor ^= LLTB_COMPACT_RED;
+
+	uint32_t left = Left(node);
+	if (0 != left) {
+		m_pNodes[left].LeftAndColor ^= LLTB_COMPACT_RED;
+	}
+
+	uint32_t right = Right(node);
+	if (0 != right) {
+		m_pNodes[right].LeftAndColor ^= LLTB_COMPACT_RED;
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Insert()
+//
+bool CompactLeftLeaningRedBlack::Insert(VoidRef_t ref)
+{
+	m_Root = InsertRec(m_Root, ref);
+
+	// The root node of a red-black tree must be black.
+	SetRed(m_Root, false);
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	InsertRec()
+//
+uint32_t CompactLeftLeaningRedBlack::InsertRec(uint32_t node, const VoidRef_t& ref)
+{
+	if (0 == node) {
+		node = NewNode();
+		m_pNodes[node].Ref = ref;
+		return node;
+	}
+
+#if defined(USE_234_TREE)
+	// Split 4-nodes on the way down the tree, as in
+	// LeftLeaningRedBlack::InsertRec().
+	if (IsRed(Left(node)) && IsRed(Right(node))) {
+		ColorFlip(node);
+	}
+#endif
+
+	// The recursive call may grow the arena, so the result is stored in a
+	// local before it is written back into the node.
+	if (ref.Key == m_pNodes[node].Ref.Key) {
+		m_pNodes[node].Ref = ref;
+	}
+	else if (ref.Key < m_pNodes[node].Ref.Key) {
+		uint32_t child = InsertRec(Left(node), ref);
+		SetLeft(node, child);
+	}
+	else {
+		uint32_t child = InsertRec(Right(node), ref);
+		SetRight(node, child);
+	}
+
+	// Fix a right-leaning red node.
+	if (IsRed(Right(node)) && (false == IsRed(Left(node)))) {
+		node = RotateLeft(node);
+	}
+
+	// Fix two reds in a row.
+	if (IsRed(Left(node)) && IsRed(Left(Left(node)))) {
+		node = RotateRight(node);
+	}
+
+#if !defined(USE_234_TREE)
+	// Split 4-nodes on the way back out of the tree.
+	if (IsRed(Left(node)) && IsRed(Right(node))) {
+		ColorFlip(node);
+	}
+#endif
+
+	return node;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	MoveRedLeft()
+//
+uint32_t CompactLeftLeaningRedBlack::MoveRedLeft(uint32_t node)
+{
+	ColorFlip(node);
+
+	if ((0 != Right(node)) && IsRed(Left(Right(node)))) {
+		SetRight(node, RotateRight(Right(node)));
+		node = RotateLeft(node);
+
+		ColorFlip(node);
+
+#if defined(USE_234_TREE)
+		// If the right child was a 4-node, it is left with a lone red
+		// right child that no FixUp() will see.
+		if (IsRed(Right(Right(node)))) {
+			SetRight(node, RotateLeft(Right(node)));
+		}
+#endif
+	}
+
+	return node;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	MoveRedRight()
+//
+uint32_t CompactLeftLeaningRedBlack::MoveRedRight(uint32_t node)
+{
+	ColorFlip(node);
+
+	if ((0 != Left(node)) && IsRed(Left(Left(node)))) {
+		node = RotateRight(node);
+
+		ColorFlip(node);
+	}
+
+	return node;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FindMin()
+//
+uint32_t CompactLeftLeaningRedBlack::FindMin(uint32_t node) const
+{
+	while (0 != Left(node)) {
+		node = Left(node);
+	}
+
+	return node;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FixUp()
+//
+uint32_t CompactLeftLeaningRedBlack::FixUp(uint32_t node)
+{
+	// A 2-3-4 tree keeps its 4-nodes, so it only fixes a red right child
+	// that has no red sibling.
+#if defined(USE_234_TREE)
+	if (IsRed(Right(node)) && (false == IsRed(Left(node)))) {
+#else
+	if (IsRed(Right(node))) {
+#endif
+		node = RotateLeft(node);
+	}
+
+	if (IsRed(Left(node)) && IsRed(Left(Left(node)))) {
+		node = RotateRight(node);
+	}
+
+#if !defined(USE_234_TREE)
+	if (IsRed(Left(node)) && IsRed(Right(node))) {
+		ColorFlip(node);
+	}
+#endif
+
+	return node;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Delete()
+//
+void CompactLeftLeaningRedBlack::Delete(const uint32_t key)
+{
+	if (0 != m_Root) {
+		m_Root = DeleteRec(m_Root, key);
+
+		if (0 != m_Root) {
+			SetRed(m_Root, false);
+		}
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	DeleteRec()
+//
+//	Deletion never allocates, so links can be written back directly.
+//
+uint32_t CompactLeftLeaningRedBlack::DeleteRec(uint32_t node, const uint32_t key)
+{
+	if (key < m_pNodes[node].Ref.Key) {
+		if (0 != Left(node)) {
+			if ((false == IsRed(Left(node))) && (false == IsRed(Left(Left(node))))) {
+				node = MoveRedLeft(node);
+			}
+
+			SetLeft(node, DeleteRec(Left(node), key));
+		}
+	}
+	else {
+		// A 4-node already has a red right child, and rotating it would
+		// leave two reds in a row on the right.
+		if (IsRed(Left(node)) && (false == IsRed(Right(node)))) {
+			node = RotateRight(node);
+		}
+
+		// Deletion of a leaf node.
+		if ((key == m_pNodes[node].Ref.Key) && (0 == Right(node))) {
+			Free(node);
+			return 0;
+		}
+
+		if (0 != Right(node)) {
+			if ((false == IsRed(Right(node))) && (false == IsRed(Left(Right(node))))) {
+				node = MoveRedRight(node);
+			}
+
+			// Deletion of an internal node: pull up the successor.
+			if (key == m_pNodes[node].Ref.Key) {
+				m_pNodes[node].Ref = m_pNodes[FindMin(Right(node))].Ref;
+				SetRight(node, DeleteMin(Right(node)));
+			}
+			else {
+				SetRight(node, DeleteRec(Right(node), key));
+			}
+		}
+	}
+
+	return FixUp(node);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	DeleteMin()
+//
+uint32_t CompactLeftLeaningRedBlack::DeleteMin(uint32_t node)
+{
+	if (0 == Left(node)) {
+		Free(node);
+		return 0;
+	}
+
+	if ((false == IsRed(Left(node))) && (false == IsRed(Left(Left(node))))) {
+		node = MoveRedLeft(node);
+	}
+
+	SetLeft(node, DeleteMin(Left(node)));
+
+	return FixUp(node);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	CheckRec()
+//
+//	Returns the black height of the subtree, or -1 after recording the
+//	first problem found in check.  pPrev is the node before this subtree
+//	in key order.  The recursion is as deep as the tree, which is at most
+//	twice the black height.
+//
+int CompactLeftLeaningRedBlack::CheckRec(uint32_t node, const LLTBCompact_t*& pPrev, LLRBCheck_t& check) const
+{
+	if (0 == node) {
+		return 0;
+	}
+
+	uint32_t left  = Left(node);
+	uint32_t right = Right(node);
+
+	// A 2-3 tree never has a red right child.  A 2-3-4 tree may, but only
+	// as half of a 4-node.
+#if defined(USE_234_TREE)
+	bool rightLeaning = IsRed(right) && (false == IsRed(left));
+#else
+	bool rightLeaning = IsRed(right);
+#endif
+
+	if (rightLeaning) {
+		check.Error = LLRB_ERROR_RIGHT_LEANING;
+		check.Key   = m_pNodes[node].Ref.Key;
+		return -1;
+	}
+
+	if (IsRed(node) && (IsRed(left) || IsRed(right))) {
+		check.Error = LLRB_ERROR_RED_RED;
+		check.Key   = m_pNodes[node].Ref.Key;
+		return -1;
+	}
+
+	int leftHeight = CheckRec(left, pPrev, check);
+
+	if (leftHeight < 0) {
+		return -1;
+	}
+
+	if ((nullptr != pPrev) && (false == (pPrev->Ref.Key < m_pNodes[node].Ref.Key))) {
+		check.Error = LLRB_ERROR_ORDER;
+		check.Key   = m_pNodes[node].Ref.Key;
+		return -1;
+	}
+
+	pPrev = m_pNodes + node;
+	++check.Count;
+
+	int rightHeight = CheckRec(right, pPrev, check);
+
+	if (rightHeight < 0) {
+		return -1;
+	}
+
+	if (leftHeight != rightHeight) {
+		check.Error = LLRB_ERROR_BLACK_HEIGHT;
+		check.Key   = m_pNodes[node].Ref.Key;
+		return -1;
+	}
+
+	return leftHeight + (IsRed(node) ? 0 : 1);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Validate()
+//
+bool CompactLeftLeaningRedBlack::Validate(LLRBCheck_t& check) const
+{
+	const LLTBCompact_t* pPrev = nullptr;
+
+	check.Error       = LLRB_VALID;
+	check.Key         = 0;
+	check.Count       = 0;
+	check.BlackHeight = 0;
+
+	if ((0 != m_Root) && IsRed(m_Root)) {
+		check.Error = LLRB_ERROR_RED_ROOT;
+		check.Key   = m_pNodes[m_Root].Ref.Key;
+		return false;
+	}
+
+	int height = CheckRec(m_Root, pPrev, check);
+
+	if (height < 0) {
+		return false;
+	}
+
+	check.BlackHeight = height;
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	SaveSnapshot()
+//
+//	The arena may contain freed slots and is in insertion order, so the
+//	nodes are renumbered in pre-order the same way as in
+//	LeftLeaningRedBlack::SaveSnapshot().
+//
+bool CompactLeftLeaningRedBlack::SaveSnapshot(const char* path) const
+{
+	struct Pending_t
+	{
+		uint32_t Node;
+		uint32_t Parent;
+		bool     IsRight;
+	};
+
+	std::vector<LLTBCompact_t> records(1);
+	std::vector<Pending_t>     stack;
+
+	records[0] = m_pNodes[0];
+
+	if (0 != m_Root) {
+		Pending_t root = { m_Root, 0, false };
+		stack.push_back(root);
+	}
+
+	while (false == stack.empty()) {
+		Pending_t next = stack.back();
+		stack.pop_back();
+
+		uint32_t index = uint32_t(records.size());
+
+		LLTBCompact_t record;
+		record.Ref          = m_pNodes[next.Node].Ref;
+		record.LeftAndColor = m_pNodes[next.Node].LeftAndColor & LLTB_COMPACT_RED;
+		record.Right        = 0;
+		records.push_back(record);
+
+		if (0 != next.Parent) {
+			if (next.IsRight) {
+				records[next.Parent].Right = index;
+			}
+			else {
+				records[next.Parent].LeftAndColor |= index;
+			}
+		}
+
+		if (0 != Right(next.Node)) {
+			Pending_t right = { Right(next.Node), index, true };
+			stack.push_back(right);
+		}
+
+		if (0 != Left(next.Node)) {
+			Pending_t left = { Left(next.Node), index, false };
+			stack.push_back(left);
+		}
+	}
+
+	return LeftLeaningRedBlackSnapshot::Write(path, records.data(), uint32_t(records.size() - 1));
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LoadSnapshot()
+//
+//	The snapshot is already in arena layout, so it is copied in with a
+//	single memcpy().  The copy is checked with
+//	LeftLeaningRedBlackSnapshot::CheckNodes() before it replaces the
+//	current arena, since the algorithms in this file trust every index
+//	they follow and every color they read.  A file that fails the check
+//	leaves the tree as it was.  Damage that keeps the tree valid, such as
+//	a changed key that is still in order, cannot be detected.
+//
+bool CompactLeftLeaningRedBlack::LoadSnapshot(const char* path)
+{
+	LeftLeaningRedBlackSnapshot snapshot;
+
+	if (false == snapshot.Open(path)) {
+		return false;
+	}
+
+	uint32_t count    = snapshot.Count();
+	uint32_t capacity = FIRST_CAPACITY;
+
+	while (capacity < count + 1) {
+		capacity *= 2;
+	}
+
+	if (capacity > MAX_CAPACITY) {
+		return false;
+	}
+
+	LLTBCompact_t* pNodes = static_cast<LLTBCompact_t*>(::operator new(capacity * sizeof(LLTBCompact_t)));
+
+	memcpy(pNodes, snapshot.Nodes(), (size_t(count) + 1) * sizeof(LLTBCompact_t));
+
+	pNodes[0].Ref.Key      = 0;
+	pNodes[0].LeftAndColor = 0;
+	pNodes[0].Right        = 0;
+
+#if defined(USE_234_TREE)
+	const bool allow4Nodes = true;
+#else
+	const bool allow4Nodes = false;
+#endif
+
+	if (false == LeftLeaningRedBlackSnapshot::CheckNodes(pNodes, count, allow4Nodes)) {
+		::operator delete(pNodes);
+		return false;
+	}
+
+	::operator delete(m_pNodes);
+
+	m_pNodes   = pNodes;
+	m_Capacity = capacity;
+	m_Used     = count + 1;
+	m_FreeList = 0;
+	m_Root     = snapshot.Root();
+
+	return true;
+}
@@ -0,0 +1,142 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: CompactLeftLeaningRedBlack.h
+//
+//	$Header: $
+//
+//
+//	Compact node layout for the LLRB.  This is the same algorithm as
+//	LeftLeaningRedBlack, but nodes live in a single contiguous arena and
+//	link to each other with 32-bit indices instead of pointers.  The color
+//	of a node is packed into the high bit of its left-child index, so each
+//	node is 12 bytes instead of the 24 bytes taken by LLTB_t after padding.
+//
+//	Index 0 is reserved as a black sentinel that stands in for nullptr.
+//	Since the sentinel is always black, IsRed() does not need to test for
+//	a missing child before reading the color.
+//
+//	The arena grows by doubling, which moves the nodes.  Any pointer
+//	returned by LookUp() is only valid until the next Insert().
+//
+//	The tree can hold up to 2^31 - 1 keys.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include "VoidRef.h"
+
+
+struct LLRBCheck_t;
+
+
+struct LLTBCompact_t
+{
+	VoidRef_t Ref;
+
+	// Index of the left child.  The high bit holds IsRed for this node.
+	uint32_t LeftAndColor;
+
+	uint32_t Right;
+};
+
+
+class CompactLeftLeaningRedBlack
+{
+private:
+	LLTBCompact_t* m_pNodes;
+	uint32_t       m_Capacity;
+	uint32_t       m_Used;		// number of arena slots ever handed out
+	uint32_t       m_FreeList;	// freed slots, linked through Right
+	uint32_t       m_Root;
+
+	CompactLeftLeaningRedBlack(const CompactLeftLeaningRedBlack&);
+	CompactLeftLeaningRedBlack& operator=(const CompactLeftLeaningRedBlack&);
+
+	uint32_t NewNode(void);
+	void     Free(uint32_t node);
+	void     Grow(void);
+
+	bool     IsRed(uint32_t node) const;
+	void     SetRed(uint32_t node, bool isRed);
+	uint32_t Left(uint32_t node) const;
+	uint32_t Right(uint32_t node) const;
+	void     SetLeft(uint32_t node, uint32_t child);
+	void     SetRight(uint32_t node, uint32_t child);
+
+	uint32_t RotateLeft(uint32_t node);
+	uint32_t RotateRight(uint32_t node);
+	void     ColorFlip(uint32_t node);
+	uint32_t MoveRedLeft(uint32_t node);
+	uint32_t MoveRedRight(uint32_t node);
+	uint32_t FindMin(uint32_t node) const;
+	uint32_t FixUp(uint32_t node);
+
+	uint32_t InsertRec(uint32_t node, const VoidRef_t& ref);
+	uint32_t DeleteRec(uint32_t node, const uint32_t key);
+	uint32_t DeleteMin(uint32_t node);
+
+	int      CheckRec(uint32_t node, const LLTBCompact_t*& pPrev, LLRBCheck_t& check) const;
+
+public:
+	CompactLeftLeaningRedBlack(void);
+	~CompactLeftLeaningRedBlack(void);
+	void FreeAll(void);
+
+	void* LookUp(const uint32_t key);
+	bool  Insert(VoidRef_t ref);
+	void  Delete(const uint32_t key);
+
+	// Binary snapshots.  The file format is this tree's arena layout, see
+	// LeftLeaningRedBlackSnapshot.h.
+	bool  SaveSnapshot(const char* path) const;
+	bool  LoadSnapshot(const char* path);
+
+	// Checks the same invariants as LeftLeaningRedBlack::Validate(), for
+	// whichever arrangement USE_234_TREE selects.
+	bool  Validate(LLRBCheck_t& check) const;
+};
+
+
+#define LLTB_COMPACT_RED	0x80000000u
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Node accessors
+//
+//	These are kept inline since every step of every operation goes through
+//	them.  None of them needs a null test, because index 0 is a real
+//	(black) node.
+//
+inline bool CompactLeftLeaningRedBlack::IsRed(uint32_t node) const
+{
+	return 0 != (m_pNodes[node].LeftAndColor & LLTB_COMPACT_RED);
+}
+
+inline void CompactLeftLeaningRedBlack::SetRed(uint32_t node, bool isRed)
+{
+	m_pNodes[node].LeftAndColor = (m_pNodes[node].LeftAndColor & ~LLTB_COMPACT_RED) | (isRed ? LLTB_COMPACT_RED : 0);
+}
+
+inline uint32_t CompactLeftLeaningRedBlack::Left(uint32_t node) const
+{
+	return m_pNodes[node].LeftAndColor & ~LLTB_COMPACT_RED;
+}
+
+inline uint32_t CompactLeftLeaningRedBlack::Right(uint32_t node) const
+{
+	return m_pNodes[node].Right;
+}
+
+inline void CompactLeftLeaningRedBlack::SetLeft(uint32_t node, uint32_t child)
+{
+	m_pNodes[node].LeftAndColor = (m_pNodes[node].LeftAndColor & LLTB_COMPACT_RED) | child;
+}
+
+inline void CompactLeftLeaningRedBlack::SetRight(uint32_t node, uint32_t child)
+{
+	m_pNodes[node].Right = child;
+}
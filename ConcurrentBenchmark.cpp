@@ -0,0 +1,623 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: ConcurrentBenchmark.cpp
+//
+//	$Header: $
+//
+//
+//	Multi-threaded stress test and throughput benchmark for the concurrent
+//	trees (llrb_mt_bench).
+//
+//	The throughput runs fill a tree with the even keys 0, 2, ... 2(n - 1),
+//	then start every thread at once.  Each operation picks a uniform key in
+//	[0, 2n), so about half of all lookups miss, and is a write with the
+//	given probability, split evenly between Insert() and Delete().  The
+//	figure reported is the total number of operations finished by all of
+//	the threads per second of wall time.  The engines are:
+//
+//	  locked	LeftLeaningRedBlack, with one mutex around every operation
+//	  cow		ConcurrentLeftLeaningRedBlack: lock-free readers, with
+//	 		writers serialized on a mutex
+//	  olc		OptimisticLeftLeaningRedBlack: lock-free readers, with
+//	 		writers only conflicting on the nodes they change
+//
+//	--stress checks OptimisticLeftLeaningRedBlack instead of timing it.
+//	Each writer thread owns the keys that are equal to its index modulo
+//	the number of threads, and inserts and deletes them at random while
+//	tracking what it expects its keys to hold.  Meanwhile one thread looks
+//	up a fixed set of keys that are never deleted, and must always find
+//	them, and another calls Purge() in a loop.  At the end the tree must
+//	pass Validate() and hold exactly the keys the writers expect.
+//
+//	Running more threads than there are cores still works, but measures
+//	preemption more than contention.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "LeftLeaningRedBlack.h"
+#include "ConcurrentLeftLeaningRedBlack.h"
+#include "OptimisticLeftLeaningRedBlack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+#define MT_DEFAULT_KEYS		1000000
+#define MT_DEFAULT_OPS		200000
+
+// Pinned keys the stress reader checks.  They sit above every key the
+// writers use.
+#define MT_PINNED_KEYS		1024
+#define MT_PINNED_BASE		0x80000000u
+
+
+typedef std::chrono::steady_clock Clock_t;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	NextRandom()
+//
+//	splitmix64.  Each thread runs its own generator, so drawing keys costs
+//	the same for every engine and shares nothing between threads.
+//
+static inline uint64_t NextRandom(uint64_t& state)
+{
+	uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+
+	return z ^ (z >> 31);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LockedTree_t
+//
+//	The baseline: the plain tree behind one global lock.
+//
+struct LockedTree_t
+{
+	std::mutex          Lock;
+	LeftLeaningRedBlack Tree;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	MtInsert(), MtLookUp(), MtDelete()
+//
+//	The concurrent trees can be called directly.  LockedTree_t gets
+//	overloads that take the lock.
+//
+template <typename Tree_t>
+inline void MtInsert(Tree_t& tree, uint32_t key)
+{
+	VoidRef_t ref;
+	ref.Key = key;
+	tree.Insert(ref);
+}
+
+template <typename Tree_t>
+inline bool MtLookUp(Tree_t& tree, uint32_t key)
+{
+	return tree.LookUp(key);
+}
+
+template <typename Tree_t>
+inline void MtDelete(Tree_t& tree, uint32_t key)
+{
+	tree.Delete(key);
+}
+
+inline void MtInsert(LockedTree_t& tree, uint32_t key)
+{
+	std::lock_guard<std::mutex> lock(tree.Lock);
+
+	VoidRef_t ref;
+	ref.Key = key;
+	tree.Tree.Insert(ref);
+}
+
+inline bool MtLookUp(LockedTree_t& tree, uint32_t key)
+{
+	std::lock_guard<std::mutex> lock(tree.Lock);
+
+	return nullptr != tree.Tree.LookUp(key);
+}
+
+inline void MtDelete(LockedTree_t& tree, uint32_t key)
+{
+	std::lock_guard<std::mutex> lock(tree.Lock);
+
+	tree.Tree.Delete(key);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	StartGate_t
+//
+//	Holds every thread back until all of them are ready, so that thread
+//	creation is not timed and no thread gets a head start on an idle tree.
+//
+class StartGate_t
+{
+private:
+	std::atomic<int>  m_Waiting;
+	std::atomic<bool> m_Open;
+
+public:
+	StartGate_t(int threads)
+		: m_Waiting(threads)
+		, m_Open(false)
+	{
+	}
+
+	void Arrive(void)
+	{
+		m_Waiting.fetch_sub(1);
+
+		while (false == m_Open.load()) {
+			std::this_thread::yield();
+		}
+	}
+
+	void Open(void)
+	{
+		while (0 != m_Waiting.load()) {
+			std::this_thread::yield();
+		}
+
+		m_Open.store(true);
+	}
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Options_t
+//
+struct Options_t
+{
+	std::vector<int> Threads;
+	std::vector<int> WritePercents;
+	uint64_t         Keys;
+	uint64_t         Ops;
+	uint64_t         Seed;
+	bool             Engines[3];
+	bool             Stress;
+
+	Options_t(void)
+		: Keys(MT_DEFAULT_KEYS)
+		, Ops(MT_DEFAULT_OPS)
+		, Seed(1)
+		, Stress(false)
+	{
+		const int threads[] = { 1, 2, 4, 8 };
+		const int writes[]  = { 0, 10, 50, 100 };
+
+		Threads.assign(threads, threads + 4);
+		WritePercents.assign(writes, writes + 4);
+
+		for (int i = 0; i < 3; ++i) {
+			Engines[i] = true;
+		}
+	}
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	ParseCount()
+//
+//	Accepts a K, M or G suffix, so "100M" is 100,000,000.
+//
+static bool ParseCount(const char* pText, uint64_t& value)
+{
+	char*  pEnd  = nullptr;
+	double count = strtod(pText, &pEnd);
+
+	if ((pEnd == pText) || (count < 1.0)) {
+		return false;
+	}
+
+	switch (*pEnd) {
+		case 'k': case 'K':	count *= 1e3; ++pEnd; break;
+		case 'm': case 'M':	count *= 1e6; ++pEnd; break;
+		case 'g': case 'G':	count *= 1e9; ++pEnd; break;
+		default:			break;
+	}
+
+	value = uint64_t(count);
+
+	return '\0' == *pEnd;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	ParseList()
+//
+//	Parses a comma-separated list of integers in [lo, hi].
+//
+static bool ParseList(const char* pText, int lo, int hi, std::vector<int>& values)
+{
+	values.clear();
+
+	std::string list(pText);
+	size_t      start = 0;
+
+	while (start <= list.size()) {
+		size_t end = list.find(',', start);
+
+		if (std::string::npos == end) {
+			end = list.size();
+		}
+
+		std::string item  = list.substr(start, end - start);
+		char*       pEnd  = nullptr;
+		long        value = strtol(item.c_str(), &pEnd, 10);
+
+		if (item.empty() || ('\0' != *pEnd) || (value < lo) || (value > hi)) {
+			return false;
+		}
+
+		values.push_back(int(value));
+		start = end + 1;
+	}
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	ParseArgs()
+//
+static bool ParseArgs(int argc, char** argv, Options_t& options)
+{
+	for (int i = 1; i < argc; ++i) {
+		const char* pArg   = argv[i];
+		const char* pValue = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+		if ((0 == strcmp(pArg, "--threads")) && (nullptr != pValue)) {
+			if (false == ParseList(pValue, 1, 1024, options.Threads)) {
+				fprintf(stderr, "bad list for --threads: %s\n", pValue);
+				return false;
+			}
+
+			++i;
+		}
+		else if ((0 == strcmp(pArg, "--writes")) && (nullptr != pValue)) {
+			if (false == ParseList(pValue, 0, 100, options.WritePercents)) {
+				fprintf(stderr, "bad list for --writes: %s\n", pValue);
+				return false;
+			}
+
+			++i;
+		}
+		else if ((0 == strcmp(pArg, "--keys")) && (nullptr != pValue)) {
+			// Keys are stored doubled, and the stress test keeps the top
+			// half of the key space for its pinned keys.
+			if ((false == ParseCount(pValue, options.Keys)) || (options.Keys >= (uint64_t(1) << 30))) {
+				fprintf(stderr, "bad count for --keys: %s\n", pValue);
+				return false;
+			}
+
+			++i;
+		}
+		else if ((0 == strcmp(pArg, "--ops")) && (nullptr != pValue)) {
+			if (false == ParseCount(pValue, options.Ops)) {
+				fprintf(stderr, "bad count for --ops: %s\n", pValue);
+				return false;
+			}
+
+			++i;
+		}
+		else if ((0 == strcmp(pArg, "--engines")) && (nullptr != pValue)) {
+			options.Engines[0] = (nullptr != strstr(pValue, "locked"));
+			options.Engines[1] = (nullptr != strstr(pValue, "cow"));
+			options.Engines[2] = (nullptr != strstr(pValue, "olc"));
+
+			++i;
+		}
+		else if ((0 == strcmp(pArg, "--seed")) && (nullptr != pValue)) {
+			options.Seed = strtoull(pValue, nullptr, 10);
+			++i;
+		}
+		else if (0 == strcmp(pArg, "--stress")) {
+			options.Stress = true;
+		}
+		else {
+			fprintf(stderr,
+				"usage: %s [options]\n"
+				"  --threads LIST       thread counts to run (default 1,2,4,8)\n"
+				"  --writes LIST        percentages of operations that write (default 0,10,50,100)\n"
+				"  --keys N             keys in the tree before timing starts (default %d)\n"
+				"  --ops N              operations per thread (default %d)\n"
+				"  --engines LIST       any of locked,cow,olc\n"
+				"  --seed N             seed for the key streams\n"
+				"  --stress             check OptimisticLeftLeaningRedBlack instead of timing\n",
+				argv[0], MT_DEFAULT_KEYS, MT_DEFAULT_OPS);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Fill()
+//
+//	Inserts the even keys below 2n in a pseudo-random order, since filling
+//	in ascending order would favor the trees that happen to handle that
+//	well.  Multiplying by an odd constant permutes the indices modulo any
+//	power of two, and the indices past n are skipped.
+//
+template <typename Tree_t>
+static void Fill(Tree_t& tree, uint64_t keys)
+{
+	uint64_t span = 1;
+
+	while (span < keys) {
+		span <<= 1;
+	}
+
+	for (uint64_t i = 0; i < span; ++i) {
+		uint64_t index = (i * 0x9E3779B97F4A7C15ull) & (span - 1);
+
+		if (index < keys) {
+			MtInsert(tree, uint32_t(2 * index));
+		}
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Worker()
+//
+//	Returns the number of lookups that hit, which keeps the optimizer from
+//	discarding them.
+//
+template <typename Tree_t>
+static uint64_t Worker(Tree_t& tree, StartGate_t& gate, const Options_t& options, int writePercent, uint64_t seed)
+{
+	uint64_t state = seed;
+	uint64_t hits  = 0;
+
+	gate.Arrive();
+
+	for (uint64_t i = 0; i < options.Ops; ++i) {
+		uint64_t draw = NextRandom(state);
+		uint32_t key  = uint32_t((draw >> 8) % (2 * options.Keys));
+
+		if ((draw & 0xFF) * 100 >= uint64_t(writePercent) * 256) {
+			hits += MtLookUp(tree, key);
+		}
+		else if (0 != (draw & 0x100000000000ull)) {
+			MtInsert(tree, key);
+		}
+		else {
+			MtDelete(tree, key);
+		}
+	}
+
+	return hits;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Run()
+//
+template <typename Tree_t>
+static void Run(const char* engine, const Options_t& options)
+{
+	for (size_t w = 0; w < options.WritePercents.size(); ++w) {
+		for (size_t t = 0; t < options.Threads.size(); ++t) {
+			int threads      = options.Threads[t];
+			int writePercent = options.WritePercents[w];
+
+			Tree_t tree;
+			Fill(tree, options.Keys);
+
+			StartGate_t              gate(threads);
+			std::vector<std::thread> workers;
+			std::vector<uint64_t>    hits(threads, 0);
+
+			for (int i = 0; i < threads; ++i) {
+				uint64_t seed = options.Seed * 1000003 + i;
+
+				workers.push_back(std::thread([&tree, &gate, &options, &hits, writePercent, seed, i]() {
+					hits[i] = Worker(tree, gate, options, writePercent, seed);
+				}));
+			}
+
+			gate.Open();
+
+			Clock_t::time_point start = Clock_t::now();
+
+			for (int i = 0; i < threads; ++i) {
+				workers[i].join();
+			}
+
+			double seconds = std::chrono::duration<double>(Clock_t::now() - start).count();
+			double ops     = double(options.Ops) * threads;
+
+			uint64_t totalHits = 0;
+			for (int i = 0; i < threads; ++i) {
+				totalHits += hits[i];
+			}
+
+			printf("%-8s %8d %7d%% %12.0f %10.3f %10.3f %12llu\n",
+				engine, threads, writePercent, ops, seconds, ops / seconds / 1e6, (unsigned long long)totalHits);
+			fflush(stdout);
+		}
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Stress()
+//
+//	Returns true if the tree came through intact.  See the top of the
+//	file for what is checked.
+//
+static bool Stress(const Options_t& options)
+{
+	for (size_t t = 0; t < options.Threads.size(); ++t) {
+		int threads = options.Threads[t];
+
+		// Spread the keys so that the writers share the same subtrees.
+		uint64_t perThread = (options.Keys > uint64_t(threads)) ? (options.Keys / threads) : 1;
+
+		OptimisticLeftLeaningRedBlack tree;
+
+		for (uint32_t i = 0; i < MT_PINNED_KEYS; ++i) {
+			MtInsert(tree, MT_PINNED_BASE + 2 * i);
+		}
+
+		std::vector<std::set<uint32_t> > expected(threads);
+		std::atomic<uint64_t>            errors(0);
+		std::atomic<bool>                stop(false);
+		std::atomic<uint64_t>            purges(0);
+		StartGate_t                      gate(threads);
+		std::vector<std::thread>         workers;
+
+		for (int i = 0; i < threads; ++i) {
+			workers.push_back(std::thread([&, i]() {
+				std::set<uint32_t>& mine  = expected[i];
+				uint64_t            state = options.Seed * 1000003 + i;
+
+				gate.Arrive();
+
+				for (uint64_t op = 0; op < options.Ops; ++op) {
+					uint64_t draw = NextRandom(state);
+					uint32_t key  = uint32_t(((draw >> 8) % perThread) * threads + i);
+
+					VoidRef_t ref;
+					ref.Key = key;
+
+					bool changed = (0 != (draw & 1)) ? tree.Insert(ref) : tree.Delete(key);
+					bool expect  = (0 != (draw & 1)) ? mine.insert(key).second : (0 != mine.erase(key));
+
+					if ((changed != expect) || (tree.LookUp(key) != (0 != mine.count(key)))) {
+						errors.fetch_add(1);
+					}
+				}
+			}));
+		}
+
+		std::thread reader([&]() {
+			uint64_t state = options.Seed;
+
+			while (false == stop.load()) {
+				uint32_t i = uint32_t(NextRandom(state) % MT_PINNED_KEYS);
+
+				// The odd keys in between are never inserted.
+				if ((false == tree.LookUp(MT_PINNED_BASE + 2 * i)) || tree.LookUp(MT_PINNED_BASE + 2 * i + 1)) {
+					errors.fetch_add(1);
+				}
+			}
+		});
+
+		std::thread purger([&]() {
+			while (false == stop.load()) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				tree.Purge();
+				purges.fetch_add(1);
+			}
+		});
+
+		gate.Open();
+
+		for (int i = 0; i < threads; ++i) {
+			workers[i].join();
+		}
+
+		stop.store(true);
+		reader.join();
+		purger.join();
+
+		size_t live = MT_PINNED_KEYS;
+
+		for (int i = 0; i < threads; ++i) {
+			live += expected[i].size();
+
+			for (std::set<uint32_t>::const_iterator it = expected[i].begin(); it != expected[i].end(); ++it) {
+				if (false == tree.LookUp(*it)) {
+					errors.fetch_add(1);
+				}
+			}
+		}
+
+		LLRBCheck_t check;
+
+		if ((false == tree.Validate(check)) || (check.Count != live) || (tree.Count() != live)) {
+			fprintf(stderr, "stress: %d threads: %s at key %u, %zu keys counted, %zu expected\n",
+				threads, LeftLeaningRedBlack::ErrorText(check.Error), check.Key, size_t(check.Count), live);
+			return false;
+		}
+
+		printf("stress   %8d threads %12llu ops %6llu purges %6llu errors\n",
+			threads, (unsigned long long)(options.Ops * threads),
+			(unsigned long long)purges.load(), (unsigned long long)errors.load());
+
+		if (0 != errors.load()) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	main()
+//
+int main(int argc, char** argv)
+{
+	Options_t options;
+
+	if (false == ParseArgs(argc, argv, options)) {
+		return 1;
+	}
+
+	if (options.Stress) {
+		return Stress(options) ? 0 : 2;
+	}
+
+	fprintf(stderr, "%u hardware threads\n", std::thread::hardware_concurrency());
+
+	printf("%-8s %8s %8s %12s %10s %10s %12s\n", "engine", "threads", "writes", "ops", "seconds", "Mops/s", "hits");
+
+	if (options.Engines[0]) {
+		Run<LockedTree_t>("locked", options);
+	}
+
+	if (options.Engines[1]) {
+		Run<ConcurrentLeftLeaningRedBlack>("cow", options);
+	}
+
+	if (options.Engines[2]) {
+		Run<OptimisticLeftLeaningRedBlack>("olc", options);
+	}
+
+	return 0;
+}
@@ -0,0 +1,670 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: ConcurrentLeftLeaningRedBlack.cpp
+//
+//	$Header: $
+//
+//
+//	Path-copying LLRB with lock-free readers.  See the header for the
+//	overall scheme.  The rebalancing logic is the same as in
+//	LeftLeaningRedBlack.cpp, except that every helper that changes a node
+//	first passes it through Mut(), and returns the (possibly new) node so
+//	that the caller links in the copy instead of the original.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "ConcurrentLeftLeaningRedBlack.h"
+#include "LeftLeaningRedBlack.h"
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	IsRed()
+//
+static inline bool IsRed(const LLTBVersioned_t* pNode)
+{
+	return ((nullptr != pNode) && pNode->IsRed);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FindMin()
+//
+static const LLTBVersioned_t* FindMin(const LLTBVersioned_t* pNode)
+{
+	while (nullptr != pNode->pLeft) {
+		pNode = pNode->pLeft;
+	}
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	constructor
+//
+ConcurrentLeftLeaningRedBlack::ConcurrentLeftLeaningRedBlack(void)
+	: m_pRoot(nullptr)
+	, m_Pool(sizeof(LLTBVersioned_t))
+	, m_WriteVersion(0)
+{
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	destructor
+//
+//	No reader may still be using the tree once it is being destroyed, so
+//	the pool can release everything, including retired nodes, at once.
+//
+ConcurrentLeftLeaningRedBlack::~ConcurrentLeftLeaningRedBlack(void)
+{
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FreeAll()
+//
+//	Unpublishes the tree, waits for every reader that could still be
+//	walking it to leave, then releases all of the nodes in bulk.
+//
+void ConcurrentLeftLeaningRedBlack::FreeAll(void)
+{
+	std::lock_guard<std::mutex> lock(m_WriteLock);
+
+	m_pRoot.store(nullptr);
+
+	m_Epochs.WaitForReaders(m_Epochs.Advance());
+
+	m_Pool.ReleaseAll();
+	m_Replaced.clear();
+	m_Retired.clear();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	NewNode()
+//
+//	Note that a new node defaults to being red.
+//
+LLTBVersioned_t* ConcurrentLeftLeaningRedBlack::NewNode(void)
+{
+	LLTBVersioned_t* pNew = static_cast<LLTBVersioned_t*>(m_Pool.Alloc());
+
+	pNew->Ref.Key = 0;
+	pNew->IsRed   = true;
+	pNew->Version = m_WriteVersion;
+	pNew->pLeft   = nullptr;
+	pNew->pRight  = nullptr;
+
+	return pNew;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Mut()
+//
+//	Returns a node that the current write is allowed to modify.  If pNode
+//	was created by this write it is not visible to any reader yet, so it is
+//	returned as is.  Otherwise it is copied, and the original is queued to
+//	be retired once the write is published.
+//
+LLTBVersioned_t* ConcurrentLeftLeaningRedBlack::Mut(LLTBVersioned_t* pNode)
+{
+	if (m_WriteVersion == pNode->Version) {
+		return pNode;
+	}
+
+	LLTBVersioned_t* pCopy = static_cast<LLTBVersioned_t*>(m_Pool.Alloc());
+
+	*pCopy = *pNode;
+	pCopy->Version = m_WriteVersion;
+
+	m_Replaced.push_back(pNode);
+
+	return pCopy;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Drop()
+//
+//	Removes a node from the tree for good.  A copy made by this write can be
+//	freed immediately; a published node has to be retired.
+//
+void ConcurrentLeftLeaningRedBlack::Drop(LLTBVersioned_t* pNode)
+{
+	if (m_WriteVersion == pNode->Version) {
+		m_Pool.Free(pNode);
+	}
+	else {
+		m_Replaced.push_back(pNode);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Publish()
+//
+//	Makes the new version of the tree visible to readers, then tags every
+//	node the write replaced with the epoch it was unlinked in.
+//
+void ConcurrentLeftLeaningRedBlack::Publish(LLTBVersioned_t* pRoot)
+{
+	m_pRoot.store(pRoot);
+
+	if (false == m_Replaced.empty()) {
+		uint64_t epoch = m_Epochs.Advance();
+
+		for (size_t i = 0; i < m_Replaced.size(); ++i) {
+			Retired_t retired = { epoch, m_Replaced[i] };
+			m_Retired.push_back(retired);
+		}
+
+		m_Replaced.clear();
+	}
+
+	Reclaim();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Reclaim()
+//
+//	Retired nodes are appended in epoch order, so everything that is safe
+//	to free is at the front of the list.
+//
+void ConcurrentLeftLeaningRedBlack::Reclaim(void)
+{
+	if (m_Retired.empty()) {
+		return;
+	}
+
+	uint64_t safe  = m_Epochs.SafeEpoch();
+	size_t   count = 0;
+
+	while ((count < m_Retired.size()) && (m_Retired[count].Epoch < safe)) {
+		m_Pool.Free(m_Retired[count].pNode);
+		++count;
+	}
+
+	m_Retired.erase(m_Retired.begin(), m_Retired.begin() + count);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Find()
+//
+const LLTBVersioned_t* ConcurrentLeftLeaningRedBlack::Find(const LLTBVersioned_t* pNode, const uint32_t key)
+{
+	while (nullptr != pNode) {
+		if (key == pNode->Ref.Key) {
+			return pNode;
+		}
+
+		pNode = (key < pNode->Ref.Key) ? pNode->pLeft : pNode->pRight;
+	}
+
+	return nullptr;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUp()
+//
+//	Returns true if the key is in the tree, copying its ref to pRef.
+//
+bool ConcurrentLeftLeaningRedBlack::LookUp(const uint32_t key, VoidRef_t* pRef)
+{
+	EpochReadGuard guard(m_Epochs);
+
+	const LLTBVersioned_t* pNode = Find(m_pRoot.load(), key);
+
+	if (nullptr == pNode) {
+		return false;
+	}
+
+	if (nullptr != pRef) {
+		*pRef = pNode->Ref;
+	}
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	RotateLeft()
+//
+LLTBVersioned_t* ConcurrentLeftLeaningRedBlack::RotateLeft(LLTBVersioned_t* pNode)
+{
+	pNode = Mut(pNode);
+
+	LLTBVersioned_t* pTemp = Mut(pNode->pRight);
+	pNode->pRight = pTemp->pLeft;
+	pTemp->pLeft = pNode;
+	pTemp->IsRed = pNode->IsRed;
+	pNode->IsRed = true;
+
+	return pTemp;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	RotateRight()
+//
+LLTBVersioned_t* ConcurrentLeftLeaningRedBlack::RotateRight(LLTBVersioned_t* pNode)
+{
+	pNode = Mut(pNode);
+
+	LLTBVersioned_t* pTemp = Mut(pNode->pLeft);
+	pNode->pLeft = pTemp->pRight;
+	pTemp->pRight = pNode;
+	pTemp->IsRed = pNode->IsRed;
+	pNode->IsRed = true;
+
+	return pTemp;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	ColorFlip()
+//
+//	Both children change color, so both of them have to be copied as well.
+//
+LLTBVersioned_t* ConcurrentLeftLeaningRedBlack::ColorFlip(LLTBVersioned_t* pNode)
+{
+	pNode = Mut(pNode);
+	pNode->IsRed = !pNode->IsRed;
+
+	if (nullptr != pNode->pLeft) {
+		pNode->pLeft = Mut(pNode->pLeft);
+		pNode->pLeft->IsRed = !pNode->pLeft->IsRed;
+	}
+
+	if (nullptr != pNode->pRight) {
+		pNode->pRight = Mut(pNode->pRight);
+		pNode->pRight->IsRed = !pNode->pRight->IsRed;
+	}
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Insert()
+//
+//	Returns true if the key was added, false if an existing ref was
+//	replaced.
+//
+bool ConcurrentLeftLeaningRedBlack::Insert(VoidRef_t ref)
+{
+	std::lock_guard<std::mutex> lock(m_WriteLock);
+
+	++m_WriteVersion;
+
+	bool added = false;
+
+	LLTBVersioned_t* pRoot = InsertRec(m_pRoot.load(), ref, added);
+
+	// The root node of a red-black tree must be black.  InsertRec()
+	// always hands back a node owned by this write.
+	pRoot->IsRed = false;
+
+	Publish(pRoot);
+
+	return added;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	InsertRec()
+//
+LLTBVersioned_t* ConcurrentLeftLeaningRedBlack::InsertRec(LLTBVersioned_t* pNode, const VoidRef_t& ref, bool& added)
+{
+	if (nullptr == pNode) {
+		pNode = NewNode();
+		pNode->Ref = ref;
+		added = true;
+		return pNode;
+	}
+
+	// Every node on the search path gets a new child link.
+	pNode = Mut(pNode);
+
+#if defined(USE_234_TREE)
+	// Split 4-nodes on the way down the tree, as in
+	// LeftLeaningRedBlack::InsertRec().
+	if (IsRed(pNode->pLeft) && IsRed(pNode->pRight)) {
+		pNode = ColorFlip(pNode);
+	}
+#endif
+
+	if (ref.Key == pNode->Ref.Key) {
+		pNode->Ref = ref;
+	}
+	else if (ref.Key < pNode->Ref.Key) {
+		pNode->pLeft = InsertRec(pNode->pLeft, ref, added);
+	}
+	else {
+		pNode->pRight = InsertRec(pNode->pRight, ref, added);
+	}
+
+	// Fix a right-leaning red node.
+	if (IsRed(pNode->pRight) && (false == IsRed(pNode->pLeft))) {
+		pNode = RotateLeft(pNode);
+	}
+
+	// Fix two reds in a row.
+	if (IsRed(pNode->pLeft) && IsRed(pNode->pLeft->pLeft)) {
+		pNode = RotateRight(pNode);
+	}
+
+#if !defined(USE_234_TREE)
+	// Split 4-nodes on the way back out of the tree.
+	if (IsRed(pNode->pLeft) && IsRed(pNode->pRight)) {
+		pNode = ColorFlip(pNode);
+	}
+#endif
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	MoveRedLeft()
+//
+LLTBVersioned_t* ConcurrentLeftLeaningRedBlack::MoveRedLeft(LLTBVersioned_t* pNode)
+{
+	pNode = ColorFlip(pNode);
+
+	if ((nullptr != pNode->pRight) && IsRed(pNode->pRight->pLeft)) {
+		pNode->pRight = RotateRight(pNode->pRight);
+		pNode = RotateLeft(pNode);
+
+		pNode = ColorFlip(pNode);
+
+#if defined(USE_234_TREE)
+		// If pRight was a 4-node, it is left with a lone red right child
+		// that no FixUp() will see.
+		if (IsRed(pNode->pRight->pRight)) {
+			pNode->pRight = RotateLeft(pNode->pRight);
+		}
+#endif
+	}
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	MoveRedRight()
+//
+LLTBVersioned_t* ConcurrentLeftLeaningRedBlack::MoveRedRight(LLTBVersioned_t* pNode)
+{
+	pNode = ColorFlip(pNode);
+
+	if ((nullptr != pNode->pLeft) && IsRed(pNode->pLeft->pLeft)) {
+		pNode = RotateRight(pNode);
+
+		pNode = ColorFlip(pNode);
+	}
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FixUp()
+//
+LLTBVersioned_t* ConcurrentLeftLeaningRedBlack::FixUp(LLTBVersioned_t* pNode)
+{
+	// A 2-3-4 tree keeps its 4-nodes, so it only fixes a red right child
+	// that has no red sibling.
+#if defined(USE_234_TREE)
+	if (IsRed(pNode->pRight) && (false == IsRed(pNode->pLeft))) {
+#else
+	if (IsRed(pNode->pRight)) {
+#endif
+		pNode = RotateLeft(pNode);
+	}
+
+	if (IsRed(pNode->pLeft) && IsRed(pNode->pLeft->pLeft)) {
+		pNode = RotateRight(pNode);
+	}
+
+#if !defined(USE_234_TREE)
+	if (IsRed(pNode->pLeft) && IsRed(pNode->pRight)) {
+		pNode = ColorFlip(pNode);
+	}
+#endif
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Delete()
+//
+//	Returns true if the key was found and removed.  Keys that are not in
+//	the tree are rejected before anything is copied.
+//
+bool ConcurrentLeftLeaningRedBlack::Delete(const uint32_t key)
+{
+	std::lock_guard<std::mutex> lock(m_WriteLock);
+
+	LLTBVersioned_t* pRoot = m_pRoot.load();
+
+	if (nullptr == Find(pRoot, key)) {
+		return false;
+	}
+
+	++m_WriteVersion;
+
+	pRoot = DeleteRec(pRoot, key);
+
+	if (nullptr != pRoot) {
+		pRoot = Mut(pRoot);
+		pRoot->IsRed = false;
+	}
+
+	Publish(pRoot);
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	DeleteRec()
+//
+LLTBVersioned_t* ConcurrentLeftLeaningRedBlack::DeleteRec(LLTBVersioned_t* pNode, const uint32_t key)
+{
+	pNode = Mut(pNode);
+
+	if (key < pNode->Ref.Key) {
+		if (nullptr != pNode->pLeft) {
+			if ((false == IsRed(pNode->pLeft)) && (false == IsRed(pNode->pLeft->pLeft))) {
+				pNode = MoveRedLeft(pNode);
+			}
+
+			pNode->pLeft = DeleteRec(pNode->pLeft, key);
+		}
+	}
+	else {
+		// A 4-node already has a red right child, and rotating it would
+		// leave two reds in a row on the right.
+		if (IsRed(pNode->pLeft) && (false == IsRed(pNode->pRight))) {
+			pNode = RotateRight(pNode);
+		}
+
+		// Deletion of a leaf node.
+		if ((key == pNode->Ref.Key) && (nullptr == pNode->pRight)) {
+			Drop(pNode);
+			return nullptr;
+		}
+
+		if (nullptr != pNode->pRight) {
+			if ((false == IsRed(pNode->pRight)) && (false == IsRed(pNode->pRight->pLeft))) {
+				pNode = MoveRedRight(pNode);
+			}
+
+			// Deletion of an internal node: pull up the successor.
+			if (key == pNode->Ref.Key) {
+				pNode->Ref = FindMin(pNode->pRight)->Ref;
+				pNode->pRight = DeleteMin(pNode->pRight);
+			}
+			else {
+				pNode->pRight = DeleteRec(pNode->pRight, key);
+			}
+		}
+	}
+
+	return FixUp(pNode);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	DeleteMin()
+//
+LLTBVersioned_t* ConcurrentLeftLeaningRedBlack::DeleteMin(LLTBVersioned_t* pNode)
+{
+	pNode = Mut(pNode);
+
+	if (nullptr == pNode->pLeft) {
+		Drop(pNode);
+		return nullptr;
+	}
+
+	if ((false == IsRed(pNode->pLeft)) && (false == IsRed(pNode->pLeft->pLeft))) {
+		pNode = MoveRedLeft(pNode);
+	}
+
+	pNode->pLeft = DeleteMin(pNode->pLeft);
+
+	return FixUp(pNode);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	CheckRec()
+//
+//	Returns the black height of the subtree, or -1 after recording the
+//	first problem found in check.  pPrev is the node before this subtree
+//	in key order.  The recursion is as deep as the tree, which is at most
+//	twice the black height.
+//
+static int CheckRec(const LLTBVersioned_t* pNode, const LLTBVersioned_t*& pPrev, LLRBCheck_t& check)
+{
+	if (nullptr == pNode) {
+		return 0;
+	}
+
+	// A 2-3 tree never has a red right child.  A 2-3-4 tree may, but only
+	// as half of a 4-node.
+#if defined(USE_234_TREE)
+	bool rightLeaning = IsRed(pNode->pRight) && (false == IsRed(pNode->pLeft));
+#else
+	bool rightLeaning = IsRed(pNode->pRight);
+#endif
+
+	if (rightLeaning) {
+		check.Error = LLRB_ERROR_RIGHT_LEANING;
+		check.Key   = pNode->Ref.Key;
+		return -1;
+	}
+
+	if (pNode->IsRed && (IsRed(pNode->pLeft) || IsRed(pNode->pRight))) {
+		check.Error = LLRB_ERROR_RED_RED;
+		check.Key   = pNode->Ref.Key;
+		return -1;
+	}
+
+	int leftHeight = CheckRec(pNode->pLeft, pPrev, check);
+
+	if (leftHeight < 0) {
+		return -1;
+	}
+
+	if ((nullptr != pPrev) && (false == (pPrev->Ref.Key < pNode->Ref.Key))) {
+		check.Error = LLRB_ERROR_ORDER;
+		check.Key   = pNode->Ref.Key;
+		return -1;
+	}
+
+	pPrev = pNode;
+	++check.Count;
+
+	int rightHeight = CheckRec(pNode->pRight, pPrev, check);
+
+	if (rightHeight < 0) {
+		return -1;
+	}
+
+	if (leftHeight != rightHeight) {
+		check.Error = LLRB_ERROR_BLACK_HEIGHT;
+		check.Key   = pNode->Ref.Key;
+		return -1;
+	}
+
+	return leftHeight + (pNode->IsRed ? 0 : 1);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Validate()
+//
+//	Published nodes never change, so holding off reclamation is all it
+//	takes to check a consistent tree.
+//
+bool ConcurrentLeftLeaningRedBlack::Validate(LLRBCheck_t& check)
+{
+	EpochReadGuard guard(m_Epochs);
+
+	const LLTBVersioned_t* pRoot = m_pRoot.load();
+	const LLTBVersioned_t* pPrev = nullptr;
+
+	check.Error       = LLRB_VALID;
+	check.Key         = 0;
+	check.Count       = 0;
+	check.BlackHeight = 0;
+
+	if (IsRed(pRoot)) {
+		check.Error = LLRB_ERROR_RED_ROOT;
+		check.Key   = pRoot->Ref.Key;
+		return false;
+	}
+
+	int height = CheckRec(pRoot, pPrev, check);
+
+	if (height < 0) {
+		return false;
+	}
+
+	check.BlackHeight = height;
+
+	return true;
+}
@@ -0,0 +1,120 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: ConcurrentLeftLeaningRedBlack.h
+//
+//	$Header: $
+//
+//
+//	LLRB that supports any number of concurrent readers alongside writers.
+//	Readers never take a lock and never wait on a writer.
+//
+//	Writers use path copying: a node that is reachable from the published
+//	root is never modified.  Instead, every write copies each node it needs
+//	to change (the search path, plus any sibling touched by a rotation or
+//	color flip), builds the new version of the tree out of those copies and
+//	the untouched subtrees, then publishes the new root with one atomic
+//	store.  A reader that loaded the old root keeps seeing a consistent,
+//	unchanging tree.
+//
+//	The nodes that a write replaced are retired with EpochManager, and are
+//	only returned to the node pool once no reader can still be looking at
+//	them.
+//
+//	Writers are serialized with a mutex.  The copies made during a write
+//	are tagged with that write's version number, so a node created earlier
+//	in the same write is changed in place instead of being copied again.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "VoidRef.h"
+#include "NodePool.h"
+#include "EpochManager.h"
+
+
+struct LLRBCheck_t;
+
+
+struct LLTBVersioned_t
+{
+	VoidRef_t Ref;
+
+	bool IsRed;
+
+	// Number of the write that created this node.
+	uint64_t Version;
+
+	LLTBVersioned_t* pLeft;
+	LLTBVersioned_t* pRight;
+};
+
+
+class ConcurrentLeftLeaningRedBlack
+{
+private:
+	struct Retired_t
+	{
+		uint64_t         Epoch;
+		LLTBVersioned_t* pNode;
+	};
+
+	std::atomic<LLTBVersioned_t*> m_pRoot;
+
+	EpochManager m_Epochs;
+
+	// Everything below is only touched while holding m_WriteLock.
+	std::mutex                    m_WriteLock;
+	NodePool                      m_Pool;
+	uint64_t                      m_WriteVersion;
+	std::vector<LLTBVersioned_t*> m_Replaced;
+	std::vector<Retired_t>        m_Retired;
+
+	ConcurrentLeftLeaningRedBlack(const ConcurrentLeftLeaningRedBlack&);
+	ConcurrentLeftLeaningRedBlack& operator=(const ConcurrentLeftLeaningRedBlack&);
+
+	LLTBVersioned_t* NewNode(void);
+	LLTBVersioned_t* Mut(LLTBVersioned_t* pNode);
+	void             Drop(LLTBVersioned_t* pNode);
+	void             Publish(LLTBVersioned_t* pRoot);
+	void             Reclaim(void);
+
+	LLTBVersioned_t* RotateLeft(LLTBVersioned_t* pNode);
+	LLTBVersioned_t* RotateRight(LLTBVersioned_t* pNode);
+	LLTBVersioned_t* ColorFlip(LLTBVersioned_t* pNode);
+	LLTBVersioned_t* MoveRedLeft(LLTBVersioned_t* pNode);
+	LLTBVersioned_t* MoveRedRight(LLTBVersioned_t* pNode);
+	LLTBVersioned_t* FixUp(LLTBVersioned_t* pNode);
+
+	LLTBVersioned_t* InsertRec(LLTBVersioned_t* pNode, const VoidRef_t& ref, bool& added);
+	LLTBVersioned_t* DeleteRec(LLTBVersioned_t* pNode, const uint32_t key);
+	LLTBVersioned_t* DeleteMin(LLTBVersioned_t* pNode);
+
+	static const LLTBVersioned_t* Find(const LLTBVersioned_t* pNode, const uint32_t key);
+
+public:
+	ConcurrentLeftLeaningRedBlack(void);
+	~ConcurrentLeftLeaningRedBlack(void);
+	void FreeAll(void);
+
+	// Safe to call from any number of threads at once, including while
+	// another thread is writing.  The ref is copied out, since the node
+	// holding it may be reclaimed as soon as LookUp() returns.
+	bool LookUp(const uint32_t key, VoidRef_t* pRef = nullptr);
+
+	// Writers.  These may be called from any thread, but only one runs
+	// at a time.
+	bool Insert(VoidRef_t ref);
+	bool Delete(const uint32_t key);
+
+	// Checks the same invariants as LeftLeaningRedBlack::Validate() on the
+	// tree that is published when it starts.  Like LookUp(), this is safe
+	// to run while another thread is writing.
+	bool Validate(LLRBCheck_t& check);
+};
@@ -0,0 +1,135 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: EpochManager.cpp
+//
+//	$Header: $
+//
+//
+//	Epoch-based reclamation.  See EpochManager.h.
+//
+//	All of the atomics here use the default sequentially consistent
+//	ordering.  The argument for why a writer never frees a node that a
+//	reader can still reach depends on the reader's slot store coming
+//	before its load of the tree root, and the writer's root store coming
+//	before its scan of the slots, in one total order.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "EpochManager.h"
+#include <functional>
+#include <thread>
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	constructor
+//
+//	The global epoch starts at 1 since 0 marks a free slot.
+//
+EpochManager::EpochManager(void)
+	: m_GlobalEpoch(1)
+{
+	for (int i = 0; i < SLOT_COUNT; ++i) {
+		m_Slots[i].Epoch.store(0);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	EnterRead()
+//
+//	Claims a free slot and stores the current epoch in it.  Each thread
+//	starts probing from a slot picked by hashing its id, so in the common
+//	case every reader thread keeps reusing its own slot.
+//
+//	The epoch stored may be older than the global epoch by the time the
+//	slot is claimed.  That only makes the writer more conservative.
+//
+int EpochManager::EnterRead(void)
+{
+	static thread_local int preferred = -1;
+
+	if (preferred < 0) {
+		preferred = static_cast<int>(std::hash<std::thread::id>()(std::this_thread::get_id()) % SLOT_COUNT);
+	}
+
+	for (;;) {
+		uint64_t epoch = m_GlobalEpoch.load();
+
+		for (int i = 0; i < SLOT_COUNT; ++i) {
+			int      slot     = (preferred + i) % SLOT_COUNT;
+			uint64_t expected = 0;
+
+			if (m_Slots[slot].Epoch.compare_exchange_strong(expected, epoch)) {
+				preferred = slot;
+				return slot;
+			}
+		}
+
+		// More concurrent readers than slots.  Wait for one to leave.
+		std::this_thread::yield();
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	ExitRead()
+//
+void EpochManager::ExitRead(int slot)
+{
+	m_Slots[slot].Epoch.store(0);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Advance()
+//
+//	Called by a writer after it has published a new root.  Returns the
+//	epoch that nodes unlinked by that write must be tagged with.
+//
+uint64_t EpochManager::Advance(void)
+{
+	return m_GlobalEpoch.fetch_add(1);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	SafeEpoch()
+//
+//	Returns the oldest epoch any active reader may be in.  Nodes tagged
+//	with an epoch less than this are no longer reachable by any reader.
+//
+uint64_t EpochManager::SafeEpoch(void) const
+{
+	uint64_t safe = m_GlobalEpoch.load();
+
+	for (int i = 0; i < SLOT_COUNT; ++i) {
+		uint64_t epoch = m_Slots[i].Epoch.load();
+
+		if ((0 != epoch) && (epoch < safe)) {
+			safe = epoch;
+		}
+	}
+
+	return safe;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	WaitForReaders()
+//
+//	Blocks the writer until every reader that may have seen the tree as it
+//	was at the given epoch has left.
+//
+void EpochManager::WaitForReaders(uint64_t epoch) const
+{
+	while (SafeEpoch() <= epoch) {
+		std::this_thread::yield();
+	}
+}
@@ -0,0 +1,92 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: EpochManager.h
+//
+//	$Header: $
+//
+//
+//	Epoch-based reclamation for trees that are read without locks.
+//
+//	Readers announce the global epoch they started in by claiming a slot.
+//	A writer that unlinks nodes publishes its change, then calls Advance()
+//	to get the epoch the unlinked nodes are tagged with.  Those nodes can
+//	be freed once SafeEpoch() is greater than their tag, since every reader
+//	that could still see them has left.
+//
+//	Claiming a slot is a single compare-and-swap on a cache line that is
+//	normally private to the reading thread, so readers never block each
+//	other or the writer.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include <stdint.h>
+#include <atomic>
+
+
+// Most threads that can be inside a read section at once.
+#define EPOCH_SLOT_COUNT	128
+
+
+class EpochManager
+{
+private:
+	enum { SLOT_COUNT = EPOCH_SLOT_COUNT };
+
+	// Each slot sits on its own cache line so that readers on different
+	// cores do not contend.  Zero means the slot is free.
+	struct alignas(64) Slot_t
+	{
+		std::atomic<uint64_t> Epoch;
+	};
+
+	Slot_t                m_Slots[SLOT_COUNT];
+	std::atomic<uint64_t> m_GlobalEpoch;
+
+	EpochManager(const EpochManager&);
+	EpochManager& operator=(const EpochManager&);
+
+public:
+	EpochManager(void);
+
+	int  EnterRead(void);
+	void ExitRead(int slot);
+
+	uint64_t Advance(void);
+	uint64_t SafeEpoch(void) const;
+	void     WaitForReaders(uint64_t epoch) const;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	EpochReadGuard
+//
+//	Holds an epoch slot for the lifetime of the guard.  Any node reached
+//	from a root loaded while the guard is held stays valid until the guard
+//	is destroyed.
+//
+class EpochReadGuard
+{
+private:
+	EpochManager& m_Manager;
+	int           m_Slot;
+
+	EpochReadGuard(const EpochReadGuard&);
+	EpochReadGuard& operator=(const EpochReadGuard&);
+
+public:
+	EpochReadGuard(EpochManager& manager)
+		: m_Manager(manager)
+		, m_Slot(manager.EnterRead())
+	{
+	}
+
+	~EpochReadGuard(void)
+	{
+		m_Manager.ExitRead(m_Slot);
+	}
+};
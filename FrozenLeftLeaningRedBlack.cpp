@@ -0,0 +1,298 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: FrozenLeftLeaningRedBlack.cpp
+//
+//	$Header: $
+//
+//
+//	Eytzinger-ordered read-only LLRB.  See the header for the layout.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "FrozenLeftLeaningRedBlack.h"
+#include "LeftLeaningRedBlack.h"
+#include <stdlib.h>
+#include <new>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+// Pad slots hold this key, which sorts after every real key.
+#define FROZEN_PAD_KEY	0xFFFFFFFFu
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	constructor
+//
+FrozenLeftLeaningRedBlack::FrozenLeftLeaningRedBlack(void)
+	: m_pKeys(nullptr)
+	, m_pRefs(nullptr)
+	, m_Count(0)
+	, m_Slots(0)
+	, m_Height(0)
+	, m_MaxKey(0)
+{
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	destructor
+//
+FrozenLeftLeaningRedBlack::~FrozenLeftLeaningRedBlack(void)
+{
+	FreeAll();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FreeAll()
+//
+void FrozenLeftLeaningRedBlack::FreeAll(void)
+{
+	free(m_pKeys);
+	free(m_pRefs);
+
+	m_pKeys  = nullptr;
+	m_pRefs  = nullptr;
+	m_Count  = 0;
+	m_Slots  = 0;
+	m_Height = 0;
+	m_MaxKey = 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Build()
+//
+bool FrozenLeftLeaningRedBlack::Build(const LeftLeaningRedBlack& tree)
+{
+	std::vector<VoidRef_t> sorted;
+
+	for (LeftLeaningRedBlack::Iterator it = tree.begin(); it != tree.end(); ++it) {
+		sorted.push_back(*it);
+	}
+
+	return BuildFromSorted(sorted.data(), sorted.size());
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FillRec()
+//
+//	Visits the slots of the complete tree in sorted (in-order) order, and
+//	hands each one the next ref from the sorted array.  Once the real refs
+//	run out, the remaining slots, which are the largest in sorted order,
+//	become padding.  The recursion is only as deep as the tree is high.
+//
+size_t FrozenLeftLeaningRedBlack::FillRec(size_t slot, const VoidRef_t* pSorted, size_t next)
+{
+	if (slot > m_Slots) {
+		return next;
+	}
+
+	next = FillRec(2 * slot, pSorted, next);
+
+	if (next < m_Count) {
+		m_pRefs[slot] = pSorted[next];
+	}
+	else {
+		m_pRefs[slot].Key = FROZEN_PAD_KEY;
+	}
+
+	m_pKeys[slot] = m_pRefs[slot].Key;
+
+	return FillRec(2 * slot + 1, pSorted, next + 1);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	BuildFromSorted()
+//
+//	The keys must be strictly increasing.  If they are not, nothing is
+//	changed and false is returned.
+//
+bool FrozenLeftLeaningRedBlack::BuildFromSorted(const VoidRef_t* pRefs, size_t count)
+{
+	for (size_t i = 1; i < count; ++i) {
+		if (false == (pRefs[i - 1].Key < pRefs[i].Key)) {
+			return false;
+		}
+	}
+
+	FreeAll();
+
+	if (0 == count) {
+		return true;
+	}
+
+	int height = 0;
+	while (((size_t(1) << height) - 1) < count) {
+		++height;
+	}
+
+	size_t slots = (size_t(1) << height) - 1;
+
+	// Slot 0 is unused, which puts the 16 grandchildren four levels
+	// below any node on one cache line.
+	void* pKeys   = nullptr;
+	void* pValues = nullptr;
+
+	if ((0 != posix_memalign(&pKeys, 64, (slots + 1) * sizeof(uint32_t))) ||
+		(0 != posix_memalign(&pValues, 64, (slots + 1) * sizeof(VoidRef_t)))) {
+		free(pKeys);
+		throw std::bad_alloc();
+	}
+
+	m_pKeys  = static_cast<uint32_t*>(pKeys);
+	m_pRefs  = static_cast<VoidRef_t*>(pValues);
+	m_Count  = count;
+	m_Slots  = slots;
+	m_Height = height;
+	m_MaxKey = pRefs[count - 1].Key;
+
+	m_pKeys[0]     = 0;
+	m_pRefs[0].Key = 0;
+
+	FillRec(1, pRefs, 0);
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FinishLookUp()
+//
+//	Turns the slot a search walked off the bottom of the tree at into the
+//	result, exactly as LowerBound() and LookUp() do.
+//
+inline void FrozenLeftLeaningRedBlack::FinishLookUp(const uint32_t key, size_t index, const VoidRef_t** ppOut) const
+{
+	index >>= __builtin_ctzll(~uint64_t(index)) + 1;
+
+	*ppOut = ((key <= m_MaxKey) && (key == m_pKeys[index])) ? (m_pRefs + index) : nullptr;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUpGroup()
+//
+//	Scalar version.  Every search in a frozen tree takes exactly m_Height
+//	steps, so the searches in a group run in lockstep, one level at a time
+//	across the whole group.  Keys above m_MaxKey walk the tree like any
+//	other and are turned away at the end.
+//
+void FrozenLeftLeaningRedBlack::LookUpGroup(const uint32_t* pKeys, size_t count, const VoidRef_t** ppOut) const
+{
+	size_t index[FROZEN_BATCH_WIDTH];
+
+	for (size_t i = 0; i < count; ++i) {
+		index[i] = 1;
+	}
+
+	for (int level = 0; level < m_Height; ++level) {
+		for (size_t i = 0; i < count; ++i) {
+			__builtin_prefetch(m_pKeys + 16 * index[i]);
+			index[i] = 2 * index[i] + (m_pKeys[index[i]] < pKeys[i]);
+		}
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		FinishLookUp(pKeys[i], index[i], ppOut + i);
+	}
+}
+
+
+#if defined(__AVX2__)
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUpGroupAVX2()
+//
+//	Same as LookUpGroup(), eight searches per register and four registers
+//	per group.  Each level is one gather, one compare and one shift-and-
+//	subtract per register: the compare yields -1 where the search goes
+//	right, so 2i - mask is the next index.
+//
+//	AVX2 only has a signed compare, so both sides are biased by 2^31 first
+//	to make it order unsigned keys correctly.  Indices fit in 32 bits
+//	because a frozen tree never has more than 2^31 slots.
+//
+static void LookUpGroupAVX2(const uint32_t* pTreeKeys, int height, const uint32_t* pKeys, uint32_t* pIndex)
+{
+	const __m256i bias = _mm256_set1_epi32(int(0x80000000u));
+
+	__m256i key[4];
+	__m256i index[4];
+
+	for (int v = 0; v < 4; ++v) {
+		key[v]   = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pKeys + 8 * v)), bias);
+		index[v] = _mm256_set1_epi32(1);
+	}
+
+	for (int level = 0; level < height; ++level) {
+		for (int v = 0; v < 4; ++v) {
+			__m256i node  = _mm256_i32gather_epi32(reinterpret_cast<const int*>(pTreeKeys), index[v], 4);
+			__m256i right = _mm256_cmpgt_epi32(key[v], _mm256_xor_si256(node, bias));
+
+			index[v] = _mm256_sub_epi32(_mm256_add_epi32(index[v], index[v]), right);
+		}
+	}
+
+	for (int v = 0; v < 4; ++v) {
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(pIndex + 8 * v), index[v]);
+	}
+}
+
+#endif
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUpBatch()
+//
+void FrozenLeftLeaningRedBlack::LookUpBatch(const uint32_t* pKeys, size_t count, const VoidRef_t** ppOut) const
+{
+	if (0 == m_Count) {
+		for (size_t i = 0; i < count; ++i) {
+			ppOut[i] = nullptr;
+		}
+
+		return;
+	}
+
+	size_t done = 0;
+
+#if defined(__AVX2__)
+	static_assert(32 == FROZEN_BATCH_WIDTH, "LookUpGroupAVX2() handles 32 keys at a time");
+
+	if (m_Height < 32) {
+		uint32_t index[FROZEN_BATCH_WIDTH];
+
+		for ( ; done + FROZEN_BATCH_WIDTH <= count; done += FROZEN_BATCH_WIDTH) {
+			LookUpGroupAVX2(m_pKeys, m_Height, pKeys + done, index);
+
+			for (size_t i = 0; i < FROZEN_BATCH_WIDTH; ++i) {
+				FinishLookUp(pKeys[done + i], index[i], ppOut + done + i);
+			}
+		}
+	}
+#endif
+
+	for ( ; done < count; done += FROZEN_BATCH_WIDTH) {
+		size_t group = ((count - done) < FROZEN_BATCH_WIDTH) ? (count - done) : FROZEN_BATCH_WIDTH;
+
+		LookUpGroup(pKeys + done, group, ppOut + done);
+	}
+}
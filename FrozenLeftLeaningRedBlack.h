@@ -0,0 +1,134 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: FrozenLeftLeaningRedBlack.h
+//
+//	$Header: $
+//
+//
+//	Immutable, read-optimized copy of a LeftLeaningRedBlack.
+//
+//	The keys are stored in one array in Eytzinger (breadth-first) order:
+//	the root is at index 1, and the children of the node at index i are
+//	at 2i and 2i + 1.  A search is then pure index arithmetic.  There are no
+//	child pointers to load, so the address of every node on the path is
+//	known as soon as the compares above it are done.
+//
+//	That makes prefetching very effective.  The 16 nodes four levels below
+//	index i sit at 16i through 16i + 15, which is one aligned 64-byte
+//	cache line, so each step of the search fetches the line it needs four
+//	steps ahead.  On trees much larger than the last-level cache this hides
+//	most of the memory latency that LookUp() spends waiting on each level.
+//
+//	The array is padded out to a complete tree of 2^h - 1 slots with copies
+//	of the largest possible key.  Every search therefore takes exactly h
+//	steps with no early exit, which keeps the loop free of unpredictable
+//	branches.
+//
+//	The refs are kept in a second array in the same order, so the key
+//	array stays dense and the refs are only touched once the search has
+//	found its key.
+//
+//	Build it from a tree with LeftLeaningRedBlack::Freeze(), and rebuild it
+//	whenever the tree has changed enough to matter.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include "VoidRef.h"
+
+
+// Number of searches advanced together by LookUpBatch().
+#define FROZEN_BATCH_WIDTH	32
+
+
+class LeftLeaningRedBlack;
+
+
+class FrozenLeftLeaningRedBlack
+{
+private:
+	uint32_t*  m_pKeys;		// 1-based, 64-byte aligned
+	VoidRef_t* m_pRefs;		// same order as m_pKeys
+	size_t     m_Count;		// number of real keys
+	size_t     m_Slots;		// 2^m_Height - 1
+	int        m_Height;
+	uint32_t   m_MaxKey;
+
+	FrozenLeftLeaningRedBlack(const FrozenLeftLeaningRedBlack&);
+	FrozenLeftLeaningRedBlack& operator=(const FrozenLeftLeaningRedBlack&);
+
+	size_t FillRec(size_t slot, const VoidRef_t* pSorted, size_t next);
+	void   LookUpGroup(const uint32_t* pKeys, size_t count, const VoidRef_t** ppOut) const;
+	void   FinishLookUp(const uint32_t key, size_t index, const VoidRef_t** ppOut) const;
+
+public:
+	FrozenLeftLeaningRedBlack(void);
+	~FrozenLeftLeaningRedBlack(void);
+	void FreeAll(void);
+
+	// Replaces the contents with the keys of the tree.
+	bool Build(const LeftLeaningRedBlack& tree);
+
+	// Same as Build(), from refs that are already sorted by key.
+	bool BuildFromSorted(const VoidRef_t* pRefs, size_t count);
+
+	size_t Count(void) const { return m_Count; }
+
+	// Returns the ref stored for key, or nullptr.
+	const VoidRef_t* LookUp(const uint32_t key) const;
+
+	// Looks up count keys at once, writing what LookUp() would return for
+	// pKeys[i] to ppOut[i].  When built with AVX2 enabled (-mavx2), eight
+	// searches run in each vector register, with gathers replacing the
+	// per-level loads.
+	void LookUpBatch(const uint32_t* pKeys, size_t count, const VoidRef_t** ppOut) const;
+
+	// Index of the first slot whose key is >= key, or 0 if there is none.
+	// Padding slots only ever follow the real keys in sorted order, so
+	// they are never returned for a key <= m_MaxKey.
+	size_t LowerBound(const uint32_t key) const;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LowerBound()
+//
+//	Each step moves to the left child if the key is not greater than the
+//	node, and to the right child otherwise, recording the choice in the low
+//	bit of the index.  After h steps the index has walked off the bottom of
+//	the tree, and the answer is the last node where the search went left.
+//	That node is found by shifting out the trailing 1 bits (the right turns
+//	taken below it) and then the 0 bit of the left turn itself.
+//
+inline size_t FrozenLeftLeaningRedBlack::LowerBound(const uint32_t key) const
+{
+	if ((0 == m_Count) || (key > m_MaxKey)) {
+		return 0;
+	}
+
+	const uint32_t* pKeys = m_pKeys;
+	size_t          index = 1;
+
+	for (int level = 0; level < m_Height; ++level) {
+		__builtin_prefetch(pKeys + 16 * index);
+		index = 2 * index + (pKeys[index] < key);
+	}
+
+	return index >> (__builtin_ctzll(~uint64_t(index)) + 1);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUp()
+//
+inline const VoidRef_t* FrozenLeftLeaningRedBlack::LookUp(const uint32_t key) const
+{
+	size_t index = LowerBound(key);
+
+	return ((0 != index) && (key == m_pKeys[index])) ? (m_pRefs + index) : nullptr;
+}
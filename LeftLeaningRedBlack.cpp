@@ -49,7 +49,17 @@
 
 /*LLRBT methods provided by Lee Stanza*/
 #include "LeftLeaningRedBlack.h"
+#include "LeftLeaningRedBlackSnapshot.h"
+#include "WriteAheadLog.h"
+#include "FrozenLeftLeaningRedBlack.h"
+#include "LookUpScheduler.h"
 //#include "QzCommon.h"
+#include <atomic>
+#include <mutex>
+#include <ostream>
+#include <system_error>
+#include <thread>
+#include <vector>
 
 #ifdef USE_MALLOC_MACRO
 #define new DEBUG_NEW
@@ -62,583 +72,3771 @@ static char THIS_FILE[] = __FILE__;
 // If this is not defined, the tree is arranged as a 2-3 tree.
 //
 // In general, defining this symbol will reduce performance of all
-// operations on the LLRB.
+// operations on the LLRB.  BalancedTree.h describes the third choice, a
+// wide-node B-tree with the same core interface.
 //
 //#define USE_234_TREE
 
 
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Statistics
+//
+//	Each thread counts into its own StatsBlock_t, found through a
+//	thread_local, so the counting never contends with other threads.  The
+//	owning thread bumps a counter with a relaxed load and store instead of
+//	an atomic add, which is as cheap as a plain increment; the atomics are
+//	only there so GetStats() can read the blocks from another thread.
+//
+//	Every block is linked into a registry when its thread first counts
+//	something.  When the thread exits, its totals are folded into the
+//	registry's retired block so they are not lost.
+//
+//	Without USE_LLRB_STATS, LLRB_COUNT() and LookUpDepth_t compile to
+//	nothing.
+//
+#if defined(USE_LLRB_STATS)
+
+struct StatsBlock_t
+{
+	std::atomic<uint64_t> Counters[LLRB_COUNTER_COUNT];
+	std::atomic<uint64_t> LookUpDepth[LLRB_STATS_DEPTHS];
+	std::atomic<uint64_t> LookUpDepthSum;
+	StatsBlock_t*         pNext;
+
+	StatsBlock_t(void)
+		: pNext(nullptr)
+	{
+		Clear();
+	}
+
+	void Clear(void)
+	{
+		for (int i = 0; i < LLRB_COUNTER_COUNT; ++i) {
+			Counters[i].store(0, std::memory_order_relaxed);
+		}
+		for (int i = 0; i < LLRB_STATS_DEPTHS; ++i) {
+			LookUpDepth[i].store(0, std::memory_order_relaxed);
+		}
+		LookUpDepthSum.store(0, std::memory_order_relaxed);
+	}
+};
+
+
+struct StatsRegistry_t
+{
+	std::mutex    Lock;
+	StatsBlock_t* pLive;
+	StatsBlock_t  Retired;
+
+	StatsRegistry_t(void)
+		: pLive(nullptr)
+	{
+	}
+};
+
+
+// Never destroyed, since threads may still be exiting, and folding their
+// blocks into it, while static objects are being destroyed.
+static StatsRegistry_t& Registry(void)
+{
+	static StatsRegistry_t* s_pRegistry = new StatsRegistry_t;
+
+	return *s_pRegistry;
+}
+
+
+static inline void Bump(std::atomic<uint64_t>& counter, uint64_t amount)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+
+class ThreadStats_t
+{
+public:
+	StatsBlock_t Block;
+
+	ThreadStats_t(void)
+	{
+		StatsRegistry_t& registry = Registry();
+		std::lock_guard<std::mutex> lock(registry.Lock);
+
+		Block.pNext    = registry.pLive;
+		registry.pLive = &Block;
+	}
+
+	~ThreadStats_t(void)
+	{
+		StatsRegistry_t& registry = Registry();
+		std::lock_guard<std::mutex> lock(registry.Lock);
+
+		for (int i = 0; i < LLRB_COUNTER_COUNT; ++i) {
+			Bump(registry.Retired.Counters[i], Block.Counters[i].load(std::memory_order_relaxed));
+		}
+		for (int i = 0; i < LLRB_STATS_DEPTHS; ++i) {
+			Bump(registry.Retired.LookUpDepth[i], Block.LookUpDepth[i].load(std::memory_order_relaxed));
+		}
+		Bump(registry.Retired.LookUpDepthSum, Block.LookUpDepthSum.load(std::memory_order_relaxed));
+
+		StatsBlock_t** ppLink = &registry.pLive;
+
+		while (&Block != *ppLink) {
+			ppLink = &((*ppLink)->pNext);
+		}
+
+		*ppLink = Block.pNext;
+	}
+};
+
+
+static inline StatsBlock_t& ThreadStats(void)
+{
+	static thread_local ThreadStats_t s_Stats;
+
+	return s_Stats.Block;
+}
+
+
+#define LLRB_COUNT(counter)				Bump(ThreadStats().Counters[counter], 1)
+#define LLRB_COUNT_BY(counter, amount)	Bump(ThreadStats().Counters[counter], (amount))
+
+
+// Counts the nodes a LookUp() visits, and records the total when the
+// search returns.
+class LookUpDepth_t
+{
+private:
+	uint32_t m_Depth;
+
+public:
+	LookUpDepth_t(void) : m_Depth(0) { }
+
+	~LookUpDepth_t(void)
+	{
+		StatsBlock_t& stats = ThreadStats();
+
+		Bump(stats.LookUpDepth[(m_Depth < LLRB_STATS_DEPTHS) ? m_Depth : (LLRB_STATS_DEPTHS - 1)], 1);
+		Bump(stats.LookUpDepthSum, m_Depth);
+	}
+
+	void Step(void) { ++m_Depth; }
+};
+
+#else
+
+#define LLRB_COUNT(counter)				((void)0)
+#define LLRB_COUNT_BY(counter, amount)	((void)0)
+
+class LookUpDepth_t
+{
+public:
+	void Step(void) { }
+};
+
+#endif
+
+
 /////////////////////////////////////////////////////////////////////////////
 //
 //	constructor
 //
 LeftLeaningRedBlack::LeftLeaningRedBlack(void)
 	: m_pRoot(nullptr)
+	, m_pPool(std::make_shared<NodePool>(sizeof(LLTB_t)))
+	, m_pInsertObserver(nullptr)
+	, m_pInsertContext(nullptr)
+	, m_pLog(nullptr)
+	, m_LastLogged(0)
+	, m_pFinger(nullptr)
+	, m_pCompaction(nullptr)
 {
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
-//	destructor
+//	constructor
 //
-LeftLeaningRedBlack::~LeftLeaningRedBlack(void)
+//	Builds the tree from an array of refs that is already sorted by key.
+//	See BuildFromSorted().
+//
+LeftLeaningRedBlack::LeftLeaningRedBlack(const VoidRef_t* pRefs, size_t count)
+	: m_pRoot(nullptr)
+	, m_pPool(std::make_shared<NodePool>(sizeof(LLTB_t)))
+	, m_pInsertObserver(nullptr)
+	, m_pInsertContext(nullptr)
+	, m_pLog(nullptr)
+	, m_LastLogged(0)
+	, m_pFinger(nullptr)
+	, m_pCompaction(nullptr)
 {
-	Free(m_pRoot);
+	BuildFromSorted(pRefs, count);
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
-//	FreeAll()
+//	move constructor
 //
-void LeftLeaningRedBlack::FreeAll(void)
+//	The source gets a new, empty pool, so it can go on being used as an
+//	empty tree.
+//
+LeftLeaningRedBlack::LeftLeaningRedBlack(LeftLeaningRedBlack&& other)
+	: m_pRoot(other.m_pRoot)
+	, m_pPool(std::move(other.m_pPool))
+	, m_pInsertObserver(other.m_pInsertObserver)
+	, m_pInsertContext(other.m_pInsertContext)
+	, m_pLog(other.m_pLog)
+	, m_LastLogged(other.m_LastLogged)
+	, m_pFinger(std::move(other.m_pFinger))
+	, m_pCompaction(std::move(other.m_pCompaction))
 {
-	Free(m_pRoot);
+	other.m_pRoot           = nullptr;
+	other.m_pPool           = std::make_shared<NodePool>(sizeof(LLTB_t));
+	other.m_pInsertObserver = nullptr;
+	other.m_pInsertContext  = nullptr;
+	other.m_pLog            = nullptr;
+	other.m_LastLogged      = 0;
+}
 
-	m_pRoot = nullptr;
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	move assignment
+//
+//	The old contents of this tree end up in a temporary, which frees them.
+//
+LeftLeaningRedBlack& LeftLeaningRedBlack::operator=(LeftLeaningRedBlack&& other)
+{
+	if (this != &other) {
+		LeftLeaningRedBlack temp(std::move(other));
+		Swap(temp);
+	}
+
+	return *this;
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
-//	Free()
+//	Swap()
 //
-void LeftLeaningRedBlack::Free(LLTB_t* pNode)
+void LeftLeaningRedBlack::Swap(LeftLeaningRedBlack& other)
 {
-	if (nullptr != pNode) {
-		if (nullptr != pNode->pLeft) {
-			Free(pNode->pLeft);
-		}
-		if (nullptr != pNode->pRight) {
-			Free(pNode->pRight);
-		}
+	std::swap(m_pRoot, other.m_pRoot);
+	std::swap(m_pPool, other.m_pPool);
+	std::swap(m_pInsertObserver, other.m_pInsertObserver);
+	std::swap(m_pInsertContext, other.m_pInsertContext);
+	std::swap(m_pLog, other.m_pLog);
+	std::swap(m_LastLogged, other.m_LastLogged);
+	std::swap(m_pFinger, other.m_pFinger);
+	std::swap(m_pCompaction, other.m_pCompaction);
+}
+
 
-		pNode = nullptr;
-		delete pNode;
+/////////////////////////////////////////////////////////////////////////////
+//
+//	destructor
+//
+//	The node pool releases its slabs when it is destroyed, so there is no
+//	need to walk the tree here unless the pool is shared with another tree.
+//
+LeftLeaningRedBlack::~LeftLeaningRedBlack(void)
+{
+	StopCompact();
 
+	if (1 != m_pPool.use_count()) {
+		Free(m_pRoot);
+	}
+	else {
+		LLRB_COUNT_BY(LLRB_COUNTER_NODE_FREE, m_pPool->LiveCount());
 	}
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
-//	NewNode()
+//	FreeAll()
 //
-//	Note that a new node defaults to being red.
+//	Every node in the tree came from m_pPool, so the whole tree is released
+//	by handing the slabs back instead of visiting each node.  That is only
+//	possible when no other tree is using the same pool.
 //
-LLTB_t* LeftLeaningRedBlack::NewNode(void)
+//	With a log attached, every key is logged as deleted first.
+//
+void LeftLeaningRedBlack::FreeAll(void)
 {
-	LLTB_t* pNew = new LLTB_t;
+	StopCompact();
 
-	pNew->Ref.Key = 0;
-	pNew->IsRed = true;
-	pNew->pLeft = nullptr;
-	pNew->pRight = nullptr;
+	LogDeletes(begin(), end());
 
-	return pNew;
+	if (1 == m_pPool.use_count()) {
+		LLRB_COUNT_BY(LLRB_COUNTER_NODE_FREE, m_pPool->LiveCount());
+
+		m_pPool->ReleaseAll();
+	}
+	else {
+		Free(m_pRoot);
+	}
+
+	m_pRoot = nullptr;
+
+	DropFinger();
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
-//	LookUp()
-//
-//	Since a red-black tree is a binary tree, look-up operations are done
-//	using iterative traversal.
+//	Free()
 //
-//	This assumes that all keys stored in the tree have been assigned non-nullptr
-//	values.
+//	Returns pNode and all of its children to the node pool, and returns
+//	the number of nodes freed.
 //
-//	If the key is not in the tree, this will return nullptr.
+//	This uses no recursion or stack.  While the top node has a left child,
+//	rotating right moves that child up, which leaves the tree as one long
+//	right spine.  Each node is freed as soon as it has no left child, so
+//	every node is rotated at most once and visited at most twice.
 //
-void* LeftLeaningRedBlack::LookUp(uint32_t key)
+size_t LeftLeaningRedBlack::Free(LLTB_t* pNode)
 {
-	LLTB_t* pNode = m_pRoot;
+	size_t count = 0;
 
 	while (nullptr != pNode) {
-		if (key < pNode->Ref.Key) {
-			pNode = pNode->pLeft;
+		LLTB_t* pLeft = pNode->pLeft;
+
+		if (nullptr != pLeft) {
+			pNode->pLeft  = pLeft->pRight;
+			pLeft->pRight = pNode;
+			pNode         = pLeft;
 		}
 		else {
-			pNode = pNode->pRight;
+			LLTB_t* pRight = pNode->pRight;
+
+			m_pPool->Free(pNode);
+			++count;
+
+			pNode = pRight;
 		}
 	}
 
-	return nullptr;
+	LLRB_COUNT_BY(LLRB_COUNTER_NODE_FREE, count);
+
+	return count;
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
-//	IsRed()
+//	ReleasePool()
 //
-static inline bool IsRed(LLTB_t* pNode)
+//	Body of the thread started by FreeAllAsync().  The pool is released
+//	when the last reference to it, which this thread holds, goes away.
+//
+static void ReleasePool(std::shared_ptr<NodePool> pPool)
 {
-	return ((nullptr != pNode) && pNode->IsRed);
+	pPool.reset();
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
-//	RotateLeft()
-//
-//	Rotate the subtree to the left:
+//	FreeAllAsync()
 //
-//	   4            6
-//	  / \          /
-//	 2   6  -->   4
-//	             /
-//	            2
+//	Empties the tree at once, and hands its pool to a background thread
+//	to release.  The tree carries on with a fresh pool, so it can be used
+//	again straight away.
 //
-//	Node '6' will take on the color '4' used to have, while '4' becomes a
-//	red node.
+//	A pool shared with other trees after Split() cannot be touched from
+//	another thread, so in that case this is the same as FreeAll().  The
+//	same happens if no thread can be started.
 //
-static LLTB_t* RotateLeft(LLTB_t* pNode)
+void LeftLeaningRedBlack::FreeAllAsync(void)
 {
-	LLTB_t* pTemp = pNode->pRight;
-	pNode->pRight = pTemp->pLeft;
-	pTemp->pLeft = pNode;
-	pTemp->IsRed = pNode->IsRed;
-	pNode->IsRed = true;
+	StopCompact();
 
-	return pTemp;
+	if (1 != m_pPool.use_count()) {
+		FreeAll();
+		return;
+	}
+
+	LogDeletes(begin(), end());
+
+	LLRB_COUNT_BY(LLRB_COUNTER_NODE_FREE, m_pPool->LiveCount());
+
+	std::shared_ptr<NodePool> pOld = std::make_shared<NodePool>(sizeof(LLTB_t));
+
+	pOld->Configure(m_pPool->Config());
+
+	std::swap(pOld, m_pPool);
+
+	m_pRoot = nullptr;
+
+	DropFinger();
+
+	try {
+		std::thread(ReleasePool, std::move(pOld)).detach();
+	}
+	catch (const std::system_error&) {
+		// pOld, if still set, releases the pool here instead.
+	}
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
-//	RotateRight()
+//	SetPoolConfig()
 //
-//	Rotate the subtree to the right:
+//	Nodes that are already allocated stay where they are.  A pool shared
+//	after Split() is configured for every tree using it.
 //
-//	   4        2
-//	  / \        \
-//	 2   6  -->   4
-//	               \
-//	                6
+void LeftLeaningRedBlack::SetPoolConfig(const NodePoolConfig_t& config)
+{
+	m_pPool->Configure(config);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
 //
-//	Node '2' will take on the color '4' used to have, while '4' becomes a
-//	red node.
+//	PoolConfig()
 //
-static LLTB_t* RotateRight(LLTB_t* pNode)
+NodePoolConfig_t LeftLeaningRedBlack::PoolConfig(void) const
 {
-	LLTB_t* pTemp = pNode->pLeft;
-	pNode->pLeft = pTemp->pRight;
-	pTemp->pRight = pNode;
-	pTemp->IsRed = pNode->IsRed;
-	pNode->IsRed = true;
-
-	return pTemp;
+	return m_pPool->Config();
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
-//	ColorFlip()
-//
-//	Flips the color of the node and both of its children from black to red
-//	(or red to black).
+//	Relocate()
 //
-//	Any time that a color flip is applied, it may cause pNode to end up
-//	with an invalid color relative to its parent node.  Therefore some kind
-//	of fix-up operation will be required after this function is called.
+//	Moves one node to the next slot of the compaction arena, and returns
+//	its new address.  The arena was reserved as one run, so slots are
+//	handed out in address order.
 //
-static void ColorFlip(LLTB_t* pNode)
+LLTB_t* LeftLeaningRedBlack::Relocate(LLTB_t* pNode)
 {
-	pNode->IsRed = !pNode->IsRed;
+	LLTB_t* pNew = static_cast<LLTB_t*>(m_pCompaction->pPool->Alloc());
 
-	if (nullptr != pNode->pLeft) {
-		pNode->pLeft->IsRed = !pNode->pLeft->IsRed;
-	}
+	*pNew = *pNode;
 
-	if (nullptr != pNode->pRight) {
-		pNode->pRight->IsRed = !pNode->pRight->IsRed;
-	}
+	m_pPool->Free(pNode);
+
+	++m_pCompaction->Tail;
+
+	return pNew;
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
-//	Insert()
+//	Compact()
 //
-bool LeftLeaningRedBlack::Insert(VoidRef_t ref)
+//	Copies the tree, one node at a time, into a new arena in breadth-first
+//	order.  The arena itself serves as the queue: slots [0, Head) hold
+//	nodes whose children have already been moved, and slots [Head, Tail)
+//	hold nodes whose children are still in the old pool.  Every link is
+//	patched as its node moves, so the tree is whole between calls, and
+//	each step is O(1), so a call with a budget of b nodes takes O(b).
+//
+//	Once the queue runs dry every node has moved, the old pool has no
+//	live nodes left, and its slabs are released in one go.
+//
+bool LeftLeaningRedBlack::Compact(size_t budget)
 {
-	m_pRoot = InsertRec(m_pRoot, ref);
+	if (nullptr == m_pCompaction) {
+		if ((nullptr == m_pRoot) || (1 != m_pPool.use_count())) {
+			return false;
+		}
 
-	// The root node of a red-black tree must be black.
-	m_pRoot->IsRed = false;
-	if (/*m_pRoot->pLeft == nullptr && m_pRoot->pRight == nullptr ||*/ m_pRoot->Ref.Key == ref.Key) //if is root or empty
-	{
-		cout << "No Parent. ";
-		cout << "Newest :" <<m_pRoot->Ref.Key;
-		m_pRoot->IsRed ? cout << " (Red) \n" : cout << " (Black) \n"; //ternary color check
+		m_pCompaction.reset(new Compaction_t);
+
+		m_pCompaction->pPool = std::make_shared<NodePool>(sizeof(LLTB_t));
+		m_pCompaction->pPool->Configure(m_pPool->Config());
+		// The pool holds exactly the nodes in the tree, so this is one
+		// slot per node.
+		m_pCompaction->pPool->Reserve(m_pPool->LiveCount());
+
+		m_pCompaction->Head   = 0;
+		m_pCompaction->Tail   = 0;
+		m_pCompaction->pFirst = Relocate(m_pRoot);
+
+		m_pRoot = m_pCompaction->pFirst;
 	}
-	else
-	{
-		LLTB_t* parent = FindParent(m_pRoot, ref);//shallow copy?
-		cout << "Parent :";
-		cout << parent->Ref.Key;
-		parent->IsRed ? cout << "(Red). " : cout << "(Black). ";
-		cout << "Newest :";
-		if (parent->pLeft->Ref.Key == ref.Key)
-		{
-			cout << parent->pLeft->Ref.Key;
-			parent->pLeft->IsRed ? cout << " (Red)\n" : cout << " (Black)\n";
+
+	DropFinger();
+
+	Compaction_t* pPass = m_pCompaction.get();
+	size_t        moved = 0;
+
+	while ((pPass->Head < pPass->Tail) && ((0 == budget) || (moved < budget))) {
+		LLTB_t* pNode = pPass->pFirst + pPass->Head;
+
+		if (nullptr != pNode->pLeft) {
+			pNode->pLeft = Relocate(pNode->pLeft);
+			++moved;
 		}
-		else
-		{
-			cout << parent->pRight->Ref.Key;
-			parent->pRight->IsRed ? cout << " (Red)\n" : cout << " (Black)\n";
+
+		if (nullptr != pNode->pRight) {
+			pNode->pRight = Relocate(pNode->pRight);
+			++moved;
 		}
+
+		++pPass->Head;
+	}
+
+	if (pPass->Head < pPass->Tail) {
+		return true;
 	}
-  	return true;
+
+	m_pPool = pPass->pPool;
+
+	m_pCompaction.reset();
+
+	return false;
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
-//	InsertRec()
+//	AbandonCompact()
 //
-//	Note that during rebalancing, a rotation may change the value assigned
-//	to pNode.  This will change which node is the root of the subtree that
-//	is being modified.  The caller will need to use the returned pointer
-//	to replace whichever value was passed into InsertRec.
+//	Ends a Compact() pass early.  The nodes that have already moved stay
+//	in the arena, which joins the tree's pool, so the top of the tree
+//	keeps its new layout.  Splicing keeps the arena's unused slots for
+//	later allocations instead of walking them.
 //
-LLTB_t* LeftLeaningRedBlack::InsertRec(LLTB_t* pNode, VoidRef_t ref)
+void LeftLeaningRedBlack::AbandonCompact(void)
 {
-	// Special case for inserting a leaf.  Just return the pointer;
-	// the caller will insert the new node into the parent node.
-	if (nullptr == pNode) {
-		pNode = NewNode();
-		pNode->Ref = ref;
-		return pNode;
+	m_pPool->Splice(*m_pCompaction->pPool);
+
+	m_pCompaction.reset();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	NewNode()
+//
+//	Note that a new node defaults to being red.
+//
+LLTB_t* LeftLeaningRedBlack::NewNode(void)
+{
+	LLTB_t* pNew = static_cast<LLTB_t*>(m_pPool->Alloc());
+
+	LLRB_COUNT(LLRB_COUNTER_NODE_ALLOC);
+
+	pNew->Ref.Key = 0;
+	pNew->IsRed = true;
+	pNew->pLeft = nullptr;
+	pNew->pRight = nullptr;
+#if defined(USE_ORDER_STATISTICS)
+	pNew->Size = 1;
+#endif
+
+	return pNew;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUp()
+//
+//	Since a red-black tree is a binary tree, look-up operations are done
+//	using iterative traversal.
+//
+//	Returns a pointer to the VoidRef_t stored with the key.  The pointer is
+//	valid until the key is deleted or the tree is freed.
+//
+//	If the key is not in the tree, this will return nullptr.
+//
+void* LeftLeaningRedBlack::LookUp(uint32_t key)
+{
+	LLTB_t* pNode = m_pRoot;
+
+	LookUpDepth_t depth;
+
+	while (nullptr != pNode) {
+		depth.Step();
+
+		if (key == pNode->Ref.Key) {
+			return &(pNode->Ref);
+		}
+
+		if (key < pNode->Ref.Key) {
+			pNode = pNode->pLeft;
+		}
+		else {
+			pNode = pNode->pRight;
+		}
+	}
+
+	return nullptr;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	SearchKernel()
+//
+//	Branch-light search loop.  Instead of testing for equality at every
+//	level, this always walks all the way down to a leaf, going left
+//	whenever the search key is not greater than the node's key.  The last
+//	node where it went left is the smallest key >= the search key, so that
+//	node holds the key if the key is in the tree at all.
+//
+//	That leaves the loop condition as the only branch.  The steps are
+//	taken by LLRBSearch_t, where the candidate update and the child select
+//	are written as conditional expressions that compile to conditional
+//	moves, so a mispredicted compare no longer flushes the pipeline on
+//	every level.
+//
+//	When Prefetch is set, both children of the next node are requested from
+//	memory before the compare that decides between them is finished.  This
+//	costs extra bandwidth, but overlaps the cache miss for the next level
+//	with the work on the current one.
+//
+template <bool Prefetch>
+static inline LLTB_t* SearchKernel(LLTB_t* pNode, const uint32_t key)
+{
+	LLRBSearch_t search;
+
+	search.Start(pNode, key);
+
+	if (nullptr != pNode) {
+		do {
+			if (Prefetch) {
+				__builtin_prefetch(search.pNode->pLeft);
+				__builtin_prefetch(search.pNode->pRight);
+			}
+		} while (search.Step());
+	}
+
+	return (nullptr != search.Result()) ? search.pFound : nullptr;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUpBranchless()
+//
+//	Same result as LookUp(), using the branch-light SearchKernel().  This
+//	always visits a full root-to-leaf path, so it is faster when the tree
+//	is large and the keys being searched for are unpredictable, and slower
+//	when most searches would have ended near the root.
+//
+void* LeftLeaningRedBlack::LookUpBranchless(const uint32_t key)
+{
+	LLTB_t* pNode = SearchKernel<false>(m_pRoot, key);
+
+	return (nullptr != pNode) ? &(pNode->Ref) : nullptr;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUpPrefetch()
+//
+//	LookUpBranchless() plus prefetching of both children at every level.
+//	This is only worth using when the tree is much larger than the cache.
+//
+void* LeftLeaningRedBlack::LookUpPrefetch(const uint32_t key)
+{
+	LLTB_t* pNode = SearchKernel<true>(m_pRoot, key);
+
+	return (nullptr != pNode) ? &(pNode->Ref) : nullptr;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUpBatch()
+//
+//	Runs up to LLRB_BATCH_WIDTH searches side by side, in the style of
+//	asynchronous memory access chaining (AMAC).  Each pass over the lanes
+//	moves every search down one level and prefetches the node it will read
+//	on the next pass, so by the time a lane comes round again its node has
+//	had the other lanes' worth of time to arrive.
+//
+//	Searches do not all take the same number of steps, so a lane that
+//	finishes is refilled with the next key straight away rather than idling
+//	until the slowest lane in its group is done.
+//
+//	Each step is the same LLRBSearch_t step as SearchKernel().
+//
+void LeftLeaningRedBlack::LookUpBatch(const uint32_t* pKeys, size_t count, void** ppOut)
+{
+	struct Lane_t
+	{
+		LLRBSearch_t Search;
+		size_t       Index;
+	};
+
+	if (nullptr == m_pRoot) {
+		for (size_t i = 0; i < count; ++i) {
+			ppOut[i] = nullptr;
+		}
+
+		return;
+	}
+
+	Lane_t lanes[LLRB_BATCH_WIDTH];
+	int    live = 0;
+	size_t next = 0;
+
+	while ((live < LLRB_BATCH_WIDTH) && (next < count)) {
+		lanes[live].Search.Start(m_pRoot, pKeys[next]);
+		lanes[live].Index = next++;
+		++live;
+	}
+
+	while (live > 0) {
+		for (int i = 0; i < live; ) {
+			Lane_t& lane = lanes[i];
+
+			if (lane.Search.Step()) {
+				__builtin_prefetch(lane.Search.pNode);
+				++i;
+				continue;
+			}
+
+			// This search is done.
+			ppOut[lane.Index] = lane.Search.Result();
+
+			if (next < count) {
+				lane.Search.Start(m_pRoot, pKeys[next]);
+				lane.Index = next++;
+				++i;
+			}
+			else {
+				// No keys left, so retire the lane.  The last live lane is
+				// moved into its place, and gets its turn on this pass.
+				lanes[i] = lanes[--live];
+			}
+		}
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUpAsync()
+//
+//	LookUpBatch() with each lane turned into a coroutine: the node for the
+//	next level is prefetched, and the scheduler runs the other lanes until
+//	this one's turn comes round again.  The root is read without
+//	suspending, since every search starts there and it stays cached.
+//
+LookUpTask LeftLeaningRedBlack::LookUpAsync(LookUpScheduler& scheduler, const uint32_t key)
+{
+	LLRBSearch_t search;
+
+	search.Start(m_pRoot, key);
+
+	if (nullptr != search.pNode) {
+		while (search.Step()) {
+			__builtin_prefetch(search.pNode);
+
+			co_await scheduler.Yield();
+		}
+	}
+
+	co_return search.Result();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	IsRed()
+//
+static inline bool IsRed(LLTB_t* pNode)
+{
+	return ((nullptr != pNode) && pNode->IsRed);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	UpdateSize()
+//
+//	Recomputes the subtree size of pNode from its children.  This must be
+//	called whenever a child link of pNode is replaced.  Rotations keep the
+//	sizes up to date on their own.
+//
+//	When USE_ORDER_STATISTICS is not defined this compiles to nothing.
+//
+#if defined(USE_ORDER_STATISTICS)
+static inline size_t SubtreeSize(const LLTB_t* pNode)
+{
+	return (nullptr != pNode) ? pNode->Size : 0;
+}
+
+static inline void UpdateSize(LLTB_t* pNode)
+{
+	pNode->Size = 1 + SubtreeSize(pNode->pLeft) + SubtreeSize(pNode->pRight);
+}
+#else
+static inline void UpdateSize(LLTB_t* /*pNode*/)
+{
+}
+#endif
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	RotateLeft()
+//
+//	Rotate the subtree to the left:
+//
+//	   4            6
+//	  / \          /
+//	 2   6  -->   4
+//	             /
+//	            2
+//
+//	Node '6' will take on the color '4' used to have, while '4' becomes a
+//	red node.
+//
+static LLTB_t* RotateLeft(LLTB_t* pNode)
+{
+	LLRB_COUNT(LLRB_COUNTER_ROTATE_LEFT);
+
+	LLTB_t* pTemp = pNode->pRight;
+	pNode->pRight = pTemp->pLeft;
+	pTemp->pLeft = pNode;
+	pTemp->IsRed = pNode->IsRed;
+	pNode->IsRed = true;
+
+#if defined(USE_ORDER_STATISTICS)
+	pTemp->Size = pNode->Size;
+	UpdateSize(pNode);
+#endif
+
+	return pTemp;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	RotateRight()
+//
+//	Rotate the subtree to the right:
+//
+//	   4        2
+//	  / \        \
+//	 2   6  -->   4
+//	               \
+//	                6
+//
+//	Node '2' will take on the color '4' used to have, while '4' becomes a
+//	red node.
+//
+static LLTB_t* RotateRight(LLTB_t* pNode)
+{
+	LLRB_COUNT(LLRB_COUNTER_ROTATE_RIGHT);
+
+	LLTB_t* pTemp = pNode->pLeft;
+	pNode->pLeft = pTemp->pRight;
+	pTemp->pRight = pNode;
+	pTemp->IsRed = pNode->IsRed;
+	pNode->IsRed = true;
+
+#if defined(USE_ORDER_STATISTICS)
+	pTemp->Size = pNode->Size;
+	UpdateSize(pNode);
+#endif
+
+	return pTemp;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	ColorFlip()
+//
+//	Flips the color of the node and both of its children from black to red
+//	(or red to black).
+//
+//	Any time that a color flip is applied, it may cause pNode to end up
+//	with an invalid color relative to its parent node.  Therefore some kind
+//	of fix-up operation will be required after this function is called.
+//
+static void ColorFlip(LLTB_t* pNode)
+{
+	LLRB_COUNT(LLRB_COUNTER_COLOR_FLIP);
+
+	pNode->IsRed = !pNode->IsRed;
+
+	if (nullptr != pNode->pLeft) {
+		pNode->pLeft->IsRed = !pNode->pLeft->IsRed;
+	}
+
+	if (nullptr != pNode->pRight) {
+		pNode->pRight->IsRed = !pNode->pRight->IsRed;
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Insert()
+//
+bool LeftLeaningRedBlack::Insert(VoidRef_t ref)
+{
+	StopCompact();
+
+	if (nullptr != m_pLog) {
+		m_LastLogged = m_pLog->Append(WAL_INSERT, ref.Key);
+	}
+
+	DropFinger();
+
+	m_pRoot = InsertRec(m_pRoot, ref);
+
+	// The root node of a red-black tree must be black.
+	m_pRoot->IsRed = false;
+
+	// Diagnostics are only gathered when an observer has been installed,
+	// so the normal insert path does no I/O and no second walk of the tree.
+	if (nullptr != m_pInsertObserver) {
+		ReportInsert(ref);
+	}
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	ReportInsert()
+//
+void LeftLeaningRedBlack::ReportInsert(VoidRef_t ref)
+{
+	LLTB_t* pParent = FindParent(m_pRoot, ref);
+	LLTB_t* pNode   = m_pRoot;
+
+	if (nullptr != pParent) {
+		pNode = (ref.Key < pParent->Ref.Key) ? pParent->pLeft : pParent->pRight;
+	}
+
+	m_pInsertObserver(pParent, pNode, m_pInsertContext);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	SetInsertObserver()
+//
+//	Installs a hook that is called after every Insert() with the parent of
+//	the inserted key (after rebalancing) and the node holding the key.
+//	Pass nullptr to turn tracing back off.
+//
+void LeftLeaningRedBlack::SetInsertObserver(InsertObserver_t pObserver, void* pContext)
+{
+	m_pInsertObserver = pObserver;
+	m_pInsertContext  = pContext;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	AttachLog()
+//
+//	A log that is already in use may hold changes this tree never made,
+//	so numbering starts from wherever the log is now.
+//
+void LeftLeaningRedBlack::AttachLog(WriteAheadLog* pLog)
+{
+	m_pLog       = pLog;
+	m_LastLogged = (nullptr == pLog) ? 0 : pLog->LastSequence();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LogInserts()
+//
+void LeftLeaningRedBlack::LogInserts(Iterator first, const Iterator& last)
+{
+	if (nullptr != m_pLog) {
+		for ( ; first != last; ++first) {
+			m_LastLogged = m_pLog->Append(WAL_INSERT, first->Key);
+		}
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LogDeletes()
+//
+void LeftLeaningRedBlack::LogDeletes(Iterator first, const Iterator& last)
+{
+	if (nullptr != m_pLog) {
+		for ( ; first != last; ++first) {
+			m_LastLogged = m_pLog->Append(WAL_DELETE, first->Key);
+		}
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	PrintInsert()
+//
+//	Stock observer that writes the parent and color of each new key to cout.
+//
+void LeftLeaningRedBlack::PrintInsert(const LLTB_t* pParent, const LLTB_t* pNode, void* /*pContext*/)
+{
+	if (nullptr == pParent) {
+		cout << "No Parent. ";
+		cout << "Newest :" << pNode->Ref.Key;
+		pNode->IsRed ? cout << " (Red) \n" : cout << " (Black) \n"; //ternary color check
+	}
+	else {
+		cout << "Parent :";
+		cout << pParent->Ref.Key;
+		pParent->IsRed ? cout << "(Red). " : cout << "(Black). ";
+		cout << "Newest :";
+		cout << pNode->Ref.Key;
+		pNode->IsRed ? cout << " (Red)\n" : cout << " (Black)\n";
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	InsertRec()
+//
+//	Note that during rebalancing, a rotation may change the value assigned
+//	to pNode.  This will change which node is the root of the subtree that
+//	is being modified.  The caller will need to use the returned pointer
+//	to replace whichever value was passed into InsertRec.
+//
+LLTB_t* LeftLeaningRedBlack::InsertRec(LLTB_t* pNode, VoidRef_t ref)
+{
+	// Special case for inserting a leaf.  Just return the pointer;
+	// the caller will insert the new node into the parent node.
+	if (nullptr == pNode) {
+		pNode = NewNode();
+		pNode->Ref = ref;
+		return pNode;
+	}
+
+#if defined(USE_234_TREE)
+	// Split 4-nodes on the way down the tree.  This is what makes the
+	// tree a 2-3-4 tree: any 4-nodes that remain off the search path are
+	// left in place, so they can still absorb a later insertion.
+	if (IsRed(pNode->pLeft) && IsRed(pNode->pRight)) {
+		ColorFlip(pNode);
+	}
+#endif
+
+	// Check to see if the value is already in the tree.  If so, we
+	// simply replace the value of the key, since duplicate keys are
+	// not allowed.
+	if (ref.Key == pNode->Ref.Key) {
+		pNode->Ref = ref;
+	}
+
+	// Otherwise recurse left or right depending on key value.
+	//
+	// Note: pLeft or pRight may be a nullptr pointer before recursing.
+	// This indicates that pNode is a leaf (or only has one child),
+	// so the new node will be inserted using the return value.
+	//
+	// The other reason for pass-by-value, followed by an assignment,
+	// is that the recursive call may perform a rotation, so the
+	// pointer that gets passed in may end up not being the root of
+	// the subtree once the recursion returns.
+	//
+	else {
+		if (ref.Key < pNode->Ref.Key) {
+			pNode->pLeft = InsertRec(pNode->pLeft, ref);
+		}
+		else {
+			pNode->pRight = InsertRec(pNode->pRight, ref);
+		}
+
+		UpdateSize(pNode);
+	}
+
+	// If necessary, apply a rotation to get the correct representation
+	// in the parent node as we're backing out of the recursion.  This
+	// places the tree in a state where the parent can safely apply a
+	// rotation to restore the required black/red balance of the tree.
+
+	// Fix a right-leaning red node: this will assure that a 3-node is
+	// the left child.
+	if (IsRed(pNode->pRight) && (false == IsRed(pNode->pLeft))) {
+		pNode = RotateLeft(pNode);
+	}
+
+	// Fix two reds in a row: this will rebalance a 4-node.
+	if (IsRed(pNode->pLeft) && IsRed(pNode->pLeft->pLeft)) {
+		pNode = RotateRight(pNode);
+	}
+
+	// If we perform the color flip here, the tree is assembled as a
+	// mapping of a 2-3 tree.
+#if !defined(USE_234_TREE)
+	// This color flip will effectively split 4-nodes on the way back
+	// out of the tree.  By doing this here, there will be no 4-nodes
+	// left in the tree after the insertion is complete.
+	if (IsRed(pNode->pLeft) && IsRed(pNode->pRight)) {
+		ColorFlip(pNode);
+	}
+#endif
+	// Return the new root of the subtree that was just updated,
+	// since rotations may have changed the value of this pointer.
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	MoveRedLeft()
+//
+//	This code assumes that either pNode or pNode->pLeft are red.
+//
+static LLTB_t* MoveRedLeft(LLTB_t* pNode)
+{
+	LLRB_COUNT(LLRB_COUNTER_MOVE_RED_LEFT);
+
+	// If both children are black, we turn these three nodes into a
+	// 4-node by applying a color flip.
+	ColorFlip(pNode);
+
+	// But we may end up with a case where pRight has a red child.
+	// Apply a pair of rotations and a color flip to make pNode a
+	// red node, both of its children become black nodes, and pLeft
+	// becomes a 3-node.
+	if ((nullptr != pNode->pRight) && IsRed(pNode->pRight->pLeft)) {
+		pNode->pRight = RotateRight(pNode->pRight);
+		pNode = RotateLeft(pNode);
+
+		ColorFlip(pNode);
+
+#if defined(USE_234_TREE)
+		// If pRight was a 4-node, the red node borrowed from it leaves a
+		// lone red right child behind.  That node is off the search path,
+		// so no FixUp() will ever see it.  Turn it back into a 3-node.
+		if (IsRed(pNode->pRight->pRight)) {
+			pNode->pRight = RotateLeft(pNode->pRight);
+		}
+#endif
+	}
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	MoveRedRight()
+//
+//	This code assumes that either pNode or pNode->Right is a red node.
+//
+static LLTB_t* MoveRedRight(LLTB_t* pNode)
+{
+	LLRB_COUNT(LLRB_COUNTER_MOVE_RED_RIGHT);
+
+	// Applying a color flip may turn pNode into a 4-node,
+	// with both of its children being red.
+	ColorFlip(pNode);
+
+	// However, this may cause a situation where both of pNode's
+	// children are red, along with pNode->pLeft->pLeft.  Applying a
+	// rotation and a color flip will fix this special case, since
+	// it makes pNode red and pNode's children black.
+	if ((nullptr != pNode->pLeft) && IsRed(pNode->pLeft->pLeft)) {
+		pNode = RotateRight(pNode);
+
+		ColorFlip(pNode);
+	}
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FindMin()
+//
+//	Find the node under pNode that contains the smallest key value.
+//
+static LLTB_t* FindMin(LLTB_t* pNode)
+{
+	while (nullptr != pNode->pLeft) {
+		pNode = pNode->pLeft;
+	}
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FixUp()
+//
+//	Apply fix-up logic during deletion.  Applying color flips and rotations
+//	will preserve perfect black-link balance.  This will also fix any
+//	right-leaning red nodes and eliminate 4-nodes when backing out of
+//	recursive calls.
+//
+static LLTB_t* FixUp(LLTB_t* pNode)
+{
+	LLRB_COUNT(LLRB_COUNTER_FIX_UP);
+
+	// Fix right-leaning red nodes.  A 2-3-4 tree keeps its 4-nodes, so
+	// it only needs to fix a red right child that has no red sibling.
+#if defined(USE_234_TREE)
+	if (IsRed(pNode->pRight) && (false == IsRed(pNode->pLeft))) {
+#else
+	if (IsRed(pNode->pRight)) {
+#endif
+		pNode = RotateLeft(pNode);
+	}
+
+	// Detect if there is a 4-node that traverses down the left.
+	// This is fixed by a right rotation, making both of the red
+	// nodes the children of pNode.
+	if (IsRed(pNode->pLeft) && IsRed(pNode->pLeft->pLeft)) {
+		pNode = RotateRight(pNode);
+	}
+
+#if !defined(USE_234_TREE)
+	// Split 4-nodes.
+	if (IsRed(pNode->pLeft) && IsRed(pNode->pRight)) {
+		ColorFlip(pNode);
+	}
+#endif
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Delete()
+//
+void LeftLeaningRedBlack::Delete(const uint32_t key)
+{
+	StopCompact();
+
+	if (nullptr != m_pLog) {
+		m_LastLogged = m_pLog->Append(WAL_DELETE, key);
+	}
+
+	DropFinger();
+
+	if (nullptr != m_pRoot) {
+		LLTB_t* pRemoved = nullptr;
+
+		m_pRoot = DeleteRec(m_pRoot, key, pRemoved);
+
+		// Assuming we have not deleted the last node from the tree, we
+		// need to force the root to be a black node to conform with the
+		// the rules of a red-black tree.
+		if (nullptr != m_pRoot) {
+			m_pRoot->IsRed = false;
+		}
+
+		Free(pRemoved);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Extract()
+//
+bool LeftLeaningRedBlack::Extract(const uint32_t key, VoidRef_t& ref)
+{
+	StopCompact();
+
+	if (nullptr != m_pLog) {
+		m_LastLogged = m_pLog->Append(WAL_DELETE, key);
+	}
+
+	DropFinger();
+
+	if (nullptr == m_pRoot) {
+		return false;
+	}
+
+	LLTB_t* pRemoved = nullptr;
+
+	m_pRoot = DeleteRec(m_pRoot, key, pRemoved);
+
+	if (nullptr != m_pRoot) {
+		m_pRoot->IsRed = false;
+	}
+
+	if (nullptr == pRemoved) {
+		return false;
+	}
+
+	ref = pRemoved->Ref;
+
+	Free(pRemoved);
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	DetachMin()
+//
+//	The DeleteMin() logic, except that the bottom node on the left spine
+//	is handed back through pMin instead of being freed.  In an LLRB that
+//	node never has children.
+//
+static LLTB_t* DetachMin(LLTB_t* pNode, LLTB_t*& pMin)
+{
+	if (nullptr == pNode->pLeft) {
+		pMin = pNode;
+		return nullptr;
+	}
+
+	if ((false == IsRed(pNode->pLeft)) && (false == IsRed(pNode->pLeft->pLeft))) {
+		pNode = MoveRedLeft(pNode);
+	}
+
+	pNode->pLeft = DetachMin(pNode->pLeft, pMin);
+	UpdateSize(pNode);
+
+	return FixUp(pNode);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	DetachMax()
+//
+//	Mirror image of DetachMin(), which follows the path DeleteRec() takes
+//	for a key larger than any in the tree.  A red left child is rotated
+//	over to the right on the way down, so the bottom node on the right
+//	spine never has children either.
+//
+static LLTB_t* DetachMax(LLTB_t* pNode, LLTB_t*& pMax)
+{
+	if (IsRed(pNode->pLeft) && (false == IsRed(pNode->pRight))) {
+		pNode = RotateRight(pNode);
+	}
+
+	if (nullptr == pNode->pRight) {
+		pMax = pNode;
+		return nullptr;
+	}
+
+	if ((false == IsRed(pNode->pRight)) && (false == IsRed(pNode->pRight->pLeft))) {
+		pNode = MoveRedRight(pNode);
+	}
+
+	pNode->pRight = DetachMax(pNode->pRight, pMax);
+	UpdateSize(pNode);
+
+	return FixUp(pNode);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	DeleteRec()
+//
+//	The node holding the key is unlinked from the tree and returned through
+//	pRemoved with its child links cleared, so the caller decides whether to
+//	free it.  pRemoved is left alone if the key is not in the tree.
+//
+LLTB_t* LeftLeaningRedBlack::DeleteRec(LLTB_t* pNode, const uint32_t key, LLTB_t*& pRemoved)
+{
+	if (key < pNode->Ref.Key) {
+		if (nullptr != pNode->pLeft) {
+			// If pNode and pNode->pLeft are black, we may need to
+			// move pRight to become the left child if a deletion
+			// would produce a red node.
+			if ((false == IsRed(pNode->pLeft)) && (false == IsRed(pNode->pLeft->pLeft))) {
+				pNode = MoveRedLeft(pNode);
+			}
+
+			pNode->pLeft = DeleteRec(pNode->pLeft, key, pRemoved);
+			UpdateSize(pNode);
+		}
+	}
+	else {
+		// If the left child is red, apply a rotation so we make
+		// the right child red.  A 4-node already has a red right child,
+		// and rotating it would leave two reds in a row on the right.
+		if (IsRed(pNode->pLeft) && (false == IsRed(pNode->pRight))) {
+			pNode = RotateRight(pNode);
+		}
+
+		// Special case for deletion of a leaf node.
+		// The arrangement logic of LLRBs assures that in this case,
+		// pNode cannot have a left child.
+		if ((key == pNode->Ref.Key) && (nullptr == pNode->pRight)) {
+			pRemoved = pNode;
+			return nullptr;
+		}
+
+		// If we get here, we need to traverse down the right node.
+		// However, if there is no right node, then the target key is
+		// not in the tree, so we can break out of the recursion.
+		if (nullptr != pNode->pRight) {
+			if ((false == IsRed(pNode->pRight)) && (false == IsRed(pNode->pRight->pLeft))) {
+				pNode = MoveRedRight(pNode);
+			}
+
+			// Deletion of an internal node: We cannot simply unlink this
+			// node from the tree, so we have to find the node containing
+			// the smallest key value that is larger than the key we're
+			// deleting.  That node is unlinked from the right subtree
+			// instead, and takes the place of the node we're deleting.
+			// Moving the node rather than its ref keeps every pointer
+			// returned by LookUp() valid until its own key is deleted.
+			if (key == pNode->Ref.Key) {
+				LLTB_t* pMin   = nullptr;
+				LLTB_t* pRight = DetachMin(pNode->pRight, pMin);
+
+				pMin->pLeft  = pNode->pLeft;
+				pMin->pRight = pRight;
+				pMin->IsRed  = pNode->IsRed;
+
+				pNode->pLeft  = nullptr;
+				pNode->pRight = nullptr;
+				pRemoved      = pNode;
+
+				pNode = pMin;
+			}
+			else {
+				pNode->pRight = DeleteRec(pNode->pRight, key, pRemoved);
+			}
+
+			UpdateSize(pNode);
+		}
+	}
+
+	// Fix right-leaning red nodes and eliminate 4-nodes on the way up.
+	// Need to avoid allowing search operations to terminate on 4-nodes,
+	// or searching may not locate intended key.
+	return FixUp(pNode);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	DeleteMin()
+//
+//	Delete the bottom node on the left spine while maintaining balance.
+//	To do so, we maintain the invariant that the current node or its left
+//	child is red.
+//
+//	The only reason this is a member function instead of a static function
+//	like all of the other support functions is because it needs to call
+//	Free().
+//
+LLTB_t* LeftLeaningRedBlack::DeleteMin(LLTB_t* pNode)
+{
+	LLTB_t* pMin = nullptr;
+
+	pNode = DetachMin(pNode, pMin);
+
+	Free(pMin);
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	DeleteMax()
+//
+//	Delete the bottom node on the right spine, the same way DeleteMin()
+//	deletes the bottom node on the left spine.
+//
+LLTB_t* LeftLeaningRedBlack::DeleteMax(LLTB_t* pNode)
+{
+	LLTB_t* pMax = nullptr;
+
+	pNode = DetachMax(pNode, pMax);
+
+	Free(pMax);
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	PopMin()
+//
+//	Removes the smallest key and hands back its ref, which lets the tree
+//	serve as a priority queue.  Returns false if the tree is empty.
+//
+bool LeftLeaningRedBlack::PopMin(VoidRef_t& ref)
+{
+	StopCompact();
+
+	if (nullptr == m_pRoot) {
+		return false;
+	}
+
+	if (nullptr != m_pLog) {
+		m_LastLogged = m_pLog->Append(WAL_DELETE, FindMin(m_pRoot)->Ref.Key);
+	}
+
+	DropFinger();
+
+	LLTB_t* pMin = nullptr;
+
+	m_pRoot = DetachMin(m_pRoot, pMin);
+
+	if (nullptr != m_pRoot) {
+		m_pRoot->IsRed = false;
+	}
+
+	ref = pMin->Ref;
+
+	Free(pMin);
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	PopMax()
+//
+bool LeftLeaningRedBlack::PopMax(VoidRef_t& ref)
+{
+	StopCompact();
+
+	if (nullptr == m_pRoot) {
+		return false;
+	}
+
+	if (nullptr != m_pLog) {
+		LLTB_t* pMax = m_pRoot;
+		while (nullptr != pMax->pRight) {
+			pMax = pMax->pRight;
+		}
+
+		m_LastLogged = m_pLog->Append(WAL_DELETE, pMax->Ref.Key);
+	}
+
+	DropFinger();
+
+	LLTB_t* pMax = nullptr;
+
+	m_pRoot = DetachMax(m_pRoot, pMax);
+
+	if (nullptr != m_pRoot) {
+		m_pRoot->IsRed = false;
+	}
+
+	ref = pMax->Ref;
+
+	Free(pMax);
+
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	MaxKeysForHeight()
+//
+//	A 2-3 tree with black height h holds at most 3^h - 1 keys (every node
+//	is a 3-node).  This saturates instead of overflowing for tall trees.
+//
+static size_t MaxKeysForHeight(int height)
+{
+	size_t maxKeys = 0;
+
+	for (int i = 0; i < height; ++i) {
+		if (maxKeys > ((SIZE_MAX - 2) / 3)) {
+			return SIZE_MAX;
+		}
+
+		maxKeys = (maxKeys * 3) + 2;
+	}
+
+	return maxKeys;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	BuildRec()
+//
+//	Builds a black-rooted subtree with black height `height` holding the
+//	`count` nodes starting at pNodes.  The nodes are already in key order,
+//	so the only decision at each level is whether the root is a 2-node
+//	(one black node) or a 3-node (a black node with a red left child).
+//
+//	A 2-node is used whenever the remaining keys fit in two subtrees of
+//	height - 1, otherwise a 3-node splits them three ways.  The caller
+//	guarantees 2^height - 1 <= count <= 3^height - 1, which keeps every
+//	subtree inside the same bounds for height - 1.
+//
+static LLTB_t* BuildRec(LLTB_t* pNodes, size_t count, int height)
+{
+	if (0 == count) {
+		return nullptr;
+	}
+
+	size_t childMax = MaxKeysForHeight(height - 1);
+
+	// The right side of a 2-node gets the larger half of the keys, so a
+	// 2-node works if that half fits in a subtree of height - 1.
+	size_t leftCount = (count - 1) / 2;
+
+	if ((count - 1 - leftCount) <= childMax) {
+		LLTB_t* pNode = pNodes + leftCount;
+		pNode->IsRed  = false;
+#if defined(USE_ORDER_STATISTICS)
+		pNode->Size   = count;
+#endif
+		pNode->pLeft  = BuildRec(pNodes, leftCount, height - 1);
+		pNode->pRight = BuildRec(pNode + 1, count - 1 - leftCount, height - 1);
+
+		return pNode;
+	}
+
+	size_t rest        = count - 2;
+	leftCount          = rest / 3;
+	size_t middleCount = (rest - leftCount) / 2;
+	size_t rightCount  = rest - leftCount - middleCount;
+
+	LLTB_t* pRed   = pNodes + leftCount;
+	LLTB_t* pBlack = pRed + 1 + middleCount;
+
+	pRed->IsRed  = true;
+	pRed->pLeft  = BuildRec(pNodes, leftCount, height - 1);
+	pRed->pRight = BuildRec(pRed + 1, middleCount, height - 1);
+
+	pBlack->IsRed  = false;
+	pBlack->pLeft  = pRed;
+#if defined(USE_ORDER_STATISTICS)
+	pRed->Size     = leftCount + middleCount + 1;
+	pBlack->Size   = count;
+#endif
+	pBlack->pRight = BuildRec(pBlack + 1, rightCount, height - 1);
+
+	return pBlack;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	BuildFromSorted()
+//
+//	Replaces the contents of the tree with `count` refs taken from an array
+//	that is sorted by strictly increasing key.  This runs in O(n) time,
+//	compared to O(n log n) for calling Insert() on each key, and all of the
+//	nodes are allocated as one contiguous block, laid out in key order.
+//
+//	The resulting tree has the minimum possible black height for the number
+//	of keys, and is a valid LLRB for both the 2-3 and 2-3-4 modes.
+//
+//	Returns false, leaving the tree untouched, if the keys are not sorted
+//	or contain duplicates.
+//
+//	With a log attached, the old keys are logged as deleted and the new
+//	ones as inserted.
+//
+bool LeftLeaningRedBlack::BuildFromSorted(const VoidRef_t* pRefs, size_t count)
+{
+	for (size_t i = 1; i < count; ++i) {
+		if (false == (pRefs[i - 1].Key < pRefs[i].Key)) {
+			return false;
+		}
+	}
+
+	FreeAll();
+
+	if (nullptr != m_pLog) {
+		for (size_t i = 0; i < count; ++i) {
+			m_LastLogged = m_pLog->Append(WAL_INSERT, pRefs[i].Key);
+		}
+	}
+
+	if (0 == count) {
+		return true;
+	}
+
+	LLTB_t* pNodes = static_cast<LLTB_t*>(m_pPool->AllocContiguous(count));
+
+	LLRB_COUNT_BY(LLRB_COUNTER_NODE_ALLOC, count);
+
+	for (size_t i = 0; i < count; ++i) {
+		pNodes[i].Ref = pRefs[i];
+	}
+
+	// The black height is the height of the largest complete binary tree
+	// that fits in count keys.
+	int height = 0;
+	while ((height < 63) && (((size_t(1) << (height + 1)) - 1) <= count)) {
+		++height;
+	}
+
+	m_pRoot = BuildRec(pNodes, count, height);
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	InsertIterative()
+//
+//	Same algorithm as InsertRec(), but the path from the root to the new
+//	leaf is recorded in a fixed-size stack.  The rebalancing that
+//	InsertRec() applies while unwinding is applied here while popping the
+//	stack.
+//
+//	Since the tree was valid before this insertion, rebalancing can stop
+//	as soon as a level returns the same, black, subtree root that it was
+//	given: none of the ancestors above it can see a change in color.
+//	With USE_234_TREE, 4-nodes are split on the way down instead.  Every
+//	level from the new leaf up to the highest node that was split may need
+//	rebalancing, so the stop is only taken at or above that node.
+//
+bool LeftLeaningRedBlack::InsertIterative(VoidRef_t ref)
+{
+	StopCompact();
+
+	if (nullptr != m_pLog) {
+		m_LastLogged = m_pLog->Append(WAL_INSERT, ref.Key);
+	}
+
+	DropFinger();
+
+	LLTB_t* stack[LLRB_MAX_DEPTH];
+	bool    goLeft[LLRB_MAX_DEPTH];
+	int     depth = 0;
+
+	// Depth of the highest node whose colors were flipped on the way down.
+	// Rebalancing cannot stop until it has climbed back up to this depth.
+	int     flipped = LLRB_MAX_DEPTH;
+
+	LLTB_t* pNode  = m_pRoot;
+	LLTB_t* pChild = nullptr;
+
+	while (nullptr != pNode) {
+#if defined(USE_234_TREE)
+		if (IsRed(pNode->pLeft) && IsRed(pNode->pRight)) {
+			ColorFlip(pNode);
+
+			if (flipped > depth) {
+				flipped = depth;
+			}
+		}
+#endif
+
+		// Duplicate keys are not allowed, so just replace the value.
+		if (ref.Key == pNode->Ref.Key) {
+			pNode->Ref = ref;
+
+			// Nothing was added, but any flips made on the way down
+			// still need to be rebalanced.
+			if (LLRB_MAX_DEPTH == flipped) {
+				return true;
+			}
+
+			pChild = pNode;
+			break;
+		}
+
+		stack[depth]  = pNode;
+		goLeft[depth] = (ref.Key < pNode->Ref.Key);
+		pNode = goLeft[depth] ? pNode->pLeft : pNode->pRight;
+		++depth;
+	}
+
+	bool added = (nullptr == pChild);
+
+	if (added) {
+		pChild = NewNode();
+		pChild->Ref = ref;
+	}
+
+	while (depth > 0) {
+		--depth;
+		pNode = stack[depth];
+
+		if (goLeft[depth]) {
+			pNode->pLeft = pChild;
+		}
+		else {
+			pNode->pRight = pChild;
+		}
+
+		UpdateSize(pNode);
+
+		LLTB_t* pTop = pNode;
+
+		if (IsRed(pTop->pRight) && (false == IsRed(pTop->pLeft))) {
+			pTop = RotateLeft(pTop);
+		}
+
+		if (IsRed(pTop->pLeft) && IsRed(pTop->pLeft->pLeft)) {
+			pTop = RotateRight(pTop);
+		}
+
+#if !defined(USE_234_TREE)
+		if (IsRed(pTop->pLeft) && IsRed(pTop->pRight)) {
+			ColorFlip(pTop);
+		}
+#endif
+
+		pChild = pTop;
+
+		if ((pTop == pNode) && (false == pTop->IsRed) && (depth <= flipped)) {
+			break;
+		}
+	}
+
+#if defined(USE_ORDER_STATISTICS)
+	// The ancestors above an early stop still gained one node.
+	for (int i = 0; added && (i < depth); ++i) {
+		++(stack[i]->Size);
+	}
+#endif
+
+	// If rebalancing did not stop early, pChild is the new root.  Otherwise
+	// the ancestors above the stopping point still link to pChild.
+	if (0 == depth) {
+		m_pRoot = pChild;
+	}
+
+	m_pRoot->IsRed = false;
+
+	if (added && (nullptr != m_pInsertObserver)) {
+		ReportInsert(ref);
+	}
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	DeleteIterative()
+//
+//	Same algorithm as DeleteRec() combined with DeleteMin().  The
+//	MoveRedLeft() and MoveRedRight() transforms are applied on the way
+//	down, and every node they return is pushed onto the path stack so
+//	that FixUp() can be applied, and the parent re-linked, on the way
+//	back up.
+//
+void LeftLeaningRedBlack::DeleteIterative(const uint32_t key)
+{
+	StopCompact();
+
+	if (nullptr != m_pLog) {
+		m_LastLogged = m_pLog->Append(WAL_DELETE, key);
+	}
+
+	DropFinger();
+
+	if (nullptr == m_pRoot) {
+		return;
+	}
+
+	LLTB_t* stack[LLRB_MAX_DEPTH];
+	bool    goLeft[LLRB_MAX_DEPTH];
+	int     depth = 0;
+
+	LLTB_t* pNode  = m_pRoot;
+	LLTB_t* pChild = nullptr;
+
+	for (;;) {
+		if (key < pNode->Ref.Key) {
+			if (nullptr == pNode->pLeft) {
+				// Key is not in the tree.
+				pChild = FixUp(pNode);
+				break;
+			}
+
+			if ((false == IsRed(pNode->pLeft)) && (false == IsRed(pNode->pLeft->pLeft))) {
+				pNode = MoveRedLeft(pNode);
+			}
+
+			stack[depth]  = pNode;
+			goLeft[depth] = true;
+			++depth;
+			pNode = pNode->pLeft;
+			continue;
+		}
+
+		if (IsRed(pNode->pLeft) && (false == IsRed(pNode->pRight))) {
+			pNode = RotateRight(pNode);
+		}
+
+		// Deletion of a leaf node.
+		if ((key == pNode->Ref.Key) && (nullptr == pNode->pRight)) {
+			Free(pNode);
+			pChild = nullptr;
+			break;
+		}
+
+		if (nullptr == pNode->pRight) {
+			// Key is not in the tree.
+			pChild = FixUp(pNode);
+			break;
+		}
+
+		if ((false == IsRed(pNode->pRight)) && (false == IsRed(pNode->pRight->pLeft))) {
+			pNode = MoveRedRight(pNode);
+		}
+
+		stack[depth]  = pNode;
+		goLeft[depth] = false;
+		++depth;
+
+		if (key != pNode->Ref.Key) {
+			pNode = pNode->pRight;
+			continue;
+		}
+
+		// Deletion of an internal node: unlink the successor from the
+		// right subtree using the DeleteMin() logic, then put it in the
+		// deleted node's place on the stack, as DeleteRec() does.
+		LLTB_t* pRemoved = pNode;
+		int     target   = depth - 1;
+
+		pNode = pNode->pRight;
+
+		while (nullptr != pNode->pLeft) {
+			if ((false == IsRed(pNode->pLeft)) && (false == IsRed(pNode->pLeft->pLeft))) {
+				pNode = MoveRedLeft(pNode);
+			}
+
+			stack[depth]  = pNode;
+			goLeft[depth] = true;
+			++depth;
+			pNode = pNode->pLeft;
+		}
+
+		// The successor's own parent link is rewritten on the way back
+		// up, even when that parent is the node being deleted.
+		pNode->pLeft  = pRemoved->pLeft;
+		pNode->pRight = pRemoved->pRight;
+		pNode->IsRed  = pRemoved->IsRed;
+		stack[target] = pNode;
+
+		pRemoved->pLeft  = nullptr;
+		pRemoved->pRight = nullptr;
+		Free(pRemoved);
+
+		pChild = nullptr;
+		break;
+	}
+
+	while (depth > 0) {
+		--depth;
+		pNode = stack[depth];
+
+		if (goLeft[depth]) {
+			pNode->pLeft = pChild;
+		}
+		else {
+			pNode->pRight = pChild;
+		}
+
+		UpdateSize(pNode);
+		pChild = FixUp(pNode);
+	}
+
+	m_pRoot = pChild;
+
+	if (nullptr != m_pRoot) {
+		m_pRoot->IsRed = false;
+	}
+}
+
+
+// Bounds of the finger's root level, outside the range of any key.
+static const int64_t FINGER_NO_LOW  = -1;
+static const int64_t FINGER_NO_HIGH = int64_t(1) << 32;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	PushFinger()
+//
+//	Extends the finger by one level.  The child's subtree holds the keys
+//	on its side of its parent's key, within the parent's own range.
+//
+static inline void PushFinger(int& depth, LLTB_t** pPath, int64_t* pLo, int64_t* pHi, LLTB_t* pChild)
+{
+	LLTB_t* pParent = pPath[depth - 1];
+
+	if (pParent->pLeft == pChild) {
+		pLo[depth] = pLo[depth - 1];
+		pHi[depth] = pParent->Ref.Key;
+	}
+	else {
+		pLo[depth] = pParent->Ref.Key;
+		pHi[depth] = pHi[depth - 1];
+	}
+
+	pPath[depth++] = pChild;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	SeedFinger()
+//
+//	Moves the finger to the node hint refers to.  The hint already carries
+//	the path from the root, so only the key ranges need to be worked out,
+//	and none of that touches any node that is not on the path.  If the
+//	finger is already there, as it is when the hint came from the previous
+//	hinted insert, it is left alone.
+//
+void LeftLeaningRedBlack::SeedFinger(const Iterator& hint)
+{
+	if ((this != hint.m_pTree) || (0 == hint.m_Depth) || (m_pRoot != hint.m_Path[0])) {
+		return;
+	}
+
+	if (nullptr == m_pFinger) {
+		m_pFinger.reset(new Finger_t);
+		m_pFinger->Depth = 0;
+	}
+
+	Finger_t& finger = *m_pFinger;
+
+	if ((finger.Depth == hint.m_Depth) && (finger.Path[finger.Depth - 1] == hint.m_Path[hint.m_Depth - 1])) {
+		return;
+	}
+
+	finger.Path[0] = m_pRoot;
+	finger.Lo[0]   = FINGER_NO_LOW;
+	finger.Hi[0]   = FINGER_NO_HIGH;
+	finger.Depth   = 1;
+
+	for (int i = 1; i < hint.m_Depth; ++i) {
+		PushFinger(finger.Depth, finger.Path, finger.Lo, finger.Hi, hint.m_Path[i]);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FingerSearch()
+//
+//	Climbs the finger to the lowest level whose subtree can hold key, then
+//	searches down from there as LookUp() would.  Returns the node holding
+//	key, or nullptr if the key is not in the tree, in which case the
+//	finger ends at the node the key would be added under.
+//
+//	When the keys being searched for are increasing, the next key usually
+//	belongs in the subtree at or just above the bottom of the finger, so
+//	only a few levels are climbed and searched instead of the whole height
+//	of the tree.
+//
+LLTB_t* LeftLeaningRedBlack::FingerSearch(const uint32_t key)
+{
+	if (nullptr == m_pFinger) {
+		m_pFinger.reset(new Finger_t);
+		m_pFinger->Depth = 0;
+	}
+
+	Finger_t& finger = *m_pFinger;
+
+	while ((finger.Depth > 0) && ((int64_t(key) <= finger.Lo[finger.Depth - 1]) || (int64_t(key) >= finger.Hi[finger.Depth - 1]))) {
+		--finger.Depth;
+	}
+
+	if (0 == finger.Depth) {
+		if (nullptr == m_pRoot) {
+			return nullptr;
+		}
+
+		finger.Path[0] = m_pRoot;
+		finger.Lo[0]   = FINGER_NO_LOW;
+		finger.Hi[0]   = FINGER_NO_HIGH;
+		finger.Depth   = 1;
+	}
+
+	for (;;) {
+		LLTB_t* pNode = finger.Path[finger.Depth - 1];
+
+		if (key == pNode->Ref.Key) {
+			return pNode;
+		}
+
+		LLTB_t* pNext = (key < pNode->Ref.Key) ? pNode->pLeft : pNode->pRight;
+
+		if (nullptr == pNext) {
+			return nullptr;
+		}
+
+		PushFinger(finger.Depth, finger.Path, finger.Lo, finger.Hi, pNext);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUpNear()
+//
+void* LeftLeaningRedBlack::LookUpNear(const uint32_t key)
+{
+	LLTB_t* pNode = FingerSearch(key);
+
+	return (nullptr != pNode) ? &(pNode->Ref) : nullptr;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUp()
+//
+void* LeftLeaningRedBlack::LookUp(const Iterator& hint, const uint32_t key)
+{
+	SeedFinger(hint);
+
+	return LookUpNear(key);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	InsertNear()
+//
+//	The finger is the path InsertIterative() would have walked, so the new
+//	leaf is linked in and rebalanced in exactly the same way, including
+//	stopping as soon as a level is left unchanged.  The levels above that
+//	point are still valid, only the levels below it need to be searched
+//	again to bring the finger back down to the new key, and those are the
+//	nodes rebalancing just touched.
+//
+//	With USE_234_TREE, 4-nodes have to be split on the way down from the
+//	root, which a search that starts partway down would miss, so this
+//	falls back to InsertIterative() and then moves the finger to the key.
+//
+bool LeftLeaningRedBlack::InsertNear(VoidRef_t ref)
+{
+	StopCompact();
+
+#if defined(USE_234_TREE)
+	InsertIterative(ref);
+	FingerSearch(ref.Key);
+
+	return true;
+#else
+	if (nullptr != m_pLog) {
+		m_LastLogged = m_pLog->Append(WAL_INSERT, ref.Key);
+	}
+
+	LLTB_t* pFound = FingerSearch(ref.Key);
+
+	// Duplicate keys are not allowed, so just replace the value.
+	if (nullptr != pFound) {
+		pFound->Ref = ref;
+		return true;
+	}
+
+	Finger_t& finger = *m_pFinger;
+
+	LLTB_t* pChild = NewNode();
+	pChild->Ref = ref;
+
+	int depth = finger.Depth;
+
+	while (depth > 0) {
+		--depth;
+
+		LLTB_t* pNode = finger.Path[depth];
+
+		if (ref.Key < pNode->Ref.Key) {
+			pNode->pLeft = pChild;
+		}
+		else {
+			pNode->pRight = pChild;
+		}
+
+		UpdateSize(pNode);
+
+		LLTB_t* pTop = pNode;
+
+		if (IsRed(pTop->pRight) && (false == IsRed(pTop->pLeft))) {
+			pTop = RotateLeft(pTop);
+		}
+
+		if (IsRed(pTop->pLeft) && IsRed(pTop->pLeft->pLeft)) {
+			pTop = RotateRight(pTop);
+		}
+
+		if (IsRed(pTop->pLeft) && IsRed(pTop->pRight)) {
+			ColorFlip(pTop);
+		}
+
+		pChild = pTop;
+
+		if ((pTop == pNode) && (false == pTop->IsRed)) {
+			break;
+		}
+	}
+
+#if defined(USE_ORDER_STATISTICS)
+	for (int i = 0; i < depth; ++i) {
+		++(finger.Path[i]->Size);
+	}
+#endif
+
+	if (0 == depth) {
+		m_pRoot = pChild;
+	}
+
+	m_pRoot->IsRed = false;
+
+	// Everything above the level where rebalancing stopped is unchanged.
+	// If it did not stop, pChild is the new root, and the root level of
+	// the finger always has the full key range.
+	finger.Path[depth] = pChild;
+	finger.Depth       = depth + 1;
+
+	if (0 == depth) {
+		finger.Lo[0] = FINGER_NO_LOW;
+		finger.Hi[0] = FINGER_NO_HIGH;
+	}
+
+	FingerSearch(ref.Key);
+
+	if (nullptr != m_pInsertObserver) {
+		ReportInsert(ref);
+	}
+
+	return true;
+#endif
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Insert()
+//
+//	Hinted insert.  The returned iterator is built from the finger, which
+//	ends at the new key, so passing it straight back in as the next hint
+//	costs nothing.
+//
+LeftLeaningRedBlack::Iterator LeftLeaningRedBlack::Insert(const Iterator& hint, VoidRef_t ref)
+{
+	SeedFinger(hint);
+	InsertNear(ref);
+
+	Iterator it;
+	it.m_pTree = this;
+
+	for (int i = 0; i < m_pFinger->Depth; ++i) {
+		it.m_Path[i] = m_pFinger->Path[i];
+	}
+
+	it.m_Depth = m_pFinger->Depth;
+
+	return it;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Traverse()
+//
+//	Perform an in-order traversal of the tree, printing out all of the key
+//	values in the tree.  This should display all keys in their sorted order.
+//	Use Validate() to check the structure of the tree.
+//
+void LeftLeaningRedBlack::Traverse(void)
+{
+	TraverseRec(m_pRoot);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	TraverseRec()
+//
+void LeftLeaningRedBlack::TraverseRec(LLTB_t* pNode)
+{
+	if (nullptr == pNode) {
+		return;
+	}
+	if (nullptr != pNode->pLeft) {
+		TraverseRec(pNode->pLeft);
+	}
+	if (pNode->IsRed)
+		cout << "(Red) ";
+	else
+		cout << "(Black) ";
+	cout << pNode->Ref.Key << endl;
+
+	if (nullptr != pNode->pRight) {
+		TraverseRec(pNode->pRight);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	JoinTree_t
+//
+//	A black-rooted subtree together with its black height, which is the
+//	number of black nodes on every path from the root down to a leaf.  The
+//	split and join operations below carry the height along with each tree
+//	so that it never has to be recomputed.
+//
+struct JoinTree_t
+{
+	LLTB_t* pRoot;
+	int     Height;
+};
+
+
+// Subtrees shorter than this are not worth handing to another thread
+// (a black height of 10 is at least 1023 keys).
+#define PARALLEL_MIN_HEIGHT	10
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	BlackHeight()
+//
+static int BlackHeight(LLTB_t* pNode)
+{
+	int height = 0;
+
+	while (nullptr != pNode) {
+		if (false == pNode->IsRed) {
+			++height;
+		}
+
+		pNode = pNode->pLeft;
+	}
+
+	return height;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	JoinFixUp()
+//
+//	The rebalancing InsertRec() applies on the way back up, including the
+//	4-node split.  Joining hangs a red node somewhere along one spine of the
+//	taller tree, which is the same situation as inserting a new leaf, so
+//	the same fix-up restores the invariants.  The 4-node split is always
+//	applied, since a 2-3 tree is valid in both modes.
+//
+//	A 2-3-4 tree may already hold 4-nodes along the spine, and rotating one
+//	of those leaves a black node leaning right.  JoinRightRec() and
+//	JoinLeftRec() split them on the way down with SplitSpine(), just as the
+//	2-3-4 InsertRec() does, so the fix-up only ever sees 2-3 shapes.
+//
+static LLTB_t* JoinFixUp(LLTB_t* pNode)
+{
+	if (IsRed(pNode->pRight) && (false == IsRed(pNode->pLeft))) {
+		pNode = RotateLeft(pNode);
+	}
+
+	if (IsRed(pNode->pLeft) && IsRed(pNode->pLeft->pLeft)) {
+		pNode = RotateRight(pNode);
+	}
+
+	if (IsRed(pNode->pLeft) && IsRed(pNode->pRight)) {
+		ColorFlip(pNode);
+	}
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	SplitSpine()
+//
+//	Splits a 4-node the join is about to walk through.  This moves a level
+//	of black height from the children up to pNode, so it has to happen
+//	before the height passed down is worked out.
+//
+static void SplitSpine(LLTB_t* pNode)
+{
+#if defined(USE_234_TREE)
+	if (IsRed(pNode->pLeft) && IsRed(pNode->pRight)) {
+		ColorFlip(pNode);
+	}
+#else
+	(void)pNode;
+#endif
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	JoinRightRec()
+//
+//	Walks down the right spine of the taller left tree until it reaches a
+//	black node with the same black height as the right tree, and replaces
+//	it with a red pKey whose children are that node and the right tree.
+//
+//	`height` is the black height of pNode counting pNode itself.
+//
+static LLTB_t* JoinRightRec(LLTB_t* pNode, int height, LLTB_t* pKey, const JoinTree_t& right)
+{
+	if ((false == IsRed(pNode)) && (height == right.Height)) {
+		pKey->IsRed  = true;
+		pKey->pLeft  = pNode;
+		pKey->pRight = right.pRoot;
+		UpdateSize(pKey);
+		return pKey;
+	}
+
+	SplitSpine(pNode);
+
+	pNode->pRight = JoinRightRec(pNode->pRight, height - (pNode->IsRed ? 0 : 1), pKey, right);
+	UpdateSize(pNode);
+
+	return JoinFixUp(pNode);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	JoinLeftRec()
+//
+//	Mirror image of JoinRightRec(), walking down the left spine of the
+//	taller right tree.
+//
+static LLTB_t* JoinLeftRec(LLTB_t* pNode, int height, LLTB_t* pKey, const JoinTree_t& left)
+{
+	if ((false == IsRed(pNode)) && (height == left.Height)) {
+		pKey->IsRed  = true;
+		pKey->pLeft  = left.pRoot;
+		pKey->pRight = pNode;
+		UpdateSize(pKey);
+		return pKey;
+	}
+
+	SplitSpine(pNode);
+
+	pNode->pLeft = JoinLeftRec(pNode->pLeft, height - (pNode->IsRed ? 0 : 1), pKey, left);
+	UpdateSize(pNode);
+
+	return JoinFixUp(pNode);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	JoinTrees()
+//
+//	Joins two trees and a key node, where every key in `left` is less than
+//	pKey's key and every key in `right` is greater.  This costs O(|h1 - h2|)
+//	since only the spine of the taller tree is visited.
+//
+static JoinTree_t JoinTrees(const JoinTree_t& left, LLTB_t* pKey, const JoinTree_t& right)
+{
+	JoinTree_t joined;
+
+	if (left.Height > right.Height) {
+		joined.pRoot  = JoinRightRec(left.pRoot, left.Height, pKey, right);
+		joined.Height = left.Height;
+	}
+	else if (left.Height < right.Height) {
+		joined.pRoot  = JoinLeftRec(right.pRoot, right.Height, pKey, left);
+		joined.Height = right.Height;
+	}
+	else {
+		pKey->IsRed   = false;
+		pKey->pLeft   = left.pRoot;
+		pKey->pRight  = right.pRoot;
+		UpdateSize(pKey);
+		joined.pRoot  = pKey;
+		joined.Height = left.Height + 1;
+		return joined;
+	}
+
+	// A red root gets painted black, which adds a level of black height.
+	if (joined.pRoot->IsRed) {
+		joined.pRoot->IsRed = false;
+		++joined.Height;
+	}
+
+	return joined;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	DetachChildren()
+//
+//	Takes a black-rooted tree apart into its root and two black-rooted
+//	subtrees.  A red child is painted black, which makes it one level taller
+//	than its black sibling would be.
+//
+static void DetachChildren(const JoinTree_t& tree, JoinTree_t& left, JoinTree_t& right)
+{
+	LLTB_t* pNode = tree.pRoot;
+
+	left.pRoot   = pNode->pLeft;
+	left.Height  = tree.Height - 1;
+	right.pRoot  = pNode->pRight;
+	right.Height = tree.Height - 1;
+
+	if (IsRed(left.pRoot)) {
+		left.pRoot->IsRed = false;
+		++left.Height;
+	}
+
+	if (IsRed(right.pRoot)) {
+		right.pRoot->IsRed = false;
+		++right.Height;
+	}
+
+	pNode->pLeft  = nullptr;
+	pNode->pRight = nullptr;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	SplitTree()
+//
+//	Splits a tree into the keys less than key, the node holding key (or
+//	nullptr), and the keys greater than key.  Each level of the descent
+//	joins the subtree it did not descend into back onto one side, and since
+//	the heights being joined grow steadily, the total cost is O(log n).
+//
+static void SplitTree(const JoinTree_t& tree, const uint32_t key, JoinTree_t& less, LLTB_t*& pMatch, JoinTree_t& greater)
+{
+	if (nullptr == tree.pRoot) {
+		less.pRoot    = nullptr;
+		less.Height   = 0;
+		greater.pRoot = nullptr;
+		greater.Height= 0;
+		pMatch        = nullptr;
+		return;
+	}
+
+	LLTB_t*    pNode = tree.pRoot;
+	JoinTree_t left;
+	JoinTree_t right;
+
+	DetachChildren(tree, left, right);
+
+	if (key < pNode->Ref.Key) {
+		JoinTree_t rest;
+		SplitTree(left, key, less, pMatch, rest);
+		greater = JoinTrees(rest, pNode, right);
+	}
+	else if (key > pNode->Ref.Key) {
+		JoinTree_t rest;
+		SplitTree(right, key, rest, pMatch, greater);
+		less = JoinTrees(left, pNode, rest);
+	}
+	else {
+		less    = left;
+		greater = right;
+		pMatch  = pNode;
+		UpdateSize(pNode);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	JoinTwo()
+//
+//	Joins two trees without a separating key, by splitting the smallest
+//	node off the right tree and using it as the key.
+//
+static JoinTree_t JoinTwo(const JoinTree_t& left, const JoinTree_t& right)
+{
+	if (nullptr == left.pRoot) {
+		return right;
+	}
+
+	if (nullptr == right.pRoot) {
+		return left;
+	}
+
+	LLTB_t* pMin = right.pRoot;
+	while (nullptr != pMin->pLeft) {
+		pMin = pMin->pLeft;
+	}
+
+	JoinTree_t empty;
+	JoinTree_t rest;
+	LLTB_t*    pKey;
+
+	SplitTree(right, pMin->Ref.Key, empty, pKey, rest);
+
+	return JoinTrees(left, pKey, rest);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	ForkJoin()
+//
+//	Runs two independent halves of a set operation.  While fork levels
+//	remain and the subtrees are large enough to be worth it, the left half
+//	runs on a new thread while the current thread does the right half.
+//	Nodes dropped by the left half are collected separately and merged
+//	afterwards, since the node pool is not thread-safe.
+//
+template <typename Left_t, typename Right_t>
+static void ForkJoin(bool parallel, std::vector<LLTB_t*>& garbage, Left_t leftWork, Right_t rightWork)
+{
+	if (parallel) {
+		std::vector<LLTB_t*> leftGarbage;
+		std::thread worker([&]() { leftWork(leftGarbage); });
+		rightWork(garbage);
+		worker.join();
+		garbage.insert(garbage.end(), leftGarbage.begin(), leftGarbage.end());
+	}
+	else {
+		leftWork(garbage);
+		rightWork(garbage);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	UnionRec()
+//
+//	Join-based union: split b around the root of a, recurse on the two
+//	halves, then join the results back together around a's root.  When a
+//	key is in both trees, a's node is kept and b's node is dropped.
+//
+//	Dropped nodes are added to `garbage` with their children detached, to
+//	be freed once all threads are done.
+//
+static JoinTree_t UnionRec(const JoinTree_t& a, const JoinTree_t& b, int forks, std::vector<LLTB_t*>& garbage)
+{
+	if (nullptr == a.pRoot) {
+		return b;
+	}
+
+	if (nullptr == b.pRoot) {
+		return a;
+	}
+
+	LLTB_t*    pNode = a.pRoot;
+	JoinTree_t aLeft, aRight, bLeft, bRight, left, right;
+	LLTB_t*    pMatch;
+
+	DetachChildren(a, aLeft, aRight);
+	SplitTree(b, pNode->Ref.Key, bLeft, pMatch, bRight);
+
+	if (nullptr != pMatch) {
+		garbage.push_back(pMatch);
+	}
+
+	bool parallel = (forks > 0) && (a.Height >= PARALLEL_MIN_HEIGHT) && (b.Height >= PARALLEL_MIN_HEIGHT);
+
+	ForkJoin(parallel, garbage,
+		[&](std::vector<LLTB_t*>& g) { left  = UnionRec(aLeft, bLeft, forks - 1, g); },
+		[&](std::vector<LLTB_t*>& g) { right = UnionRec(aRight, bRight, forks - 1, g); });
+
+	return JoinTrees(left, pNode, right);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	IntersectRec()
+//
+//	Keeps a's node for every key found in both trees.
+//
+static JoinTree_t IntersectRec(const JoinTree_t& a, const JoinTree_t& b, int forks, std::vector<LLTB_t*>& garbage)
+{
+	if ((nullptr == a.pRoot) || (nullptr == b.pRoot)) {
+		// Whatever is left of the other tree has no match.
+		if (nullptr != a.pRoot) {
+			garbage.push_back(a.pRoot);
+		}
+
+		if (nullptr != b.pRoot) {
+			garbage.push_back(b.pRoot);
+		}
+
+		JoinTree_t empty = { nullptr, 0 };
+		return empty;
+	}
+
+	LLTB_t*    pNode = a.pRoot;
+	JoinTree_t aLeft, aRight, bLeft, bRight, left, right;
+	LLTB_t*    pMatch;
+
+	DetachChildren(a, aLeft, aRight);
+	SplitTree(b, pNode->Ref.Key, bLeft, pMatch, bRight);
+
+	bool parallel = (forks > 0) && (a.Height >= PARALLEL_MIN_HEIGHT) && (b.Height >= PARALLEL_MIN_HEIGHT);
+
+	ForkJoin(parallel, garbage,
+		[&](std::vector<LLTB_t*>& g) { left  = IntersectRec(aLeft, bLeft, forks - 1, g); },
+		[&](std::vector<LLTB_t*>& g) { right = IntersectRec(aRight, bRight, forks - 1, g); });
+
+	if (nullptr != pMatch) {
+		garbage.push_back(pMatch);
+		return JoinTrees(left, pNode, right);
+	}
+
+	garbage.push_back(pNode);
+
+	return JoinTwo(left, right);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	DifferenceRec()
+//
+//	Removes from a every key found in b.  Here a is split around the root
+//	of b, so that b's nodes (which are all dropped) drive the recursion.
+//
+static JoinTree_t DifferenceRec(const JoinTree_t& a, const JoinTree_t& b, int forks, std::vector<LLTB_t*>& garbage)
+{
+	if ((nullptr == a.pRoot) || (nullptr == b.pRoot)) {
+		if (nullptr != b.pRoot) {
+			garbage.push_back(b.pRoot);
+		}
+
+		return a;
+	}
+
+	LLTB_t*    pNode = b.pRoot;
+	JoinTree_t aLeft, aRight, bLeft, bRight, left, right;
+	LLTB_t*    pMatch;
+
+	DetachChildren(b, bLeft, bRight);
+	SplitTree(a, pNode->Ref.Key, aLeft, pMatch, aRight);
+
+	garbage.push_back(pNode);
+
+	if (nullptr != pMatch) {
+		garbage.push_back(pMatch);
+	}
+
+	bool parallel = (forks > 0) && (a.Height >= PARALLEL_MIN_HEIGHT) && (b.Height >= PARALLEL_MIN_HEIGHT);
+
+	ForkJoin(parallel, garbage,
+		[&](std::vector<LLTB_t*>& g) { left  = DifferenceRec(aLeft, bLeft, forks - 1, g); },
+		[&](std::vector<LLTB_t*>& g) { right = DifferenceRec(aRight, bRight, forks - 1, g); });
+
+	return JoinTwo(left, right);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	ForkLevels()
+//
+//	Number of times a set operation may fork, which gives one thread per
+//	hardware thread at the bottom of the fork tree.
+//
+static int ForkLevels(void)
+{
+	unsigned threads = std::thread::hardware_concurrency();
+	int      levels  = 0;
+
+	while ((1u << levels) < threads) {
+		++levels;
 	}
 
-	// Check to see if the value is already in the tree.  If so, we
-	// simply replace the value of the key, since duplicate keys are
-	// not allowed.
-	if (ref.Key == pNode->Ref.Key) {
-		pNode->Ref = ref;
+	return levels;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	AdoptNodes()
+//
+//	Makes every node in `other` belong to this tree's pool, so that the two
+//	trees can exchange nodes.  This is O(1) in slabs when the other tree's
+//	pool is private.  If the other pool is shared with yet another tree,
+//	the nodes cannot be moved, so the other tree is rebuilt from a copy.
+//
+void LeftLeaningRedBlack::AdoptNodes(LeftLeaningRedBlack& other)
+{
+	StopCompact();
+	other.StopCompact();
+
+	if (other.m_pPool == m_pPool) {
+		return;
 	}
 
-	// Otherwise recurse left or right depending on key value.
-	//
-	// Note: pLeft or pRight may be a nullptr pointer before recursing.
-	// This indicates that pNode is a leaf (or only has one child),
-	// so the new node will be inserted using the return value.
-	//
-	// The other reason for pass-by-value, followed by an assignment,
-	// is that the recursive call may perform a rotation, so the
-	// pointer that gets passed in may end up not being the root of
-	// the subtree once the recursion returns.
-	//
-	else {
-		if (ref.Key < pNode->Ref.Key) {
-			pNode->pLeft = InsertRec(pNode->pLeft, ref);
+	if (1 != other.m_pPool.use_count()) {
+		std::vector<VoidRef_t> refs;
+
+		for (Iterator it = other.begin(); it != other.end(); ++it) {
+			refs.push_back(*it);
 		}
-		else {
-			pNode->pRight = InsertRec(pNode->pRight, ref);
+
+		NodePoolConfig_t config = other.m_pPool->Config();
+
+		// The keys stay the same, so the rebuild is not logged.
+		WriteAheadLog* pLog = other.m_pLog;
+		other.m_pLog = nullptr;
+
+		other.FreeAll();
+		other.m_pPool = std::make_shared<NodePool>(sizeof(LLTB_t));
+		other.m_pPool->Configure(config);
+		other.BuildFromSorted(refs.data(), refs.size());
+
+		other.m_pLog = pLog;
+	}
+
+	m_pPool->Splice(*other.m_pPool);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Split()
+//
+//	Moves every key >= key from this tree into `right`, replacing whatever
+//	`right` held before.  O(log n).
+//
+//	The nodes stay where they are, so afterwards the two trees share this
+//	tree's node pool.
+//
+//	With a log attached, each tree logs the keys it loses as deleted and
+//	the keys it gains as inserted, which adds O(k) for k keys moved.
+//
+void LeftLeaningRedBlack::Split(const uint32_t key, LeftLeaningRedBlack& right)
+{
+	StopCompact();
+
+	if (&right == this) {
+		return;
+	}
+
+	right.FreeAll();
+	right.m_pPool = m_pPool;
+
+	LogDeletes(lower_bound(key), end());
+	right.LogInserts(lower_bound(key), end());
+
+	JoinTree_t tree = { m_pRoot, BlackHeight(m_pRoot) };
+	JoinTree_t less, greater;
+	LLTB_t*    pMatch;
+
+	SplitTree(tree, key, less, pMatch, greater);
+
+	// The matching key belongs on the right, as its new smallest key.
+	if (nullptr != pMatch) {
+		JoinTree_t empty = { nullptr, 0 };
+		greater = JoinTrees(empty, pMatch, greater);
+	}
+
+	m_pRoot       = less.pRoot;
+	right.m_pRoot = greater.pRoot;
+
+	DropFinger();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Join()
+//
+//	Appends ref followed by all of `right` to this tree.  Every key in this
+//	tree must be less than ref.Key, and every key in `right` greater.  If
+//	that does not hold, nothing is changed and false is returned.
+//
+//	Runs in O(|h1 - h2|) plus the cost of adopting right's nodes, and one
+//	log record for every key that moves, if either tree has a log.
+//
+bool LeftLeaningRedBlack::Join(VoidRef_t ref, LeftLeaningRedBlack& right)
+{
+	if (&right == this) {
+		return false;
+	}
+
+	if (nullptr != m_pRoot) {
+		LLTB_t* pMax = m_pRoot;
+		while (nullptr != pMax->pRight) {
+			pMax = pMax->pRight;
+		}
+
+		if (false == (pMax->Ref.Key < ref.Key)) {
+			return false;
 		}
 	}
 
-	// If necessary, apply a rotation to get the correct representation
-	// in the parent node as we're backing out of the recursion.  This
-	// places the tree in a state where the parent can safely apply a
-	// rotation to restore the required black/red balance of the tree.
+	if (nullptr != right.m_pRoot) {
+		LLTB_t* pMin = FindMin(right.m_pRoot);
 
-	// Fix a right-leaning red node: this will assure that a 3-node is
-	// the left child.
-	if (IsRed(pNode->pRight) && (false == IsRed(pNode->pLeft))) {
-		pNode = RotateLeft(pNode);
+		if (false == (ref.Key < pMin->Ref.Key)) {
+			return false;
+		}
 	}
 
-	// Fix two reds in a row: this will rebalance a 4-node.
-	if (IsRed(pNode->pLeft) && IsRed(pNode->pLeft->pLeft)) {
-		pNode = RotateRight(pNode);
+	right.LogDeletes(right.begin(), right.end());
+
+	if (nullptr != m_pLog) {
+		m_LastLogged = m_pLog->Append(WAL_INSERT, ref.Key);
+	}
+
+	LogInserts(right.begin(), right.end());
+
+	AdoptNodes(right);
+
+	LLTB_t* pKey = NewNode();
+	pKey->Ref = ref;
+
+	JoinTree_t left    = { m_pRoot, BlackHeight(m_pRoot) };
+	JoinTree_t greater = { right.m_pRoot, BlackHeight(right.m_pRoot) };
+
+	m_pRoot       = JoinTrees(left, pKey, greater).pRoot;
+	right.m_pRoot = nullptr;
+
+	DropFinger();
+	right.DropFinger();
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	EraseRange()
+//
+//	Deletes every key in [lo, hi] and returns how many there were.  Two
+//	splits cut the range out as a subtree of its own, which is freed as a
+//	whole, and one join puts the rest back together, so this is
+//	O(log n + k) for k keys erased, against O(k log n) for deleting them
+//	one at a time.
+//
+//	The log has no record for a range, so when one is attached every
+//	erased key is logged as its own delete.
+//
+size_t LeftLeaningRedBlack::EraseRange(const uint32_t lo, const uint32_t hi)
+{
+	StopCompact();
+
+	if ((nullptr == m_pRoot) || (lo > hi)) {
+		return 0;
+	}
+
+	LogDeletes(lower_bound(lo), upper_bound(hi));
+
+	DropFinger();
+
+	JoinTree_t tree = { m_pRoot, BlackHeight(m_pRoot) };
+	JoinTree_t less, upper, inside, greater;
+	LLTB_t*    pLo;
+	LLTB_t*    pHi;
+
+	SplitTree(tree, lo, less, pLo, upper);
+	SplitTree(upper, hi, inside, pHi, greater);
+
+	m_pRoot = JoinTwo(less, greater).pRoot;
+
+	return Free(pLo) + Free(inside.pRoot) + Free(pHi);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Union()
+//
+//	Moves every key of `other` that is not already in this tree into this
+//	tree.  For keys in both trees this tree's ref is kept.
+//
+//	This takes O(m log(n/m + 1)) work for trees of size m <= n.  The two
+//	independent halves of each level are run on separate threads until
+//	there is one thread per hardware thread.
+//
+//	With a log attached, every key of `other` is logged as inserted here,
+//	even those this tree already holds, since that does no harm on replay.
+//
+void LeftLeaningRedBlack::Union(LeftLeaningRedBlack& other)
+{
+	if (&other == this) {
+		return;
+	}
+
+	other.LogDeletes(other.begin(), other.end());
+	LogInserts(other.begin(), other.end());
+
+	AdoptNodes(other);
+
+	JoinTree_t a = { m_pRoot, BlackHeight(m_pRoot) };
+	JoinTree_t b = { other.m_pRoot, BlackHeight(other.m_pRoot) };
+
+	std::vector<LLTB_t*> garbage;
+
+	m_pRoot       = UnionRec(a, b, ForkLevels(), garbage).pRoot;
+	other.m_pRoot = nullptr;
+
+	DropFinger();
+	other.DropFinger();
+
+	for (size_t i = 0; i < garbage.size(); ++i) {
+		Free(garbage[i]);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Intersect()
+//
+//	Keeps only the keys that are in both trees.  `other` ends up empty.
+//
+//	With a log attached, the two trees are walked side by side to find the
+//	keys this tree loses.
+//
+void LeftLeaningRedBlack::Intersect(LeftLeaningRedBlack& other)
+{
+	if (&other == this) {
+		return;
+	}
+
+	other.LogDeletes(other.begin(), other.end());
+
+	if (nullptr != m_pLog) {
+		Iterator theirs = other.begin();
+
+		for (Iterator it = begin(); it != end(); ++it) {
+			while ((theirs != other.end()) && (theirs->Key < it->Key)) {
+				++theirs;
+			}
+
+			if ((theirs == other.end()) || (it->Key < theirs->Key)) {
+				m_LastLogged = m_pLog->Append(WAL_DELETE, it->Key);
+			}
+		}
+	}
+
+	AdoptNodes(other);
+
+	JoinTree_t a = { m_pRoot, BlackHeight(m_pRoot) };
+	JoinTree_t b = { other.m_pRoot, BlackHeight(other.m_pRoot) };
+
+	std::vector<LLTB_t*> garbage;
+
+	m_pRoot       = IntersectRec(a, b, ForkLevels(), garbage).pRoot;
+	other.m_pRoot = nullptr;
+
+	DropFinger();
+	other.DropFinger();
+
+	for (size_t i = 0; i < garbage.size(); ++i) {
+		Free(garbage[i]);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Difference()
+//
+//	Removes every key that is in `other` from this tree.  `other` ends up
+//	empty.
+//
+//	With a log attached, every key of `other` is logged as deleted here,
+//	even those this tree does not hold, since that does no harm on replay.
+//
+void LeftLeaningRedBlack::Difference(LeftLeaningRedBlack& other)
+{
+	if (&other == this) {
+		FreeAll();
+		return;
+	}
+
+	other.LogDeletes(other.begin(), other.end());
+	LogDeletes(other.begin(), other.end());
+
+	AdoptNodes(other);
+
+	JoinTree_t a = { m_pRoot, BlackHeight(m_pRoot) };
+	JoinTree_t b = { other.m_pRoot, BlackHeight(other.m_pRoot) };
+
+	std::vector<LLTB_t*> garbage;
+
+	m_pRoot       = DifferenceRec(a, b, ForkLevels(), garbage).pRoot;
+	other.m_pRoot = nullptr;
+
+	DropFinger();
+	other.DropFinger();
+
+	for (size_t i = 0; i < garbage.size(); ++i) {
+		Free(garbage[i]);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	SubtreeCheck_t
+//
+//	What Validate() knows about a subtree once it has been checked: enough
+//	to check the node above it without looking inside it again.
+//
+struct SubtreeCheck_t
+{
+	LLRBError_t Error;
+	uint32_t    Key;
+	size_t      Count;
+	int         BlackHeight;
+	uint32_t    MinKey;
+	uint32_t    MaxKey;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	CheckNode()
+//
+//	The invariants that only involve a node and its children.  A 2-3 tree
+//	never has a red right child.  A 2-3-4 tree may, but only as half of a
+//	4-node, so the left child must be red too.
+//
+static LLRBError_t CheckNode(LLTB_t* pNode)
+{
+	if (IsRed(pNode->pRight)) {
+#if defined(USE_234_TREE)
+		if (false == IsRed(pNode->pLeft)) {
+			return LLRB_ERROR_RIGHT_LEANING;
+		}
+#else
+		return LLRB_ERROR_RIGHT_LEANING;
+#endif
+	}
+
+	if (pNode->IsRed && (IsRed(pNode->pLeft) || IsRed(pNode->pRight))) {
+		return LLRB_ERROR_RED_RED;
+	}
+
+#if defined(USE_ORDER_STATISTICS)
+	if (pNode->Size != (1 + SubtreeSize(pNode->pLeft) + SubtreeSize(pNode->pRight))) {
+		return LLRB_ERROR_SIZE;
+	}
+#endif
+
+	return LLRB_VALID;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	CheckSubtree()
+//
+//	Iterative in-order walk of a subtree.  The stack holds the nodes whose
+//	right subtrees are still to be visited, each with the number of black
+//	nodes from pRoot down to it, so every missing child can be checked
+//	against the black height of the first one found.
+//
+//	The stack only has to be as deep as the longest chain of left links,
+//	which is never more than LLRB_MAX_DEPTH in a valid tree.
+//
+static void CheckSubtree(LLTB_t* pRoot, SubtreeCheck_t& check)
+{
+	struct Frame_t
+	{
+		LLTB_t* pNode;
+		int     Blacks;
+	};
+
+	Frame_t  stack[LLRB_MAX_DEPTH];
+	int      depth  = 0;
+	int      blacks = 0;
+	LLTB_t*  pNode  = pRoot;
+
+	check.Error       = LLRB_VALID;
+	check.Key         = 0;
+	check.Count       = 0;
+	check.BlackHeight = -1;
+	check.MinKey      = 0;
+	check.MaxKey      = 0;
+
+	for (;;) {
+		while (nullptr != pNode) {
+			LLRBError_t error = (LLRB_MAX_DEPTH == depth) ? LLRB_ERROR_TOO_DEEP : CheckNode(pNode);
+
+			if (false == pNode->IsRed) {
+				++blacks;
+			}
+
+			if ((LLRB_VALID == error) && ((nullptr == pNode->pLeft) || (nullptr == pNode->pRight))) {
+				if (check.BlackHeight < 0) {
+					check.BlackHeight = blacks;
+				}
+				else if (blacks != check.BlackHeight) {
+					error = LLRB_ERROR_BLACK_HEIGHT;
+				}
+			}
+
+			if (LLRB_VALID != error) {
+				check.Error = error;
+				check.Key   = pNode->Ref.Key;
+				return;
+			}
+
+			stack[depth].pNode  = pNode;
+			stack[depth].Blacks = blacks;
+			++depth;
+
+			pNode = pNode->pLeft;
+		}
+
+		if (0 == depth) {
+			break;
+		}
+
+		--depth;
+		pNode  = stack[depth].pNode;
+		blacks = stack[depth].Blacks;
+
+		if (0 == check.Count) {
+			check.MinKey = pNode->Ref.Key;
+		}
+		else if (false == (check.MaxKey < pNode->Ref.Key)) {
+			check.Error = LLRB_ERROR_ORDER;
+			check.Key   = pNode->Ref.Key;
+			return;
+		}
+
+		check.MaxKey = pNode->Ref.Key;
+		++check.Count;
+
+		pNode = pNode->pRight;
+	}
+
+	if (check.BlackHeight < 0) {
+		check.BlackHeight = 0;
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	CheckSubtreeParallel()
+//
+//	Near the root, the two subtrees of each node are checked at the same
+//	time, the left one on a new thread, and the results are combined here
+//	with the same tests CheckSubtree() applies.  Below the fork levels, or
+//	once subtrees become too small to be worth a thread, this falls back
+//	to CheckSubtree().
+//
+//	When both subtrees are bad, the left one is reported, which matches
+//	what the serial walk would have found first.
+//
+static void CheckSubtreeParallel(LLTB_t* pNode, int forks, SubtreeCheck_t& check)
+{
+	if ((nullptr == pNode) || (forks <= 0) || (BlackHeight(pNode) < PARALLEL_MIN_HEIGHT)) {
+		CheckSubtree(pNode, check);
+		return;
+	}
+
+	check.Error = CheckNode(pNode);
+	check.Key   = pNode->Ref.Key;
+
+	if (LLRB_VALID != check.Error) {
+		return;
+	}
+
+	SubtreeCheck_t left;
+	SubtreeCheck_t right;
+
+	std::thread worker([&]() { CheckSubtreeParallel(pNode->pLeft, forks - 1, left); });
+	CheckSubtreeParallel(pNode->pRight, forks - 1, right);
+	worker.join();
+
+	if (LLRB_VALID != left.Error) {
+		check = left;
+	}
+	else if ((0 != left.Count) && (false == (left.MaxKey < pNode->Ref.Key))) {
+		check.Error = LLRB_ERROR_ORDER;
+	}
+	else if (LLRB_VALID != right.Error) {
+		check = right;
+	}
+	else if ((0 != right.Count) && (false == (pNode->Ref.Key < right.MinKey))) {
+		check.Error = LLRB_ERROR_ORDER;
+		check.Key   = right.MinKey;
 	}
-
-	// If we perform the color flip here, the tree is assembled as a
-	// mapping of a 2-3 tree.
-#if !defined(USE_234_TREE)
-	// This color flip will effectively split 4-nodes on the way back
-	// out of the tree.  By doing this here, there will be no 4-nodes
-	// left in the tree after the insertion is complete.
-	if (IsRed(pNode->pLeft) && IsRed(pNode->pRight)) {
-		ColorFlip(pNode);
+	else if (left.BlackHeight != right.BlackHeight) {
+		check.Error = LLRB_ERROR_BLACK_HEIGHT;
+	}
+	else {
+		check.Count       = left.Count + 1 + right.Count;
+		check.BlackHeight = left.BlackHeight + (pNode->IsRed ? 0 : 1);
+		check.MinKey      = (0 != left.Count) ? left.MinKey : pNode->Ref.Key;
+		check.MaxKey      = (0 != right.Count) ? right.MaxKey : pNode->Ref.Key;
 	}
-#endif
-	// Return the new root of the subtree that was just updated,
-	// since rotations may have changed the value of this pointer.
-	return pNode;
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
-//	MoveRedLeft()
+//	Validate()
 //
-//	This code assumes that either pNode or pNode->pLeft are red.
+//	Checks that the keys are in order, that red links lean left as the
+//	tree's 2-3 or 2-3-4 arrangement requires, that no red node has a red
+//	child, that every path from the root to a leaf crosses the same number
+//	of black nodes, that the root is black, and under USE_ORDER_STATISTICS
+//	that every subtree size is right.
 //
-static LLTB_t* MoveRedLeft(LLTB_t* pNode)
+//	Returns false if any of these fail, with check.Error saying which rule
+//	was broken and check.Key where.
+//
+bool LeftLeaningRedBlack::Validate(LLRBCheck_t& check, bool parallel) const
 {
-	// If both children are black, we turn these three nodes into a
-	// 4-node by applying a color flip.
-	ColorFlip(pNode);
-
-	// But we may end up with a case where pRight has a red child.
-	// Apply a pair of rotations and a color flip to make pNode a
-	// red node, both of its children become black nodes, and pLeft
-	// becomes a 3-node.
-	if ((nullptr != pNode->pRight) && IsRed(pNode->pRight->pLeft)) {
-		pNode->pRight = RotateRight(pNode->pRight);
-		pNode = RotateLeft(pNode);
+	SubtreeCheck_t result;
 
-		ColorFlip(pNode);
+	if (IsRed(m_pRoot)) {
+		result.Error = LLRB_ERROR_RED_ROOT;
+		result.Key   = m_pRoot->Ref.Key;
+	}
+	else {
+		CheckSubtreeParallel(m_pRoot, parallel ? ForkLevels() : 0, result);
 	}
 
-	return pNode;
+	check.Error       = result.Error;
+	check.Key         = (LLRB_VALID != result.Error) ? result.Key : 0;
+	check.Count       = (LLRB_VALID == result.Error) ? result.Count : 0;
+	check.BlackHeight = (LLRB_VALID == result.Error) ? result.BlackHeight : 0;
+
+	return (LLRB_VALID == result.Error);
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
-//	MoveRedRight()
-//
-//	This code assumes that either pNode or pNode->Right is a red node.
+//	ErrorText()
 //
-static LLTB_t* MoveRedRight(LLTB_t* pNode)
+const char* LeftLeaningRedBlack::ErrorText(LLRBError_t error)
 {
-	// Applying a color flip may turn pNode into a 4-node,
-	// with both of its children being red.
-	ColorFlip(pNode);
+	switch (error) {
+		case LLRB_VALID:				return "valid";
+		case LLRB_ERROR_RED_ROOT:		return "root is red";
+		case LLRB_ERROR_ORDER:			return "keys out of order";
+		case LLRB_ERROR_RIGHT_LEANING:	return "red right child";
+		case LLRB_ERROR_RED_RED:		return "red node with red child";
+		case LLRB_ERROR_BLACK_HEIGHT:	return "unequal black height";
+		case LLRB_ERROR_SIZE:			return "wrong subtree size";
+		case LLRB_ERROR_TOO_DEEP:		return "tree too deep";
+	}
 
-	// However, this may cause a situation where both of pNode's
-	// children are red, along with pNode->pLeft->pLeft.  Applying a
-	// rotation and a color flip will fix this special case, since
-	// it makes pNode red and pNode's children black.
-	if ((nullptr != pNode->pLeft) && IsRed(pNode->pLeft->pLeft)) {
-		pNode = RotateRight(pNode);
+	return "unknown error";
+}
 
-		ColorFlip(pNode);
-	}
 
-	return pNode;
+#if defined(USE_ORDER_STATISTICS)
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Size()
+//
+size_t LeftLeaningRedBlack::Size(void) const
+{
+	return SubtreeSize(m_pRoot);
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
-//	FindMin()
+//	Rank()
 //
-//	Find the node under pNode that contains the smallest key value.
+//	Returns the number of keys in the tree that are less than key.  Every
+//	time the search turns right, the left subtree and the node itself are
+//	all smaller than key.
 //
-static LLTB_t* FindMin(LLTB_t* pNode)
+size_t LeftLeaningRedBlack::Rank(const uint32_t key) const
 {
-	while (nullptr != pNode->pLeft) {
-		pNode = pNode->pLeft;
+	size_t  rank  = 0;
+	LLTB_t* pNode = m_pRoot;
+
+	while (nullptr != pNode) {
+		if (key <= pNode->Ref.Key) {
+			pNode = pNode->pLeft;
+		}
+		else {
+			rank += SubtreeSize(pNode->pLeft) + 1;
+			pNode = pNode->pRight;
+		}
 	}
 
-	return pNode;
+	return rank;
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
-//	FixUp()
+//	Select()
 //
-//	Apply fix-up logic during deletion.  Applying color flips and rotations
-//	will preserve perfect black-link balance.  This will also fix any
-//	right-leaning red nodes and eliminate 4-nodes when backing out of
-//	recursive calls.
+//	Returns the ref holding the k-th smallest key, counting from 0, or
+//	nullptr if the tree has k or fewer keys.
 //
-static LLTB_t* FixUp(LLTB_t* pNode)
+void* LeftLeaningRedBlack::Select(size_t k) const
 {
-	// Fix right-leaning red nodes.
-	if (IsRed(pNode->pRight)) {
-		pNode = RotateLeft(pNode);
-	}
+	LLTB_t* pNode = m_pRoot;
 
-	// Detect if there is a 4-node that traverses down the left.
-	// This is fixed by a right rotation, making both of the red
-	// nodes the children of pNode.
-	if (IsRed(pNode->pLeft) && IsRed(pNode->pLeft->pLeft)) {
-		pNode = RotateRight(pNode);
-	}
+	while (nullptr != pNode) {
+		size_t leftSize = SubtreeSize(pNode->pLeft);
 
-	// Split 4-nodes.
-	if (IsRed(pNode->pLeft) && IsRed(pNode->pRight)) {
-		ColorFlip(pNode);
+		if (k < leftSize) {
+			pNode = pNode->pLeft;
+		}
+		else if (k == leftSize) {
+			return &(pNode->Ref);
+		}
+		else {
+			k -= leftSize + 1;
+			pNode = pNode->pRight;
+		}
 	}
 
-	return pNode;
+	return nullptr;
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
-//	Delete()
+//	CountRange()
 //
-void LeftLeaningRedBlack::Delete(const uint32_t key)
+//	Returns the number of keys in [lo, hi].  The keys <= hi are counted
+//	directly rather than as Rank(hi + 1), so that hi may be UINT32_MAX.
+//
+size_t LeftLeaningRedBlack::CountRange(const uint32_t lo, const uint32_t hi) const
 {
-	if (nullptr != m_pRoot) {
-		m_pRoot = DeleteRec(m_pRoot, key);
+	if (lo > hi) {
+		return 0;
+	}
 
-		// Assuming we have not deleted the last node from the tree, we
-		// need to force the root to be a black node to conform with the
-		// the rules of a red-black tree.
-		if (nullptr != m_pRoot) {
-			m_pRoot->IsRed = false;
+	size_t  atMostHi = 0;
+	LLTB_t* pNode    = m_pRoot;
+
+	while (nullptr != pNode) {
+		if (hi < pNode->Ref.Key) {
+			pNode = pNode->pLeft;
+		}
+		else {
+			atMostHi += SubtreeSize(pNode->pLeft) + 1;
+			pNode = pNode->pRight;
 		}
 	}
+
+	return atMostHi - Rank(lo);
 }
 
+#endif // USE_ORDER_STATISTICS
+
 
 /////////////////////////////////////////////////////////////////////////////
 //
-//	DeleteRec()
+//	SaveSnapshot()
+//
+//	Numbers the nodes in pre-order with an explicit stack.  A child does not
+//	know its index until it is popped, so each stack entry remembers which
+//	link of its parent to fill in at that point.
 //
-LLTB_t* LeftLeaningRedBlack::DeleteRec(LLTB_t* pNode, const uint32_t key)
+bool LeftLeaningRedBlack::SaveSnapshot(const char* path) const
 {
-	if (key < pNode->Ref.Key) {
-		if (nullptr != pNode->pLeft) {
-			// If pNode and pNode->pLeft are black, we may need to
-			// move pRight to become the left child if a deletion
-			// would produce a red node.
-			if ((false == IsRed(pNode->pLeft)) && (false == IsRed(pNode->pLeft->pLeft))) {
-				pNode = MoveRedLeft(pNode);
-			}
+	struct Pending_t
+	{
+		const LLTB_t* pNode;
+		uint32_t      Parent;
+		bool          IsRight;
+	};
 
-			pNode->pLeft = DeleteRec(pNode->pLeft, key);
-		}
+	std::vector<LLTBCompact_t> records(1);
+	std::vector<Pending_t>     stack;
+
+	records[0].Ref.Key      = 0;
+	records[0].LeftAndColor = 0;
+	records[0].Right        = 0;
+
+	if (nullptr != m_pRoot) {
+		Pending_t root = { m_pRoot, 0, false };
+		stack.push_back(root);
 	}
-	else {
-		// If the left child is red, apply a rotation so we make
-		// the right child red.
-		if (IsRed(pNode->pLeft)) {
-			pNode = RotateRight(pNode);
-		}
 
-		// Special case for deletion of a leaf node.
-		// The arrangement logic of LLRBs assures that in this case,
-		// pNode cannot have a left child.
-		if ((key == pNode->Ref.Key) && (nullptr == pNode->pRight)) {
-			Free(pNode);
-			return nullptr;
+	while (false == stack.empty()) {
+		Pending_t next = stack.back();
+		stack.pop_back();
+
+		if (records.size() >= size_t(LLTB_COMPACT_RED - 1)) {
+			return false;
 		}
 
-		// If we get here, we need to traverse down the right node.
-		// However, if there is no right node, then the target key is
-		// not in the tree, so we can break out of the recursion.
-		if (nullptr != pNode->pRight) {
-			if ((false == IsRed(pNode->pRight)) && (false == IsRed(pNode->pRight->pLeft))) {
-				pNode = MoveRedRight(pNode);
-			}
+		uint32_t index = uint32_t(records.size());
 
-			// Deletion of an internal node: We cannot delete this node
-			// from the tree, so we have to find the node containing
-			// the smallest key value that is larger than the key we're
-			// deleting.  This other key will replace the value we're
-			// deleting, then we can delete the node that previously
-			// held the key/value pair we just moved.
-			if (key == pNode->Ref.Key) {
-				pNode->Ref = FindMin(pNode->pRight)->Ref;
-				pNode->pRight = DeleteMin(pNode->pRight);
+		LLTBCompact_t record;
+		record.Ref          = next.pNode->Ref;
+		record.LeftAndColor = next.pNode->IsRed ? LLTB_COMPACT_RED : 0;
+		record.Right        = 0;
+		records.push_back(record);
+
+		if (0 != next.Parent) {
+			if (next.IsRight) {
+				records[next.Parent].Right = index;
 			}
 			else {
-				pNode->pRight = DeleteRec(pNode->pRight, key);
+				records[next.Parent].LeftAndColor |= index;
 			}
 		}
+
+		// Push the right child first so that the left subtree is numbered
+		// before it.
+		if (nullptr != next.pNode->pRight) {
+			Pending_t right = { next.pNode->pRight, index, true };
+			stack.push_back(right);
+		}
+
+		if (nullptr != next.pNode->pLeft) {
+			Pending_t left = { next.pNode->pLeft, index, false };
+			stack.push_back(left);
+		}
 	}
 
-	// Fix right-leaning red nodes and eliminate 4-nodes on the way up.
-	// Need to avoid allowing search operations to terminate on 4-nodes,
-	// or searching may not locate intended key.
-	return FixUp(pNode);
+	return LeftLeaningRedBlackSnapshot::Write(path, records.data(), uint32_t(records.size() - 1), m_LastLogged);
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
-//	DeleteMin()
+//	LoadSnapshot()
 //
-//	Delete the bottom node on the left spine while maintaining balance.
-//	To do so, we maintain the invariant that the current node or its left
-//	child is red.
+//	Copies the mapped records into one contiguous block of nodes, where
+//	record i becomes node i - 1, so each index turns into a pointer with
+//	one add.
 //
-//	The only reason this is a member function instead of a static function
-//	like all of the other support functions is because it needs to call
-//	Free().
+//	LeftLeaningRedBlackSnapshot::CheckNodes() first makes sure that the
+//	records form one valid LLRB, in this file's arrangement, with no shared
+//	or stray nodes.  A file that fails the check, or whose header is
+//	damaged, leaves the tree as it was.  Damage that keeps the tree valid,
+//	such as a changed key that is still in order, cannot be detected.
 //
-LLTB_t* LeftLeaningRedBlack::DeleteMin(LLTB_t* pNode)
+//	With a log attached, the old keys are logged as deleted and the loaded
+//	ones as inserted.  Recover() loads into a tree with no log.
+//
+bool LeftLeaningRedBlack::LoadSnapshot(const char* path)
 {
-	// If this node has no children, we're done.
-	// Due to the arrangement of an LLRB tree, the node cannot have a
-	// right child.
-	if (NULL == pNode->pLeft) {
-		Free(pNode);
-		return NULL;
+	LeftLeaningRedBlackSnapshot snapshot;
+
+	if (false == snapshot.Open(path)) {
+		return false;
 	}
 
-	// If these nodes are black, we need to rearrange this subtree to
-	// force the left child to be red.
-	if ((false == IsRed(pNode->pLeft)) && (false == IsRed(pNode->pLeft->pLeft))) {
-		pNode = MoveRedLeft(pNode);
+	const LLTBCompact_t* pRecords = snapshot.Nodes();
+	uint32_t             count    = snapshot.Count();
+
+#if defined(USE_234_TREE)
+	const bool allow4Nodes = true;
+#else
+	const bool allow4Nodes = false;
+#endif
+
+	if (false == LeftLeaningRedBlackSnapshot::CheckNodes(pRecords, count, allow4Nodes)) {
+		return false;
 	}
 
-	// Continue recursing to locate the node to delete.
-	pNode->pLeft = DeleteMin(pNode->pLeft);
+	std::shared_ptr<NodePool> pPool = std::make_shared<NodePool>(sizeof(LLTB_t));
+	LLTB_t*                   pNodes = nullptr;
 
-	// Fix right-leaning red nodes and eliminate 4-nodes on the way up.
-	// Need to avoid allowing search operations to terminate on 4-nodes,
-	// or searching may not locate intended key.
-	return FixUp(pNode);
+	pPool->Configure(m_pPool->Config());
+
+	if (0 != count) {
+		pNodes = static_cast<LLTB_t*>(pPool->AllocContiguous(count));
+	}
+
+	for (uint32_t i = 1; i <= count; ++i) {
+		uint32_t left  = pRecords[i].LeftAndColor & ~LLTB_COMPACT_RED;
+		uint32_t right = pRecords[i].Right;
+
+		LLTB_t* pNode = pNodes + (i - 1);
+		pNode->Ref    = pRecords[i].Ref;
+		pNode->IsRed  = (0 != (pRecords[i].LeftAndColor & LLTB_COMPACT_RED));
+		pNode->pLeft  = (0 == left)  ? nullptr : (pNodes + (left - 1));
+		pNode->pRight = (0 == right) ? nullptr : (pNodes + (right - 1));
+	}
+
+#if defined(USE_ORDER_STATISTICS)
+	// Children come after their parents, so a reverse pass sees every
+	// child before its parent.
+	for (uint32_t i = count; i > 0; --i) {
+		UpdateSize(pNodes + (i - 1));
+	}
+#endif
+
+	FreeAll();
+
+	if (nullptr != m_pLog) {
+		for (uint32_t i = 1; i <= count; ++i) {
+			m_LastLogged = m_pLog->Append(WAL_INSERT, pRecords[i].Ref.Key);
+		}
+	}
+
+	m_pPool = pPool;
+	m_pRoot = pNodes;
+
+	return true;
 }
 
+
 /////////////////////////////////////////////////////////////////////////////
 //
-//	Traverse()
+//	Freeze()
 //
-//	Perform an in-order traversal of the tree, printing out all of the key
-//	values in the tree.  This should display all keys in their sorted order.
+bool LeftLeaningRedBlack::Freeze(FrozenLeftLeaningRedBlack& frozen) const
+{
+	return frozen.Build(*this);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
 //
-void LeftLeaningRedBlack::Traverse(void)
+//	GetStats()
+//
+//	The counters are read while other threads may still be bumping them,
+//	so each one is exact, but they are not a consistent snapshot of each
+//	other.
+//
+void LeftLeaningRedBlack::GetStats(LLRBStats_t& stats) const
 {
-	if (nullptr != m_pRoot) {
-		uint32_t prev = 0;
-		TraverseRec(m_pRoot, prev);
+	for (int i = 0; i < LLRB_COUNTER_COUNT; ++i) {
+		stats.Counters[i] = 0;
 	}
+	for (int i = 0; i < LLRB_STATS_DEPTHS; ++i) {
+		stats.LookUpDepth[i] = 0;
+	}
+	stats.LookUpDepthSum = 0;
+
+#if defined(USE_LLRB_STATS)
+	StatsRegistry_t& registry = Registry();
+	std::lock_guard<std::mutex> lock(registry.Lock);
+
+	for (const StatsBlock_t* pBlock = &registry.Retired; nullptr != pBlock; ) {
+		for (int i = 0; i < LLRB_COUNTER_COUNT; ++i) {
+			stats.Counters[i] += pBlock->Counters[i].load(std::memory_order_relaxed);
+		}
+		for (int i = 0; i < LLRB_STATS_DEPTHS; ++i) {
+			stats.LookUpDepth[i] += pBlock->LookUpDepth[i].load(std::memory_order_relaxed);
+		}
+		stats.LookUpDepthSum += pBlock->LookUpDepthSum.load(std::memory_order_relaxed);
+
+		pBlock = (&registry.Retired == pBlock) ? registry.pLive : pBlock->pNext;
+	}
+#endif
+
+	stats.PoolNodeSize      = m_pPool->NodeSize();
+	stats.PoolLiveNodes     = m_pPool->LiveCount();
+	stats.PoolReservedBytes = m_pPool->ReservedBytes();
+	stats.PoolSlabs         = m_pPool->SlabCount();
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
-//	TraverseRec()
+//	ResetStats()
 //
-void LeftLeaningRedBlack::TraverseRec(LLTB_t* pNode, uint32_t& prev)
+void LeftLeaningRedBlack::ResetStats(void)
 {
-	if (!(nullptr != pNode))
-	{
-		cout << "\nOnly root to traverse.\n";
-	}
-	if (nullptr != pNode->pLeft) {
-		TraverseRec(pNode->pLeft, prev);
+#if defined(USE_LLRB_STATS)
+	StatsRegistry_t& registry = Registry();
+	std::lock_guard<std::mutex> lock(registry.Lock);
+
+	registry.Retired.Clear();
+
+	for (StatsBlock_t* pBlock = registry.pLive; nullptr != pBlock; pBlock = pBlock->pNext) {
+		pBlock->Clear();
 	}
-	if (!(prev < pNode->Ref.Key))
+#endif
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	WriteStats()
+//
+//	The rebalancing steps are one counter family labelled by step, so a
+//	dashboard can compare them directly between 2-3 and 2-3-4 builds.  The
+//	depth histogram uses cumulative "le" buckets as Prometheus expects.
+//	Buckets past the deepest search seen so far are left out, since they
+//	would all repeat the total.
+//
+void LeftLeaningRedBlack::WriteStats(std::ostream& out, const LLRBStats_t& stats, const char* prefix)
+{
+	static const char* s_StepNames[] =
 	{
-		cout << "\nRight child should not be greater than parent.\n";
+		"rotate_left",
+		"rotate_right",
+		"color_flip",
+		"move_red_left",
+		"move_red_right",
+		"fix_up"
+	};
+
+	out << "# HELP " << prefix << "_rebalance_total Rebalancing steps taken by insertions and deletions.\n";
+	out << "# TYPE " << prefix << "_rebalance_total counter\n";
+
+	for (int i = LLRB_COUNTER_ROTATE_LEFT; i <= LLRB_COUNTER_FIX_UP; ++i) {
+		out << prefix << "_rebalance_total{step=\"" << s_StepNames[i] << "\"} " << stats.Counters[i] << "\n";
 	}
-	prev = pNode->Ref.Key;
-	if (pNode->IsRed)
-		cout << "(Red) ";
-	else
-		cout << "(Black) ";
-	cout << pNode->Ref.Key << endl;
 
-	if (nullptr != pNode->pRight) {
-		TraverseRec(pNode->pRight, prev);
+	out << "# HELP " << prefix << "_nodes_allocated_total Tree nodes taken from node pools.\n";
+	out << "# TYPE " << prefix << "_nodes_allocated_total counter\n";
+	out << prefix << "_nodes_allocated_total " << stats.Counters[LLRB_COUNTER_NODE_ALLOC] << "\n";
+
+	out << "# HELP " << prefix << "_nodes_freed_total Tree nodes returned to node pools.\n";
+	out << "# TYPE " << prefix << "_nodes_freed_total counter\n";
+	out << prefix << "_nodes_freed_total " << stats.Counters[LLRB_COUNTER_NODE_FREE] << "\n";
+
+	uint64_t total   = 0;
+	int      deepest = 0;
+
+	for (int i = 0; i < LLRB_STATS_DEPTHS; ++i) {
+		total += stats.LookUpDepth[i];
+
+		if (0 != stats.LookUpDepth[i]) {
+			deepest = i;
+		}
+	}
+
+	out << "# HELP " << prefix << "_lookup_depth Nodes visited by each LookUp().\n";
+	out << "# TYPE " << prefix << "_lookup_depth histogram\n";
+
+	uint64_t cumulative = 0;
+
+	for (int i = 0; (i <= deepest) && (i < (LLRB_STATS_DEPTHS - 1)); ++i) {
+		cumulative += stats.LookUpDepth[i];
+
+		out << prefix << "_lookup_depth_bucket{le=\"" << i << "\"} " << cumulative << "\n";
 	}
+
+	out << prefix << "_lookup_depth_bucket{le=\"+Inf\"} " << total << "\n";
+	out << prefix << "_lookup_depth_sum " << stats.LookUpDepthSum << "\n";
+	out << prefix << "_lookup_depth_count " << total << "\n";
+
+	out << "# HELP " << prefix << "_pool_live_nodes Nodes in use in the tree's node pool.\n";
+	out << "# TYPE " << prefix << "_pool_live_nodes gauge\n";
+	out << prefix << "_pool_live_nodes " << stats.PoolLiveNodes << "\n";
+
+	out << "# HELP " << prefix << "_pool_node_bytes Size of each node in the tree's node pool.\n";
+	out << "# TYPE " << prefix << "_pool_node_bytes gauge\n";
+	out << prefix << "_pool_node_bytes " << stats.PoolNodeSize << "\n";
+
+	out << "# HELP " << prefix << "_pool_reserved_bytes Memory held by the tree's node pool.\n";
+	out << "# TYPE " << prefix << "_pool_reserved_bytes gauge\n";
+	out << prefix << "_pool_reserved_bytes " << stats.PoolReservedBytes << "\n";
+
+	out << "# HELP " << prefix << "_pool_slabs Slabs held by the tree's node pool.\n";
+	out << "# TYPE " << prefix << "_pool_slabs gauge\n";
+	out << prefix << "_pool_slabs " << stats.PoolSlabs << "\n";
 }
 
+
 /*Project Functions*/
 uint32_t LeftLeaningRedBlack::Max(uint32_t& left, uint32_t& right)
 {//Written by Brendan Aguiar
@@ -652,10 +3850,11 @@ uint32_t LeftLeaningRedBlack::Min(uint32_t& left, uint32_t& right)
 
 LLTB_t* LeftLeaningRedBlack::FindParent(LLTB_t* tempPtr, VoidRef_t ref)
 {//Written by Brendan Aguiar
-	if ((tempPtr->pLeft->Ref.Key == ref.Key) || (tempPtr->pRight->Ref.Key == ref.Key)) // Check children
-		return tempPtr;//return if child matches Key
-	else if (tempPtr->Ref.Key > ref.Key) //Search left subtree
-		return FindParent(tempPtr->pLeft, ref);
-	else //Search right subtree
-		return FindParent(tempPtr->pRight, ref);
+	LLTB_t* parent = nullptr; //root has no parent
+	while (nullptr != tempPtr && tempPtr->Ref.Key != ref.Key)
+	{
+		parent = tempPtr;
+		tempPtr = (ref.Key < tempPtr->Ref.Key) ? tempPtr->pLeft : tempPtr->pRight; //Search left or right subtree
+	}
+	return parent;
 }//end Find Parent
@@ -22,7 +22,8 @@
 //	insertions and look-ups, since fewer special cases are triggered due to
 //	how the nodes in the tree are arranged.  Test it if it matters, but in
 //	general, leave the USE_234_TREE symbol undefined for better overall
-//	performance.
+//	performance.  `make bench` builds llrb_bench and llrb_bench_234, which
+//	measure both arrangements against WideNodeTree and std::map.
 //
 //	By enforcing the left-leaning rule, fewer special cases need to be tested
 //	when performing insertions and deletions, meaning that less code needs to
@@ -51,6 +52,42 @@
 
 
 #include "VoidRef.h"
+#include "NodePool.h"
+#include <iosfwd>
+#include <iterator>
+#include <memory>
+
+
+// The height of an LLRB is at most 2 * log2(N + 1).  96 levels is enough
+// for any tree of 24-byte nodes that fits in a 48-bit address space, plus
+// the one extra level that the delete transforms may temporarily add.
+#define LLRB_MAX_DEPTH	96
+
+// Number of searches LookUpBatch() keeps in flight.  Each one has at most
+// one outstanding cache miss, so this should roughly match the number of
+// misses the core can track at once (10 to 20 on current x86 cores).
+#define LLRB_BATCH_WIDTH	16
+
+// Define this symbol to give every node a subtree-size field, which
+// enables the O(log n) Rank(), Select() and CountRange() queries.  This
+// grows each node from 24 to 32 bytes and adds a little work to every
+// rotation, so leave it undefined unless those queries are needed.
+//
+//#define USE_ORDER_STATISTICS
+
+// Define this symbol to count how often the rebalancing steps run, how
+// many nodes are allocated and freed, and how deep LookUp() searches go.
+// Each thread counts into its own block, so an event costs one
+// uncontended store, and when the symbol is undefined the counting
+// compiles away entirely.  GetStats() can be called either way; without
+// the symbol it only reports the node pool.
+//
+//#define USE_LLRB_STATS
+
+// LookUp() depths counted individually.  Deeper searches are counted in
+// the last bucket.
+#define LLRB_STATS_DEPTHS	64
+
 
 /*LLRBT class declarations provided by Lee Stanza*/
 struct LLTB_t
@@ -59,35 +96,611 @@ struct LLTB_t
 
 	bool IsRed;
 
+#if defined(USE_ORDER_STATISTICS)
+	// Number of nodes in the subtree rooted at this node.
+	size_t Size;
+#endif
+
 	LLTB_t* pLeft;
 	LLTB_t* pRight;
 };
 
 
+// One branch-light lower-bound search, advanced a level at a time.
+// LookUpBranchless(), LookUpPrefetch(), LookUpBatch() and LookUpAsync()
+// all walk the tree with this.  pFound is the last node where the search
+// went left, which holds the key if the key is in the tree at all.
+struct LLRBSearch_t
+{
+	LLTB_t*  pNode;
+	LLTB_t*  pFound;
+	uint32_t Key;
+
+	void Start(LLTB_t* pRoot, const uint32_t key)
+	{
+		pNode  = pRoot;
+		pFound = nullptr;
+		Key    = key;
+	}
+
+	// Moves down one level from pNode, which must not be nullptr.  Both
+	// updates compile to conditional moves.  Returns false once the
+	// search has run off the bottom of the tree.
+	bool Step(void)
+	{
+		bool goLeft = (Key <= pNode->Ref.Key);
+
+		pFound = goLeft ? pNode : pFound;
+		pNode  = goLeft ? pNode->pLeft : pNode->pRight;
+
+		return nullptr != pNode;
+	}
+
+	VoidRef_t* Result(void) const
+	{
+		return ((nullptr != pFound) && (Key == pFound->Ref.Key)) ? &(pFound->Ref) : nullptr;
+	}
+};
+
+
+enum LLRBCounter_t
+{
+	LLRB_COUNTER_ROTATE_LEFT,
+	LLRB_COUNTER_ROTATE_RIGHT,
+	LLRB_COUNTER_COLOR_FLIP,
+	LLRB_COUNTER_MOVE_RED_LEFT,
+	LLRB_COUNTER_MOVE_RED_RIGHT,
+	LLRB_COUNTER_FIX_UP,
+	LLRB_COUNTER_NODE_ALLOC,
+	LLRB_COUNTER_NODE_FREE,
+	LLRB_COUNTER_COUNT
+};
+
+
+struct LLRBStats_t
+{
+	// Totals for every tree in the process, summed over all threads,
+	// including threads that have exited.  All zero unless the tree was
+	// built with USE_LLRB_STATS.
+	uint64_t Counters[LLRB_COUNTER_COUNT];
+
+	// LookUpDepth[d] is the number of LookUp() calls that visited d nodes.
+	uint64_t LookUpDepth[LLRB_STATS_DEPTHS];
+	uint64_t LookUpDepthSum;
+
+	// The node pool of the tree GetStats() was called on.
+	size_t   PoolNodeSize;
+	size_t   PoolLiveNodes;
+	size_t   PoolReservedBytes;
+	size_t   PoolSlabs;
+};
+
+
+// What Validate() found wrong with a tree.
+enum LLRBError_t
+{
+	LLRB_VALID,
+	LLRB_ERROR_RED_ROOT,		// the root is red
+	LLRB_ERROR_ORDER,			// keys are not strictly increasing in order
+	LLRB_ERROR_RIGHT_LEANING,	// a red right child the tree does not allow
+	LLRB_ERROR_RED_RED,			// a red node has a red child
+	LLRB_ERROR_BLACK_HEIGHT,	// paths to the leaves cross different numbers of black nodes
+	LLRB_ERROR_SIZE,			// a subtree size is wrong (USE_ORDER_STATISTICS)
+	LLRB_ERROR_TOO_DEEP			// the tree is deeper than LLRB_MAX_DEPTH
+};
+
+
+struct LLRBCheck_t
+{
+	LLRBError_t Error;
+
+	// Key of the node where the error was found.  When the error involves
+	// two nodes, such as a red-red violation, this is the parent.
+	uint32_t    Key;
+
+	// Only filled in when the tree is valid.
+	size_t      Count;
+	int         BlackHeight;
+};
+
+
+class WriteAheadLog;
+class FrozenLeftLeaningRedBlack;
+class LookUpScheduler;
+class LookUpTask;
+
+
+// Optional trace hook invoked after each insertion.  pParent is nullptr
+// when the new node ended up as the root of the tree.
+typedef void (*InsertObserver_t)(const LLTB_t* pParent, const LLTB_t* pNode, void* pContext);
+
+
 class LeftLeaningRedBlack
 {
+public:
+	class Iterator;
+	typedef Iterator iterator;
+	typedef Iterator const_iterator;
+
 private:
 	LLTB_t* m_pRoot;
 
+	// All nodes for this tree are allocated from here.  The pool is only
+	// shared with other trees after Split(); such trees must be used from
+	// the same thread.
+	std::shared_ptr<NodePool> m_pPool;
+
+	InsertObserver_t m_pInsertObserver;
+	void*            m_pInsertContext;
+
+	// Optional durability log, and the sequence number of the last change
+	// this tree wrote to it.
+	WriteAheadLog* m_pLog;
+	uint64_t       m_LastLogged;
+
+	// Path from the root to where the last hinted operation ended up, with
+	// the open range of keys the subtree at each level can hold, so a
+	// search for a nearby key only has to climb to the lowest level that
+	// can hold it.  Allocated on first use, and emptied by every change to
+	// the tree that does not go through the finger.
+	struct Finger_t
+	{
+		int     Depth;
+		LLTB_t* Path[LLRB_MAX_DEPTH];
+		int64_t Lo[LLRB_MAX_DEPTH];
+		int64_t Hi[LLRB_MAX_DEPTH];
+	};
+
+	std::unique_ptr<Finger_t> m_pFinger;
+
+	void DropFinger(void)
+	{
+		if (nullptr != m_pFinger) {
+			m_pFinger->Depth = 0;
+		}
+	}
+
+	void    SeedFinger(const Iterator& hint);
+	LLTB_t* FingerSearch(const uint32_t key);
+
+	// State of an unfinished Compact() pass.  Nodes are moved into pPool
+	// in breadth-first order, starting at pFirst; see Compact().  Any
+	// change to the tree ends the pass.
+	struct Compaction_t
+	{
+		std::shared_ptr<NodePool> pPool;
+		LLTB_t* pFirst;
+		size_t  Head;
+		size_t  Tail;
+	};
+
+	std::unique_ptr<Compaction_t> m_pCompaction;
+
+	void StopCompact(void)
+	{
+		if (nullptr != m_pCompaction) {
+			AbandonCompact();
+		}
+	}
+
+	void    AbandonCompact(void);
+	LLTB_t* Relocate(LLTB_t* pNode);
+
+	// Copying would leave two trees freeing the same nodes.  Use move
+	// construction or Swap() to hand a tree over.
+	LeftLeaningRedBlack(const LeftLeaningRedBlack&);
+	LeftLeaningRedBlack& operator=(const LeftLeaningRedBlack&);
+
+	void ReportInsert(VoidRef_t ref);
+	void AdoptNodes(LeftLeaningRedBlack& other);
+
+	// The log only has records for single keys, so bulk changes log each
+	// key from first up to last as an insert or a delete.  These do
+	// nothing if no log is attached.
+	void LogInserts(Iterator first, const Iterator& last);
+	void LogDeletes(Iterator first, const Iterator& last);
+
 public:
 	LeftLeaningRedBlack(void);
+	LeftLeaningRedBlack(const VoidRef_t* pRefs, size_t count);
 	~LeftLeaningRedBlack(void);
+
+	// Moving takes over the nodes, the pool, the observer and the log, and
+	// leaves the source as an empty tree with a pool of its own.
+	LeftLeaningRedBlack(LeftLeaningRedBlack&& other);
+	LeftLeaningRedBlack& operator=(LeftLeaningRedBlack&& other);
+	void Swap(LeftLeaningRedBlack& other);
+
 	void FreeAll(void);
-	void Free(LLTB_t* pNode);
+	size_t Free(LLTB_t* pNode);
+
+	// Same as FreeAll(), except that the memory is released by a
+	// background thread, so the caller does not wait for a large tree to
+	// be torn down.
+	void FreeAllAsync(void);
+
+	// Sets the page size and NUMA node for the memory that later nodes
+	// are carved from.  See NodePool.h.
+	void             SetPoolConfig(const NodePoolConfig_t& config);
+	NodePoolConfig_t PoolConfig(void) const;
+
+	// Moves the nodes into a fresh arena in breadth-first order, so the
+	// top levels that every search passes through share cache lines and
+	// pages, and the old, fragmented slabs can be released.  Each call
+	// moves at most budget nodes, or all of them if budget is 0, and
+	// returns true while the pass has more to do.  The tree can be
+	// searched between calls; any change to it ends the pass early.
+	//
+	// Moving a node invalidates pointers returned by LookUp() for it, and
+	// every iterator.  A pool shared after Split() is left alone.
+	bool Compact(size_t budget = 0);
 	LLTB_t* NewNode(void);
 	
 	void* LookUp(const uint32_t value);
+	void* LookUpBranchless(const uint32_t value);
+	void* LookUpPrefetch(const uint32_t value);
+
+	// Looks up count keys at once, writing what LookUp() would return for
+	// pKeys[i] to ppOut[i].  Several searches are advanced in turn, so the
+	// cache misses of independent searches overlap instead of queuing.
+	// That only pays off once the tree is larger than the cache; for
+	// small trees a loop over LookUp() is faster.
+	void LookUpBatch(const uint32_t* pKeys, size_t count, void** ppOut);
+
+	// Coroutine version of LookUp(), for callers that await it from their
+	// own coroutines; see LookUpScheduler.h.  The search suspends to the
+	// scheduler at every level, so other work can run while the next node
+	// is fetched.  The tree must not change while any search is suspended.
+	LookUpTask LookUpAsync(LookUpScheduler& scheduler, const uint32_t value);
 	bool Insert(VoidRef_t ref);
 	LLTB_t* InsertRec(LLTB_t* pNode, VoidRef_t ref);
 	void Delete(const uint32_t value);
-	LLTB_t* DeleteRec(LLTB_t* pNode, const uint32_t value);
+
+	// Same as Delete(), but hands back the ref that was stored with the
+	// key.  Returns false if the key was not in the tree.
+	bool Extract(const uint32_t value, VoidRef_t& ref);
+
+	bool BuildFromSorted(const VoidRef_t* pRefs, size_t count);
+	LLTB_t* DeleteRec(LLTB_t* pNode, const uint32_t value, LLTB_t*& pRemoved);
 	LLTB_t* DeleteMin(LLTB_t* pNode);
+	LLTB_t* DeleteMax(LLTB_t* pNode);
+
+	// Remove the smallest or largest key and hand back its ref, in
+	// O(log n).  Return false if the tree is empty.
+	bool PopMin(VoidRef_t& ref);
+	bool PopMax(VoidRef_t& ref);
+
+	// Deletes every key in [lo, hi] in O(log n + k), and returns the
+	// number of keys deleted.
+	size_t EraseRange(const uint32_t lo, const uint32_t hi);
+
+	// Non-recursive versions of Insert() and Delete().  These keep the
+	// same invariants, but walk an explicit path stack instead of using
+	// the call stack.
+	bool InsertIterative(VoidRef_t ref);
+	void DeleteIterative(const uint32_t value);
+
+	// Finger search.  These start from wherever the previous hinted
+	// operation left off instead of from the root, so keys that arrive in
+	// increasing order, or close to the last key, are found or added after
+	// only a few steps.  The iterator versions start from hint instead,
+	// and are the same as the plain versions if hint is end() or belongs
+	// to another tree.  Insert() returns an iterator at the key.
+	//
+	// A lookup moves the finger too, so these must not be called from more
+	// than one thread at a time even when nothing is being changed.
+	bool     InsertNear(VoidRef_t ref);
+	void*    LookUpNear(const uint32_t value);
+	Iterator Insert(const Iterator& hint, VoidRef_t ref);
+	void*    LookUp(const Iterator& hint, const uint32_t value);
+
+	void SetInsertObserver(InsertObserver_t pObserver, void* pContext = nullptr);
+
+	// Every change to the tree is appended to the log before it is made.
+	// Changes to many keys at once, such as FreeAll(), BuildFromSorted(),
+	// Split(), Join(), the set operations and LoadSnapshot(), write one
+	// record per key they add or remove.  Pass nullptr to stop logging.
+	void AttachLog(WriteAheadLog* pLog);
+	static void PrintInsert(const LLTB_t* pParent, const LLTB_t* pNode, void* pContext);
 
 	void Traverse(void);
-	void TraverseRec(LLTB_t* pNode, uint32_t& prev);
+	void TraverseRec(LLTB_t* pNode);
+
+	// Checks every LLRB invariant without printing anything, and reports
+	// the first problem found.  This is O(n) with no recursion.  Passing
+	// parallel splits the work across hardware threads.
+	bool Validate(LLRBCheck_t& check, bool parallel = false) const;
+	static const char* ErrorText(LLRBError_t error);
+
+	// In-order iteration and range queries.  These do no I/O and no
+	// recursion.  Any change to the tree invalidates all iterators.
+	Iterator begin(void) const;
+	Iterator end(void) const;
+	Iterator find(const uint32_t key) const;
+	Iterator lower_bound(const uint32_t key) const;
+	Iterator upper_bound(const uint32_t key) const;
+
+	template <typename Visitor_t>
+	size_t Range(const uint32_t lo, const uint32_t hi, Visitor_t visit) const;
+
+	// Join-based bulk operations.  Split() moves every key >= key into
+	// `right`, Join() appends ref and then all of `right` to this tree, and
+	// the set operations leave their result in this tree.  In every case
+	// the other tree ends up empty, and nodes are moved rather than copied.
+	void Split(const uint32_t key, LeftLeaningRedBlack& right);
+	bool Join(VoidRef_t ref, LeftLeaningRedBlack& right);
+	void Union(LeftLeaningRedBlack& other);
+	void Intersect(LeftLeaningRedBlack& other);
+	void Difference(LeftLeaningRedBlack& other);
+
+	// Binary snapshots, in the format described in
+	// LeftLeaningRedBlackSnapshot.h.  LoadSnapshot() replaces the contents
+	// of the tree, and leaves it unchanged if the file cannot be used.
+	bool SaveSnapshot(const char* path) const;
+	bool LoadSnapshot(const char* path);
+
+	// Copies the tree into a read-only Eytzinger layout for fast lookups.
+	// The frozen copy does not see later changes to the tree.
+	bool Freeze(FrozenLeftLeaningRedBlack& frozen) const;
+
+	// Counters and node pool occupancy.  The counters are shared by all
+	// trees, so ResetStats() clears them for every tree.  It is only exact
+	// while no other thread is using a tree.
+	void GetStats(LLRBStats_t& stats) const;
+	static void ResetStats(void);
+
+	// Writes stats in the Prometheus text exposition format, with every
+	// metric name starting with prefix.
+	static void WriteStats(std::ostream& out, const LLRBStats_t& stats, const char* prefix = "llrb");
+
+#if defined(USE_ORDER_STATISTICS)
+	// Order statistics, all O(log n).  Rank() is the number of keys less
+	// than key, Select() returns the ref holding the k-th smallest key
+	// (counting from 0), and CountRange() counts the keys in [lo, hi].
+	size_t Size(void) const;
+	size_t Rank(const uint32_t key) const;
+	void*  Select(size_t k) const;
+	size_t CountRange(const uint32_t lo, const uint32_t hi) const;
+#endif
 
 	/*Project Functions*/
 	uint32_t Min(uint32_t& left, uint32_t& right);
 	uint32_t Max(uint32_t& left, uint32_t& right);
 	LLTB_t* FindParent(LLTB_t* tempPtr, VoidRef_t ref);
-};
\ No newline at end of file
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LeftLeaningRedBlack::Iterator
+//
+//	Bidirectional iterator over the keys in sorted order.  Since LLTB_t has
+//	no parent pointers, the iterator carries the path from the root down to
+//	the current node, which keeps ++ and -- at amortized O(1).
+//
+//	An empty path is the end() position.
+//
+class LeftLeaningRedBlack::Iterator
+{
+private:
+	friend class LeftLeaningRedBlack;
+
+	const LeftLeaningRedBlack* m_pTree;
+	LLTB_t* m_Path[LLRB_MAX_DEPTH];
+	int     m_Depth;
+
+	void PushLeftSpine(LLTB_t* pNode)
+	{
+		while (nullptr != pNode) {
+			m_Path[m_Depth++] = pNode;
+			pNode = pNode->pLeft;
+		}
+	}
+
+	void PushRightSpine(LLTB_t* pNode)
+	{
+		while (nullptr != pNode) {
+			m_Path[m_Depth++] = pNode;
+			pNode = pNode->pRight;
+		}
+	}
+
+public:
+	typedef std::bidirectional_iterator_tag iterator_category;
+	typedef VoidRef_t                       value_type;
+	typedef ptrdiff_t                       difference_type;
+	typedef const VoidRef_t*                pointer;
+	typedef const VoidRef_t&                reference;
+
+	Iterator(void)
+		: m_pTree(nullptr)
+		, m_Depth(0)
+	{
+	}
+
+	reference operator*(void) const  { return m_Path[m_Depth - 1]->Ref; }
+	pointer   operator->(void) const { return &(m_Path[m_Depth - 1]->Ref); }
+
+	// Returns the node the iterator currently refers to.
+	const LLTB_t* Node(void) const { return (0 == m_Depth) ? nullptr : m_Path[m_Depth - 1]; }
+
+	bool operator==(const Iterator& other) const { return Node() == other.Node(); }
+	bool operator!=(const Iterator& other) const { return Node() != other.Node(); }
+
+	Iterator& operator++(void)
+	{
+		LLTB_t* pNode = m_Path[m_Depth - 1];
+
+		if (nullptr != pNode->pRight) {
+			PushLeftSpine(pNode->pRight);
+		}
+		else {
+			// Back up until we leave a left subtree.
+			--m_Depth;
+			while ((m_Depth > 0) && (m_Path[m_Depth - 1]->pRight == pNode)) {
+				pNode = m_Path[--m_Depth];
+			}
+		}
+
+		return *this;
+	}
+
+	Iterator& operator--(void)
+	{
+		if (0 == m_Depth) {
+			// Decrementing end() moves to the largest key.
+			PushRightSpine(m_pTree->m_pRoot);
+			return *this;
+		}
+
+		LLTB_t* pNode = m_Path[m_Depth - 1];
+
+		if (nullptr != pNode->pLeft) {
+			PushRightSpine(pNode->pLeft);
+		}
+		else {
+			// Back up until we leave a right subtree.
+			--m_Depth;
+			while ((m_Depth > 0) && (m_Path[m_Depth - 1]->pLeft == pNode)) {
+				pNode = m_Path[--m_Depth];
+			}
+		}
+
+		return *this;
+	}
+
+	Iterator operator++(int) { Iterator prev(*this); ++(*this); return prev; }
+	Iterator operator--(int) { Iterator prev(*this); --(*this); return prev; }
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	begin()
+//
+inline LeftLeaningRedBlack::Iterator LeftLeaningRedBlack::begin(void) const
+{
+	Iterator it;
+	it.m_pTree = this;
+	it.PushLeftSpine(m_pRoot);
+
+	return it;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	end()
+//
+inline LeftLeaningRedBlack::Iterator LeftLeaningRedBlack::end(void) const
+{
+	Iterator it;
+	it.m_pTree = this;
+
+	return it;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	find()
+//
+inline LeftLeaningRedBlack::Iterator LeftLeaningRedBlack::find(const uint32_t key) const
+{
+	Iterator it = lower_bound(key);
+
+	if ((it != end()) && (it->Key != key)) {
+		it.m_Depth = 0;
+	}
+
+	return it;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	lower_bound()
+//
+//	Returns the first key >= key.  The whole search path is recorded, then
+//	trimmed back to the last node where the search turned left, since that
+//	node is the answer and the path above it is its ancestor chain.
+//
+inline LeftLeaningRedBlack::Iterator LeftLeaningRedBlack::lower_bound(const uint32_t key) const
+{
+	Iterator it;
+	it.m_pTree = this;
+
+	int     found = 0;
+	LLTB_t* pNode = m_pRoot;
+
+	while (nullptr != pNode) {
+		it.m_Path[it.m_Depth++] = pNode;
+
+		if (key <= pNode->Ref.Key) {
+			found = it.m_Depth;
+			pNode = pNode->pLeft;
+		}
+		else {
+			pNode = pNode->pRight;
+		}
+	}
+
+	it.m_Depth = found;
+
+	return it;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	upper_bound()
+//
+//	Returns the first key > key.
+//
+inline LeftLeaningRedBlack::Iterator LeftLeaningRedBlack::upper_bound(const uint32_t key) const
+{
+	Iterator it;
+	it.m_pTree = this;
+
+	int     found = 0;
+	LLTB_t* pNode = m_pRoot;
+
+	while (nullptr != pNode) {
+		it.m_Path[it.m_Depth++] = pNode;
+
+		if (key < pNode->Ref.Key) {
+			found = it.m_Depth;
+			pNode = pNode->pLeft;
+		}
+		else {
+			pNode = pNode->pRight;
+		}
+	}
+
+	it.m_Depth = found;
+
+	return it;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Range()
+//
+//	Calls visit(const VoidRef_t&) for every key in [lo, hi], in sorted
+//	order, and returns the number of keys visited.  This costs O(log n) to
+//	find lo plus O(k) for the k keys in the range; nodes outside the range
+//	are never touched beyond the initial descent.
+//
+template <typename Visitor_t>
+size_t LeftLeaningRedBlack::Range(const uint32_t lo, const uint32_t hi, Visitor_t visit) const
+{
+	size_t count = 0;
+
+	for (Iterator it = lower_bound(lo); (0 != it.m_Depth) && (it->Key <= hi); ++it) {
+		visit(*it);
+		++count;
+	}
+
+	return count;
+}
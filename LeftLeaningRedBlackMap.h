@@ -0,0 +1,1175 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: LeftLeaningRedBlackMap.h
+//
+//	$Header: $
+//
+//
+//	Header-only template version of LeftLeaningRedBlack.  Instead of being
+//	fixed to VoidRef_t, the tree is parameterized on the key type, the
+//	mapped value type, and the comparator.  Both the key and the value are
+//	stored inline in the node, so looking up a value does not need a second
+//	indirection, and the comparator is known at compile time so that the
+//	compiler can inline the comparisons.
+//
+//	The algorithms are the same ones used in LeftLeaningRedBlack.cpp.  See
+//	that file for the explanation of each rebalancing step.
+//
+//	Like std::map, two keys are considered equal when neither compares as
+//	less than the other.
+//
+//	Values never have to be copied: Emplace() builds the value inside the
+//	node, InsertOrAssign() moves it there, and Extract() unlinks the node
+//	itself and hands it over in a NodeHandle_t, which Insert() can link
+//	back in.  Deleting a key relinks the successor node into its place
+//	rather than moving the successor's key and value, so the address of
+//	every other value stays the same.
+//
+//	The tree can be augmented with a subtree aggregate, such as a sum or a
+//	maximum, by passing a policy as Augment_t.  The policy describes a
+//	monoid over the entries:
+//
+//	    struct MyAugment_t
+//	    {
+//	        typedef ... Summary_t;
+//
+//	        static Summary_t Identity(void);
+//	        static Summary_t Lift(const Key_t& key, const Value_t& value);
+//	        static Summary_t Combine(const Summary_t& left, const Summary_t& right);
+//	    };
+//
+//	Combine() must be associative, with Identity() as its identity, but
+//	need not be commutative: entries are always combined in key order.
+//	Every node then holds the combined summary of its subtree, which is
+//	kept up to date by the rotations and the fix-ups, and
+//	RangeAggregate() combines the keys in a range in O(log n).
+//
+//	LLRBSum_t and LLRBMax_t are ready-made policies over the values.  An
+//	interval tree is LLRBMax_t with each interval's start as the key and
+//	its end as the value: some interval overlaps [a, b] exactly when the
+//	largest end among the starts up to b is at least a.
+//
+//	The default LLRBNoAugment_t adds no field to the node and no work to
+//	any operation.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include <stddef.h>
+#include <functional>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "NodePool.h"
+
+
+// The default: no aggregate is kept.  Summary_t only exists so that the
+// declarations of the aggregate queries still compile.
+struct LLRBNoAugment_t
+{
+	struct Summary_t
+	{
+	};
+};
+
+
+// Sum of the values in a subtree.
+template <typename Key_t, typename Value_t>
+struct LLRBSum_t
+{
+	typedef Value_t Summary_t;
+
+	static Summary_t Identity(void)                                      { return Value_t(); }
+	static Summary_t Lift(const Key_t&, const Value_t& value)            { return value; }
+	static Summary_t Combine(const Summary_t& left, const Summary_t& right) { return left + right; }
+};
+
+
+// Largest value in a subtree.  An empty range gives the lowest value the
+// type can hold.
+template <typename Key_t, typename Value_t>
+struct LLRBMax_t
+{
+	typedef Value_t Summary_t;
+
+	static Summary_t Identity(void)                                      { return std::numeric_limits<Value_t>::lowest(); }
+	static Summary_t Lift(const Key_t&, const Value_t& value)            { return value; }
+	static Summary_t Combine(const Summary_t& left, const Summary_t& right) { return (left < right) ? right : left; }
+};
+
+
+// Where the node keeps the aggregate of its subtree.  Unaugmented nodes
+// inherit from the empty specialization, which takes no space.
+template <typename Augment_t>
+struct LLRBAugmentField_t
+{
+	typename Augment_t::Summary_t Aggregate;
+};
+
+template <>
+struct LLRBAugmentField_t<LLRBNoAugment_t>
+{
+};
+
+
+template <typename Key_t, typename Value_t, typename Compare_t = std::less<Key_t>, typename Augment_t = LLRBNoAugment_t>
+class LeftLeaningRedBlackMap
+{
+public:
+	typedef typename Augment_t::Summary_t Summary_t;
+
+	struct Node_t : LLRBAugmentField_t<Augment_t>
+	{
+		Key_t   Key;
+		Value_t Value;
+
+		bool    IsRed;
+
+		Node_t* pLeft;
+		Node_t* pRight;
+	};
+
+	class NodeHandle_t;
+
+private:
+	Node_t*   m_pRoot;
+	size_t    m_Count;
+	NodePool  m_Pool;
+	Compare_t m_Compare;
+
+	// NodePool only guarantees pointer alignment.
+	static_assert(alignof(Node_t) <= sizeof(void*), "over-aligned keys or values are not supported");
+
+	LeftLeaningRedBlackMap(const LeftLeaningRedBlackMap&);
+	LeftLeaningRedBlackMap& operator=(const LeftLeaningRedBlackMap&);
+
+	bool Less(const Key_t& left, const Key_t& right) const  { return m_Compare(left, right); }
+	bool Equal(const Key_t& left, const Key_t& right) const { return !m_Compare(left, right) && !m_Compare(right, left); }
+
+	static bool IsRed(const Node_t* pNode) { return (nullptr != pNode) && pNode->IsRed; }
+
+	// Tag for the unaugmented tree, where the hooks below do nothing.
+	typedef std::is_same<Augment_t, LLRBNoAugment_t> Plain_t;
+
+	static void Update(Node_t* pNode) { Update(pNode, Plain_t()); }
+	static void Update(Node_t*, std::true_type) { }
+	static void Update(Node_t* pNode, std::false_type);
+
+	static void InitAggregate(Node_t*, std::true_type) { }
+	static void InitAggregate(Node_t* pNode, std::false_type);
+
+	static Summary_t Aggregate(const Node_t* pNode);
+
+	void Refresh(const Key_t& key, std::true_type) { }
+	void Refresh(const Key_t& key, std::false_type);
+
+	static Node_t* RotateLeft(Node_t* pNode);
+	static Node_t* RotateRight(Node_t* pNode);
+	static void    ColorFlip(Node_t* pNode);
+	static Node_t* MoveRedLeft(Node_t* pNode);
+	static Node_t* MoveRedRight(Node_t* pNode);
+	static Node_t* FixUp(Node_t* pNode);
+	static Node_t* DetachMin(Node_t* pNode, Node_t*& pMin);
+
+	template <typename KeyArg_t, typename... Args_t>
+	Node_t* NewNode(KeyArg_t&& key, Args_t&&... args);
+	void    FreeNode(Node_t* pNode);
+	void    Free(Node_t* pNode);
+
+	template <typename Make_t>
+	bool    InsertNode(const Key_t& key, Make_t& make, Node_t*& pFound);
+	template <typename Make_t>
+	Node_t* InsertRec(Node_t* pNode, const Key_t& key, Make_t& make, Node_t*& pFound, bool& added);
+	Node_t* DeleteRec(Node_t* pNode, const Key_t& key, Node_t*& pRemoved);
+	Node_t* Remove(const Key_t& key);
+
+public:
+	LeftLeaningRedBlackMap(const Compare_t& compare = Compare_t());
+	~LeftLeaningRedBlackMap(void);
+	void FreeAll(void);
+
+	// Moving takes over every node in O(1), and leaves the source empty.
+	LeftLeaningRedBlackMap(LeftLeaningRedBlackMap&& other);
+	LeftLeaningRedBlackMap& operator=(LeftLeaningRedBlackMap&& other);
+	void Swap(LeftLeaningRedBlackMap& other);
+
+	Value_t*       LookUp(const Key_t& key);
+	const Value_t* LookUp(const Key_t& key) const;
+	bool           Insert(const Key_t& key, const Value_t& value);
+	bool           Delete(const Key_t& key);
+
+	// Builds the value in place from args if the key is not in the tree.
+	// If it is, nothing is built, the old value is kept, and false is
+	// returned.
+	template <typename... Args_t>
+	bool Emplace(Key_t key, Args_t&&... args);
+
+	// Moves value into the tree, replacing the old value if the key is
+	// already there.  Returns true if the key was added.
+	template <typename ValueArg_t>
+	bool InsertOrAssign(Key_t key, ValueArg_t&& value);
+
+	// Unlinks the node holding key and hands it over.  The handle is empty
+	// if the key is not in the tree.
+	NodeHandle_t Extract(const Key_t& key);
+
+	// Links an extracted node back into the tree.  Returns true and empties
+	// the handle if the key was added.  If the key is already in the tree,
+	// the handle keeps the node and false is returned.
+	bool Insert(NodeHandle_t&& node);
+
+	size_t Count(void) const { return m_Count; }
+	bool   IsEmpty(void) const { return 0 == m_Count; }
+
+	// Aggregate queries, for augmented trees only.  RangeAggregate()
+	// combines the entries with keys in [lo, hi], in key order, in
+	// O(log n).
+	Summary_t Aggregate(void) const;
+	Summary_t RangeAggregate(const Key_t& lo, const Key_t& hi) const;
+
+	// Values changed through LookUp() or a node handle are not seen by
+	// the aggregates until this is called for their key.  Insert() and
+	// InsertOrAssign() take care of it themselves.
+	void Refresh(const Key_t& key) { Refresh(key, Plain_t()); }
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LeftLeaningRedBlackMap::NodeHandle_t
+//
+//	Owns a node that Extract() took out of the map.  The key and value stay
+//	where they are inside the node, so they can be read, changed or moved
+//	out through the handle, and the node can go back into the same map
+//	with Insert(), all without copying or allocating.
+//
+//	The node still belongs to the map's pool, so a handle must not outlive
+//	its map or be kept across a move of the map.  A handle passed to the
+//	Insert() of a different map has its key and value moved into a new
+//	node of that map.
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+class LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::NodeHandle_t
+{
+private:
+	friend class LeftLeaningRedBlackMap;
+
+	Node_t*                 m_pNode;
+	LeftLeaningRedBlackMap* m_pOwner;
+
+	NodeHandle_t(Node_t* pNode, LeftLeaningRedBlackMap* pOwner)
+		: m_pNode(pNode)
+		, m_pOwner(pOwner)
+	{
+	}
+
+	NodeHandle_t(const NodeHandle_t&);
+	NodeHandle_t& operator=(const NodeHandle_t&);
+
+	Node_t* Release(void)
+	{
+		Node_t* pNode = m_pNode;
+		m_pNode = nullptr;
+		return pNode;
+	}
+
+public:
+	NodeHandle_t(void)
+		: m_pNode(nullptr)
+		, m_pOwner(nullptr)
+	{
+	}
+
+	NodeHandle_t(NodeHandle_t&& other)
+		: m_pNode(other.m_pNode)
+		, m_pOwner(other.m_pOwner)
+	{
+		other.m_pNode = nullptr;
+	}
+
+	NodeHandle_t& operator=(NodeHandle_t&& other)
+	{
+		if (this != &other) {
+			Reset();
+			m_pNode  = other.Release();
+			m_pOwner = other.m_pOwner;
+		}
+
+		return *this;
+	}
+
+	~NodeHandle_t(void)
+	{
+		Reset();
+	}
+
+	// Destroys the node, if there is one.
+	void Reset(void)
+	{
+		if (nullptr != m_pNode) {
+			m_pOwner->FreeNode(Release());
+		}
+	}
+
+	bool IsEmpty(void) const { return nullptr == m_pNode; }
+
+	// The key may be changed before the node is inserted again.
+	Key_t&   Key(void)   { return m_pNode->Key; }
+	Value_t& Value(void) { return m_pNode->Value; }
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	constructor
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::LeftLeaningRedBlackMap(const Compare_t& compare)
+	: m_pRoot(nullptr)
+	, m_Count(0)
+	, m_Pool(sizeof(Node_t))
+	, m_Compare(compare)
+{
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	destructor
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::~LeftLeaningRedBlackMap(void)
+{
+	FreeAll();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	move constructor
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::LeftLeaningRedBlackMap(LeftLeaningRedBlackMap&& other)
+	: m_pRoot(other.m_pRoot)
+	, m_Count(other.m_Count)
+	, m_Pool(sizeof(Node_t))
+	, m_Compare(std::move(other.m_Compare))
+{
+	m_Pool.Swap(other.m_Pool);
+
+	other.m_pRoot = nullptr;
+	other.m_Count = 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	move assignment
+//
+//	The old contents of this map end up in a temporary, which frees them.
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>&
+LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::operator=(LeftLeaningRedBlackMap&& other)
+{
+	if (this != &other) {
+		LeftLeaningRedBlackMap temp(std::move(other));
+		Swap(temp);
+	}
+
+	return *this;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Swap()
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+void LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Swap(LeftLeaningRedBlackMap& other)
+{
+	std::swap(m_pRoot, other.m_pRoot);
+	std::swap(m_Count, other.m_Count);
+	std::swap(m_Compare, other.m_Compare);
+	m_Pool.Swap(other.m_Pool);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FreeAll()
+//
+//	If neither the key nor the value has a destructor to run, the whole
+//	tree is released by handing the pool's slabs back.  Otherwise every
+//	node has to be visited to destroy its contents.
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+void LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::FreeAll(void)
+{
+	if (false == (std::is_trivially_destructible<Key_t>::value && std::is_trivially_destructible<Value_t>::value)) {
+		Free(m_pRoot);
+	}
+
+	m_Pool.ReleaseAll();
+
+	m_pRoot = nullptr;
+	m_Count = 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Free()
+//
+//	Destroys pNode and all of its children.  Like LeftLeaningRedBlack::
+//	Free(), this rotates left children up until the nodes form a single
+//	right spine, destroying each node once it has no left child, so no
+//	stack is needed.
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+void LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Free(Node_t* pNode)
+{
+	while (nullptr != pNode) {
+		Node_t* pLeft = pNode->pLeft;
+
+		if (nullptr != pLeft) {
+			pNode->pLeft  = pLeft->pRight;
+			pLeft->pRight = pNode;
+			pNode         = pLeft;
+		}
+		else {
+			Node_t* pRight = pNode->pRight;
+
+			FreeNode(pNode);
+
+			pNode = pRight;
+		}
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	NewNode()
+//
+//	Note that a new node defaults to being red.
+//
+//	The key and value are constructed directly in the node from whatever
+//	they are given, so a value built from args, or moved in, is never
+//	copied.
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+template <typename KeyArg_t, typename... Args_t>
+typename LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Node_t*
+LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::NewNode(KeyArg_t&& key, Args_t&&... args)
+{
+	Node_t* pNew = static_cast<Node_t*>(m_Pool.Alloc());
+
+	try {
+		new (&(pNew->Key)) Key_t(std::forward<KeyArg_t>(key));
+	}
+	catch (...) {
+		m_Pool.Free(pNew);
+		throw;
+	}
+
+	try {
+		new (&(pNew->Value)) Value_t(std::forward<Args_t>(args)...);
+	}
+	catch (...) {
+		pNew->Key.~Key_t();
+		m_Pool.Free(pNew);
+		throw;
+	}
+
+	pNew->IsRed  = true;
+	pNew->pLeft  = nullptr;
+	pNew->pRight = nullptr;
+
+	InitAggregate(pNew, Plain_t());
+
+	return pNew;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FreeNode()
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+void LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::FreeNode(Node_t* pNode)
+{
+	pNode->~Node_t();
+	m_Pool.Free(pNode);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUp()
+//
+//	If the key is not in the tree, this will return nullptr.
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+Value_t* LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::LookUp(const Key_t& key)
+{
+	Node_t* pNode = m_pRoot;
+
+	while (nullptr != pNode) {
+		if (Less(key, pNode->Key)) {
+			pNode = pNode->pLeft;
+		}
+		else if (Less(pNode->Key, key)) {
+			pNode = pNode->pRight;
+		}
+		else {
+			return &(pNode->Value);
+		}
+	}
+
+	return nullptr;
+}
+
+
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+const Value_t* LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::LookUp(const Key_t& key) const
+{
+	return const_cast<LeftLeaningRedBlackMap*>(this)->LookUp(key);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	RotateLeft()
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+typename LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Node_t*
+LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::RotateLeft(Node_t* pNode)
+{
+	Node_t* pTemp = pNode->pRight;
+	pNode->pRight = pTemp->pLeft;
+	pTemp->pLeft = pNode;
+	pTemp->IsRed = pNode->IsRed;
+	pNode->IsRed = true;
+
+	Update(pNode);
+	Update(pTemp);
+
+	return pTemp;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	RotateRight()
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+typename LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Node_t*
+LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::RotateRight(Node_t* pNode)
+{
+	Node_t* pTemp = pNode->pLeft;
+	pNode->pLeft = pTemp->pRight;
+	pTemp->pRight = pNode;
+	pTemp->IsRed = pNode->IsRed;
+	pNode->IsRed = true;
+
+	Update(pNode);
+	Update(pTemp);
+
+	return pTemp;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	ColorFlip()
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+void LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::ColorFlip(Node_t* pNode)
+{
+	pNode->IsRed = !pNode->IsRed;
+
+	if (nullptr != pNode->pLeft) {
+		pNode->pLeft->IsRed = !pNode->pLeft->IsRed;
+	}
+
+	if (nullptr != pNode->pRight) {
+		pNode->pRight->IsRed = !pNode->pRight->IsRed;
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Insert()
+//
+//	Returns true if the key was added, or false if the key was already in
+//	the tree, in which case its value is replaced.
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+bool LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Insert(const Key_t& key, const Value_t& value)
+{
+	Node_t* pFound = nullptr;
+	auto    make   = [&]() { return NewNode(key, value); };
+
+	if (InsertNode(key, make, pFound)) {
+		return true;
+	}
+
+	pFound->Value = value;
+
+	Refresh(key);
+
+	return false;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Emplace()
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+template <typename... Args_t>
+bool LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Emplace(Key_t key, Args_t&&... args)
+{
+	Node_t* pFound = nullptr;
+	auto    make   = [&]() { return NewNode(std::move(key), std::forward<Args_t>(args)...); };
+
+	return InsertNode(key, make, pFound);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	InsertOrAssign()
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+template <typename ValueArg_t>
+bool LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::InsertOrAssign(Key_t key, ValueArg_t&& value)
+{
+	Node_t* pFound = nullptr;
+	auto    make   = [&]() { return NewNode(std::move(key), std::forward<ValueArg_t>(value)); };
+
+	if (InsertNode(key, make, pFound)) {
+		return true;
+	}
+
+	pFound->Value = std::forward<ValueArg_t>(value);
+
+	Refresh(pFound->Key);
+
+	return false;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Insert()
+//
+//	A node from this map is linked back in as it is.  A node from another
+//	map belongs to that map's pool, so its contents are moved into a new
+//	node instead, and the old node is freed along with the handle.
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+bool LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Insert(NodeHandle_t&& node)
+{
+	if (node.IsEmpty()) {
+		return false;
+	}
+
+	Node_t* pFound = nullptr;
+
+	if (this != node.m_pOwner) {
+		auto make = [&]() { return NewNode(std::move(node.Key()), std::move(node.Value())); };
+
+		if (false == InsertNode(node.Key(), make, pFound)) {
+			return false;
+		}
+
+		node.Reset();
+
+		return true;
+	}
+
+	auto make = [&]() {
+		Node_t* pNode = node.Release();
+		pNode->IsRed  = true;
+		pNode->pLeft  = nullptr;
+		pNode->pRight = nullptr;
+		return pNode;
+	};
+
+	// InsertRec() compares against the key it was given on the way down
+	// only, so the key can live in the node that make() hands over.
+	return InsertNode(node.m_pNode->Key, make, pFound);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	InsertNode()
+//
+//	Shared by every way of inserting.  make() is only called if the key is
+//	not in the tree, and returns the new node.  Either way, pFound ends up
+//	pointing at the node that holds the key.  Returns true if the key was
+//	added.
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+template <typename Make_t>
+bool LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::InsertNode(const Key_t& key, Make_t& make, Node_t*& pFound)
+{
+	bool added = false;
+
+	m_pRoot = InsertRec(m_pRoot, key, make, pFound, added);
+
+	// The root node of a red-black tree must be black.
+	m_pRoot->IsRed = false;
+
+	if (added) {
+		++m_Count;
+	}
+
+	return added;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	InsertRec()
+//
+//	Once make() has been called, key may have been moved from, so it is not
+//	looked at again on the way back up.
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+template <typename Make_t>
+typename LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Node_t*
+LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::InsertRec(Node_t* pNode, const Key_t& key, Make_t& make, Node_t*& pFound, bool& added)
+{
+	if (nullptr == pNode) {
+		pFound = make();
+		added  = true;
+		Update(pFound);
+		return pFound;
+	}
+
+#if defined(USE_234_TREE)
+	// Split 4-nodes on the way down into the tree.
+	if (IsRed(pNode->pLeft) && IsRed(pNode->pRight)) {
+		ColorFlip(pNode);
+	}
+#endif
+
+	if (Less(key, pNode->Key)) {
+		pNode->pLeft = InsertRec(pNode->pLeft, key, make, pFound, added);
+	}
+	else if (Less(pNode->Key, key)) {
+		pNode->pRight = InsertRec(pNode->pRight, key, make, pFound, added);
+	}
+	else {
+		pFound = pNode;
+	}
+
+	// Fix a right-leaning red node.
+	if (IsRed(pNode->pRight) && (false == IsRed(pNode->pLeft))) {
+		pNode = RotateLeft(pNode);
+	}
+
+	// Fix two reds in a row.
+	if (IsRed(pNode->pLeft) && IsRed(pNode->pLeft->pLeft)) {
+		pNode = RotateRight(pNode);
+	}
+
+#if !defined(USE_234_TREE)
+	// Split 4-nodes on the way back out of the tree.
+	if (IsRed(pNode->pLeft) && IsRed(pNode->pRight)) {
+		ColorFlip(pNode);
+	}
+#endif
+
+	Update(pNode);
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	MoveRedLeft()
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+typename LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Node_t*
+LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::MoveRedLeft(Node_t* pNode)
+{
+	ColorFlip(pNode);
+
+	if ((nullptr != pNode->pRight) && IsRed(pNode->pRight->pLeft)) {
+		pNode->pRight = RotateRight(pNode->pRight);
+		pNode = RotateLeft(pNode);
+
+		ColorFlip(pNode);
+
+#if defined(USE_234_TREE)
+		// Borrowing from a 4-node leaves a lone red right child behind.
+		if (IsRed(pNode->pRight->pRight)) {
+			pNode->pRight = RotateLeft(pNode->pRight);
+		}
+#endif
+	}
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	MoveRedRight()
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+typename LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Node_t*
+LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::MoveRedRight(Node_t* pNode)
+{
+	ColorFlip(pNode);
+
+	if ((nullptr != pNode->pLeft) && IsRed(pNode->pLeft->pLeft)) {
+		pNode = RotateRight(pNode);
+
+		ColorFlip(pNode);
+	}
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FixUp()
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+typename LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Node_t*
+LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::FixUp(Node_t* pNode)
+{
+	// A 2-3-4 tree keeps its 4-nodes, so it only fixes a red right child
+	// that has no red sibling, and never splits.
+#if defined(USE_234_TREE)
+	if (IsRed(pNode->pRight) && (false == IsRed(pNode->pLeft))) {
+#else
+	if (IsRed(pNode->pRight)) {
+#endif
+		pNode = RotateLeft(pNode);
+	}
+
+	if (IsRed(pNode->pLeft) && IsRed(pNode->pLeft->pLeft)) {
+		pNode = RotateRight(pNode);
+	}
+
+#if !defined(USE_234_TREE)
+	if (IsRed(pNode->pLeft) && IsRed(pNode->pRight)) {
+		ColorFlip(pNode);
+	}
+#endif
+
+	Update(pNode);
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Delete()
+//
+//	Returns true if the key was found and removed.
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+bool LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Delete(const Key_t& key)
+{
+	Node_t* pRemoved = Remove(key);
+
+	if (nullptr == pRemoved) {
+		return false;
+	}
+
+	FreeNode(pRemoved);
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Extract()
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+typename LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::NodeHandle_t
+LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Extract(const Key_t& key)
+{
+	return NodeHandle_t(Remove(key), this);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Remove()
+//
+//	Unlinks the node holding key, and returns it without destroying it, or
+//	returns nullptr if the key is not in the tree.
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+typename LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Node_t*
+LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Remove(const Key_t& key)
+{
+	Node_t* pRemoved = nullptr;
+
+	if (nullptr != m_pRoot) {
+		m_pRoot = DeleteRec(m_pRoot, key, pRemoved);
+
+		if (nullptr != m_pRoot) {
+			m_pRoot->IsRed = false;
+		}
+	}
+
+	if (nullptr != pRemoved) {
+		--m_Count;
+	}
+
+	return pRemoved;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	DeleteRec()
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+typename LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Node_t*
+LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::DeleteRec(Node_t* pNode, const Key_t& key, Node_t*& pRemoved)
+{
+	if (Less(key, pNode->Key)) {
+		if (nullptr != pNode->pLeft) {
+			if ((false == IsRed(pNode->pLeft)) && (false == IsRed(pNode->pLeft->pLeft))) {
+				pNode = MoveRedLeft(pNode);
+			}
+
+			pNode->pLeft = DeleteRec(pNode->pLeft, key, pRemoved);
+		}
+	}
+	else {
+		// A 4-node already has a red right child.
+		if (IsRed(pNode->pLeft) && (false == IsRed(pNode->pRight))) {
+			pNode = RotateRight(pNode);
+		}
+
+		// Deletion of a leaf node.
+		if (Equal(key, pNode->Key) && (nullptr == pNode->pRight)) {
+			pRemoved = pNode;
+			return nullptr;
+		}
+
+		if (nullptr != pNode->pRight) {
+			if ((false == IsRed(pNode->pRight)) && (false == IsRed(pNode->pRight->pLeft))) {
+				pNode = MoveRedRight(pNode);
+			}
+
+			// Deletion of an internal node: the successor node is
+			// unlinked from the right subtree and takes this node's
+			// place, so neither node's contents move.
+			if (Equal(key, pNode->Key)) {
+				Node_t* pMin   = nullptr;
+				Node_t* pRight = DetachMin(pNode->pRight, pMin);
+
+				pMin->pLeft  = pNode->pLeft;
+				pMin->pRight = pRight;
+				pMin->IsRed  = pNode->IsRed;
+
+				pNode->pLeft  = nullptr;
+				pNode->pRight = nullptr;
+				pRemoved      = pNode;
+
+				pNode = pMin;
+			}
+			else {
+				pNode->pRight = DeleteRec(pNode->pRight, key, pRemoved);
+			}
+		}
+	}
+
+	return FixUp(pNode);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	DetachMin()
+//
+//	Unlinks the bottom node on the left spine and hands it back through
+//	pMin, instead of destroying it.
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+typename LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Node_t*
+LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::DetachMin(Node_t* pNode, Node_t*& pMin)
+{
+	if (nullptr == pNode->pLeft) {
+		pMin = pNode;
+		return nullptr;
+	}
+
+	if ((false == IsRed(pNode->pLeft)) && (false == IsRed(pNode->pLeft->pLeft))) {
+		pNode = MoveRedLeft(pNode);
+	}
+
+	pNode->pLeft = DetachMin(pNode->pLeft, pMin);
+
+	return FixUp(pNode);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Update()
+//
+//	Recomputes the aggregate of pNode from its own entry and its children,
+//	which must already be up to date.
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+void LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Update(Node_t* pNode, std::false_type)
+{
+	pNode->Aggregate = Augment_t::Combine(Augment_t::Combine(Aggregate(pNode->pLeft), Augment_t::Lift(pNode->Key, pNode->Value)), Aggregate(pNode->pRight));
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	InitAggregate()
+//
+//	The aggregate is a field of its own, constructed after the key and
+//	the value, and destroyed along with the node.
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+void LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::InitAggregate(Node_t* pNode, std::false_type)
+{
+	new (&(pNode->Aggregate)) Summary_t(Augment_t::Lift(pNode->Key, pNode->Value));
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Aggregate()
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+typename LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Summary_t
+LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Aggregate(const Node_t* pNode)
+{
+	return (nullptr != pNode) ? pNode->Aggregate : Augment_t::Identity();
+}
+
+
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+typename LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Summary_t
+LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Aggregate(void) const
+{
+	static_assert(false == Plain_t::value, "Aggregate() needs an augmented map");
+
+	return Aggregate(m_pRoot);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	RangeAggregate()
+//
+//	Finds the highest node inside [lo, hi], where the searches for lo and
+//	hi part ways.  Below it, the search for lo picks up every node it
+//	passes that is not less than lo, together with that node's right
+//	subtree, and the search for hi does the same on the other side.  Each
+//	piece is combined on the side it belongs, so the result is in key
+//	order.
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+typename LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Summary_t
+LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::RangeAggregate(const Key_t& lo, const Key_t& hi) const
+{
+	static_assert(false == Plain_t::value, "RangeAggregate() needs an augmented map");
+
+	const Node_t* pSplit = m_pRoot;
+
+	while (nullptr != pSplit) {
+		if (Less(hi, pSplit->Key)) {
+			pSplit = pSplit->pLeft;
+		}
+		else if (Less(pSplit->Key, lo)) {
+			pSplit = pSplit->pRight;
+		}
+		else {
+			break;
+		}
+	}
+
+	if (nullptr == pSplit) {
+		return Augment_t::Identity();
+	}
+
+	Summary_t left = Augment_t::Identity();
+
+	for (const Node_t* pNode = pSplit->pLeft; nullptr != pNode; ) {
+		if (Less(pNode->Key, lo)) {
+			pNode = pNode->pRight;
+		}
+		else {
+			left  = Augment_t::Combine(Augment_t::Combine(Augment_t::Lift(pNode->Key, pNode->Value), Aggregate(pNode->pRight)), left);
+			pNode = pNode->pLeft;
+		}
+	}
+
+	Summary_t right = Augment_t::Identity();
+
+	for (const Node_t* pNode = pSplit->pRight; nullptr != pNode; ) {
+		if (Less(hi, pNode->Key)) {
+			pNode = pNode->pLeft;
+		}
+		else {
+			right = Augment_t::Combine(right, Augment_t::Combine(Aggregate(pNode->pLeft), Augment_t::Lift(pNode->Key, pNode->Value)));
+			pNode = pNode->pRight;
+		}
+	}
+
+	return Augment_t::Combine(Augment_t::Combine(left, Augment_t::Lift(pSplit->Key, pSplit->Value)), right);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Refresh()
+//
+//	Records the path down to key, then recomputes the aggregates from the
+//	bottom of it back up to the root.  An LLRB is never more than twice
+//	as deep as a perfectly balanced tree, so 128 levels is always enough.
+//
+template <typename Key_t, typename Value_t, typename Compare_t, typename Augment_t>
+void LeftLeaningRedBlackMap<Key_t, Value_t, Compare_t, Augment_t>::Refresh(const Key_t& key, std::false_type)
+{
+	Node_t* path[128];
+	int     depth = 0;
+
+	for (Node_t* pNode = m_pRoot; nullptr != pNode; ) {
+		path[depth++] = pNode;
+
+		if (Less(key, pNode->Key)) {
+			pNode = pNode->pLeft;
+		}
+		else if (Less(pNode->Key, key)) {
+			pNode = pNode->pRight;
+		}
+		else {
+			break;
+		}
+	}
+
+	while (depth > 0) {
+		Update(path[--depth]);
+	}
+}
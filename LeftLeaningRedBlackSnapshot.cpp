@@ -0,0 +1,307 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: LeftLeaningRedBlackSnapshot.cpp
+//
+//	$Header: $
+//
+//
+//	Memory-mapped LLRB snapshots.  See the header for the file format.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "LeftLeaningRedBlackSnapshot.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	constructor
+//
+LeftLeaningRedBlackSnapshot::LeftLeaningRedBlackSnapshot(void)
+	: m_pMapping(nullptr)
+	, m_MappingSize(0)
+	, m_pNodes(nullptr)
+	, m_Count(0)
+	, m_Root(0)
+	, m_LogSequence(0)
+{
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	destructor
+//
+LeftLeaningRedBlackSnapshot::~LeftLeaningRedBlackSnapshot(void)
+{
+	Close();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Open()
+//
+//	Maps a snapshot file read-only.  Only the header and the file size are
+//	checked here, so that opening stays O(1); LookUp() checks every index
+//	it follows, so a damaged file cannot make it read outside the mapping.
+//
+bool LeftLeaningRedBlackSnapshot::Open(const char* path)
+{
+	Close();
+
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat info;
+
+	if ((0 != fstat(fd, &info)) || (size_t(info.st_size) < sizeof(LLRBSnapshotHeader_t))) {
+		close(fd);
+		return false;
+	}
+
+	size_t size     = size_t(info.st_size);
+	void*  pMapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+
+	// The mapping keeps its own reference to the file.
+	close(fd);
+
+	if (MAP_FAILED == pMapping) {
+		return false;
+	}
+
+	const LLRBSnapshotHeader_t* pHeader = static_cast<const LLRBSnapshotHeader_t*>(pMapping);
+
+	bool valid = (LLRB_SNAPSHOT_MAGIC == pHeader->Magic)
+			  && (LLRB_SNAPSHOT_VERSION == pHeader->Version)
+			  && (sizeof(LLTBCompact_t) == pHeader->NodeSize)
+			  && (pHeader->Count < 0x7FFFFFFFu)
+			  && (pHeader->Root == ((0 == pHeader->Count) ? 0u : 1u))
+			  && ((size - sizeof(LLRBSnapshotHeader_t)) / sizeof(LLTBCompact_t) >= size_t(pHeader->Count) + 1);
+
+	if (false == valid) {
+		munmap(pMapping, size);
+		return false;
+	}
+
+	m_pMapping    = pMapping;
+	m_MappingSize = size;
+	m_pNodes      = reinterpret_cast<const LLTBCompact_t*>(pHeader + 1);
+	m_Count       = pHeader->Count;
+	m_Root        = pHeader->Root;
+	m_LogSequence = pHeader->LogSequence;
+
+	// Start reading the file in the background.  Searches that get ahead
+	// of the read-ahead simply fault their pages in.
+	madvise(m_pMapping, m_MappingSize, MADV_WILLNEED);
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Close()
+//
+void LeftLeaningRedBlackSnapshot::Close(void)
+{
+	if (nullptr != m_pMapping) {
+		munmap(m_pMapping, m_MappingSize);
+	}
+
+	m_pMapping    = nullptr;
+	m_MappingSize = 0;
+	m_pNodes      = nullptr;
+	m_Count       = 0;
+	m_Root        = 0;
+	m_LogSequence = 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUp()
+//
+//	In a valid snapshot a child always has a higher index than its parent,
+//	so requiring that on every step also rules out cycles.
+//
+const VoidRef_t* LeftLeaningRedBlackSnapshot::LookUp(const uint32_t key) const
+{
+	uint32_t node = m_Root;
+
+	while (0 != node) {
+		const LLTBCompact_t& current = m_pNodes[node];
+
+		if (key == current.Ref.Key) {
+			return &(current.Ref);
+		}
+
+		uint32_t next = (key < current.Ref.Key) ? (current.LeftAndColor & ~LLTB_COMPACT_RED) : current.Right;
+
+		if ((0 != next) && ((next <= node) || (next > m_Count))) {
+			return nullptr;
+		}
+
+		node = next;
+	}
+
+	return nullptr;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Write()
+//
+bool LeftLeaningRedBlackSnapshot::Write(const char* path, const LLTBCompact_t* pNodes, uint32_t count, uint64_t logSequence)
+{
+	std::string temp = std::string(path) + ".tmp";
+
+	FILE* pFile = fopen(temp.c_str(), "wb");
+
+	if (nullptr == pFile) {
+		return false;
+	}
+
+	LLRBSnapshotHeader_t header;
+	header.Magic       = LLRB_SNAPSHOT_MAGIC;
+	header.Version     = LLRB_SNAPSHOT_VERSION;
+	header.NodeSize    = sizeof(LLTBCompact_t);
+	header.Count       = count;
+	header.Root        = (0 == count) ? 0 : 1;
+	header.LogSequence = logSequence;
+
+	bool written = (1 == fwrite(&header, sizeof(header), 1, pFile))
+				&& ((size_t(count) + 1) == fwrite(pNodes, sizeof(LLTBCompact_t), size_t(count) + 1, pFile))
+				&& (0 == fflush(pFile))
+				&& (0 == fsync(fileno(pFile)));
+
+	written = (0 == fclose(pFile)) && written;
+
+	if (written) {
+		written = (0 == rename(temp.c_str(), path));
+	}
+
+	if (false == written) {
+		remove(temp.c_str());
+	}
+
+	return written;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	CheckNodes()
+//
+//	Once every link points forward and every record from 2 on has exactly
+//	one parent, the records form a single tree rooted at record 1, with no
+//	cycles, no shared children and nothing left over.
+//
+//	Every child also comes after its parent, so a reverse pass sees both
+//	children of a node before the node itself.  That pass carries the
+//	smallest and largest key and the black height of each subtree up to
+//	its parent, which is all the other checks need.
+//
+bool LeftLeaningRedBlackSnapshot::CheckNodes(const LLTBCompact_t* pNodes, uint32_t count, bool allow4Nodes)
+{
+	struct Subtree_t
+	{
+		uint32_t MinKey;
+		uint32_t MaxKey;
+		int      BlackHeight;
+	};
+
+	if (0 == count) {
+		return true;
+	}
+
+	std::vector<bool> linked(size_t(count) + 1, false);
+
+	for (uint32_t i = 1; i <= count; ++i) {
+		uint32_t child[2] = { pNodes[i].LeftAndColor & ~LLTB_COMPACT_RED, pNodes[i].Right };
+
+		for (int c = 0; c < 2; ++c) {
+			if (0 == child[c]) {
+				continue;
+			}
+
+			if ((child[c] <= i) || (child[c] > count) || linked[child[c]]) {
+				return false;
+			}
+
+			linked[child[c]] = true;
+		}
+	}
+
+	for (uint32_t i = 2; i <= count; ++i) {
+		if (false == linked[i]) {
+			return false;
+		}
+	}
+
+	std::vector<Subtree_t> subtrees(size_t(count) + 1);
+
+	for (uint32_t i = count; i > 0; --i) {
+		const LLTBCompact_t& node  = pNodes[i];
+		uint32_t             left  = node.LeftAndColor & ~LLTB_COMPACT_RED;
+		uint32_t             right = node.Right;
+
+		bool isRed      = (0 != (node.LeftAndColor & LLTB_COMPACT_RED));
+		bool leftIsRed  = (0 != left)  && (0 != (pNodes[left].LeftAndColor & LLTB_COMPACT_RED));
+		bool rightIsRed = (0 != right) && (0 != (pNodes[right].LeftAndColor & LLTB_COMPACT_RED));
+
+		if (rightIsRed && ((false == allow4Nodes) || (false == leftIsRed))) {
+			return false;
+		}
+
+		if (isRed && (leftIsRed || rightIsRed)) {
+			return false;
+		}
+
+		Subtree_t& subtree = subtrees[i];
+
+		int leftHeight  = 0;
+		int rightHeight = 0;
+
+		subtree.MinKey = node.Ref.Key;
+		subtree.MaxKey = node.Ref.Key;
+
+		if (0 != left) {
+			if (false == (subtrees[left].MaxKey < node.Ref.Key)) {
+				return false;
+			}
+
+			subtree.MinKey = subtrees[left].MinKey;
+			leftHeight     = subtrees[left].BlackHeight;
+		}
+
+		if (0 != right) {
+			if (false == (node.Ref.Key < subtrees[right].MinKey)) {
+				return false;
+			}
+
+			subtree.MaxKey = subtrees[right].MaxKey;
+			rightHeight    = subtrees[right].BlackHeight;
+		}
+
+		if (leftHeight != rightHeight) {
+			return false;
+		}
+
+		subtree.BlackHeight = leftHeight + (isRed ? 0 : 1);
+	}
+
+	// The root must be black.
+	return 0 == (pNodes[1].LeftAndColor & LLTB_COMPACT_RED);
+}
@@ -0,0 +1,109 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: LeftLeaningRedBlackSnapshot.h
+//
+//	$Header: $
+//
+//
+//	On-disk snapshot of an LLRB, designed so that loading it does no
+//	per-key work.
+//
+//	The file is a fixed header followed by an array of LLTBCompact_t
+//	records, which is exactly the arena layout used by
+//	CompactLeftLeaningRedBlack: 12-byte nodes linked by 32-bit indices,
+//	the color in the high bit of the left index, and a black sentinel in
+//	slot 0.  The nodes are stored in pre-order, so the root is always in
+//	slot 1, and every child has a higher index than its parent.
+//
+//	That lets a snapshot be used three ways:
+//
+//	  - LeftLeaningRedBlackSnapshot memory-maps the file and searches it
+//	    in place as a read-only tree.  Opening it costs one mmap(), and
+//	    after that only the pages a search touches are ever read.
+//
+//	  - CompactLeftLeaningRedBlack::LoadSnapshot() copies the node array
+//	    into its arena with one memcpy().
+//
+//	  - LeftLeaningRedBlack::LoadSnapshot() converts the indices to
+//	    pointers in one linear pass over a contiguous block of nodes,
+//	    without any comparisons or rebalancing.
+//
+//	Records are written in the byte order of the machine that wrote them.
+//	A snapshot written on a machine with a different byte order is
+//	rejected, since the magic number will not match.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include "VoidRef.h"
+#include "CompactLeftLeaningRedBlack.h"
+
+
+// "LLRBSNAP" when read as little-endian bytes.
+#define LLRB_SNAPSHOT_MAGIC		0x50414e5342524c4cull
+#define LLRB_SNAPSHOT_VERSION	1
+
+
+struct LLRBSnapshotHeader_t
+{
+	uint64_t Magic;
+	uint32_t Version;
+	uint32_t NodeSize;	// sizeof(LLTBCompact_t)
+	uint32_t Count;		// number of keys; the file holds Count + 1 records
+	uint32_t Root;		// 0 if the tree is empty, otherwise 1
+
+	// Sequence number of the last WriteAheadLog record reflected in the
+	// snapshot, or 0 if the tree had no log.
+	uint64_t LogSequence;
+};
+
+
+class LeftLeaningRedBlackSnapshot
+{
+private:
+	void*                m_pMapping;
+	size_t               m_MappingSize;
+	const LLTBCompact_t* m_pNodes;
+	uint32_t             m_Count;
+	uint32_t             m_Root;
+	uint64_t             m_LogSequence;
+
+	LeftLeaningRedBlackSnapshot(const LeftLeaningRedBlackSnapshot&);
+	LeftLeaningRedBlackSnapshot& operator=(const LeftLeaningRedBlackSnapshot&);
+
+public:
+	LeftLeaningRedBlackSnapshot(void);
+	~LeftLeaningRedBlackSnapshot(void);
+
+	bool Open(const char* path);
+	void Close(void);
+
+	// Returns the ref stored for key, or nullptr.  The pointer refers into
+	// the mapping, and is valid until Close().
+	const VoidRef_t* LookUp(const uint32_t key) const;
+
+	uint32_t Count(void) const       { return m_Count; }
+	uint64_t LogSequence(void) const { return m_LogSequence; }
+
+	// The mapped node array, including the sentinel, and the index of the
+	// root within it.  These are what the trees load from.
+	const LLTBCompact_t* Nodes(void) const { return m_pNodes; }
+	uint32_t             Root(void) const  { return m_Root; }
+
+	// Writes count + 1 records, starting with the sentinel, that are
+	// already in pre-order.  The file is written under a temporary name and
+	// renamed into place, so a crash never leaves a partial snapshot behind.
+	static bool Write(const char* path, const LLTBCompact_t* pNodes, uint32_t count, uint64_t logSequence = 0);
+
+	// Checks that count + 1 records, read from a file, form a valid LLRB
+	// that the trees can take over: every link points forward to a record
+	// in range, every record other than the root is linked to exactly
+	// once, the keys are in order, and the colors satisfy the LLRB rules
+	// with an equal black height everywhere.  allow4Nodes accepts the red
+	// right children of a 2-3-4 tree.  This is O(count) and does not
+	// recurse, whatever the file holds.
+	static bool CheckNodes(const LLTBCompact_t* pNodes, uint32_t count, bool allow4Nodes);
+};
@@ -0,0 +1,255 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: LookUpScheduler.cpp
+//
+//	$Header: $
+//
+//
+//	Run queue and frame cache behind LeftLeaningRedBlack::LookUpAsync().
+//	See the header for how the pieces fit together.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "LookUpScheduler.h"
+#include <new>
+
+
+// Initial size of the run queue, which must be a power of two.
+#define LOOKUP_QUEUE_SIZE	64
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FrameCache_t
+//
+//	Frames of finished searches, kept per thread.  All LookUpAsync() frames
+//	are the same size, so a frame of any other size just goes back to the
+//	heap.  The cache is emptied when the thread exits.
+//
+struct FrameCache_t
+{
+	struct Free_t
+	{
+		Free_t* pNext;
+	};
+
+	Free_t* pFree;
+	size_t  Count;
+	size_t  Size;
+
+	FrameCache_t(void) : pFree(nullptr), Count(0), Size(0) { }
+
+	~FrameCache_t(void)
+	{
+		while (nullptr != pFree) {
+			Free_t* pNext = pFree->pNext;
+
+			::operator delete(pFree);
+
+			pFree = pNext;
+		}
+	}
+};
+
+
+static thread_local FrameCache_t g_FrameCache;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	operator new()
+//
+void* LookUpTask::promise_type::operator new(size_t size)
+{
+	FrameCache_t& cache = g_FrameCache;
+
+	if ((size == cache.Size) && (nullptr != cache.pFree)) {
+		FrameCache_t::Free_t* pFrame = cache.pFree;
+
+		cache.pFree = pFrame->pNext;
+		--cache.Count;
+
+		return pFrame;
+	}
+
+	return ::operator new(size);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	operator delete()
+//
+//	The first frame freed on a thread decides which size it caches.
+//
+void LookUpTask::promise_type::operator delete(void* pFrame, size_t size)
+{
+	FrameCache_t& cache = g_FrameCache;
+
+	if (0 == cache.Size) {
+		cache.Size = size;
+	}
+
+	if ((size != cache.Size) || (cache.Count >= LOOKUP_FRAME_CACHE)) {
+		::operator delete(pFrame);
+		return;
+	}
+
+	FrameCache_t::Free_t* pFree = static_cast<FrameCache_t::Free_t*>(pFrame);
+
+	pFree->pNext = cache.pFree;
+	cache.pFree  = pFree;
+	++cache.Count;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUpLane_t
+//
+//	One lane of LookUpScheduler::LookUpBatch(): a coroutine that is queued
+//	as soon as it is created, and frees itself when it finishes.
+//
+struct LookUpLane_t
+{
+	struct promise_type
+	{
+		LookUpLane_t get_return_object(void) { return LookUpLane_t{ std::coroutine_handle<promise_type>::from_promise(*this) }; }
+
+		std::suspend_always initial_suspend(void) const noexcept { return { }; }
+		std::suspend_never  final_suspend(void) const noexcept { return { }; }
+
+		void return_void(void) { }
+		void unhandled_exception(void) { std::terminate(); }
+	};
+
+	std::coroutine_handle<promise_type> Handle;
+};
+
+
+// Keys left to look up, shared by the lanes of one LookUpBatch() call.
+struct LookUpWork_t
+{
+	LeftLeaningRedBlack* pTree;
+	const uint32_t*      pKeys;
+	void**               ppOut;
+	size_t               Count;
+	size_t               Next;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	RunLane()
+//
+//	Takes the next key until there are none left, so a lane whose search
+//	ends early starts another one instead of idling.
+//
+static LookUpLane_t RunLane(LookUpScheduler& scheduler, LookUpWork_t& work)
+{
+	while (work.Next < work.Count) {
+		size_t index = work.Next++;
+
+		work.ppOut[index] = co_await work.pTree->LookUpAsync(scheduler, work.pKeys[index]);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	constructor
+//
+LookUpScheduler::LookUpScheduler(void)
+	: m_pReady(new std::coroutine_handle<>[LOOKUP_QUEUE_SIZE])
+	, m_Mask(LOOKUP_QUEUE_SIZE - 1)
+	, m_Head(0)
+	, m_Tail(0)
+{
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	destructor
+//
+LookUpScheduler::~LookUpScheduler(void)
+{
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Grow()
+//
+//	Doubles the ring, unwrapping the queued coroutines to the front of it.
+//
+void LookUpScheduler::Grow(void)
+{
+	size_t size  = m_Mask + 1;
+	size_t count = m_Tail - m_Head;
+
+	std::unique_ptr<std::coroutine_handle<>[]> pReady(new std::coroutine_handle<>[2 * size]);
+
+	for (size_t i = 0; i < count; ++i) {
+		pReady[i] = m_pReady[(m_Head + i) & m_Mask];
+	}
+
+	m_pReady.swap(pReady);
+
+	m_Mask = (2 * size) - 1;
+	m_Head = 0;
+	m_Tail = count;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	RunOne()
+//
+bool LookUpScheduler::RunOne(void)
+{
+	if (m_Head == m_Tail) {
+		return false;
+	}
+
+	m_pReady[m_Head++ & m_Mask].resume();
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Run()
+//
+size_t LookUpScheduler::Run(void)
+{
+	size_t resumed = 0;
+
+	while (m_Head != m_Tail) {
+		m_pReady[m_Head++ & m_Mask].resume();
+		++resumed;
+	}
+
+	return resumed;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUpBatch()
+//
+//	The lanes are queued before any of them runs, so their first steps are
+//	spread out like the rest.
+//
+void LookUpScheduler::LookUpBatch(LeftLeaningRedBlack& tree, const uint32_t* pKeys, size_t count, void** ppOut, int width)
+{
+	LookUpWork_t work = { &tree, pKeys, ppOut, count, 0 };
+
+	for (int i = 0; (i < width) && (size_t(i) < count); ++i) {
+		Post(RunLane(*this, work).Handle);
+	}
+
+	Run();
+}
@@ -0,0 +1,195 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: LookUpScheduler.h
+//
+//	$Header: $
+//
+//
+//	Coroutine lookups for LeftLeaningRedBlack.  This needs C++20.
+//
+//	LookUpBatch() hides memory latency by stepping several searches in
+//	turn, but only when all of the keys are known up front.  A server
+//	built on coroutines gets its keys one request at a time, so
+//	LookUpAsync() offers the same interleaving as something to await:
+//
+//		void* pRef = co_await tree.LookUpAsync(scheduler, key);
+//
+//	At every level the search prefetches the node it will read next, then
+//	suspends to the LookUpScheduler, which resumes whatever else is queued
+//	on it: other searches, or any coroutine that uses Yield().  By the time
+//	the search comes round again its node has had all of that time to
+//	arrive.  When the search ends, the coroutine that awaited it carries on
+//	straight away, without another trip through the queue.
+//
+//	Each step is the same LLRBSearch_t step that LookUpBatch() takes, and
+//	it is only worth it in the same cases: the tree has to be much larger
+//	than the cache, and enough searches have to be in flight to cover a
+//	miss (see LLRB_BATCH_WIDTH).  Suspending costs some work of its own,
+//	so with only one search in flight plain LookUp() is faster.
+//
+//	A scheduler is not thread safe.  Use one per thread, await lookups only
+//	from coroutines that the same thread resumes, and do not change a tree
+//	while any search of it is suspended.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include "LeftLeaningRedBlack.h"
+#include <coroutine>
+#include <exception>
+#include <memory>
+
+
+// Number of coroutine frames each thread keeps for reuse once their
+// searches are done, so that starting a search rarely touches the heap.
+#define LOOKUP_FRAME_CACHE	64
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUpTask
+//
+//	What LeftLeaningRedBlack::LookUpAsync() returns.  The search does not
+//	start until the task is awaited, and co_await produces what LookUp()
+//	would have returned.  Awaiting a task a second time is not allowed.
+//
+class LookUpTask
+{
+public:
+	struct promise_type;
+
+private:
+	typedef std::coroutine_handle<promise_type> Handle_t;
+
+	// Hands control straight to whichever coroutine awaited the search.
+	struct FinalAwaiter_t
+	{
+		bool await_ready(void) const noexcept { return false; }
+		void await_resume(void) const noexcept { }
+
+		std::coroutine_handle<> await_suspend(Handle_t handle) noexcept
+		{
+			return handle.promise().Continuation;
+		}
+	};
+
+	Handle_t m_Handle;
+
+	explicit LookUpTask(Handle_t handle) : m_Handle(handle) { }
+
+	LookUpTask(const LookUpTask&);
+	LookUpTask& operator=(const LookUpTask&);
+
+public:
+	struct promise_type
+	{
+		void*                   pResult;
+		std::coroutine_handle<> Continuation;
+
+		LookUpTask get_return_object(void) { return LookUpTask(Handle_t::from_promise(*this)); }
+
+		std::suspend_always initial_suspend(void) const noexcept { return { }; }
+		FinalAwaiter_t      final_suspend(void) const noexcept { return { }; }
+
+		void return_value(void* pRef) { pResult = pRef; }
+
+		// Nothing in a search can throw.
+		void unhandled_exception(void) { std::terminate(); }
+
+		static void* operator new(size_t size);
+		static void  operator delete(void* pFrame, size_t size);
+	};
+
+	LookUpTask(LookUpTask&& other) : m_Handle(other.m_Handle) { other.m_Handle = nullptr; }
+
+	~LookUpTask(void)
+	{
+		if (nullptr != m_Handle) {
+			m_Handle.destroy();
+		}
+	}
+
+	bool await_ready(void) const noexcept { return false; }
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		m_Handle.promise().Continuation = awaiting;
+
+		return m_Handle;
+	}
+
+	void* await_resume(void) const noexcept { return m_Handle.promise().pResult; }
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUpScheduler
+//
+//	A run queue of suspended coroutines, resumed oldest first.  The queue
+//	is a ring that doubles when it fills, so it never refuses a coroutine.
+//
+class LookUpScheduler
+{
+private:
+	std::unique_ptr<std::coroutine_handle<>[]> m_pReady;
+	size_t m_Mask;
+	size_t m_Head;
+	size_t m_Tail;
+
+	LookUpScheduler(const LookUpScheduler&);
+	LookUpScheduler& operator=(const LookUpScheduler&);
+
+	void Grow(void);
+
+	// Puts the coroutine that awaits it at the back of the queue.
+	struct Yield_t
+	{
+		LookUpScheduler* pScheduler;
+
+		bool await_ready(void) const noexcept { return false; }
+		void await_resume(void) const noexcept { }
+
+		void await_suspend(std::coroutine_handle<> handle) const
+		{
+			pScheduler->Post(handle);
+		}
+	};
+
+public:
+	LookUpScheduler(void);
+
+	// Anything still queued is dropped without being resumed or destroyed,
+	// since the scheduler does not own the coroutines it runs.
+	~LookUpScheduler(void);
+
+	// co_await scheduler.Yield() lets everything queued ahead of the
+	// caller run before the caller carries on.
+	Yield_t Yield(void) { return Yield_t{ this }; }
+
+	void Post(std::coroutine_handle<> handle)
+	{
+		if ((m_Tail - m_Head) > m_Mask) {
+			Grow();
+		}
+
+		m_pReady[m_Tail++ & m_Mask] = handle;
+	}
+
+	size_t Pending(void) const { return m_Tail - m_Head; }
+
+	// RunOne() resumes the oldest queued coroutine, and returns false if
+	// there was none.  Run() keeps going until the queue is empty,
+	// including any coroutines posted along the way, and returns how many
+	// were resumed.
+	bool   RunOne(void);
+	size_t Run(void);
+
+	// Same contract as LeftLeaningRedBlack::LookUpBatch(), but each search
+	// is a LookUpAsync() coroutine, with width of them in flight at once.
+	// This runs everything else queued on the scheduler as well.
+	void LookUpBatch(LeftLeaningRedBlack& tree, const uint32_t* pKeys, size_t count, void** ppOut, int width = LLRB_BATCH_WIDTH);
+};
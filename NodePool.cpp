@@ -0,0 +1,464 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: NodePool.cpp
+//
+//	$Header: $
+//
+//
+//	Slab allocator for fixed-size tree nodes.  See NodePool.h.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "NodePool.h"
+#include <stdint.h>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+// Slabs start small so that tiny trees do not reserve much memory, then
+// double in size up to this many nodes per slab.
+#define FIRST_SLAB_NODES	64
+#define MAX_SLAB_NODES		65536
+
+
+// Every node must be able to hold the free-list link, and must keep the
+// alignment of the pointers stored inside the node.
+#define NODE_ALIGNMENT		sizeof(void*)
+
+// The slab header ends on a pointer boundary, wherever the slab came
+// from, so a pool with a larger alignment may need up to its alignment
+// less NODE_ALIGNMENT bytes of padding before the first node.  Slabs for
+// those pools are over-allocated by that much.
+#define SLAB_SLACK(alignment)	((alignment) - NODE_ALIGNMENT)
+
+
+#if defined(__linux__)
+
+// Page size selectors for MAP_HUGETLB, in case the headers predate them.
+#if !defined(MAP_HUGE_SHIFT)
+#define MAP_HUGE_SHIFT		26
+#endif
+
+#define POOL_MAP_HUGE_2MB	(21 << MAP_HUGE_SHIFT)
+#define POOL_MAP_HUGE_1GB	(30 << MAP_HUGE_SHIFT)
+
+// The mbind() policy from <numaif.h>, which comes with libnuma rather
+// than libc, so the system call is made directly.
+#define POOL_MPOL_BIND		2
+
+// Highest NUMA node number a pool can be bound to, plus one.
+#define POOL_MAX_NUMA_NODES	1024
+
+#endif
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	constructor
+//
+NodePool::NodePool(size_t nodeSize, size_t alignment)
+	: m_NodeSize(0)
+	, m_Alignment((alignment > NODE_ALIGNMENT) ? alignment : NODE_ALIGNMENT)
+	, m_NextSlabNodes(FIRST_SLAB_NODES)
+	, m_pSlabs(nullptr)
+	, m_pFreeList(nullptr)
+	, m_pBump(nullptr)
+	, m_pBumpEnd(nullptr)
+	, m_LiveCount(0)
+	, m_SlabCount(0)
+	, m_ReservedBytes(0)
+	, m_Config()
+{
+	m_NodeSize = (nodeSize + m_Alignment - 1) & ~(m_Alignment - 1);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	destructor
+//
+NodePool::~NodePool(void)
+{
+	ReleaseAll();
+}
+
+
+#if defined(__linux__)
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	MapSlab()
+//
+//	Maps a slab as the pool's configuration asks, rounding bytes up to a
+//	whole number of pages.  If no huge pages are reserved, the slab is
+//	mapped with normal pages instead, aligned so that the kernel can back
+//	it with transparent huge pages.
+//
+static void* MapSlab(size_t& bytes, const NodePoolConfig_t& config)
+{
+	size_t page = size_t(sysconf(_SC_PAGESIZE));
+	int    huge = 0;
+
+	if (POOL_PAGES_2MB == config.Pages) {
+		page = size_t(1) << 21;
+		huge = POOL_MAP_HUGE_2MB;
+	}
+	else if (POOL_PAGES_1GB == config.Pages) {
+		page = size_t(1) << 30;
+		huge = POOL_MAP_HUGE_1GB;
+	}
+
+	bytes = (bytes + page - 1) & ~(page - 1);
+
+	void* pSlab = MAP_FAILED;
+
+	if (0 != huge) {
+		pSlab = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | huge, -1, 0);
+	}
+
+	if (MAP_FAILED == pSlab) {
+		// Map an extra page, so an aligned run of pages can be cut out of
+		// the middle for transparent huge pages.
+		size_t slack = (0 != huge) ? page : 0;
+		void*  pMap  = mmap(nullptr, bytes + slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (MAP_FAILED == pMap) {
+			throw std::bad_alloc();
+		}
+
+		uintptr_t start = reinterpret_cast<uintptr_t>(pMap);
+		uintptr_t first = start;
+
+		if (0 != huge) {
+			uintptr_t end = start + bytes + slack;
+
+			first = (start + page - 1) & ~uintptr_t(page - 1);
+
+			if (first > start) {
+				munmap(pMap, first - start);
+			}
+
+			if (end > first + bytes) {
+				munmap(reinterpret_cast<void*>(first + bytes), end - (first + bytes));
+			}
+
+			madvise(reinterpret_cast<void*>(first), bytes, MADV_HUGEPAGE);
+		}
+
+		pSlab = reinterpret_cast<void*>(first);
+	}
+
+	// Nothing has touched the slab yet, so every page will be placed by
+	// the policy set here.
+	if ((config.NumaNode >= 0) && (config.NumaNode < POOL_MAX_NUMA_NODES)) {
+		const size_t  bits = 8 * sizeof(unsigned long);
+		unsigned long mask[POOL_MAX_NUMA_NODES / bits] = { 0 };
+
+		mask[config.NumaNode / bits] = 1ul << (config.NumaNode % bits);
+
+		// The kernel counts one bit fewer than maxnode says.
+		syscall(SYS_mbind, pSlab, bytes, POOL_MPOL_BIND, mask, POOL_MAX_NUMA_NODES + 1, 0);
+	}
+
+	return pSlab;
+}
+
+#endif
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	NewSlab()
+//
+//	Allocates a slab with room for count nodes and links it in at the head
+//	of the slab list.  Returns the first node, aligned as the pool asks.
+//	The alignment must be a power of two.
+//
+//	A slab that is mapped directly takes whole pages, so count is raised
+//	to the number of nodes that actually fit.
+//
+char* NodePool::NewSlab(size_t& count)
+{
+	size_t slack = SLAB_SLACK(m_Alignment);
+	size_t bytes = sizeof(Slab_t) + slack + (count * m_NodeSize);
+
+	if ((bytes - sizeof(Slab_t) - slack) / m_NodeSize != count) {
+		throw std::bad_alloc();
+	}
+
+	Slab_t* pSlab  = nullptr;
+	bool    mapped = false;
+
+#if defined(__linux__)
+	if ((POOL_PAGES_DEFAULT != m_Config.Pages) || (POOL_ANY_NODE != m_Config.NumaNode)) {
+		pSlab  = static_cast<Slab_t*>(MapSlab(bytes, m_Config));
+		mapped = true;
+		count  = (bytes - sizeof(Slab_t) - slack) / m_NodeSize;
+	}
+#endif
+
+	if (nullptr == pSlab) {
+		pSlab = static_cast<Slab_t*>(::operator new(bytes));
+	}
+
+	pSlab->pNext     = m_pSlabs;
+	pSlab->ByteCount = bytes;
+	pSlab->Mapped    = mapped;
+	m_pSlabs         = pSlab;
+	++m_SlabCount;
+	m_ReservedBytes += bytes;
+
+	uintptr_t first = reinterpret_cast<uintptr_t>(pSlab + 1);
+
+	return reinterpret_cast<char*>((first + m_Alignment - 1) & ~uintptr_t(m_Alignment - 1));
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FreeSlab()
+//
+void NodePool::FreeSlab(Slab_t* pSlab)
+{
+#if defined(__linux__)
+	if (pSlab->Mapped) {
+		munmap(pSlab, pSlab->ByteCount);
+		return;
+	}
+#endif
+
+	::operator delete(pSlab);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	AllocSlow()
+//
+//	Called when both the free list and the current slab are exhausted.
+//
+void* NodePool::AllocSlow(void)
+{
+	size_t count = m_NextSlabNodes;
+
+	char* pFirst = NewSlab(count);
+
+	// Keep the new slab at the head of the list, since that is the one
+	// Alloc() carves from.
+	m_pBump    = pFirst;
+	m_pBumpEnd = pFirst + (count * m_NodeSize);
+
+	if (m_NextSlabNodes < MAX_SLAB_NODES) {
+		m_NextSlabNodes *= 2;
+	}
+
+	void* pNode = m_pBump;
+	m_pBump += m_NodeSize;
+	++m_LiveCount;
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	AllocContiguous()
+//
+//	Allocates count nodes as one array, placed in a slab of their own.
+//	The nodes are individually returned with Free() like any other node.
+//
+//	This leaves the partially used slab that Alloc() is carving from alone,
+//	so the new slab is linked in behind it.
+//
+void* NodePool::AllocContiguous(size_t count)
+{
+	if (0 == count) {
+		return nullptr;
+	}
+
+	Slab_t* pCurrent = m_pSlabs;
+
+	// Any room left over in a mapped slab is not used.
+	size_t slots  = count;
+	char*  pFirst = NewSlab(slots);
+
+	if (nullptr != pCurrent) {
+		// NewSlab() put the new slab at the head.  Move it behind the
+		// slab that Alloc() is carving from.
+		Slab_t* pSlab = m_pSlabs;
+
+		m_pSlabs        = pCurrent;
+		pSlab->pNext    = pCurrent->pNext;
+		pCurrent->pNext = pSlab;
+	}
+
+	m_LiveCount += count;
+
+	return pFirst;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FlushBump()
+//
+//	Moves the unused tail of the current slab onto the free list.
+//
+void NodePool::FlushBump(void)
+{
+	while (m_pBump < m_pBumpEnd) {
+		*reinterpret_cast<void**>(m_pBump) = m_pFreeList;
+		m_pFreeList = m_pBump;
+		m_pBump += m_NodeSize;
+	}
+
+	m_pBump    = nullptr;
+	m_pBumpEnd = nullptr;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Reserve()
+//
+//	Makes sure the current slab has room for count more nodes, so that
+//	as long as the free list is empty, the next count calls to Alloc()
+//	hand out consecutive nodes in address order.
+//
+void NodePool::Reserve(size_t count)
+{
+	if (size_t(m_pBumpEnd - m_pBump) / m_NodeSize >= count) {
+		return;
+	}
+
+	FlushBump();
+
+	char* pFirst = NewSlab(count);
+
+	m_pBump    = pFirst;
+	m_pBumpEnd = pFirst + (count * m_NodeSize);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Splice()
+//
+//	Takes over every slab owned by another pool of the same node size, so
+//	that nodes allocated from `other` now belong to this pool.  The other
+//	pool is left empty.
+//
+//	The smaller of the two unused slab tails is moved onto the free list,
+//	and the other pool's free list is appended to this one, so no memory
+//	is lost.
+//
+void NodePool::Splice(NodePool& other)
+{
+	if ((this == &other) || (nullptr == other.m_pSlabs)) {
+		return;
+	}
+
+	// Carry on carving from whichever pool has more of its current slab
+	// left, so splicing in a mostly unused slab does not cost a walk over
+	// all of it.  The smaller tail goes onto the free list.
+	if ((other.m_pBumpEnd - other.m_pBump) > (m_pBumpEnd - m_pBump)) {
+		std::swap(m_pBump, other.m_pBump);
+		std::swap(m_pBumpEnd, other.m_pBumpEnd);
+	}
+
+	other.FlushBump();
+
+	if (nullptr != other.m_pFreeList) {
+		void* pTail = other.m_pFreeList;
+		while (nullptr != *static_cast<void**>(pTail)) {
+			pTail = *static_cast<void**>(pTail);
+		}
+
+		*static_cast<void**>(pTail) = m_pFreeList;
+		m_pFreeList = other.m_pFreeList;
+	}
+
+	// The other pool's slabs go in behind this pool's head slab.
+	Slab_t* pTail = other.m_pSlabs;
+	while (nullptr != pTail->pNext) {
+		pTail = pTail->pNext;
+	}
+
+	if (nullptr != m_pSlabs) {
+		pTail->pNext    = m_pSlabs->pNext;
+		m_pSlabs->pNext = other.m_pSlabs;
+	}
+	else {
+		m_pSlabs = other.m_pSlabs;
+	}
+
+	m_LiveCount     += other.m_LiveCount;
+	m_SlabCount     += other.m_SlabCount;
+	m_ReservedBytes += other.m_ReservedBytes;
+
+	other.m_pSlabs        = nullptr;
+	other.m_pFreeList     = nullptr;
+	other.m_pBump         = nullptr;
+	other.m_pBumpEnd      = nullptr;
+	other.m_LiveCount     = 0;
+	other.m_SlabCount     = 0;
+	other.m_ReservedBytes = 0;
+	other.m_NextSlabNodes = FIRST_SLAB_NODES;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Swap()
+//
+//	Exchanges everything, including the node size and alignment, so each
+//	pool stays usable for the nodes it now holds.  Unlike Splice() this is
+//	O(1).
+//
+void NodePool::Swap(NodePool& other)
+{
+	std::swap(m_NodeSize, other.m_NodeSize);
+	std::swap(m_Alignment, other.m_Alignment);
+	std::swap(m_NextSlabNodes, other.m_NextSlabNodes);
+	std::swap(m_pSlabs, other.m_pSlabs);
+	std::swap(m_pFreeList, other.m_pFreeList);
+	std::swap(m_pBump, other.m_pBump);
+	std::swap(m_pBumpEnd, other.m_pBumpEnd);
+	std::swap(m_LiveCount, other.m_LiveCount);
+	std::swap(m_SlabCount, other.m_SlabCount);
+	std::swap(m_ReservedBytes, other.m_ReservedBytes);
+	std::swap(m_Config, other.m_Config);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	ReleaseAll()
+//
+//	Returns every slab to the system.  Any node previously handed out by
+//	this pool becomes invalid.
+//
+void NodePool::ReleaseAll(void)
+{
+	while (nullptr != m_pSlabs) {
+		Slab_t* pNext = m_pSlabs->pNext;
+		FreeSlab(m_pSlabs);
+		m_pSlabs = pNext;
+	}
+
+	m_NextSlabNodes = FIRST_SLAB_NODES;
+	m_pFreeList     = nullptr;
+	m_pBump         = nullptr;
+	m_pBumpEnd      = nullptr;
+	m_LiveCount     = 0;
+	m_SlabCount     = 0;
+	m_ReservedBytes = 0;
+}
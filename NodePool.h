@@ -0,0 +1,170 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: NodePool.h
+//
+//	$Header: $
+//
+//
+//	Fixed-size node allocator used by the balanced trees.  Nodes are carved
+//	out of large slabs, and freed nodes are kept on an intrusive free list
+//	(the first word of a free node points at the next free node), so both
+//	allocation and release are O(1) and never touch the system allocator
+//	once the pool has warmed up.
+//
+//	All of the nodes can be released in bulk by handing the slabs back,
+//	which avoids walking the tree just to free it.
+//
+//	Nodes are aligned to a pointer by default.  A pool can also be asked for
+//	a larger, power-of-two alignment, such as a cache line.
+//
+//	A pool is not thread-safe.  Each tree normally owns its own pool, but
+//	trees produced by splitting a tree share the original tree's pool.
+//
+//	On Linux a pool can be configured to back its slabs with 2MB or 1GB
+//	huge pages, which cuts TLB misses on large trees, and to bind them to
+//	one NUMA node.  Huge pages come from the reserved hugetlbfs pool if
+//	there is one, and otherwise the slabs are mapped with normal pages
+//	and marked for transparent huge pages.  Binding is best effort: if the
+//	node does not exist, the kernel's default placement is kept.  Both
+//	only affect slabs allocated after Configure(), and are ignored on
+//	other systems.  A mapped slab takes at least one whole page, so 1GB
+//	pages only make sense for very large trees.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include <stddef.h>
+
+
+enum NodePoolPages_t
+{
+	POOL_PAGES_DEFAULT,		// slabs come from ::operator new
+	POOL_PAGES_2MB,
+	POOL_PAGES_1GB
+};
+
+
+// NumaNode value that leaves placement to the kernel.
+#define POOL_ANY_NODE		(-1)
+
+
+struct NodePoolConfig_t
+{
+	NodePoolPages_t Pages;
+	int             NumaNode;
+
+	NodePoolConfig_t(NodePoolPages_t pages = POOL_PAGES_DEFAULT, int numaNode = POOL_ANY_NODE)
+		: Pages(pages)
+		, NumaNode(numaNode)
+	{
+	}
+};
+
+
+class NodePool
+{
+private:
+	struct Slab_t
+	{
+		Slab_t* pNext;
+		size_t  ByteCount;
+
+		// Set if the slab was mapped directly rather than coming from
+		// ::operator new.
+		bool    Mapped;
+	};
+
+	size_t  m_NodeSize;
+	size_t  m_Alignment;
+	size_t  m_NextSlabNodes;
+
+	Slab_t* m_pSlabs;
+	void*   m_pFreeList;
+
+	// Unused tail of the most recent slab.  Nodes are carved from here
+	// on demand, so a new slab never has to be threaded onto the free
+	// list up front.
+	char*   m_pBump;
+	char*   m_pBumpEnd;
+
+	size_t  m_LiveCount;
+	size_t  m_SlabCount;
+	size_t  m_ReservedBytes;
+
+	NodePoolConfig_t m_Config;
+
+	void* AllocSlow(void);
+	char* NewSlab(size_t& count);
+	void  FreeSlab(Slab_t* pSlab);
+	void  FlushBump(void);
+
+	NodePool(const NodePool&);
+	NodePool& operator=(const NodePool&);
+
+public:
+	NodePool(size_t nodeSize, size_t alignment = sizeof(void*));
+	~NodePool(void);
+
+	void* Alloc(void);
+	void  Free(void* pNode);
+	void  ReleaseAll(void);
+
+	void* AllocContiguous(size_t count);
+
+	void  Reserve(size_t count);
+	void  Splice(NodePool& other);
+	void  Swap(NodePool& other);
+
+	void Configure(const NodePoolConfig_t& config) { m_Config = config; }
+	const NodePoolConfig_t& Config(void) const    { return m_Config; }
+
+	size_t NodeSize(void) const  { return m_NodeSize; }
+	size_t LiveCount(void) const { return m_LiveCount; }
+	size_t SlabCount(void) const { return m_SlabCount; }
+
+	// Bytes taken from the system for slabs, including slab headers.
+	size_t ReservedBytes(void) const { return m_ReservedBytes; }
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Alloc()
+//
+//	Kept inline since this sits on the insert path.
+//
+inline void* NodePool::Alloc(void)
+{
+	void* pNode = m_pFreeList;
+
+	if (nullptr != pNode) {
+		m_pFreeList = *static_cast<void**>(pNode);
+	}
+	else if (m_pBump < m_pBumpEnd) {
+		pNode = m_pBump;
+		m_pBump += m_NodeSize;
+	}
+	else {
+		return AllocSlow();
+	}
+
+	++m_LiveCount;
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Free()
+//
+inline void NodePool::Free(void* pNode)
+{
+	*static_cast<void**>(pNode) = m_pFreeList;
+	m_pFreeList = pNode;
+
+	--m_LiveCount;
+}
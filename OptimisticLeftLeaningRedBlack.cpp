@@ -0,0 +1,1179 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: OptimisticLeftLeaningRedBlack.cpp
+//
+//	$Header: $
+//
+//
+//	LLRB with optimistic lock coupling.  See the header for the overall
+//	scheme.
+//
+//	The memory ordering follows a sequence lock.  A writer takes a node's
+//	lock with an acquire swap followed by a release fence, so the lock is
+//	visible before any of its stores, and releases it with a release
+//	increment.  A reader loads the version with acquire, reads the fields,
+//	then issues an acquire fence before loading the version again.  Child
+//	pointers are stored with release and loaded with acquire, which is what
+//	makes the fields of a newly linked node visible to a reader that finds
+//	it.
+//
+//	Every link a search follows is validated against the version of the
+//	node it was read from before the search trusts it, so a search racing
+//	with a rotation can see a half-finished change, but never acts on one.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "OptimisticLeftLeaningRedBlack.h"
+#include <stdint.h>
+#include <new>
+#include <thread>
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	IsLocked()
+//
+static inline bool IsLocked(uint64_t version)
+{
+	return 0 != (version & 1);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	ReadVersion()
+//
+static inline uint64_t ReadVersion(const LLTBOptimistic_t* pNode)
+{
+	return pNode->Version.load(std::memory_order_acquire);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Unchanged()
+//
+//	Returns true if nothing has been written to the node since its
+//	version was read, so everything read from it in between is usable.
+//
+static inline bool Unchanged(const LLTBOptimistic_t* pNode, uint64_t version)
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	return version == pNode->Version.load(std::memory_order_relaxed);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	TryLock()
+//
+//	Only succeeds if the node is still at the version the caller read.
+//
+static inline bool TryLock(LLTBOptimistic_t* pNode, uint64_t version)
+{
+	if (IsLocked(version) ||
+		(false == pNode->Version.compare_exchange_strong(version, version + 1, std::memory_order_acquire, std::memory_order_relaxed))) {
+		return false;
+	}
+
+	std::atomic_thread_fence(std::memory_order_release);
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Left(), Right(), SetLeft(), SetRight()
+//
+static inline LLTBOptimistic_t* Left(const LLTBOptimistic_t* pNode)
+{
+	return pNode->pLeft.load(std::memory_order_acquire);
+}
+
+static inline LLTBOptimistic_t* Right(const LLTBOptimistic_t* pNode)
+{
+	return pNode->pRight.load(std::memory_order_acquire);
+}
+
+static inline void SetLeft(LLTBOptimistic_t* pNode, LLTBOptimistic_t* pChild)
+{
+	pNode->pLeft.store(pChild, std::memory_order_release);
+}
+
+static inline void SetRight(LLTBOptimistic_t* pNode, LLTBOptimistic_t* pChild)
+{
+	pNode->pRight.store(pChild, std::memory_order_release);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	IsRed(), SetRed()
+//
+//	Only writers look at colors.  They may read them before locking, since
+//	every color change also changes the version of the 2-3-4 node's top.
+//
+static inline bool IsRed(const LLTBOptimistic_t* pNode)
+{
+	return (nullptr != pNode) && pNode->IsRed.load(std::memory_order_relaxed);
+}
+
+static inline void SetRed(LLTBOptimistic_t* pNode, bool isRed)
+{
+	pNode->IsRed.store(isRed, std::memory_order_relaxed);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Relink()
+//
+//	Points whichever link of pAnchor led to pOld at pNew instead.  The
+//	caller holds pAnchor's lock.
+//
+static inline void Relink(LLTBOptimistic_t* pAnchor, LLTBOptimistic_t* pOld, LLTBOptimistic_t* pNew)
+{
+	if (pOld == Left(pAnchor)) {
+		SetLeft(pAnchor, pNew);
+	}
+	else {
+		SetRight(pAnchor, pNew);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Backoff()
+//
+//	Called before retrying after a conflict.  A conflicting writer only
+//	holds its locks for a few stores, so spinning for a while is normally
+//	enough, but the writer may have been preempted, in which case spinning
+//	on would only delay it further.
+//
+static void Backoff(unsigned& retries)
+{
+	if (++retries < OPTIMISTIC_SPIN_LIMIT) {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	}
+	else {
+		std::this_thread::yield();
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LockSet_t
+//
+//	The nodes one change has locked, up to the six a split touches.  Null
+//	nodes are skipped, which saves the callers from checking which members
+//	of a group exist.
+//
+class LockSet_t
+{
+private:
+	LLTBOptimistic_t* m_pNodes[6];
+	int               m_Count;
+
+	LockSet_t(const LockSet_t&);
+	LockSet_t& operator=(const LockSet_t&);
+
+public:
+	LockSet_t(void)
+		: m_Count(0)
+	{
+	}
+
+	bool Add(LLTBOptimistic_t* pNode, uint64_t version)
+	{
+		if (nullptr == pNode) {
+			return true;
+		}
+
+		if (false == TryLock(pNode, version)) {
+			return false;
+		}
+
+		m_pNodes[m_Count++] = pNode;
+
+		return true;
+	}
+
+	// Releases the locks, moving every version on so that searches which
+	// read these nodes before the change will start over.
+	void Unlock(void)
+	{
+		for (int i = 0; i < m_Count; ++i) {
+			m_pNodes[i]->Version.fetch_add(1, std::memory_order_release);
+		}
+
+		m_Count = 0;
+	}
+
+	// Releases the locks without a change, putting the versions back.
+	void Abandon(void)
+	{
+		for (int i = 0; i < m_Count; ++i) {
+			m_pNodes[i]->Version.fetch_sub(1, std::memory_order_release);
+		}
+
+		m_Count = 0;
+	}
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	InitNode()
+//
+//	Note that a new node defaults to being red.
+//
+static LLTBOptimistic_t* InitNode(LLTBOptimistic_t* pNode, const VoidRef_t& ref)
+{
+	pNode->Version.store(0, std::memory_order_relaxed);
+	pNode->pLeft.store(nullptr, std::memory_order_relaxed);
+	pNode->pRight.store(nullptr, std::memory_order_relaxed);
+	pNode->Ref = ref;
+	pNode->IsRed.store(true, std::memory_order_relaxed);
+	pNode->IsDeleted.store(false, std::memory_order_relaxed);
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	constructor
+//
+OptimisticLeftLeaningRedBlack::OptimisticLeftLeaningRedBlack(void)
+	: m_Draining(false)
+	, m_pPool(new NodePool(sizeof(LLTBOptimistic_t), OPTIMISTIC_NODE_ALIGNMENT))
+{
+	VoidRef_t none;
+	none.Key = 0;
+
+	InitNode(&m_Head, none);
+
+	for (int i = 0; i < EPOCH_SLOT_COUNT; ++i) {
+		m_Slots[i].pNext = nullptr;
+		m_Slots[i].pEnd  = nullptr;
+		m_Slots[i].Live.store(0);
+		m_Slots[i].Deleted.store(0);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	destructor
+//
+//	No other thread may still be using the tree once it is being
+//	destroyed, so the pool can release everything at once.
+//
+OptimisticLeftLeaningRedBlack::~OptimisticLeftLeaningRedBlack(void)
+{
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	EnterWrite()
+//
+//	Claims a writer slot.  Purge() sets m_Draining before it waits for the
+//	writers in the slots to leave, and every access here is sequentially
+//	consistent, so a writer either sees m_Draining and backs off, or is
+//	seen by Purge() and waited for.
+//
+int OptimisticLeftLeaningRedBlack::EnterWrite(void)
+{
+	for (;;) {
+		int slot = m_Writers.EnterRead();
+
+		if (false == m_Draining.load()) {
+			return slot;
+		}
+
+		m_Writers.ExitRead(slot);
+
+		while (m_Draining.load()) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LeaveWrite()
+//
+void OptimisticLeftLeaningRedBlack::LeaveWrite(int slot)
+{
+	m_Writers.ExitRead(slot);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Drain()
+//
+//	Turns new writers away and waits for the running ones to finish.  The
+//	caller holds m_PurgeLock, and must clear m_Draining when done.
+//
+void OptimisticLeftLeaningRedBlack::Drain(void)
+{
+	m_Draining.store(true);
+
+	m_Writers.WaitForReaders(m_Writers.Advance());
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	NewNode()
+//
+//	Takes the next node from the chunk owned by the caller's writer slot.
+//	Only refilling the chunk touches shared state.
+//
+LLTBOptimistic_t* OptimisticLeftLeaningRedBlack::NewNode(int slot, const VoidRef_t& ref)
+{
+	WriterSlot_t& owner = m_Slots[slot];
+
+	if (owner.pNext == owner.pEnd) {
+		std::lock_guard<std::mutex> lock(m_PoolLock);
+
+		owner.pNext = static_cast<LLTBOptimistic_t*>(m_pPool->AllocContiguous(OPTIMISTIC_CHUNK_NODES));
+		owner.pEnd  = owner.pNext + OPTIMISTIC_CHUNK_NODES;
+	}
+
+	return InitNode(new (owner.pNext++) LLTBOptimistic_t, ref);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	ReadGroup()
+//
+//	Fills in the red children of group.pTop and the versions of every
+//	member.  group.pAnchor and group.AnchorVersion must already be set,
+//	and the anchor is validated last, which proves that pTop was still
+//	linked below it while the rest was read.
+//
+//	Returns false if the search has to start over.
+//
+bool OptimisticLeftLeaningRedBlack::ReadGroup(Group_t& group) const
+{
+	LLTBOptimistic_t* pTop = group.pTop;
+
+	group.TopVersion = ReadVersion(pTop);
+	group.pRedLeft   = nullptr;
+	group.pRedRight  = nullptr;
+
+	if (IsLocked(group.TopVersion)) {
+		return false;
+	}
+
+	LLTBOptimistic_t* pLeft  = Left(pTop);
+	LLTBOptimistic_t* pRight = Right(pTop);
+
+	if (IsRed(pLeft)) {
+		group.pRedLeft       = pLeft;
+		group.RedLeftVersion = ReadVersion(pLeft);
+
+		if (IsLocked(group.RedLeftVersion)) {
+			return false;
+		}
+	}
+
+	if (IsRed(pRight)) {
+		group.pRedRight       = pRight;
+		group.RedRightVersion = ReadVersion(pRight);
+
+		if (IsLocked(group.RedRightVersion)) {
+			return false;
+		}
+	}
+
+	return Unchanged(pTop, group.TopVersion) && Unchanged(group.pAnchor, group.AnchorVersion);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	SplitGroup()
+//
+//	Splits the 4-node in group by pushing its top up into parent, which
+//	is a 2-node or a 3-node, or else nothing would have been left for the
+//	search to descend through.  Which rotation the parent then needs
+//	depends on where in it the group hangs:
+//
+//	  below a 2-node, on the left       no rotation, the parent becomes a
+//	                                    3-node
+//	  below a 2-node, on the right      rotate the parent left
+//	  below a 3-node, on the right      no rotation, the parent becomes a
+//	                                    4-node
+//	  below a 3-node's red left child   rotate the parent right, after
+//	                                    rotating the red child left if the
+//	                                    group hangs on its right
+//
+//	The members of both groups are locked, plus the parent's anchor when
+//	the parent's top is replaced.  A root group has no parent, and just
+//	hands its top to the next level up, which raises the black height of
+//	the whole tree by one.
+//
+//	Returns false if another writer got there first.
+//
+bool OptimisticLeftLeaningRedBlack::SplitGroup(const Group_t& parent, const Group_t& group)
+{
+	LLTBOptimistic_t* pTop = group.pTop;
+	LockSet_t         locks;
+
+	if ((false == locks.Add(parent.pTop, parent.TopVersion)) ||
+		(false == locks.Add(parent.pRedLeft, parent.RedLeftVersion)) ||
+		(false == locks.Add(pTop, group.TopVersion)) ||
+		(false == locks.Add(group.pRedLeft, group.RedLeftVersion)) ||
+		(false == locks.Add(group.pRedRight, group.RedRightVersion))) {
+		locks.Abandon();
+		return false;
+	}
+
+	LLTBOptimistic_t* pParent  = parent.pTop;
+	LLTBOptimistic_t* pRedLeft = parent.pRedLeft;
+
+	// The parent's links can be trusted now that it is locked.
+	bool rotate = (nullptr != pParent) &&
+		((group.pAnchor == pRedLeft) || ((nullptr == pRedLeft) && (pTop == Right(pParent))));
+
+	if (rotate && (false == locks.Add(parent.pAnchor, parent.AnchorVersion))) {
+		locks.Abandon();
+		return false;
+	}
+
+	SetRed(group.pRedLeft, false);
+	SetRed(group.pRedRight, false);
+
+	if (nullptr == pParent) {
+		locks.Unlock();
+		return true;
+	}
+
+	SetRed(pTop, true);
+
+	if (false == rotate) {
+		locks.Unlock();
+		return true;
+	}
+
+	LLTBOptimistic_t* pNewTop = pTop;
+
+	if (nullptr == pRedLeft) {
+		SetRight(pParent, group.pRedLeft);
+		SetLeft(pTop, pParent);
+	}
+	else if (pTop == Left(pRedLeft)) {
+		SetLeft(pParent, Right(pRedLeft));
+		SetRight(pRedLeft, pParent);
+
+		pNewTop = pRedLeft;
+	}
+	else {
+		SetRight(pRedLeft, group.pRedLeft);
+		SetLeft(pTop, pRedLeft);
+		SetLeft(pParent, group.pRedRight);
+		SetRight(pTop, pParent);
+	}
+
+	SetRed(pNewTop, false);
+	SetRed(pParent, true);
+
+	Relink(parent.pAnchor, pParent, pNewTop);
+
+	locks.Unlock();
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	InsertLeaf()
+//
+//	Adds a red leaf below pHolder, which is the member of group where the
+//	search ran off the bottom of the tree.  The group is a 2-node or a
+//	3-node, so the new leaf makes it a 3-node or a 4-node, after at most
+//	two rotations within the group.
+//
+//	Returns false if another writer got there first.
+//
+bool OptimisticLeftLeaningRedBlack::InsertLeaf(int slot, const Group_t& group, LLTBOptimistic_t* pHolder, const VoidRef_t& ref)
+{
+	LLTBOptimistic_t* pTop     = group.pTop;
+	LLTBOptimistic_t* pRedLeft = group.pRedLeft;
+	LockSet_t         locks;
+
+	// A leaf to the right of a 2-node, or anywhere below the red child
+	// of a 3-node, ends up replacing the top.
+	bool rotate = (pHolder == pRedLeft) || ((nullptr == pRedLeft) && (ref.Key > pTop->Ref.Key));
+
+	if ((false == locks.Add(pTop, group.TopVersion)) ||
+		(false == locks.Add(pRedLeft, group.RedLeftVersion)) ||
+		(rotate && (false == locks.Add(group.pAnchor, group.AnchorVersion)))) {
+		locks.Abandon();
+		return false;
+	}
+
+	LLTBOptimistic_t* pNew = NewNode(slot, ref);
+
+	if (false == rotate) {
+		if (ref.Key < pTop->Ref.Key) {
+			SetLeft(pTop, pNew);
+		}
+		else {
+			SetRight(pTop, pNew);
+		}
+	}
+	else if (nullptr == pRedLeft) {
+		SetLeft(pNew, pTop);
+		SetRed(pNew, false);
+		SetRed(pTop, true);
+
+		Relink(group.pAnchor, pTop, pNew);
+	}
+	else if (ref.Key < pRedLeft->Ref.Key) {
+		SetLeft(pRedLeft, pNew);
+		SetLeft(pTop, nullptr);
+		SetRight(pRedLeft, pTop);
+		SetRed(pRedLeft, false);
+		SetRed(pTop, true);
+
+		Relink(group.pAnchor, pTop, pRedLeft);
+	}
+	else {
+		SetLeft(pNew, pRedLeft);
+		SetRight(pNew, pTop);
+		SetLeft(pTop, nullptr);
+		SetRed(pNew, false);
+		SetRed(pTop, true);
+
+		Relink(group.pAnchor, pTop, pNew);
+	}
+
+	locks.Unlock();
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Search()
+//
+//	Plain binary search with lock coupling: each node's version is read
+//	before the parent is validated, so the node was the parent's child at
+//	that moment.  On success, pFound is the node holding the key, or
+//	nullptr if there is none, and version is the version pFound was read
+//	at.  Deleted nodes are found like any other.
+//
+//	Returns false if the search has to start over.
+//
+bool OptimisticLeftLeaningRedBlack::Search(const uint32_t key, LLTBOptimistic_t*& pFound, uint64_t& version) const
+{
+	const LLTBOptimistic_t* pParent       = &m_Head;
+	uint64_t                parentVersion = ReadVersion(&m_Head);
+
+	if (IsLocked(parentVersion)) {
+		return false;
+	}
+
+	LLTBOptimistic_t* pNode = Left(&m_Head);
+
+	while (nullptr != pNode) {
+		uint64_t nodeVersion = ReadVersion(pNode);
+
+		if (IsLocked(nodeVersion) || (false == Unchanged(pParent, parentVersion))) {
+			return false;
+		}
+
+		if (key == pNode->Ref.Key) {
+			pFound  = pNode;
+			version = nodeVersion;
+			return true;
+		}
+
+		// Both links share the node's cache line.  Loading both lets the
+		// compiler pick one with a conditional move, instead of a branch
+		// that mispredicts half the time.
+		LLTBOptimistic_t* pLeft  = Left(pNode);
+		LLTBOptimistic_t* pRight = Right(pNode);
+
+		pParent       = pNode;
+		parentVersion = nodeVersion;
+		pNode         = (key < pNode->Ref.Key) ? pLeft : pRight;
+	}
+
+	pFound = nullptr;
+
+	return Unchanged(pParent, parentVersion);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUp()
+//
+//	Returns true if the key is in the tree, copying its ref to pRef.
+//
+bool OptimisticLeftLeaningRedBlack::LookUp(const uint32_t key, VoidRef_t* pRef)
+{
+	EpochReadGuard guard(m_Epochs);
+
+	unsigned retries = 0;
+
+	for (;;) {
+		LLTBOptimistic_t* pNode   = nullptr;
+		uint64_t          version = 0;
+
+		if (Search(key, pNode, version)) {
+			if (nullptr == pNode) {
+				return false;
+			}
+
+			bool      found = (false == pNode->IsDeleted.load(std::memory_order_relaxed));
+			VoidRef_t ref   = pNode->Ref;
+
+			if (Unchanged(pNode, version)) {
+				if (found && (nullptr != pRef)) {
+					*pRef = ref;
+				}
+
+				return found;
+			}
+		}
+
+		Backoff(retries);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	TryInsert()
+//
+//	One top-down pass of Insert(), taking a 2-3-4 node at a time.  The
+//	pass ends as soon as it changes anything; after a split the key still
+//	has to be inserted, so false is returned to start over.
+//
+bool OptimisticLeftLeaningRedBlack::TryInsert(int slot, const VoidRef_t& ref, bool& added, bool& revived)
+{
+	const uint32_t key = ref.Key;
+
+	// The root group has no parent.
+	Group_t parent = Group_t();
+	Group_t group;
+
+	group.pAnchor       = &m_Head;
+	group.AnchorVersion = ReadVersion(&m_Head);
+	group.pTop          = Left(&m_Head);
+
+	if (IsLocked(group.AnchorVersion)) {
+		return false;
+	}
+
+	if (nullptr == group.pTop) {
+		LockSet_t locks;
+
+		if (false == locks.Add(&m_Head, group.AnchorVersion)) {
+			return false;
+		}
+
+		LLTBOptimistic_t* pRoot = NewNode(slot, ref);
+		SetRed(pRoot, false);
+		SetLeft(&m_Head, pRoot);
+
+		locks.Unlock();
+
+		added = true;
+		return true;
+	}
+
+	for (;;) {
+		if (false == ReadGroup(group)) {
+			return false;
+		}
+
+		if ((nullptr != group.pRedLeft) && (nullptr != group.pRedRight)) {
+			SplitGroup(parent, group);
+			return false;
+		}
+
+		// Find the member of the group holding the key, or the member
+		// and link where the search goes on.
+		LLTBOptimistic_t* pHolder       = group.pTop;
+		uint64_t          holderVersion = group.TopVersion;
+
+		if ((key < pHolder->Ref.Key) && (nullptr != group.pRedLeft)) {
+			pHolder       = group.pRedLeft;
+			holderVersion = group.RedLeftVersion;
+		}
+		else if ((key > pHolder->Ref.Key) && (nullptr != group.pRedRight)) {
+			pHolder       = group.pRedRight;
+			holderVersion = group.RedRightVersion;
+		}
+
+		if (key == pHolder->Ref.Key) {
+			LockSet_t locks;
+
+			if (false == locks.Add(pHolder, holderVersion)) {
+				return false;
+			}
+
+			revived = pHolder->IsDeleted.load(std::memory_order_relaxed);
+
+			if (revived) {
+				pHolder->IsDeleted.store(false, std::memory_order_relaxed);
+				locks.Unlock();
+			}
+			else {
+				locks.Abandon();
+			}
+
+			added = revived;
+			return true;
+		}
+
+		LLTBOptimistic_t* pChild = (key < pHolder->Ref.Key) ? Left(pHolder) : Right(pHolder);
+
+		if (nullptr == pChild) {
+			if (false == InsertLeaf(slot, group, pHolder, ref)) {
+				return false;
+			}
+
+			added = true;
+			return true;
+		}
+
+		parent = group;
+
+		group.pAnchor       = pHolder;
+		group.AnchorVersion = holderVersion;
+		group.pTop          = pChild;
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Insert()
+//
+bool OptimisticLeftLeaningRedBlack::Insert(VoidRef_t ref)
+{
+	bool     added   = false;
+	bool     revived = false;
+	unsigned retries = 0;
+	int      slot    = EnterWrite();
+
+	while (false == TryInsert(slot, ref, added, revived)) {
+		Backoff(retries);
+	}
+
+	WriterSlot_t& owner = m_Slots[slot];
+
+	if (added) {
+		owner.Live.store(owner.Live.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	if (revived) {
+		owner.Deleted.store(owner.Deleted.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+	}
+
+	LeaveWrite(slot);
+
+	return added;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	TryDelete()
+//
+//	Returns false if the search has to start over.
+//
+bool OptimisticLeftLeaningRedBlack::TryDelete(const uint32_t key, bool& removed)
+{
+	LLTBOptimistic_t* pNode   = nullptr;
+	uint64_t          version = 0;
+
+	if (false == Search(key, pNode, version)) {
+		return false;
+	}
+
+	removed = false;
+
+	if (nullptr == pNode) {
+		return true;
+	}
+
+	LockSet_t locks;
+
+	if (false == locks.Add(pNode, version)) {
+		return false;
+	}
+
+	removed = (false == pNode->IsDeleted.load(std::memory_order_relaxed));
+
+	if (removed) {
+		pNode->IsDeleted.store(true, std::memory_order_relaxed);
+		locks.Unlock();
+	}
+	else {
+		locks.Abandon();
+	}
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Delete()
+//
+bool OptimisticLeftLeaningRedBlack::Delete(const uint32_t key)
+{
+	bool     removed = false;
+	unsigned retries = 0;
+	int      slot    = EnterWrite();
+
+	while (false == TryDelete(key, removed)) {
+		Backoff(retries);
+	}
+
+	if (removed) {
+		WriterSlot_t& owner = m_Slots[slot];
+
+		owner.Live.store(owner.Live.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+		owner.Deleted.store(owner.Deleted.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	LeaveWrite(slot);
+
+	return removed;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Count()
+//
+size_t OptimisticLeftLeaningRedBlack::Count(void) const
+{
+	int64_t total = 0;
+
+	for (int i = 0; i < EPOCH_SLOT_COUNT; ++i) {
+		total += m_Slots[i].Live.load(std::memory_order_relaxed);
+	}
+
+	return (total > 0) ? size_t(total) : 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	DeletedCount()
+//
+size_t OptimisticLeftLeaningRedBlack::DeletedCount(void) const
+{
+	int64_t total = 0;
+
+	for (int i = 0; i < EPOCH_SLOT_COUNT; ++i) {
+		total += m_Slots[i].Deleted.load(std::memory_order_relaxed);
+	}
+
+	return (total > 0) ? size_t(total) : 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	MaxKeysForHeight()
+//
+//	Same as in LeftLeaningRedBlack.cpp: at most 3^h - 1 keys fit in 2-3
+//	nodes of black height h.  This saturates instead of overflowing.
+//
+static size_t MaxKeysForHeight(int height)
+{
+	size_t maxKeys = 0;
+
+	for (int i = 0; i < height; ++i) {
+		if (maxKeys > ((SIZE_MAX - 2) / 3)) {
+			return SIZE_MAX;
+		}
+
+		maxKeys = (maxKeys * 3) + 2;
+	}
+
+	return maxKeys;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	BuildRec()
+//
+//	Same as in LeftLeaningRedBlack.cpp.  Builds a black-rooted subtree of
+//	black height `height` out of the `count` nodes at pNodes, which are in
+//	key order, using only 2-nodes and 3-nodes.
+//
+static LLTBOptimistic_t* BuildRec(LLTBOptimistic_t* pNodes, size_t count, int height)
+{
+	if (0 == count) {
+		return nullptr;
+	}
+
+	size_t childMax  = MaxKeysForHeight(height - 1);
+	size_t leftCount = (count - 1) / 2;
+
+	if ((count - 1 - leftCount) <= childMax) {
+		LLTBOptimistic_t* pNode = pNodes + leftCount;
+
+		SetRed(pNode, false);
+		SetLeft(pNode, BuildRec(pNodes, leftCount, height - 1));
+		SetRight(pNode, BuildRec(pNode + 1, count - 1 - leftCount, height - 1));
+
+		return pNode;
+	}
+
+	size_t rest        = count - 2;
+	leftCount          = rest / 3;
+	size_t middleCount = (rest - leftCount) / 2;
+	size_t rightCount  = rest - leftCount - middleCount;
+
+	LLTBOptimistic_t* pRed   = pNodes + leftCount;
+	LLTBOptimistic_t* pBlack = pRed + 1 + middleCount;
+
+	SetLeft(pRed, BuildRec(pNodes, leftCount, height - 1));
+	SetRight(pRed, BuildRec(pRed + 1, middleCount, height - 1));
+
+	SetRed(pBlack, false);
+	SetLeft(pBlack, pRed);
+	SetRight(pBlack, BuildRec(pBlack + 1, rightCount, height - 1));
+
+	return pBlack;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Rebuild()
+//
+//	Replaces the tree with a fresh one holding the given keys, which are
+//	sorted, in a new pool.  Writers must already be drained.  The new root
+//	is published under m_Head's lock so that searches starting on the old
+//	tree notice, and the old pool is only released after every reader that
+//	could still be walking the old tree has left.
+//
+void OptimisticLeftLeaningRedBlack::Rebuild(const std::vector<VoidRef_t>& live)
+{
+	std::unique_ptr<NodePool> pPool(new NodePool(sizeof(LLTBOptimistic_t), OPTIMISTIC_NODE_ALIGNMENT));
+
+	pPool->Configure(m_pPool->Config());
+
+	LLTBOptimistic_t* pRoot = nullptr;
+	size_t            count = live.size();
+
+	if (0 != count) {
+		LLTBOptimistic_t* pNodes = static_cast<LLTBOptimistic_t*>(pPool->AllocContiguous(count));
+
+		for (size_t i = 0; i < count; ++i) {
+			InitNode(new (pNodes + i) LLTBOptimistic_t, live[i]);
+		}
+
+		int height = 0;
+		while ((height < 63) && (((size_t(1) << (height + 1)) - 1) <= count)) {
+			++height;
+		}
+
+		pRoot = BuildRec(pNodes, count, height);
+	}
+
+	// No writer is left to hold m_Head, so this cannot fail.
+	LockSet_t locks;
+	locks.Add(&m_Head, ReadVersion(&m_Head));
+
+	SetLeft(&m_Head, pRoot);
+
+	locks.Unlock();
+
+	m_pPool.swap(pPool);
+
+	for (int i = 0; i < EPOCH_SLOT_COUNT; ++i) {
+		m_Slots[i].pNext = nullptr;
+		m_Slots[i].pEnd  = nullptr;
+		m_Slots[i].Live.store(0);
+		m_Slots[i].Deleted.store(0);
+	}
+
+	m_Slots[0].Live.store(int64_t(count));
+
+	m_Draining.store(false);
+
+	// pPool now holds the old tree.
+	m_Epochs.WaitForReaders(m_Epochs.Advance());
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FreeAll()
+//
+void OptimisticLeftLeaningRedBlack::FreeAll(void)
+{
+	std::lock_guard<std::mutex> lock(m_PurgeLock);
+
+	Drain();
+
+	Rebuild(std::vector<VoidRef_t>());
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Purge()
+//
+//	Rebuilds the tree without its deleted nodes.  The live keys are
+//	collected with an in-order walk, which needs no locking since the
+//	writers have been drained.  The rebuilt tree has the minimum black
+//	height for its size, with its nodes in one block in key order.
+//
+void OptimisticLeftLeaningRedBlack::Purge(void)
+{
+	std::lock_guard<std::mutex> lock(m_PurgeLock);
+
+	Drain();
+
+	std::vector<VoidRef_t>         live;
+	std::vector<LLTBOptimistic_t*> stack;
+
+	live.reserve(Count());
+
+	LLTBOptimistic_t* pNode = Left(&m_Head);
+
+	while ((nullptr != pNode) || (false == stack.empty())) {
+		while (nullptr != pNode) {
+			stack.push_back(pNode);
+			pNode = Left(pNode);
+		}
+
+		pNode = stack.back();
+		stack.pop_back();
+
+		if (false == pNode->IsDeleted.load(std::memory_order_relaxed)) {
+			live.push_back(pNode->Ref);
+		}
+
+		pNode = Right(pNode);
+	}
+
+	Rebuild(live);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	CheckRec()
+//
+//	Returns the black height of the subtree, or -1 after recording the
+//	first problem found in check.  pPrev is the node before this subtree
+//	in key order.  The recursion is as deep as the tree, which is at most
+//	twice the black height.
+//
+static int CheckRec(const LLTBOptimistic_t* pNode, const LLTBOptimistic_t*& pPrev, LLRBCheck_t& check)
+{
+	if (nullptr == pNode) {
+		return 0;
+	}
+
+	const LLTBOptimistic_t* pLeft  = Left(pNode);
+	const LLTBOptimistic_t* pRight = Right(pNode);
+
+	if (IsRed(pNode) && (IsRed(pLeft) || IsRed(pRight))) {
+		check.Error = LLRB_ERROR_RED_RED;
+		check.Key   = pNode->Ref.Key;
+		return -1;
+	}
+
+	// In a 2-3-4 LLRB, a red right child is only allowed in a 4-node.
+	if (IsRed(pRight) && (false == IsRed(pLeft))) {
+		check.Error = LLRB_ERROR_RIGHT_LEANING;
+		check.Key   = pNode->Ref.Key;
+		return -1;
+	}
+
+	int leftHeight = CheckRec(pLeft, pPrev, check);
+
+	if (leftHeight < 0) {
+		return -1;
+	}
+
+	if ((nullptr != pPrev) && (false == (pPrev->Ref.Key < pNode->Ref.Key))) {
+		check.Error = LLRB_ERROR_ORDER;
+		check.Key   = pNode->Ref.Key;
+		return -1;
+	}
+
+	pPrev = pNode;
+
+	if (false == pNode->IsDeleted.load(std::memory_order_relaxed)) {
+		++check.Count;
+	}
+
+	int rightHeight = CheckRec(pRight, pPrev, check);
+
+	if (rightHeight < 0) {
+		return -1;
+	}
+
+	if (leftHeight != rightHeight) {
+		check.Error = LLRB_ERROR_BLACK_HEIGHT;
+		check.Key   = pNode->Ref.Key;
+		return -1;
+	}
+
+	return leftHeight + (IsRed(pNode) ? 0 : 1);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Validate()
+//
+bool OptimisticLeftLeaningRedBlack::Validate(LLRBCheck_t& check) const
+{
+	const LLTBOptimistic_t* pRoot = Left(&m_Head);
+	const LLTBOptimistic_t* pPrev = nullptr;
+
+	check.Error       = LLRB_VALID;
+	check.Key         = 0;
+	check.Count       = 0;
+	check.BlackHeight = 0;
+
+	if (IsRed(pRoot)) {
+		check.Error = LLRB_ERROR_RED_ROOT;
+		check.Key   = pRoot->Ref.Key;
+		return false;
+	}
+
+	int height = CheckRec(pRoot, pPrev, check);
+
+	if (height < 0) {
+		return false;
+	}
+
+	check.BlackHeight = height;
+
+	return true;
+}
@@ -0,0 +1,185 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: OptimisticLeftLeaningRedBlack.h
+//
+//	$Header: $
+//
+//
+//	Mutable LLRB that any number of threads can read and write at once.
+//
+//	ConcurrentLeftLeaningRedBlack never blocks readers, but it serializes
+//	every write behind one mutex.  This tree changes nodes in place instead,
+//	and uses optimistic lock coupling so that writers only get in each
+//	other's way when they change the same few nodes.
+//
+//	Every node carries a version word whose low bit is a write lock.
+//	Readers never take a lock: they note a node's version, read its key
+//	and child pointer, then check that the version has not changed.  If it
+//	has, or if the node is locked, the search starts over from the root.
+//	A writer searches the same way, then locks only the nodes it is about
+//	to change by swapping in the versions it read.  Any swap that fails
+//	means someone else changed those nodes first, and the write starts
+//	over.  Nothing ever waits while holding a lock, so there is no
+//	deadlock.
+//
+//	What makes this work is that the tree is always arranged as a 2-3-4
+//	tree, and Insert() splits 4-nodes on the way down, whatever
+//	USE_234_TREE is set to.  Splitting a 4-node, or adding a leaf, only
+//	changes the 2-3-4 node being worked on and its parent, which is at
+//	most six LLTBOptimistic_t nodes, and there is no fix-up pass back up to
+//	the root.  After a split the insert restarts from the root, which keeps
+//	the rest of the walk simple.  Splits are rare (amortized O(1) per
+//	insert), so restarting costs little.
+//
+//	Delete() does not unlink anything.  It only marks the node as deleted,
+//	so the shape of the tree never shrinks and no node is ever freed while
+//	threads are walking the tree.  Inserting a deleted key again clears
+//	the mark.  Purge() rebuilds the tree from the keys that are still
+//	alive, dropping the deleted ones.  Writers wait while Purge() runs,
+//	but readers keep searching the old tree, which stays valid until
+//	EpochManager shows that every reader has left it.
+//
+//	Nodes are carved from chunks handed to each writer slot, so writers do
+//	not share an allocator either.  Counts are kept per slot the same way.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "VoidRef.h"
+#include "NodePool.h"
+#include "EpochManager.h"
+#include "LeftLeaningRedBlack.h"
+
+
+// Nodes taken from the shared pool each time a writer slot runs out.
+#define OPTIMISTIC_CHUNK_NODES		1024
+
+// Nodes are 32 bytes, so this keeps each one within a single cache line.
+#define OPTIMISTIC_NODE_ALIGNMENT	32
+
+// Retries after a conflict that only spin, before starting to yield.
+#define OPTIMISTIC_SPIN_LIMIT		64
+
+
+struct LLTBOptimistic_t
+{
+	// Even when unlocked, odd while a writer holds the node.  Each change
+	// made under the lock moves the version on by two.
+	std::atomic<uint64_t> Version;
+
+	std::atomic<LLTBOptimistic_t*> pLeft;
+	std::atomic<LLTBOptimistic_t*> pRight;
+
+	// The key never changes once the node is linked in.
+	VoidRef_t Ref;
+
+	std::atomic<bool> IsRed;
+	std::atomic<bool> IsDeleted;
+};
+
+
+class OptimisticLeftLeaningRedBlack
+{
+private:
+	// One 2-3-4 node as seen by a search: the black top and any red
+	// children, each with the version it was read at, plus the node that
+	// links to the top.
+	struct Group_t
+	{
+		LLTBOptimistic_t* pAnchor;
+		LLTBOptimistic_t* pTop;
+		LLTBOptimistic_t* pRedLeft;
+		LLTBOptimistic_t* pRedRight;
+
+		uint64_t AnchorVersion;
+		uint64_t TopVersion;
+		uint64_t RedLeftVersion;
+		uint64_t RedRightVersion;
+	};
+
+	// State owned by whichever writer holds the matching slot in
+	// m_Writers.  Counts are atomic only so that Count() may read them
+	// while writers are running.
+	struct alignas(64) WriterSlot_t
+	{
+		LLTBOptimistic_t* pNext;
+		LLTBOptimistic_t* pEnd;
+
+		std::atomic<int64_t> Live;
+		std::atomic<int64_t> Deleted;
+	};
+
+	// The root hangs off m_Head.pLeft, so that replacing the root locks a
+	// node like any other link change.
+	LLTBOptimistic_t m_Head;
+
+	// Readers hold a slot in m_Epochs, writers hold one in m_Writers.
+	EpochManager m_Epochs;
+	EpochManager m_Writers;
+
+	// Set while Purge() waits for writers to leave and rebuilds the tree.
+	std::atomic<bool> m_Draining;
+
+	WriterSlot_t m_Slots[EPOCH_SLOT_COUNT];
+
+	// m_pPool is shared by all writer slots, and only touched while
+	// holding m_PoolLock.  m_PurgeLock keeps Purge() and FreeAll() from
+	// running at the same time.
+	std::mutex                m_PoolLock;
+	std::mutex                m_PurgeLock;
+	std::unique_ptr<NodePool> m_pPool;
+
+	OptimisticLeftLeaningRedBlack(const OptimisticLeftLeaningRedBlack&);
+	OptimisticLeftLeaningRedBlack& operator=(const OptimisticLeftLeaningRedBlack&);
+
+	int  EnterWrite(void);
+	void LeaveWrite(int slot);
+	void Drain(void);
+
+	LLTBOptimistic_t* NewNode(int slot, const VoidRef_t& ref);
+
+	bool ReadGroup(Group_t& group) const;
+	bool SplitGroup(const Group_t& parent, const Group_t& group);
+	bool InsertLeaf(int slot, const Group_t& group, LLTBOptimistic_t* pHolder, const VoidRef_t& ref);
+
+	bool Search(const uint32_t key, LLTBOptimistic_t*& pFound, uint64_t& version) const;
+	bool TryInsert(int slot, const VoidRef_t& ref, bool& added, bool& revived);
+	bool TryDelete(const uint32_t key, bool& removed);
+
+	void Rebuild(const std::vector<VoidRef_t>& live);
+
+public:
+	OptimisticLeftLeaningRedBlack(void);
+	~OptimisticLeftLeaningRedBlack(void);
+
+	// Unlike the other writers, these two wait for every running writer
+	// to finish first, and for every reader of the old tree to leave
+	// before its nodes are released.
+	void FreeAll(void);
+	void Purge(void);
+
+	// Safe to call from any number of threads at once.  Readers take no
+	// lock; a search that runs into a write in progress retries.
+	bool LookUp(const uint32_t key, VoidRef_t* pRef = nullptr);
+
+	// Return false if the key was already present, or already missing.
+	bool Insert(VoidRef_t ref);
+	bool Delete(const uint32_t key);
+
+	// Both are exact when no writer is running, and only approximate
+	// otherwise.  DeletedCount() is the number of nodes Purge() would drop.
+	size_t Count(void) const;
+	size_t DeletedCount(void) const;
+
+	// Checks the 2-3-4 LLRB invariants.  This must not run at the same
+	// time as any writer.  check.Count only counts keys that are alive.
+	bool Validate(LLRBCheck_t& check) const;
+};
@@ -0,0 +1,501 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: ShardedLeftLeaningRedBlack.cpp
+//
+//	$Header: $
+//
+//
+//	Range-partitioned LLRB.  See the header for the overall scheme.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "ShardedLeftLeaningRedBlack.h"
+#include <algorithm>
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	constructor
+//
+//	Spreads shardCount shards evenly over the full 32-bit key space.  This
+//	suits uniformly distributed keys; for anything else, either pass the
+//	splitters explicitly, or let the hot shards split themselves.
+//
+ShardedLeftLeaningRedBlack::ShardedLeftLeaningRedBlack(size_t shardCount, size_t maxShardKeys)
+	: m_pMap(nullptr)
+	, m_MaxShardKeys(maxShardKeys)
+	, m_pLog(nullptr)
+{
+	if (0 == shardCount) {
+		shardCount = 1;
+	}
+
+	if (shardCount > SHARD_MAX_COUNT) {
+		shardCount = SHARD_MAX_COUNT;
+	}
+
+	std::vector<uint32_t> splitters;
+
+	for (size_t i = 1; i < shardCount; ++i) {
+		splitters.push_back(uint32_t((uint64_t(1) << 32) * i / shardCount));
+	}
+
+	Init(splitters.data(), splitters.size());
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	constructor
+//
+//	Creates count + 1 shards split at the given keys.  The splitters must
+//	be strictly increasing and greater than zero; any that are not are
+//	skipped.
+//
+ShardedLeftLeaningRedBlack::ShardedLeftLeaningRedBlack(const uint32_t* pSplitters, size_t count, size_t maxShardKeys)
+	: m_pMap(nullptr)
+	, m_MaxShardKeys(maxShardKeys)
+	, m_pLog(nullptr)
+{
+	Init(pSplitters, count);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	destructor
+//
+//	Shards are never freed while the tree is in use, only when it is
+//	destroyed, so each one is owned by the current routing table.
+//
+ShardedLeftLeaningRedBlack::~ShardedLeftLeaningRedBlack(void)
+{
+	ShardMap_t* pMap = m_pMap.load();
+
+	for (size_t i = 0; i < pMap->Shards.size(); ++i) {
+		delete pMap->Shards[i];
+	}
+
+	delete pMap;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Init()
+//
+void ShardedLeftLeaningRedBlack::Init(const uint32_t* pSplitters, size_t count)
+{
+	ShardMap_t* pMap = new ShardMap_t;
+
+	for (size_t i = 0; i < count; ++i) {
+		if (pMap->Shards.size() + 1 >= SHARD_MAX_COUNT) {
+			break;
+		}
+
+		uint32_t prev = pMap->Splitters.empty() ? 0 : pMap->Splitters.back();
+
+		if (pSplitters[i] > prev) {
+			pMap->Splitters.push_back(pSplitters[i]);
+		}
+	}
+
+	for (size_t i = 0; i <= pMap->Splitters.size(); ++i) {
+		Shard_t* pShard = new Shard_t;
+
+		pShard->Lo     = (0 == i) ? 0 : pMap->Splitters[i - 1];
+		pShard->Hi     = (pMap->Splitters.size() == i) ? (uint64_t(1) << 32) : pMap->Splitters[i];
+		pShard->Count  = 0;
+		pShard->Writes = 0;
+
+		pMap->Shards.push_back(pShard);
+	}
+
+	m_pMap.store(pMap);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FreeAll()
+//
+//	Empties every shard.  The shards themselves, and the splitters that
+//	were learned from earlier splits, are kept.  With a log attached, every
+//	key is logged as deleted.
+//
+void ShardedLeftLeaningRedBlack::FreeAll(void)
+{
+	std::lock_guard<std::mutex> resize(m_ResizeLock);
+
+	ShardMap_t* pMap = m_pMap.load();
+
+	for (size_t i = 0; i < pMap->Shards.size(); ++i) {
+		Shard_t* pShard = pMap->Shards[i];
+
+		std::lock_guard<std::mutex> lock(pShard->Lock);
+
+		pShard->Tree.FreeAll();
+		pShard->Count  = 0;
+		pShard->Writes = 0;
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	SetPoolConfig()
+//
+//	Shards are numbered in key order, as they stand when this is called.
+//	Taking the resize lock keeps the numbering still until the shard has
+//	been configured.
+//
+bool ShardedLeftLeaningRedBlack::SetPoolConfig(size_t index, const NodePoolConfig_t& config)
+{
+	std::lock_guard<std::mutex> resize(m_ResizeLock);
+
+	ShardMap_t* pMap = m_pMap.load();
+
+	if (index >= pMap->Shards.size()) {
+		return false;
+	}
+
+	Shard_t* pShard = pMap->Shards[index];
+
+	std::lock_guard<std::mutex> lock(pShard->Lock);
+
+	pShard->Tree.SetPoolConfig(config);
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LockShard()
+//
+//	Returns the shard holding key, with its lock held.  The routing table
+//	is only protected by the epoch while it is being searched; the shard
+//	itself stays valid without it, since shards are never freed.
+//
+ShardedLeftLeaningRedBlack::Shard_t* ShardedLeftLeaningRedBlack::LockShard(const uint32_t key)
+{
+	for (;;) {
+		Shard_t* pShard;
+
+		{
+			EpochReadGuard guard(m_Epochs);
+
+			const ShardMap_t* pMap = m_pMap.load();
+
+			size_t index = std::upper_bound(pMap->Splitters.begin(), pMap->Splitters.end(), key) - pMap->Splitters.begin();
+
+			pShard = pMap->Shards[index];
+		}
+
+		pShard->Lock.lock();
+
+		// If the shard was split after we loaded the table, the key may
+		// now belong to the new shard.
+		if ((key >= pShard->Lo) && (key < pShard->Hi)) {
+			return pShard;
+		}
+
+		pShard->Lock.unlock();
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	LookUp()
+//
+//	Returns true if the key is in the tree, copying its ref to pRef.
+//
+bool ShardedLeftLeaningRedBlack::LookUp(const uint32_t key, VoidRef_t* pRef)
+{
+	Shard_t* pShard = LockShard(key);
+
+	std::lock_guard<std::mutex> lock(pShard->Lock, std::adopt_lock);
+
+	VoidRef_t* pFound = static_cast<VoidRef_t*>(pShard->Tree.LookUp(key));
+
+	if (nullptr == pFound) {
+		return false;
+	}
+
+	if (nullptr != pRef) {
+		*pRef = *pFound;
+	}
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Insert()
+//
+//	Returns true if the key was added, false if an existing ref was
+//	replaced.
+//
+bool ShardedLeftLeaningRedBlack::Insert(VoidRef_t ref)
+{
+	Shard_t* pShard = LockShard(ref.Key);
+	bool     added;
+	bool     split;
+
+	{
+		std::lock_guard<std::mutex> lock(pShard->Lock, std::adopt_lock);
+
+		added = (nullptr == pShard->Tree.LookUp(ref.Key));
+
+		pShard->Tree.Insert(ref);
+
+		if (added) {
+			++pShard->Count;
+		}
+
+		++pShard->Writes;
+
+		split = (0 != m_MaxShardKeys) && (pShard->Count > m_MaxShardKeys);
+	}
+
+	// The split takes the shard lock again itself, and rechecks the size,
+	// in case another writer got there first.
+	if (split) {
+		SplitShard(pShard, m_MaxShardKeys + 1);
+	}
+
+	return added;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Delete()
+//
+//	Returns true if the key was found and removed.
+//
+bool ShardedLeftLeaningRedBlack::Delete(const uint32_t key)
+{
+	Shard_t* pShard = LockShard(key);
+
+	std::lock_guard<std::mutex> lock(pShard->Lock, std::adopt_lock);
+
+	if (nullptr == pShard->Tree.LookUp(key)) {
+		return false;
+	}
+
+	pShard->Tree.Delete(key);
+
+	--pShard->Count;
+	++pShard->Writes;
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Count()
+//
+//	Total number of keys.  Shards are counted one at a time, so under
+//	concurrent writes this is only approximate.
+//
+size_t ShardedLeftLeaningRedBlack::Count(void)
+{
+	std::lock_guard<std::mutex> resize(m_ResizeLock);
+
+	ShardMap_t* pMap  = m_pMap.load();
+	size_t      count = 0;
+
+	for (size_t i = 0; i < pMap->Shards.size(); ++i) {
+		std::lock_guard<std::mutex> lock(pMap->Shards[i]->Lock);
+
+		count += pMap->Shards[i]->Count;
+	}
+
+	return count;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	ShardCount()
+//
+size_t ShardedLeftLeaningRedBlack::ShardCount(void)
+{
+	EpochReadGuard guard(m_Epochs);
+
+	return m_pMap.load()->Shards.size();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	AttachLog()
+//
+void ShardedLeftLeaningRedBlack::AttachLog(WriteAheadLog* pLog)
+{
+	std::lock_guard<std::mutex> resize(m_ResizeLock);
+
+	ShardMap_t* pMap = m_pMap.load();
+
+	m_pLog = pLog;
+
+	for (size_t i = 0; i < pMap->Shards.size(); ++i) {
+		std::lock_guard<std::mutex> lock(pMap->Shards[i]->Lock);
+
+		pMap->Shards[i]->Tree.AttachLog(pLog);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	MedianKey()
+//
+static uint32_t MedianKey(const LeftLeaningRedBlack& tree, size_t count)
+{
+#if defined(USE_ORDER_STATISTICS)
+	return static_cast<const VoidRef_t*>(tree.Select(count / 2))->Key;
+#else
+	LeftLeaningRedBlack::Iterator it = tree.begin();
+
+	for (size_t i = 0; i < count / 2; ++i) {
+		++it;
+	}
+
+	return it->Key;
+#endif
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	SplitShard()
+//
+//	Moves the upper half of a shard into a new shard, and publishes a new
+//	routing table that includes it.  Returns false if the shard holds fewer
+//	than minKeys keys (or fewer than 2), or if the shard limit has been
+//	reached.
+//
+//	The upper half is split off in O(log n), then copied into the new
+//	shard's own pool in O(n), so that the two shards never share a pool.
+//	Only this shard is blocked while that happens.
+//
+bool ShardedLeftLeaningRedBlack::SplitShard(Shard_t* pShard, size_t minKeys)
+{
+	std::lock_guard<std::mutex> resize(m_ResizeLock);
+
+	ShardMap_t* pOld = m_pMap.load();
+
+	if (pOld->Shards.size() >= SHARD_MAX_COUNT) {
+		return false;
+	}
+
+	Shard_t* pUpper = new Shard_t;
+
+	{
+		std::lock_guard<std::mutex> lock(pShard->Lock);
+
+		// Writers only ask for a split after dropping the lock, so another
+		// split may already have shrunk this shard.
+		if ((pShard->Count < 2) || (pShard->Count < minKeys)) {
+			delete pUpper;
+			return false;
+		}
+
+		uint32_t median = MedianKey(pShard->Tree, pShard->Count);
+
+		// Moving keys between shards leaves the contents as they were, so
+		// neither half logs the move.
+		LeftLeaningRedBlack upper;
+		pShard->Tree.AttachLog(nullptr);
+		pShard->Tree.Split(median, upper);
+		pShard->Tree.AttachLog(m_pLog);
+
+		std::vector<VoidRef_t> refs;
+		refs.reserve(pShard->Count - pShard->Count / 2);
+
+		for (LeftLeaningRedBlack::Iterator it = upper.begin(); it != upper.end(); ++it) {
+			refs.push_back(*it);
+		}
+
+		// Both halves stay wherever the shard's memory was placed.
+		pUpper->Tree.SetPoolConfig(pShard->Tree.PoolConfig());
+		pUpper->Tree.BuildFromSorted(refs.data(), refs.size());
+		pUpper->Tree.AttachLog(m_pLog);
+
+		// Hands the nodes back to this shard's pool.
+		upper.FreeAll();
+
+		pUpper->Lo     = median;
+		pUpper->Hi     = pShard->Hi;
+		pUpper->Count  = refs.size();
+		pUpper->Writes = pShard->Writes / 2;
+
+		pShard->Hi      = median;
+		pShard->Count  -= refs.size();
+		pShard->Writes -= pUpper->Writes;
+
+		// The new shard is fully built before it becomes reachable.
+		ShardMap_t* pNew = new ShardMap_t(*pOld);
+
+		size_t index = std::find(pNew->Shards.begin(), pNew->Shards.end(), pShard) - pNew->Shards.begin();
+
+		pNew->Splitters.insert(pNew->Splitters.begin() + index, median);
+		pNew->Shards.insert(pNew->Shards.begin() + index + 1, pUpper);
+
+		m_pMap.store(pNew);
+	}
+
+	// Readers never wait on a shard lock while holding the epoch, so this
+	// cannot deadlock with a reader queued on the shard we just released.
+	m_Epochs.WaitForReaders(m_Epochs.Advance());
+
+	delete pOld;
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Rebalance()
+//
+size_t ShardedLeftLeaningRedBlack::Rebalance(void)
+{
+	std::vector<Shard_t*> shards;
+
+	{
+		EpochReadGuard guard(m_Epochs);
+
+		shards = m_pMap.load()->Shards;
+	}
+
+	std::vector<uint64_t> writes(shards.size());
+	uint64_t              total = 0;
+
+	for (size_t i = 0; i < shards.size(); ++i) {
+		std::lock_guard<std::mutex> lock(shards[i]->Lock);
+
+		writes[i] = shards[i]->Writes;
+		total    += writes[i];
+
+		shards[i]->Writes = 0;
+	}
+
+	size_t splits = 0;
+
+	for (size_t i = 0; i < shards.size(); ++i) {
+		if ((0 != writes[i]) && (writes[i] * shards.size() > 2 * total)) {
+			if (SplitShard(shards[i], 2)) {
+				++splits;
+			}
+		}
+	}
+
+	return splits;
+}
@@ -0,0 +1,174 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: ShardedLeftLeaningRedBlack.h
+//
+//	$Header: $
+//
+//
+//	Range-partitioned collection of LLRBs, for write loads that need more
+//	than one core.
+//
+//	The key space is cut into contiguous ranges by a small sorted array of
+//	splitter keys, and each range is held in its own LeftLeaningRedBlack
+//	with its own lock and its own node pool.  Writers to different shards
+//	never touch the same lock or the same memory, so they scale with the
+//	number of shards as long as the keys are spread across them.
+//
+//	A shard that grows past the size limit, or that Rebalance() finds is
+//	taking far more than its share of the writes, is split in two at its
+//	median key while the other shards stay online.  The routing table is
+//	immutable: a split publishes a new table with one atomic store, and the
+//	old table is freed with EpochManager once no thread is still reading it.
+//
+//	Since the split shard keeps its lock and simply shrinks, a thread that
+//	routed with the old table re-checks the shard's range after taking the
+//	lock, and routes again if the key has moved to the new shard.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "LeftLeaningRedBlack.h"
+#include "EpochManager.h"
+
+
+// Number of shards a tree starts with, unless told otherwise.
+#define SHARD_DEFAULT_COUNT		8
+
+// A shard that grows past this many keys is split.  Zero turns automatic
+// splitting off.
+#define SHARD_DEFAULT_MAX_KEYS	(1u << 20)
+
+// Shards are never split beyond this many.
+#define SHARD_MAX_COUNT			256
+
+
+class ShardedLeftLeaningRedBlack
+{
+private:
+	// One independent tree holding the keys in [Lo, Hi).  Everything here
+	// is guarded by Lock.  The range only changes when the shard is split.
+	struct Shard_t
+	{
+		std::mutex          Lock;
+		LeftLeaningRedBlack Tree;
+		uint64_t            Lo;
+		uint64_t            Hi;
+		size_t              Count;
+
+		// Writes since the last Rebalance().
+		uint64_t            Writes;
+	};
+
+	// Routing table, never modified once published.  Shards[i] holds the
+	// keys from Splitters[i - 1] up to but not including Splitters[i].
+	struct ShardMap_t
+	{
+		std::vector<uint32_t> Splitters;
+		std::vector<Shard_t*> Shards;
+	};
+
+	std::atomic<ShardMap_t*> m_pMap;
+
+	EpochManager m_Epochs;
+
+	// Serializes changes to the routing table.
+	std::mutex m_ResizeLock;
+
+	size_t m_MaxShardKeys;
+
+	// Shared by every shard, including the ones created by splits.
+	// Guarded by m_ResizeLock.
+	WriteAheadLog* m_pLog;
+
+	ShardedLeftLeaningRedBlack(const ShardedLeftLeaningRedBlack&);
+	ShardedLeftLeaningRedBlack& operator=(const ShardedLeftLeaningRedBlack&);
+
+	void     Init(const uint32_t* pSplitters, size_t count);
+	Shard_t* LockShard(const uint32_t key);
+	bool     SplitShard(Shard_t* pShard, size_t minKeys);
+
+public:
+	ShardedLeftLeaningRedBlack(size_t shardCount = SHARD_DEFAULT_COUNT, size_t maxShardKeys = SHARD_DEFAULT_MAX_KEYS);
+	ShardedLeftLeaningRedBlack(const uint32_t* pSplitters, size_t count, size_t maxShardKeys = SHARD_DEFAULT_MAX_KEYS);
+	~ShardedLeftLeaningRedBlack(void);
+	void FreeAll(void);
+
+	// All of these are safe to call from any number of threads at once.
+	// The ref is copied out by LookUp(), since the shard may change as
+	// soon as its lock is released.
+	bool LookUp(const uint32_t key, VoidRef_t* pRef = nullptr);
+	bool Insert(VoidRef_t ref);
+	bool Delete(const uint32_t key);
+
+	size_t Count(void);
+	size_t ShardCount(void);
+
+	// Logs the changes made to every shard to one WriteAheadLog.  Each
+	// change is appended while its shard is locked, so the log holds the
+	// changes to any one key in the order they were made, and replaying
+	// it into this tree reproduces its contents.  FreeAll() logs every key
+	// it removes, and splitting a shard moves keys without logging them.
+	void AttachLog(WriteAheadLog* pLog);
+
+	// Sets the page size and NUMA node for the nodes of shard `index`,
+	// counting from the lowest keys, so that each shard's memory can be
+	// kept on the socket whose threads work on its key range.  Both
+	// shards made by a later split keep the setting.  Returns false if
+	// there is no such shard.  See NodePool.h.
+	bool SetPoolConfig(size_t index, const NodePoolConfig_t& config);
+
+	// Splits every shard that took more than twice the average number of
+	// writes since the last call, and returns the number of splits.
+	size_t Rebalance(void);
+
+	// Calls visit(const VoidRef_t&) for the keys in [lo, hi] in sorted
+	// order, one shard at a time.  Each shard is locked while it is being
+	// visited, so the visitor must not call back into this tree.  Writes
+	// to shards other than the one being visited can run meanwhile, so
+	// this is not a snapshot of the whole tree.
+	template <typename Visitor_t>
+	size_t Range(const uint32_t lo, const uint32_t hi, Visitor_t visit);
+
+	template <typename Visitor_t>
+	size_t ForEach(Visitor_t visit) { return Range(0, 0xFFFFFFFF, visit); }
+};
+
+
+typedef ShardedLeftLeaningRedBlack ShardedLLRB;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Range()
+//
+//	Walks the shards with a cursor instead of a copy of the routing table,
+//	so that a shard split in the middle of the walk neither skips nor
+//	repeats any keys.
+//
+template <typename Visitor_t>
+size_t ShardedLeftLeaningRedBlack::Range(const uint32_t lo, const uint32_t hi, Visitor_t visit)
+{
+	size_t   count  = 0;
+	uint64_t cursor = lo;
+
+	while (cursor <= hi) {
+		Shard_t* pShard = LockShard(uint32_t(cursor));
+
+		std::lock_guard<std::mutex> lock(pShard->Lock, std::adopt_lock);
+
+		uint64_t last = (hi < pShard->Hi) ? hi : (pShard->Hi - 1);
+
+		count  += pShard->Tree.Range(uint32_t(cursor), uint32_t(last), std::ref(visit));
+		cursor  = pShard->Hi;
+	}
+
+	return count;
+}
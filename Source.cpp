@@ -10,6 +10,7 @@ int main()
 {
 	cout << "\nThis program, which executes once, shows basic functionality of the Left Leaning Red Black Tree.\n";
 	LeftLeaningRedBlack LLRBT;
+	LLRBT.SetInsertObserver(LeftLeaningRedBlack::PrintInsert); //Reports parent and color of each insert
 	VoidRef_t treeArr[SIZE];
 	/*Load Features*/
 	loadArr(treeArr); //Loads array with 10 random integers
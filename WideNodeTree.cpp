@@ -0,0 +1,540 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: WideNodeTree.cpp
+//
+//	$Header: $
+//
+//
+//	Wide-node B-tree.  See the header for the layout.
+//
+//	Every node other than the root holds between WIDE_MIN_KEYS and
+//	WIDE_NODE_KEYS keys, and all leaves are at the same depth.  Both
+//	updates keep that true in a single pass from the root:
+//
+//	  - Insert() splits any full node it is about to enter, so there is
+//	    always room in the parent for the key that a split pushes up.
+//
+//	  - Delete() tops up any minimal node it is about to enter, by taking
+//	    a key from a sibling or by merging with one, so there is always a
+//	    key to spare when one is removed below.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "WideNodeTree.h"
+
+
+static_assert(sizeof(((WideNode_t*)nullptr)->Keys) == 64, "the keys of a node should fill one cache line");
+static_assert(WIDE_NODE_KEYS < 256, "Count is only 8 bits");
+static_assert(WIDE_NODE_KEYS == 2 * WIDE_MIN_KEYS + 1, "a split must leave two minimal nodes");
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	InsertKey()
+//
+//	The node must have room for one more key.
+//
+static void InsertKey(WideNode_t* pNode, uint32_t index, const VoidRef_t& ref)
+{
+	for (uint32_t i = pNode->Count; i > index; --i) {
+		pNode->Keys[i] = pNode->Keys[i - 1];
+		pNode->Refs[i] = pNode->Refs[i - 1];
+	}
+
+	pNode->Keys[index] = ref.Key;
+	pNode->Refs[index] = ref;
+	++(pNode->Count);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	RemoveKey()
+//
+static void RemoveKey(WideNode_t* pNode, uint32_t index)
+{
+	--(pNode->Count);
+
+	for (uint32_t i = index; i < pNode->Count; ++i) {
+		pNode->Keys[i] = pNode->Keys[i + 1];
+		pNode->Refs[i] = pNode->Refs[i + 1];
+	}
+
+	pNode->Keys[pNode->Count] = WIDE_PAD_KEY;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	InsertChild()
+//
+//	Call after InsertKey(), so that Count already includes the new key.
+//
+static void InsertChild(WideInner_t* pNode, uint32_t index, WideNode_t* pChild)
+{
+	for (uint32_t i = pNode->Count; i > index; --i) {
+		pNode->pChild[i] = pNode->pChild[i - 1];
+	}
+
+	pNode->pChild[index] = pChild;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	RemoveChild()
+//
+//	Call after RemoveKey(), so that Count no longer includes the old key.
+//
+static void RemoveChild(WideInner_t* pNode, uint32_t index)
+{
+	for (uint32_t i = index; i <= pNode->Count; ++i) {
+		pNode->pChild[i] = pNode->pChild[i + 1];
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	constructor
+//
+WideNodeTree::WideNodeTree(void)
+	: m_pRoot(nullptr)
+	, m_Count(0)
+	, m_LeafPool(sizeof(WideNode_t), alignof(WideNode_t))
+	, m_InnerPool(sizeof(WideInner_t), alignof(WideInner_t))
+{
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	destructor
+//
+WideNodeTree::~WideNodeTree(void)
+{
+	FreeAll();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FreeAll()
+//
+//	Every node came from one of the two pools, so the whole tree can be
+//	released without walking it.
+//
+void WideNodeTree::FreeAll(void)
+{
+	m_LeafPool.ReleaseAll();
+	m_InnerPool.ReleaseAll();
+
+	m_pRoot = nullptr;
+	m_Count = 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	NewLeaf()
+//
+WideNode_t* WideNodeTree::NewLeaf(void)
+{
+	WideNode_t* pNode = static_cast<WideNode_t*>(m_LeafPool.Alloc());
+
+	for (uint32_t i = 0; i <= WIDE_NODE_KEYS; ++i) {
+		pNode->Keys[i] = WIDE_PAD_KEY;
+	}
+
+	pNode->Count  = 0;
+	pNode->IsLeaf = 1;
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	NewInner()
+//
+WideInner_t* WideNodeTree::NewInner(void)
+{
+	WideInner_t* pNode = static_cast<WideInner_t*>(m_InnerPool.Alloc());
+
+	for (uint32_t i = 0; i <= WIDE_NODE_KEYS; ++i) {
+		pNode->Keys[i]   = WIDE_PAD_KEY;
+		pNode->pChild[i] = nullptr;
+	}
+
+	pNode->Count  = 0;
+	pNode->IsLeaf = 0;
+
+	return pNode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Free()
+//
+void WideNodeTree::Free(WideNode_t* pNode)
+{
+	if (pNode->IsLeaf) {
+		m_LeafPool.Free(pNode);
+	}
+	else {
+		m_InnerPool.Free(pNode);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	SplitChild()
+//
+//	Splits the full child at index into two minimal nodes, and moves the
+//	middle key up into the parent between them.  This is the B-tree
+//	version of the ColorFlip() that splits a 4-node in the LLRB.
+//
+//	The parent must not be full.
+//
+void WideNodeTree::SplitChild(WideInner_t* pParent, uint32_t index)
+{
+	WideNode_t* pLeft  = pParent->pChild[index];
+	WideNode_t* pRight = pLeft->IsLeaf ? NewLeaf() : NewInner();
+
+	const uint32_t middle = WIDE_MIN_KEYS;
+	const uint32_t moved  = pLeft->Count - middle - 1;
+
+	for (uint32_t i = 0; i < moved; ++i) {
+		pRight->Keys[i] = pLeft->Keys[middle + 1 + i];
+		pRight->Refs[i] = pLeft->Refs[middle + 1 + i];
+	}
+
+	if (false == pLeft->IsLeaf) {
+		WideInner_t* pFrom = static_cast<WideInner_t*>(pLeft);
+		WideInner_t* pTo   = static_cast<WideInner_t*>(pRight);
+
+		for (uint32_t i = 0; i <= moved; ++i) {
+			pTo->pChild[i] = pFrom->pChild[middle + 1 + i];
+		}
+	}
+
+	pRight->Count = uint8_t(moved);
+
+	InsertKey(pParent, index, pLeft->Refs[middle]);
+	InsertChild(pParent, index + 1, pRight);
+
+	for (uint32_t i = middle; i < pLeft->Count; ++i) {
+		pLeft->Keys[i] = WIDE_PAD_KEY;
+	}
+
+	pLeft->Count = uint8_t(middle);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	MergeChildren()
+//
+//	Pulls the key at index down out of the parent, and merges it with the
+//	two minimal children on either side of it into the left child.  The
+//	right child is freed.
+//
+void WideNodeTree::MergeChildren(WideInner_t* pParent, uint32_t index)
+{
+	WideNode_t* pLeft  = pParent->pChild[index];
+	WideNode_t* pRight = pParent->pChild[index + 1];
+
+	const uint32_t base = pLeft->Count + 1;
+
+	pLeft->Keys[base - 1] = pParent->Keys[index];
+	pLeft->Refs[base - 1] = pParent->Refs[index];
+
+	for (uint32_t i = 0; i < pRight->Count; ++i) {
+		pLeft->Keys[base + i] = pRight->Keys[i];
+		pLeft->Refs[base + i] = pRight->Refs[i];
+	}
+
+	if (false == pLeft->IsLeaf) {
+		WideInner_t* pTo   = static_cast<WideInner_t*>(pLeft);
+		WideInner_t* pFrom = static_cast<WideInner_t*>(pRight);
+
+		for (uint32_t i = 0; i <= pRight->Count; ++i) {
+			pTo->pChild[base + i] = pFrom->pChild[i];
+		}
+	}
+
+	pLeft->Count = uint8_t(base + pRight->Count);
+
+	RemoveKey(pParent, index);
+	RemoveChild(pParent, index + 1);
+
+	Free(pRight);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	BorrowFromLeft()
+//
+//	Rotates one key from the left sibling of the child at index, through
+//	the parent, into the child.
+//
+void WideNodeTree::BorrowFromLeft(WideInner_t* pParent, uint32_t index)
+{
+	WideNode_t* pChild   = pParent->pChild[index];
+	WideNode_t* pSibling = pParent->pChild[index - 1];
+
+	InsertKey(pChild, 0, pParent->Refs[index - 1]);
+
+	if (false == pChild->IsLeaf) {
+		InsertChild(static_cast<WideInner_t*>(pChild), 0, static_cast<WideInner_t*>(pSibling)->pChild[pSibling->Count]);
+	}
+
+	pParent->Keys[index - 1] = pSibling->Keys[pSibling->Count - 1];
+	pParent->Refs[index - 1] = pSibling->Refs[pSibling->Count - 1];
+
+	// The sibling's last child went with the key, so only the key needs
+	// to be removed.
+	RemoveKey(pSibling, pSibling->Count - 1);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	BorrowFromRight()
+//
+void WideNodeTree::BorrowFromRight(WideInner_t* pParent, uint32_t index)
+{
+	WideNode_t* pChild   = pParent->pChild[index];
+	WideNode_t* pSibling = pParent->pChild[index + 1];
+
+	InsertKey(pChild, pChild->Count, pParent->Refs[index]);
+
+	if (false == pChild->IsLeaf) {
+		static_cast<WideInner_t*>(pChild)->pChild[pChild->Count] = static_cast<WideInner_t*>(pSibling)->pChild[0];
+	}
+
+	pParent->Keys[index] = pSibling->Keys[0];
+	pParent->Refs[index] = pSibling->Refs[0];
+
+	RemoveKey(pSibling, 0);
+
+	if (false == pSibling->IsLeaf) {
+		RemoveChild(static_cast<WideInner_t*>(pSibling), 0);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	FillChild()
+//
+//	Makes sure the child at index has a key to spare before Delete()
+//	descends into it.  This is the B-tree version of MoveRedLeft() and
+//	MoveRedRight().  A merge with the left sibling moves the child, so
+//	index is updated to where the child ended up.
+//
+WideNode_t* WideNodeTree::FillChild(WideInner_t* pParent, uint32_t& index)
+{
+	if (pParent->pChild[index]->Count > WIDE_MIN_KEYS) {
+		return pParent->pChild[index];
+	}
+
+	if ((index > 0) && (pParent->pChild[index - 1]->Count > WIDE_MIN_KEYS)) {
+		BorrowFromLeft(pParent, index);
+	}
+	else if ((index < pParent->Count) && (pParent->pChild[index + 1]->Count > WIDE_MIN_KEYS)) {
+		BorrowFromRight(pParent, index);
+	}
+	else {
+		if (index == pParent->Count) {
+			--index;
+		}
+
+		MergeChildren(pParent, index);
+	}
+
+	return pParent->pChild[index];
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Insert()
+//
+//	Duplicate keys are not allowed, so inserting a key that is already in
+//	the tree replaces its ref.
+//
+bool WideNodeTree::Insert(VoidRef_t ref)
+{
+	if (nullptr == m_pRoot) {
+		m_pRoot = NewLeaf();
+	}
+
+	// A full root is split by giving it a new parent, which is the only
+	// way the tree grows taller.
+	if (WIDE_NODE_KEYS == m_pRoot->Count) {
+		WideInner_t* pRoot = NewInner();
+
+		pRoot->pChild[0] = m_pRoot;
+		SplitChild(pRoot, 0);
+
+		m_pRoot = pRoot;
+	}
+
+	WideNode_t* pNode = m_pRoot;
+
+	for (;;) {
+		uint32_t index = WideRank(pNode, ref.Key);
+
+		if ((index < pNode->Count) && (ref.Key == pNode->Keys[index])) {
+			pNode->Refs[index] = ref;
+			return true;
+		}
+
+		if (pNode->IsLeaf) {
+			InsertKey(pNode, index, ref);
+			++m_Count;
+			return true;
+		}
+
+		WideInner_t* pInner = static_cast<WideInner_t*>(pNode);
+
+		if (WIDE_NODE_KEYS == pInner->pChild[index]->Count) {
+			SplitChild(pInner, index);
+
+			// The key that moved up may be the one being inserted, or
+			// may send the search into the new right half.
+			if (ref.Key == pInner->Keys[index]) {
+				pInner->Refs[index] = ref;
+				return true;
+			}
+
+			if (ref.Key > pInner->Keys[index]) {
+				++index;
+			}
+		}
+
+		pNode = pInner->pChild[index];
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Delete()
+//
+//	A key in a leaf is simply removed.  A key in an inner node is replaced
+//	by its predecessor or successor from whichever side has a key to spare,
+//	and the search carries on down to delete that key from its leaf.  If
+//	neither side can spare a key, the two sides are merged around the key,
+//	which moves it down a level.
+//
+void WideNodeTree::Delete(const uint32_t key)
+{
+	uint32_t    target = key;
+	WideNode_t* pNode  = m_pRoot;
+
+	while (nullptr != pNode) {
+		uint32_t index = WideRank(pNode, target);
+		bool     found = (index < pNode->Count) && (target == pNode->Keys[index]);
+
+		if (pNode->IsLeaf) {
+			if (found) {
+				RemoveKey(pNode, index);
+				--m_Count;
+			}
+
+			break;
+		}
+
+		WideInner_t* pInner = static_cast<WideInner_t*>(pNode);
+
+		if (found) {
+			WideNode_t* pLeft  = pInner->pChild[index];
+			WideNode_t* pRight = pInner->pChild[index + 1];
+
+			if (pLeft->Count > WIDE_MIN_KEYS) {
+				const WideNode_t* pMax = pLeft;
+				while (false == pMax->IsLeaf) {
+					pMax = static_cast<const WideInner_t*>(pMax)->pChild[pMax->Count];
+				}
+
+				pInner->Keys[index] = pMax->Keys[pMax->Count - 1];
+				pInner->Refs[index] = pMax->Refs[pMax->Count - 1];
+
+				target = pInner->Keys[index];
+				pNode  = pLeft;
+				continue;
+			}
+
+			if (pRight->Count > WIDE_MIN_KEYS) {
+				const WideNode_t* pMin = pRight;
+				while (false == pMin->IsLeaf) {
+					pMin = static_cast<const WideInner_t*>(pMin)->pChild[0];
+				}
+
+				pInner->Keys[index] = pMin->Keys[0];
+				pInner->Refs[index] = pMin->Refs[0];
+
+				target = pInner->Keys[index];
+				pNode  = pRight;
+				continue;
+			}
+
+			MergeChildren(pInner, index);
+			pNode = pLeft;
+		}
+		else {
+			pNode = FillChild(pInner, index);
+		}
+
+		// Only the root can be left without keys, after a merge of its
+		// last two children.  The merged child becomes the new root.
+		if (0 == pInner->Count) {
+			m_pRoot = pNode;
+			Free(pInner);
+		}
+	}
+
+	if ((nullptr != m_pRoot) && (0 == m_pRoot->Count)) {
+		Free(m_pRoot);
+		m_pRoot = nullptr;
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Traverse()
+//
+//	Prints all of the keys in sorted order, along with the depth of the
+//	node holding each one.
+//
+void WideNodeTree::Traverse(void)
+{
+	if (nullptr != m_pRoot) {
+		TraverseRec(m_pRoot, 0);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	TraverseRec()
+//
+void WideNodeTree::TraverseRec(const WideNode_t* pNode, int depth)
+{
+	for (uint32_t i = 0; i <= pNode->Count; ++i) {
+		if (false == pNode->IsLeaf) {
+			TraverseRec(static_cast<const WideInner_t*>(pNode)->pChild[i], depth + 1);
+		}
+
+		if (i < pNode->Count) {
+			cout << "(Depth " << depth << ") " << pNode->Keys[i] << endl;
+		}
+	}
+}
@@ -0,0 +1,421 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: WriteAheadLog.cpp
+//
+//	$Header: $
+//
+//
+//	Group-committed write-ahead log.  See the header for the overall
+//	scheme.
+//
+//	The file is a WalFileHeader_t followed by WalRecord_t records in
+//	sequence order.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "WriteAheadLog.h"
+#include "LeftLeaningRedBlack.h"
+#include "LeftLeaningRedBlackSnapshot.h"
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+static_assert(sizeof(WalRecord_t) == 16, "WAL records should be 16 bytes");
+static_assert(0 == (WAL_RING_SIZE & (WAL_RING_SIZE - 1)), "WAL_RING_SIZE must be a power of two");
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	constructor
+//
+WriteAheadLog::WriteAheadLog(void)
+	: m_pRing(nullptr)
+	, m_Tail(0)
+	, m_Head(0)
+	, m_File(-1)
+	, m_Policy(WAL_SYNC_BATCH)
+	, m_SyncMilliseconds(WAL_SYNC_MILLISECONDS)
+	, m_Stop(false)
+	, m_Failed(false)
+	, m_Durable(0)
+{
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	destructor
+//
+WriteAheadLog::~WriteAheadLog(void)
+{
+	Close();
+
+	delete [] m_pRing;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Open()
+//
+bool WriteAheadLog::Open(const char* path, WalSyncPolicy_t policy, unsigned syncMilliseconds)
+{
+	Close();
+
+	int file = open(path, O_RDWR | O_CREAT, 0644);
+
+	if (file < 0) {
+		return false;
+	}
+
+	uint64_t last  = 0;
+	uint64_t valid = 0;
+
+	if (false == Scan(file, 0, nullptr, nullptr, &last, &valid)) {
+		close(file);
+		return false;
+	}
+
+	bool ready;
+
+	if (0 == valid) {
+		// A new file, or one that was created but never got a header.
+		WalFileHeader_t header;
+		header.Magic      = WAL_MAGIC;
+		header.Version    = WAL_VERSION;
+		header.RecordSize = sizeof(WalRecord_t);
+
+		ready = (0 == ftruncate(file, 0))
+			 && (sizeof(header) == pwrite(file, &header, sizeof(header), 0))
+			 && (0 == fdatasync(file));
+
+		valid = sizeof(header);
+	}
+	else {
+		// Cut off anything after the last good record.
+		ready = (0 == ftruncate(file, off_t(valid)));
+	}
+
+	if ((false == ready) || (off_t(valid) != lseek(file, off_t(valid), SEEK_SET))) {
+		close(file);
+		return false;
+	}
+
+	if (nullptr == m_pRing) {
+		m_pRing = new Cell_t[WAL_RING_SIZE];
+	}
+
+	// Numbering carries on from the last record in the file.
+	for (uint64_t i = 0; i < WAL_RING_SIZE; ++i) {
+		m_pRing[(last + i) & (WAL_RING_SIZE - 1)].Turn.store(last + i, std::memory_order_relaxed);
+	}
+
+	m_Tail.store(last);
+	m_Head = last;
+	m_Durable.store(last);
+
+	m_File             = file;
+	m_Policy           = policy;
+	m_SyncMilliseconds = syncMilliseconds;
+
+	m_Stop.store(false);
+	m_Failed.store(false);
+
+	m_Writer = std::thread(&WriteAheadLog::WriterLoop, this);
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Close()
+//
+//	Every Append() must have returned before this is called.
+//
+void WriteAheadLog::Close(void)
+{
+	if (m_Writer.joinable()) {
+		m_Stop.store(true);
+		m_Writer.join();
+	}
+
+	if (m_File >= 0) {
+		close(m_File);
+		m_File = -1;
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	WriteAll()
+//
+bool WriteAheadLog::WriteAll(const void* pData, size_t size)
+{
+	const char* pBytes = static_cast<const char*>(pData);
+
+	while (size > 0) {
+		ssize_t written = write(m_File, pBytes, size);
+
+		if (written < 0) {
+			if (EINTR == errno) {
+				continue;
+			}
+
+			return false;
+		}
+
+		pBytes += written;
+		size   -= size_t(written);
+	}
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	WriterLoop()
+//
+//	Drains whatever is in the ring, writes it as one batch, syncs it if
+//	the policy calls for it, then wakes anyone waiting on those records.
+//	Producers never wake the writer, since that would need a lock on the
+//	hot path, so an idle writer polls.
+//
+//	Once Close() has asked it to stop, the writer keeps going until the
+//	ring is empty, then syncs what is left regardless of the policy.
+//
+void WriteAheadLog::WriterLoop(void)
+{
+	std::vector<WalRecord_t> batch;
+	batch.reserve(WAL_MAX_BATCH);
+
+	std::chrono::steady_clock::time_point lastSync = std::chrono::steady_clock::now();
+
+	uint64_t synced   = m_Head;
+	bool     reported = false;
+
+	for (;;) {
+		bool stopping = m_Stop.load();
+
+		batch.clear();
+
+		while (batch.size() < WAL_MAX_BATCH) {
+			Cell_t& cell = m_pRing[m_Head & (WAL_RING_SIZE - 1)];
+
+			if ((m_Head + 1) != cell.Turn.load(std::memory_order_acquire)) {
+				break;
+			}
+
+			batch.push_back(cell.Record);
+
+			// Hand the cell back to the producers for the next lap.
+			cell.Turn.store(m_Head + WAL_RING_SIZE, std::memory_order_release);
+			++m_Head;
+		}
+
+		if (false == batch.empty()) {
+			if ((false == m_Failed.load()) && (false == WriteAll(batch.data(), batch.size() * sizeof(WalRecord_t)))) {
+				m_Failed.store(true);
+			}
+		}
+
+		uint64_t durable = m_Durable.load();
+
+		if (WAL_SYNC_NEVER == m_Policy) {
+			durable = m_Head;
+		}
+		else if (synced != m_Head) {
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+			bool due = (WAL_SYNC_BATCH == m_Policy)
+					|| stopping
+					|| (now - lastSync >= std::chrono::milliseconds(m_SyncMilliseconds));
+
+			if (due) {
+				if (0 != fdatasync(m_File)) {
+					m_Failed.store(true);
+				}
+
+				synced   = m_Head;
+				durable  = m_Head;
+				lastSync = now;
+			}
+		}
+
+		bool failed = m_Failed.load();
+
+		if ((durable != m_Durable.load()) || (failed && (false == reported))) {
+			reported = failed;
+
+			{
+				std::lock_guard<std::mutex> lock(m_DurableLock);
+				m_Durable.store(durable);
+			}
+
+			m_DurableSignal.notify_all();
+		}
+
+		if (batch.empty()) {
+			if (stopping && ((synced == m_Head) || (WAL_SYNC_NEVER == m_Policy))) {
+				break;
+			}
+
+			std::this_thread::sleep_for(std::chrono::microseconds(WAL_IDLE_MICROSECONDS));
+		}
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	WaitDurable()
+//
+bool WriteAheadLog::WaitDurable(uint64_t sequence)
+{
+	std::unique_lock<std::mutex> lock(m_DurableLock);
+
+	while ((m_Durable.load() < sequence) && (false == m_Failed.load())) {
+		m_DurableSignal.wait(lock);
+	}
+
+	return (false == m_Failed.load());
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Scan()
+//
+//	Reads a log from the start, calling apply() for every record after
+//	`after`.  The scan stops at the first record that is torn, damaged, or
+//	out of sequence, since nothing after a bad record can be trusted.
+//
+//	Returns false only if the file is not a log at all.  An empty file, or
+//	one with a partial header, is treated as an empty log with no valid
+//	bytes.
+//
+bool WriteAheadLog::Scan(int file, uint64_t after, Apply_t apply, void* pContext, uint64_t* pLastSequence, uint64_t* pValidBytes)
+{
+	uint64_t last  = 0;
+	uint64_t valid = 0;
+
+	WalFileHeader_t header;
+
+	ssize_t got = pread(file, &header, sizeof(header), 0);
+
+	if (sizeof(header) == got) {
+		if ((WAL_MAGIC != header.Magic) || (WAL_VERSION != header.Version) || (sizeof(WalRecord_t) != header.RecordSize)) {
+			return false;
+		}
+
+		valid = sizeof(header);
+
+		std::vector<WalRecord_t> chunk(WAL_MAX_BATCH);
+		bool                     good = true;
+
+		while (good) {
+			got = pread(file, chunk.data(), chunk.size() * sizeof(WalRecord_t), off_t(valid));
+
+			if (got <= 0) {
+				break;
+			}
+
+			size_t count = size_t(got) / sizeof(WalRecord_t);
+
+			for (size_t i = 0; good && (i < count); ++i) {
+				const WalRecord_t& record = chunk[i];
+
+				good = (record.Check == Checksum(record))
+					&& ((WAL_INSERT == record.Op) || (WAL_DELETE == record.Op))
+					&& (record.Sequence > last);
+
+				if (good) {
+					if ((record.Sequence > after) && (nullptr != apply)) {
+						apply(pContext, record);
+					}
+
+					last   = record.Sequence;
+					valid += sizeof(WalRecord_t);
+				}
+			}
+
+			// A partial record at the end is a torn write.
+			if (count * sizeof(WalRecord_t) != size_t(got)) {
+				break;
+			}
+		}
+	}
+
+	if (nullptr != pLastSequence) {
+		*pLastSequence = last;
+	}
+
+	if (nullptr != pValidBytes) {
+		*pValidBytes = valid;
+	}
+
+	return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	ReplayFile()
+//
+bool WriteAheadLog::ReplayFile(const char* path, uint64_t after, Apply_t apply, void* pContext, uint64_t* pLastSequence)
+{
+	int file = open(path, O_RDONLY);
+
+	if (file < 0) {
+		if (nullptr != pLastSequence) {
+			*pLastSequence = 0;
+		}
+
+		return (ENOENT == errno);
+	}
+
+	bool result = Scan(file, after, apply, pContext, pLastSequence, nullptr);
+
+	close(file);
+
+	return result;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Recover()
+//
+//	The snapshot records the sequence number of the last change it
+//	includes, so only the changes made after it are replayed.
+//
+bool WriteAheadLog::Recover(LeftLeaningRedBlack& tree, const char* snapshotPath, const char* logPath)
+{
+	uint64_t after = 0;
+
+	if (0 == access(snapshotPath, F_OK)) {
+		LeftLeaningRedBlackSnapshot snapshot;
+
+		if (false == snapshot.Open(snapshotPath)) {
+			return false;
+		}
+
+		after = snapshot.LogSequence();
+
+		snapshot.Close();
+
+		if (false == tree.LoadSnapshot(snapshotPath)) {
+			return false;
+		}
+	}
+	else {
+		tree.FreeAll();
+	}
+
+	return Replay(logPath, tree, after);
+}
@@ -0,0 +1,279 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//	File: WriteAheadLog.h
+//
+//	$Header: $
+//
+//
+//	Append-only log of the keys a tree inserts and deletes, for making
+//	tree changes durable between snapshots.
+//
+//	Trees hand their changes to Append(), which claims a slot in a bounded
+//	lock-free ring and returns.  It never takes a lock and never does I/O;
+//	if the ring is full it spins until the writer has made room.  Any
+//	number of threads (or trees) may append at once.
+//
+//	A single background thread drains the ring and writes everything it
+//	finds with one write() call, so a burst of changes costs one system
+//	call and at most one fsync (group commit).  How often the log is
+//	synced is set by the WalSyncPolicy_t passed to Open().
+//
+//	A caller that needs a change to be durable before it carries on can
+//	wait for the sequence number Append() returned with WaitDurable().
+//
+//	Recovery loads the latest snapshot, then replays every record written
+//	after that snapshot was taken.  Since each record holds the final state
+//	of one key, replaying a record that the snapshot already reflects does
+//	no harm.  A torn record at the end of the log, left by a crash in the
+//	middle of a write, ends the replay and is cut off by Open().
+//
+//	There are only records for single keys.  Changes to many keys at once,
+//	such as FreeAll(), BuildFromSorted(), Split(), Join(), Union() or
+//	LoadSnapshot(), append one record for each key they add or remove, so
+//	after a large one, taking a new snapshot keeps recovery short.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "VoidRef.h"
+
+
+class LeftLeaningRedBlack;
+
+
+// "LLRBWAL1" when read as little-endian bytes.
+#define WAL_MAGIC			0x314c415742524c4cull
+#define WAL_VERSION			1
+
+// Number of records the ring can hold.  Must be a power of two.
+#define WAL_RING_SIZE		(1u << 16)
+
+// Most records written by one write() call.
+#define WAL_MAX_BATCH		4096
+
+// How long the writer sleeps when the ring is empty, and the default
+// fsync interval for WAL_SYNC_INTERVAL.
+#define WAL_IDLE_MICROSECONDS	200
+#define WAL_SYNC_MILLISECONDS	10
+
+
+enum WalSyncPolicy_t
+{
+	WAL_SYNC_NEVER,		// leave flushing to the OS
+	WAL_SYNC_BATCH,		// fdatasync() after every batch
+	WAL_SYNC_INTERVAL	// fdatasync() at most once per interval
+};
+
+
+enum WalOp_t
+{
+	WAL_INSERT = 1,
+	WAL_DELETE = 2
+};
+
+
+struct WalFileHeader_t
+{
+	uint64_t Magic;
+	uint32_t Version;
+	uint32_t RecordSize;
+};
+
+
+struct WalRecord_t
+{
+	uint64_t Sequence;
+	uint32_t Key;
+	uint8_t  Op;
+	uint8_t  Reserved;
+	uint16_t Check;		// detects records torn by a crash
+};
+
+
+class WriteAheadLog
+{
+private:
+	// Each cell's Turn says whose turn it is to use the cell: a producer
+	// may fill it when Turn equals the position it claimed, and the
+	// writer may drain it when Turn is one past that position.
+	struct Cell_t
+	{
+		std::atomic<uint64_t> Turn;
+		WalRecord_t           Record;
+	};
+
+	Cell_t* m_pRing;
+
+	// Producers and the writer each get their own cache line.
+	alignas(64) std::atomic<uint64_t> m_Tail;
+	alignas(64) uint64_t              m_Head;
+
+	int             m_File;
+	WalSyncPolicy_t m_Policy;
+	unsigned        m_SyncMilliseconds;
+
+	std::thread       m_Writer;
+	std::atomic<bool> m_Stop;
+	std::atomic<bool> m_Failed;
+
+	// Only used by threads waiting in WaitDurable().
+	std::mutex              m_DurableLock;
+	std::condition_variable m_DurableSignal;
+	std::atomic<uint64_t>   m_Durable;
+
+	WriteAheadLog(const WriteAheadLog&);
+	WriteAheadLog& operator=(const WriteAheadLog&);
+
+	void WriterLoop(void);
+	bool WriteAll(const void* pData, size_t size);
+
+	typedef void (*Apply_t)(void* pContext, const WalRecord_t& record);
+
+	static uint16_t Checksum(const WalRecord_t& record);
+	static bool     Scan(int file, uint64_t after, Apply_t apply, void* pContext, uint64_t* pLastSequence, uint64_t* pValidBytes);
+	static bool     ReplayFile(const char* path, uint64_t after, Apply_t apply, void* pContext, uint64_t* pLastSequence);
+
+	template <typename Tree_t>
+	static void ApplyTo(void* pContext, const WalRecord_t& record);
+
+public:
+	WriteAheadLog(void);
+	~WriteAheadLog(void);
+
+	// Opens (or creates) a log and starts the writer thread.  Any torn
+	// records at the end of an existing log are cut off, and numbering
+	// carries on from the last good record.
+	bool Open(const char* path, WalSyncPolicy_t policy = WAL_SYNC_BATCH, unsigned syncMilliseconds = WAL_SYNC_MILLISECONDS);
+
+	// Writes out everything appended so far, syncs it, and stops the
+	// writer thread.
+	void Close(void);
+
+	// Lock-free.  Returns the sequence number given to the record.
+	uint64_t Append(WalOp_t op, uint32_t key);
+
+	// Sequence number of the most recent Append().
+	uint64_t LastSequence(void) const { return m_Tail.load(std::memory_order_relaxed); }
+
+	// Blocks until every record up to and including sequence has been
+	// written (and synced, unless the policy is WAL_SYNC_NEVER).  Returns
+	// false if the log could not be written.
+	bool WaitDurable(uint64_t sequence);
+
+	bool Failed(void) const { return m_Failed.load(); }
+
+	// Applies the records after `after` to the tree, in order.  The tree
+	// must not have a log attached while this runs, or the replayed
+	// changes would be logged again.  A missing log counts as empty.
+	template <typename Tree_t>
+	static bool Replay(const char* path, Tree_t& tree, uint64_t after = 0, uint64_t* pLastSequence = nullptr);
+
+	// Loads the snapshot, if there is one, then replays the log on top of
+	// it.  Either file may be missing.
+	static bool Recover(LeftLeaningRedBlack& tree, const char* snapshotPath, const char* logPath);
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Append()
+//
+//	Claims the next position with a compare-and-swap on the tail, fills
+//	in the cell, then hands it to the writer by advancing its turn.  The
+//	position doubles as the sequence number, so records are logged in the
+//	order their positions were claimed.
+//
+inline uint64_t WriteAheadLog::Append(WalOp_t op, uint32_t key)
+{
+	uint64_t position = m_Tail.load(std::memory_order_relaxed);
+
+	for (;;) {
+		Cell_t&  cell = m_pRing[position & (WAL_RING_SIZE - 1)];
+		uint64_t turn = cell.Turn.load(std::memory_order_acquire);
+
+		if (turn == position) {
+			if (m_Tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+				cell.Record.Sequence = position + 1;
+				cell.Record.Key      = key;
+				cell.Record.Op       = uint8_t(op);
+				cell.Record.Reserved = 0;
+				cell.Record.Check    = Checksum(cell.Record);
+
+				cell.Turn.store(position + 1, std::memory_order_release);
+
+				return position + 1;
+			}
+		}
+		else if (turn < position) {
+			// The ring is full.  Wait for the writer to catch up.
+			std::this_thread::yield();
+			position = m_Tail.load(std::memory_order_relaxed);
+		}
+		else {
+			// Another producer claimed this position first.
+			position = m_Tail.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Checksum()
+//
+//	FNV-1a over everything but the checksum itself, folded to 16 bits.
+//
+inline uint16_t WriteAheadLog::Checksum(const WalRecord_t& record)
+{
+	const uint8_t* pBytes = reinterpret_cast<const uint8_t*>(&record);
+	uint32_t       hash   = 2166136261u;
+
+	for (size_t i = 0; i < sizeof(WalRecord_t) - sizeof(record.Check); ++i) {
+		hash = (hash ^ pBytes[i]) * 16777619u;
+	}
+
+	return uint16_t(hash ^ (hash >> 16));
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	ApplyTo()
+//
+template <typename Tree_t>
+void WriteAheadLog::ApplyTo(void* pContext, const WalRecord_t& record)
+{
+	Tree_t* pTree = static_cast<Tree_t*>(pContext);
+
+	if (WAL_INSERT == record.Op) {
+		VoidRef_t ref;
+		ref.Key = record.Key;
+		pTree->Insert(ref);
+	}
+	else {
+		pTree->Delete(record.Key);
+	}
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//	Replay()
+//
+//	Works with any tree that has Insert(VoidRef_t) and Delete(uint32_t).
+//
+template <typename Tree_t>
+bool WriteAheadLog::Replay(const char* path, Tree_t& tree, uint64_t after, uint64_t* pLastSequence)
+{
+	return ReplayFile(path, after, &ApplyTo<Tree_t>, &tree, pLastSequence);
+}